@@ -0,0 +1,157 @@
+#include "lang/steinlang/aot_runtime.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <algorithm>
+
+#include "lang/steinlang/resolution.h"
+#include "lang/steinlang/source_util.h"
+
+namespace steinlang {
+namespace {
+
+// The stack size assumed if it's unlimited, and the part of it left unused
+// for whatever the innermost call calls, e.g. printing.
+const size_t kDefaultStackSize = 8 << 20;
+const size_t kStackReserve = 1 << 20;
+
+}  // namespace
+
+AotRuntime::AotRuntime(std::string program,
+                       CompiledFunction (*resolve)(int64_t lambda_id))
+    : program_(std::move(program)),
+      resolve_(resolve),
+      stack_base_(static_cast<const char*>(__builtin_frame_address(0))) {
+  struct rlimit limit;
+  size_t size = kDefaultStackSize;
+  if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY) {
+    size = limit.rlim_cur;
+  }
+  stack_size_ = size - std::min(kStackReserve, size / 2);
+}
+
+void AotRuntime::MakeTuple(Register* dst, Register* elem, int size) {
+  std::vector<Value> values;
+  values.reserve(size);
+  for (int i = 0; i < size; ++i) {
+    values.push_back(*ValueOf(&elem[i]));
+  }
+  dst->ref = -1;
+  dst->value = Value::Tuple(std::move(values));
+}
+
+void AotRuntime::MakeClosure(Register* dst, int64_t lambda_id,
+                             const int64_t* env,
+                             std::initializer_list<int> capture) {
+  std::vector<int64_t> addrs;
+  addrs.reserve(capture.size());
+  for (int enclosing_slot : capture) {
+    addrs.push_back(env[enclosing_slot]);
+  }
+  dst->ref = -1;
+  dst->value = Value::Closure(lambda_id, std::move(addrs));
+}
+
+void AotRuntime::Call(Register* dst, Register* fn, int num_args) {
+  const ClosureObject* closure = ValueOf(fn)->closure_val();
+  CompiledFunction callee =
+      closure != nullptr ? resolve_(closure->lambda_id) : nullptr;
+  if (callee == nullptr) {
+    dst->ref = -1;
+    dst->value.set_none();
+    return;
+  }
+  if (args_.size() < static_cast<size_t>(num_args)) {
+    args_.resize(num_args);
+  }
+  for (int i = 0; i < num_args; ++i) {
+    args_[i] = *ValueOf(fn + 1 + i);
+  }
+  char frame;
+  CheckStack(&frame);
+  ++depth_;
+  Value ret;
+  // Holds the closure of a tail call while it's called.
+  Value tail_callee;
+  for (;;) {
+    callee(this, closure, num_args, &ret);
+    if (tail_callee_.type() == Value::Type::kEmpty) {
+      break;
+    }
+    tail_callee = std::move(tail_callee_);
+    closure = tail_callee.closure_val();
+    callee = resolve_(closure->lambda_id);
+    num_args = tail_num_args_;
+  }
+  --depth_;
+  dst->ref = -1;
+  dst->value.swap(ret);
+}
+
+void AotRuntime::TailCall(Register* fn, int num_args, Value* ret) {
+  const ClosureObject* closure = ValueOf(fn)->closure_val();
+  if (closure == nullptr || resolve_(closure->lambda_id) == nullptr) {
+    ret->set_none();
+    return;
+  }
+  if (args_.size() < static_cast<size_t>(num_args)) {
+    args_.resize(num_args);
+  }
+  for (int i = 0; i < num_args; ++i) {
+    args_[i] = *ValueOf(fn + 1 + i);
+  }
+  tail_callee_ = *ValueOf(fn);
+  tail_num_args_ = num_args;
+}
+
+void AotRuntime::CheckStack(const char* frame) const {
+  if (static_cast<size_t>(stack_base_ - frame) > stack_size_) {
+    fprintf(stderr, "error: stack overflow after %d nested calls.\n",
+            depth_);
+    exit(1);
+  }
+}
+
+void AotRuntime::Print(const Value& value) {
+  Literal lit;
+  value.ToLiteral(&lit);
+  MakePrintable(&lit);
+  printf("output: %s\n", lit.ShortDebugString().c_str());
+}
+
+void AotRuntime::MakePrintable(Literal* lit) {
+  if (lit->has_closure_val()) {
+    if (bytecode_ == nullptr) {
+      pgm_.reset(new Program);
+      pgm_->ParseFromString(program_);
+      bytecode_.reset(new Bytecode);
+      Compile(*pgm_, bytecode_.get());
+    }
+    Closure* closure = lit->mutable_closure_val();
+    auto fn_it = bytecode_->function_by_source_id.find(closure->lambda_id());
+    if (fn_it != bytecode_->function_by_source_id.end()) {
+      const LambdaExpression* lambda =
+          bytecode_->functions[fn_it->second].lambda;
+      *closure->mutable_param() = lambda->param();
+      *closure->mutable_body() = lambda->body();
+      ClearAnnotations(closure);
+      FillEnv(lambda->layout(), closure);
+    }
+    closure->clear_lambda_id();
+    closure->clear_capture();
+  } else if (lit->has_tuple_val()) {
+    for (Literal& elem : *lit->mutable_tuple_val()->mutable_elem()) {
+      MakePrintable(&elem);
+    }
+  }
+}
+
+Value AotRuntime::FloatFromBits(uint32_t bits) {
+  float x;
+  memcpy(&x, &bits, sizeof(x));
+  return Value::Float(x);
+}
+
+}  // namespace steinlang
@@ -0,0 +1,212 @@
+// The runtime that C++ programs emitted by steinlang_aotc link against. Each
+// compiled Function becomes a C++ function whose registers and env are locals,
+// and whose instructions call the AotRuntime methods below, which have the
+// same semantics as the VirtualMachine's.
+//
+// Unlike the VirtualMachine, the store isn't garbage collected, since its
+// roots are spread over the C++ stack. Tail calls don't grow the C++ stack,
+// but other calls do, and a program whose calls nest too deeply for it is
+// stopped with an error rather than overflowing it.
+
+#ifndef LANG_STEINLANG_AOT_RUNTIME_H_
+#define LANG_STEINLANG_AOT_RUNTIME_H_
+
+#include <stdint.h>
+#include <initializer_list>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lang/steinlang/bytecode.h"
+#include "lang/steinlang/steinlang_syntax.pb.h"
+#include "lang/steinlang/value.h"
+
+namespace steinlang {
+
+class AotRuntime {
+ public:
+  // Like VirtualMachine::Register.
+  struct Register {
+    int64_t ref = -1;
+    Value value;
+  };
+
+  // A compiled Function. It must call Enter() and then BindArgs() before
+  // anything else, while the arguments are still in the runtime's argument
+  // buffer. closure is nullptr for the top-level program.
+  using CompiledFunction = void (*)(AotRuntime* rt,
+                                    const ClosureObject* closure,
+                                    int num_args, Value* ret);
+
+  // program is the serialized Program the code was compiled from, which is
+  // parsed if a closure is printed. resolve returns the CompiledFunction of a
+  // lambda source_id, or nullptr.
+  AotRuntime(std::string program,
+             CompiledFunction (*resolve)(int64_t lambda_id));
+
+  AotRuntime(const AotRuntime&) = delete;
+  AotRuntime& operator=(const AotRuntime&) = delete;
+
+  // Bind env slots to the closure's captures, and the rest to nothing.
+  void Enter(const ClosureObject* closure, int64_t* env, int env_size) const {
+    const int num_captures =
+        closure != nullptr ? closure->capture.size() : 0;
+    for (int i = 0; i < env_size; ++i) {
+      env[i] = i < num_captures ? closure->capture[i] : -1;
+    }
+  }
+
+  // Assign the call's arguments to the parameters in slots params.
+  void BindArgs(int64_t* env, std::initializer_list<int> params,
+                int num_args) {
+    int i = 0;
+    for (int slot : params) {
+      if (i >= num_args) {
+        break;
+      }
+      Assign(&env[slot], &args_[i++]);
+    }
+  }
+
+  // Equivalent to VirtualMachine::Lookup and VirtualMachine::Assign.
+  int64_t Lookup(int64_t* slot) {
+    if (*slot < 0) {
+      *slot = store_.size();
+      store_.emplace_back();
+    }
+    return *slot;
+  }
+  void Assign(int64_t* slot, Value* value) {
+    store_[Lookup(slot)].swap(*value);
+  }
+
+  Value* ValueOf(Register* r) {
+    return r->ref >= 0 ? &store_[r->ref] : &r->value;
+  }
+
+  void Load(Register* dst, const Value& value) {
+    dst->ref = -1;
+    dst->value = value;
+  }
+
+  void Store(int64_t* slot, Register* src) {
+    const int64_t addr = Lookup(slot);
+    if (src->ref >= 0) {
+      store_[addr] = store_[src->ref];
+    } else {
+      store_[addr].swap(src->value);
+    }
+  }
+
+  // Make dst an rvalue holding a copy of src's value, and return it.
+  Value* CopyToRvalue(Register* dst, Register* src) {
+    if (src->ref >= 0) {
+      dst->value = store_[src->ref];
+    } else if (dst != src) {
+      dst->value = src->value;
+    }
+    dst->ref = -1;
+    return &dst->value;
+  }
+
+  void BinOp(Register* dst, Register* lhs, Register* rhs,
+             void (*op)(Value*, const Value&)) {
+    if (dst == rhs && dst != lhs) {
+      Value y = *ValueOf(rhs);
+      op(CopyToRvalue(dst, lhs), y);
+    } else {
+      op(CopyToRvalue(dst, lhs), *ValueOf(rhs));
+    }
+  }
+
+  // BinOp, with the int case inlined. IntOp is e.g. std::plus<int64_t>.
+  template <typename IntOp>
+  void Arith(Register* dst, Register* lhs, Register* rhs,
+             void (*op)(Value*, const Value&)) {
+    const Value& x = *ValueOf(lhs);
+    const Value& y = *ValueOf(rhs);
+    if (x.type() == Value::Type::kInt && y.type() == Value::Type::kInt) {
+      const int64_t result = IntOp()(x.int_val(), y.int_val());
+      dst->ref = -1;
+      dst->value.set_int(result);
+    } else {
+      BinOp(dst, lhs, rhs, op);
+    }
+  }
+
+  // Likewise for comparisons. IntCmp is e.g. std::less<int64_t>.
+  template <typename IntCmp>
+  void Compare(Register* dst, Register* lhs, Register* rhs,
+               void (*op)(Value*, const Value&)) {
+    const Value& x = *ValueOf(lhs);
+    const Value& y = *ValueOf(rhs);
+    if (x.type() == Value::Type::kInt && y.type() == Value::Type::kInt) {
+      const bool result = IntCmp()(x.int_val(), y.int_val());
+      dst->ref = -1;
+      dst->value.set_bool(result);
+    } else {
+      BinOp(dst, lhs, rhs, op);
+    }
+  }
+
+  // Whether a condition is true.
+  bool Test(Register* r) { return ValueOf(r)->bool_val(); }
+
+  void MakeTuple(Register* dst, Register* elem, int size);
+  void MakeClosure(Register* dst, int64_t lambda_id, const int64_t* env,
+                   std::initializer_list<int> capture);
+
+  // Call the closure in fn with the values of the num_args registers after
+  // it, like VirtualMachine::Call, and put the result in dst.
+  void Call(Register* dst, Register* fn, int num_args);
+
+  // Like Call, for a call whose result the calling function returns. The
+  // caller must return right after this, and the callee is then called by the
+  // Call that called the caller, in place of it, and returns to ret.
+  void TailCall(Register* fn, int num_args, Value* ret);
+
+  // Like VirtualMachine::Return: move or copy src's value to ret.
+  void Return(Register* src, Value* ret) {
+    if (src->ref >= 0) {
+      *ret = store_[src->ref];
+    } else {
+      ret->swap(src->value);
+    }
+  }
+
+  // Print value like interpreter_main prints output.
+  void Print(const Value& value);
+
+  // A float with the given bits, so that constants are exact.
+  static Value FloatFromBits(uint32_t bits);
+
+ private:
+  // Fill in the params and body of closures for printing.
+  void MakePrintable(Literal* lit);
+
+  // Exit with an error if the C++ stack is nearly used up.
+  void CheckStack(const char* frame) const;
+
+  std::string program_;
+  CompiledFunction (*resolve_)(int64_t lambda_id);
+  std::vector<Value> store_;
+  // Arguments of the current call. They're bound to parameters before the
+  // callee makes any other call, so one buffer is enough.
+  std::vector<Value> args_;
+  // The closure passed to TailCall, until Call calls it, and its number of
+  // arguments.
+  Value tail_callee_;
+  int tail_num_args_ = 0;
+  // The number of nested Calls, and the C++ stack they may use, which starts
+  // at stack_base_.
+  int depth_ = 0;
+  const char* stack_base_;
+  size_t stack_size_;
+  // Parsed from program_ on first use, for MakePrintable.
+  std::unique_ptr<Program> pgm_;
+  std::unique_ptr<Bytecode> bytecode_;
+};
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_AOT_RUNTIME_H_
@@ -0,0 +1,336 @@
+#include "lang/steinlang/aot_translation.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <set>
+#include <sstream>
+#include <vector>
+
+namespace steinlang {
+namespace {
+
+// A C++ string literal with the bytes of s.
+std::string CppString(const std::string& s) {
+  std::ostringstream out;
+  out << "\"";
+  for (size_t i = 0; i < s.size(); ++i) {
+    const unsigned char c = s[i];
+    if (i > 0 && i % 64 == 0) {
+      out << "\"\n    \"";
+    }
+    if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\' && c != '?') {
+      out << c;
+    } else {
+      // Octal escapes are at most 3 digits, so they can't run into the next
+      // character like hex escapes.
+      out << "\\" << static_cast<char>('0' + (c >> 6))
+          << static_cast<char>('0' + ((c >> 3) & 7))
+          << static_cast<char>('0' + (c & 7));
+    }
+  }
+  out << "\"";
+  return out.str();
+}
+
+// A C++ expression that constructs v.
+std::string CppValue(const Value& v) {
+  std::ostringstream out;
+  switch (v.type()) {
+    case Value::Type::kEmpty:
+      out << "Value()";
+      break;
+    case Value::Type::kNone:
+      out << "Value::None()";
+      break;
+    case Value::Type::kBool:
+      out << "Value::Bool(" << (v.bool_val() ? "true" : "false") << ")";
+      break;
+    case Value::Type::kInt:
+      if (v.int_val() == INT64_MIN) {
+        out << "Value::Int(INT64_MIN)";
+      } else {
+        out << "Value::Int(INT64_C(" << v.int_val() << "))";
+      }
+      break;
+    case Value::Type::kFloat: {
+      const float x = v.float_val();
+      uint32_t bits;
+      memcpy(&bits, &x, sizeof(bits));
+      out << "AotRuntime::FloatFromBits(" << bits << "u)";
+      break;
+    }
+    case Value::Type::kStr:
+      out << "Value::Str(std::string(" << CppString(v.str_val()) << ", "
+          << v.str_val().size() << "))";
+      break;
+    case Value::Type::kTuple:
+      out << "Value::Tuple({";
+      for (size_t i = 0; i < v.tuple_val()->elem.size(); ++i) {
+        out << (i > 0 ? ", " : "") << CppValue(v.tuple_val()->elem[i]);
+      }
+      out << "})";
+      break;
+    case Value::Type::kClosure:
+      // Closures are only made by kMakeClosure.
+      out << "Value::None()";
+      break;
+  }
+  return out.str();
+}
+
+std::string CppList(const std::vector<int>& ints) {
+  std::ostringstream out;
+  out << "{";
+  for (size_t i = 0; i < ints.size(); ++i) {
+    out << (i > 0 ? ", " : "") << ints[i];
+  }
+  out << "}";
+  return out.str();
+}
+
+const char* ArithOp(OpCode op) {
+  switch (op) {
+    case OpCode::kAdd:
+      return "Arith<std::plus<int64_t>>";
+    case OpCode::kSub:
+      return "Arith<std::minus<int64_t>>";
+    case OpCode::kMul:
+      return "Arith<std::multiplies<int64_t>>";
+    case OpCode::kGt:
+      return "Compare<std::greater<int64_t>>";
+    case OpCode::kGe:
+      return "Compare<std::greater_equal<int64_t>>";
+    case OpCode::kLt:
+      return "Compare<std::less<int64_t>>";
+    case OpCode::kLe:
+      return "Compare<std::less_equal<int64_t>>";
+    case OpCode::kEq:
+      return "Compare<std::equal_to<int64_t>>";
+    case OpCode::kNe:
+      return "Compare<std::not_equal_to<int64_t>>";
+    default:
+      // Division traps like the VirtualMachine's only if it isn't inlined,
+      // and the bool operations have no int case.
+      return "BinOp";
+  }
+}
+
+const char* ValueOp(OpCode op) {
+  switch (op) {
+    case OpCode::kAdd:
+      return "Add";
+    case OpCode::kSub:
+      return "Sub";
+    case OpCode::kMul:
+      return "Mul";
+    case OpCode::kDiv:
+      return "Div";
+    case OpCode::kGt:
+      return "CompareGt";
+    case OpCode::kGe:
+      return "CompareGe";
+    case OpCode::kLt:
+      return "CompareLt";
+    case OpCode::kLe:
+      return "CompareLe";
+    case OpCode::kEq:
+      return "CompareEq";
+    case OpCode::kNe:
+      return "CompareNe";
+    case OpCode::kAnd:
+      return "BoolAnd";
+    case OpCode::kOr:
+      return "BoolOr";
+    default:
+      return nullptr;
+  }
+}
+
+// True if the kCall at pc is followed by returning its result, like
+// VirtualMachine::IsTailCall. The top-level program has no caller to return
+// to.
+bool IsTailCall(const Bytecode& bytecode, int index, size_t pc) {
+  if (index == 0) {
+    return false;
+  }
+  const std::vector<Instruction>& code = bytecode.functions[index].code;
+  const int dst = code[pc].a;
+  ++pc;
+  // Follow jumps, e.g. out of the branches of a conditional, but not around a
+  // loop forever.
+  for (size_t jumps = 0; pc < code.size() && code[pc].op == OpCode::kJump &&
+                         jumps < code.size();
+       ++jumps) {
+    pc = code[pc].b;
+  }
+  return pc < code.size() && code[pc].op == OpCode::kReturn &&
+         code[pc].a == dst;
+}
+
+void TranslateFunction(const Bytecode& bytecode, int index,
+                       std::ostream& out) {
+  const Function& fn = bytecode.functions[index];
+  std::set<int> targets;
+  for (const Instruction& instr : fn.code) {
+    if (instr.op == OpCode::kJump || instr.op == OpCode::kJumpIfFalse) {
+      targets.insert(instr.b);
+    }
+  }
+  const int env_size = fn.layout->name_size();
+
+  out << "// source_id " << fn.source_id << "\n";
+  out << "void F" << index
+      << "(AotRuntime* rt, const ClosureObject* closure, int num_args, "
+         "Value* ret) {\n";
+  out << "  int64_t env[" << std::max(env_size, 1) << "];\n";
+  out << "  AotRuntime::Register r[" << std::max(fn.num_registers, 1)
+      << "];\n";
+  out << "  rt->Enter(closure, env, " << env_size << ");\n";
+  if (!fn.params.empty()) {
+    out << "  rt->BindArgs(env, " << CppList(fn.params) << ", num_args);\n";
+  }
+  for (size_t pc = 0; pc < fn.code.size(); ++pc) {
+    const Instruction& instr = fn.code[pc];
+    if (targets.count(pc)) {
+      out << "L" << pc << ":\n";
+    }
+    out << "  ";
+    switch (instr.op) {
+      case OpCode::kLoadConst: {
+        const Value& k = fn.constants[instr.b];
+        if (k.type() >= Value::Type::kStr) {
+          // Construct heap constants once.
+          out << "{ static const Value* k = new Value(" << CppValue(k)
+              << "); rt->Load(&r[" << instr.a << "], *k); }";
+        } else {
+          out << "rt->Load(&r[" << instr.a << "], " << CppValue(k) << ");";
+        }
+        break;
+      }
+      case OpCode::kLoadVar:
+        out << "r[" << instr.a << "].ref = rt->Lookup(&env[" << instr.b
+            << "]);";
+        break;
+      case OpCode::kDeclareVar:
+        out << "rt->Lookup(&env[" << instr.a << "]);";
+        break;
+      case OpCode::kStoreVar:
+        out << "rt->Store(&env[" << instr.a << "], &r[" << instr.b << "]);";
+        break;
+      case OpCode::kNeg:
+        out << "Neg(rt->CopyToRvalue(&r[" << instr.a << "], &r[" << instr.b
+            << "]));";
+        break;
+      case OpCode::kNot:
+        out << "BoolNot(rt->CopyToRvalue(&r[" << instr.a << "], &r["
+            << instr.b << "]));";
+        break;
+      case OpCode::kAdd:
+      case OpCode::kSub:
+      case OpCode::kMul:
+      case OpCode::kDiv:
+      case OpCode::kGt:
+      case OpCode::kGe:
+      case OpCode::kLt:
+      case OpCode::kLe:
+      case OpCode::kEq:
+      case OpCode::kNe:
+      case OpCode::kAnd:
+      case OpCode::kOr:
+        out << "rt->" << ArithOp(instr.op) << "(&r[" << instr.a << "], &r["
+            << instr.b << "], &r[" << instr.c << "], &" << ValueOp(instr.op)
+            << ");";
+        break;
+      case OpCode::kMakeTuple:
+        out << "rt->MakeTuple(&r[" << instr.a << "], &r[" << instr.b << "], "
+            << instr.c << ");";
+        break;
+      case OpCode::kMakeClosure: {
+        const Function& lambda_fn = bytecode.functions[instr.b];
+        out << "rt->MakeClosure(&r[" << instr.a << "], "
+            << lambda_fn.source_id << ", env, "
+            << CppList({lambda_fn.layout->capture().begin(),
+                        lambda_fn.layout->capture().end()})
+            << ");";
+        break;
+      }
+      case OpCode::kCall:
+        if (IsTailCall(bytecode, index, pc)) {
+          out << "rt->TailCall(&r[" << instr.b << "], "
+              << fn.call_sites[instr.c].num_args << ", ret); return;";
+        } else {
+          out << "rt->Call(&r[" << instr.a << "], &r[" << instr.b << "], "
+              << fn.call_sites[instr.c].num_args << ");";
+        }
+        break;
+      case OpCode::kReturn:
+        out << "rt->Return(&r[" << instr.a << "], ret); return;";
+        break;
+      case OpCode::kJump:
+        out << "goto L" << instr.b << ";";
+        break;
+      case OpCode::kJumpIfFalse:
+        out << "if (!rt->Test(&r[" << instr.a << "])) goto L" << instr.b
+            << ";";
+        break;
+      case OpCode::kPrint:
+        out << "rt->Print(*rt->ValueOf(&r[" << instr.a << "]));";
+        break;
+      case OpCode::kHalt:
+        out << "return;";
+        break;
+    }
+    out << "\n";
+  }
+  if (targets.count(fn.code.size())) {
+    out << "L" << fn.code.size() << ":\n";
+  }
+  out << "}\n\n";
+}
+
+}  // namespace
+
+std::string TranslateToCpp(const Program& pgm, const Bytecode& bytecode) {
+  std::ostringstream out;
+  out << "// Generated by steinlang_aotc. Link against aot_runtime.\n\n"
+      << "#include <stdint.h>\n"
+      << "#include <functional>\n"
+      << "#include <string>\n\n"
+      << "#include \"lang/steinlang/aot_runtime.h\"\n\n"
+      << "namespace steinlang {\n"
+      << "namespace {\n\n";
+  for (size_t i = 0; i < bytecode.functions.size(); ++i) {
+    out << "void F" << i
+        << "(AotRuntime* rt, const ClosureObject* closure, int num_args, "
+           "Value* ret);\n";
+  }
+  out << "\nAotRuntime::CompiledFunction Resolve(int64_t lambda_id) {\n"
+      << "  switch (lambda_id) {\n";
+  for (size_t i = 1; i < bytecode.functions.size(); ++i) {
+    out << "    case " << bytecode.functions[i].source_id << ":\n"
+        << "      return &F" << i << ";\n";
+  }
+  out << "    default:\n"
+      << "      return nullptr;\n"
+      << "  }\n"
+      << "}\n\n";
+  for (size_t i = 0; i < bytecode.functions.size(); ++i) {
+    TranslateFunction(bytecode, i, out);
+  }
+  const std::string serialized = pgm.SerializeAsString();
+  out << "const char kProgram[] =\n    " << CppString(serialized) << ";\n\n"
+      << "}  // namespace\n"
+      << "}  // namespace steinlang\n\n"
+      << "int main() {\n"
+      << "  steinlang::AotRuntime rt(\n"
+      << "      std::string(steinlang::kProgram, " << serialized.size()
+      << "), &steinlang::Resolve);\n"
+      << "  steinlang::Value ret;\n"
+      << "  steinlang::F0(&rt, nullptr, 0, &ret);\n"
+      << "  return 0;\n"
+      << "}\n";
+  return out.str();
+}
+
+}  // namespace steinlang
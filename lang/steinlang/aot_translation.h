@@ -0,0 +1,21 @@
+// Ahead-of-time translation of compiled bytecode to C++ source, for
+// steinlang_aotc.
+
+#ifndef LANG_STEINLANG_AOT_TRANSLATION_H_
+#define LANG_STEINLANG_AOT_TRANSLATION_H_
+
+#include <string>
+
+#include "lang/steinlang/bytecode.h"
+#include "lang/steinlang/steinlang_syntax.pb.h"
+
+namespace steinlang {
+
+// Translate bytecode, compiled from pgm, to a C++ translation unit with a
+// main() that prints the same output as running it on the VirtualMachine. The
+// result must be linked against aot_runtime.
+std::string TranslateToCpp(const Program& pgm, const Bytecode& bytecode);
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_AOT_TRANSLATION_H_
@@ -0,0 +1,88 @@
+// Measures the distribution of Evaluator step latencies with and without
+// --semispace_arena, for the program read from stdin. Steps that relieve arena
+// memory pressure make up the tail of the distribution.
+//
+// Example:
+// arena_benchmark --max_arena_allocation_usage=8388608
+//     < lang/steinlang/pgms/arena_pressure.stein.txt
+
+#include <gflags/gflags.h>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "lang/steinlang/language_evaluation.h"
+#include "lang/steinlang/memory.h"
+#include "lang/steinlang/steinlang_parser.h"
+#include "util/file_io.h"
+
+DECLARE_bool(semispace_arena);
+
+DEFINE_int32(slow_step_us, 1000,
+             "Steps taking at least this long are counted as pauses.");
+
+namespace steinlang {
+namespace {
+
+// Run pgm to completion, and return the latency of each step in microseconds.
+std::vector<double> RunSteps(const Program& pgm) {
+  PoolingArenaAllocator allocator;
+  EvalContext* ctx = allocator.AllocateEvalContext();
+  InitEvalContext(pgm, ctx);
+  Evaluator evaluator(ctx, &allocator);
+
+  std::vector<double> latencies;
+  while (evaluator.HasComputation()) {
+    auto start = std::chrono::steady_clock::now();
+    evaluator.Step();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    latencies.push_back(
+        std::chrono::duration<double, std::micro>(elapsed).count());
+    evaluator.consume_output();
+  }
+  return latencies;
+}
+
+void PrintDistribution(const std::string& name, std::vector<double> latencies) {
+  if (latencies.empty()) {
+    return;
+  }
+  double total = 0;
+  int pauses = 0;
+  for (double us : latencies) {
+    total += us;
+    pauses += us >= FLAGS_slow_step_us;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies](double p) {
+    return latencies[std::min<size_t>(latencies.size() - 1,
+                                      p / 100 * latencies.size())];
+  };
+  printf("%s: %zu steps, total %.0f us, %d pauses >= %d us\n", name.c_str(),
+         latencies.size(), total, pauses, FLAGS_slow_step_us);
+  printf("  p50 %.2f us, p99 %.2f us, p99.9 %.2f us, p99.99 %.2f us, "
+         "max %.2f us\n",
+         percentile(50), percentile(99), percentile(99.9), percentile(99.99),
+         latencies.back());
+}
+
+}  // namespace
+}  // namespace steinlang
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  steinlang::Program pgm;
+  if (!steinlang::ParseProgram(util::ReadStdInToString(), &pgm)) {
+    printf("failed to parse input.\n");
+    return 1;
+  }
+
+  FLAGS_semispace_arena = false;
+  steinlang::PrintDistribution("copy and reset", steinlang::RunSteps(pgm));
+  FLAGS_semispace_arena = true;
+  steinlang::PrintDistribution("semispace", steinlang::RunSteps(pgm));
+  return 0;
+}
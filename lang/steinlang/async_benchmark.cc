@@ -0,0 +1,120 @@
+// Evaluates --scripts copies of the program read from stdin as coroutines on
+// one RunLoop, alongside a callback that stands in for the loop's I/O and
+// reposts itself until the scripts are done. Reports how long the I/O
+// callback waited between turns, which a script can only hold up for one
+// slice of --steps_per_run steps, and compares the total time with
+// evaluating the copies one after the other.
+//
+// Example:
+// async_benchmark --scripts=100 < lang/steinlang/pgms/fibo_test.stein.txt
+
+#include <gflags/gflags.h>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "lang/steinlang/async_evaluation.h"
+#include "lang/steinlang/language_evaluation.h"
+#include "lang/steinlang/memory.h"
+#include "lang/steinlang/run_status.h"
+#include "lang/steinlang/steinlang_parser.h"
+#include "util/file_io.h"
+
+DEFINE_int32(scripts, 100, "Number of copies of the program to evaluate.");
+DEFINE_int64(steps_per_run, 4096, "Steps per slice of a script.");
+
+namespace steinlang {
+namespace {
+
+// A script and what it's evaluated with.
+struct Script {
+  explicit Script(std::shared_ptr<const Program> pgm, Executor* executor)
+      : evaluator(std::move(pgm), allocator.AllocateEvalContext(),
+                  &allocator),
+        async(&evaluator, executor) {}
+
+  PoolingArenaAllocator allocator;
+  Evaluator evaluator;
+  AsyncEvaluator async;
+  int64_t output_lines = 0;
+};
+
+Task<void> Serve(Script* script, int* running) {
+  while (auto chunk = co_await script->async.NextOutput(FLAGS_steps_per_run)) {
+    script->output_lines += chunk->size();
+  }
+  --*running;
+}
+
+double Seconds(std::chrono::steady_clock::duration elapsed) {
+  return std::chrono::duration<double>(elapsed).count();
+}
+
+}  // namespace
+}  // namespace steinlang
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  steinlang::Program pgm;
+  if (!steinlang::ParseProgram(util::ReadStdInToString(), &pgm)) {
+    printf("failed to parse input.\n");
+    return 1;
+  }
+  const std::shared_ptr<const steinlang::Program> prepared =
+      steinlang::PrepareProgram(pgm);
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < FLAGS_scripts; ++i) {
+    steinlang::PoolingArenaAllocator allocator;
+    steinlang::Evaluator evaluator(prepared, allocator.AllocateEvalContext(),
+                                   &allocator);
+    while (evaluator.Run(FLAGS_steps_per_run).reason !=
+           steinlang::StopReason::kFinished) {
+      evaluator.consume_output();
+    }
+  }
+  const double sequential =
+      steinlang::Seconds(std::chrono::steady_clock::now() - start);
+
+  steinlang::RunLoop loop;
+  std::vector<std::unique_ptr<steinlang::Script>> scripts;
+  int running = FLAGS_scripts;
+  start = std::chrono::steady_clock::now();
+  for (int i = 0; i < FLAGS_scripts; ++i) {
+    scripts.push_back(std::make_unique<steinlang::Script>(prepared, &loop));
+    steinlang::Spawn(steinlang::Serve(scripts.back().get(), &running));
+  }
+  auto last_turn = std::chrono::steady_clock::now();
+  double max_wait = 0;
+  int64_t turns = 0;
+  std::function<void()> io = [&] {
+    auto now = std::chrono::steady_clock::now();
+    max_wait = std::max(max_wait, steinlang::Seconds(now - last_turn));
+    last_turn = now;
+    ++turns;
+    if (running > 0) {
+      loop.Post(io);
+    }
+  };
+  loop.Post(io);
+  loop.Run();
+  const double async =
+      steinlang::Seconds(std::chrono::steady_clock::now() - start);
+
+  int64_t steps = 0;
+  int64_t output_lines = 0;
+  for (const auto& script : scripts) {
+    steps += script->async.steps();
+    output_lines += script->output_lines;
+  }
+  printf("%d scripts, %lld steps, %lld lines of output\n", FLAGS_scripts,
+         static_cast<long long>(steps), static_cast<long long>(output_lines));
+  printf("sequential: %.1f ms, interleaved: %.1f ms\n", sequential * 1e3,
+         async * 1e3);
+  printf("I/O callback: %lld turns, longest wait %.2f ms\n",
+         static_cast<long long>(turns), max_wait * 1e3);
+  return 0;
+}
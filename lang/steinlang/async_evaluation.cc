@@ -0,0 +1,66 @@
+#include "lang/steinlang/async_evaluation.h"
+
+namespace steinlang {
+
+namespace {
+
+// A coroutine that nothing awaits, which frees itself once it's done.
+struct Detached {
+  struct promise_type {
+    Detached get_return_object() { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+Detached RunDetached(Task<void> task) { co_await std::move(task); }
+
+}  // namespace
+
+void RunLoop::Post(std::function<void()> fn) {
+  std::lock_guard<std::mutex> lock(mu_);
+  queue_.push_back(std::move(fn));
+}
+
+void RunLoop::Run() {
+  while (true) {
+    std::function<void()> fn;
+    {
+      std::lock_guard<std::mutex> lock(mu_);
+      if (queue_.empty()) {
+        return;
+      }
+      fn = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    fn();
+  }
+}
+
+void Spawn(Task<void> task) { RunDetached(std::move(task)); }
+
+void AsyncEvaluator::RunForAwaiter::await_suspend(
+    std::coroutine_handle<> awaiting) {
+  async_->executor_->Post([this, awaiting] {
+    status_ = async_->evaluator_->Run(max_steps_);
+    async_->steps_ += status_.steps;
+    awaiting.resume();
+  });
+}
+
+Task<std::optional<std::vector<std::string>>> AsyncEvaluator::NextOutput(
+    int64_t steps_per_run) {
+  while (!finished_) {
+    const RunStatus status = co_await RunFor(steps_per_run);
+    finished_ = status.reason == StopReason::kFinished;
+    std::vector<std::string> output = evaluator_->consume_output();
+    if (!output.empty()) {
+      co_return std::move(output);
+    }
+  }
+  co_return std::nullopt;
+}
+
+}  // namespace steinlang
@@ -0,0 +1,203 @@
+// A C++20 coroutine API for evaluation, so that an event loop can interleave
+// many scripts with its own I/O, without a thread per script. Each call to
+// AsyncEvaluator::RunFor suspends the awaiting coroutine, and resumes it from
+// the executor once the steps have run, so everything else posted to the
+// executor gets a turn between slices of a script. Example:
+//
+// Task<void> Serve(AsyncEvaluator* script) {
+//   while (auto chunk = co_await script->NextOutput(4096)) {
+//     co_await WriteToClient(*chunk);
+//   }
+// }
+//
+// RunLoop loop;
+// Spawn(Serve(&script));
+// loop.Run();
+//
+// This library needs C++20; the rest of the interpreter doesn't.
+
+#ifndef LANG_STEINLANG_ASYNC_EVALUATION_H_
+#define LANG_STEINLANG_ASYNC_EVALUATION_H_
+
+#include <stdint.h>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "lang/steinlang/language_evaluation.h"
+#include "lang/steinlang/run_status.h"
+
+namespace steinlang {
+
+// Where coroutines are resumed, e.g. an event loop or a thread pool.
+class Executor {
+ public:
+  virtual ~Executor() = default;
+
+  // Call fn soon, but not from within Post. May be called from any thread.
+  virtual void Post(std::function<void()> fn) = 0;
+};
+
+// A minimal single-threaded event loop.
+class RunLoop : public Executor {
+ public:
+  void Post(std::function<void()> fn) override;
+
+  // Call the posted functions in order, including those that they post,
+  // until there are none left.
+  void Run();
+
+ private:
+  std::mutex mu_;
+  std::deque<std::function<void()>> queue_;
+};
+
+template <typename T>
+class Task;
+
+namespace internal {
+
+template <typename T>
+struct TaskPromiseBase {
+  // Resumes the coroutine that awaited the task, if any, once it's done.
+  struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(
+        std::coroutine_handle<Promise> handle) noexcept {
+      std::coroutine_handle<> continuation = handle.promise().continuation;
+      return continuation ? continuation : std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+  };
+
+  Task<T> get_return_object();
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  FinalAwaiter final_suspend() noexcept { return {}; }
+  // Nothing in the interpreter throws.
+  void unhandled_exception() { std::terminate(); }
+
+  std::coroutine_handle<> continuation;
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase<T> {
+  void return_value(T value) { result.emplace(std::move(value)); }
+
+  std::optional<T> result;
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase<void> {
+  void return_void() {}
+};
+
+}  // namespace internal
+
+// A coroutine that returns a T to the coroutine that co_awaits it. It starts
+// when it's awaited, and runs on whatever thread resumes it.
+template <typename T>
+class Task {
+ public:
+  using promise_type = internal::TaskPromise<T>;
+
+  Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+  Task& operator=(Task&& other) noexcept {
+    if (this != &other) {
+      Destroy();
+      handle_ = std::exchange(other.handle_, {});
+    }
+    return *this;
+  }
+  ~Task() { Destroy(); }
+
+  bool await_ready() const noexcept { return false; }
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+    handle_.promise().continuation = awaiting;
+    return handle_;
+  }
+  T await_resume() {
+    if constexpr (!std::is_void_v<T>) {
+      return std::move(*handle_.promise().result);
+    }
+  }
+
+ private:
+  friend struct internal::TaskPromiseBase<T>;
+
+  explicit Task(std::coroutine_handle<promise_type> handle)
+      : handle_(handle) {}
+
+  void Destroy() {
+    if (handle_) {
+      handle_.destroy();
+    }
+  }
+
+  std::coroutine_handle<promise_type> handle_;
+};
+
+template <typename T>
+Task<T> internal::TaskPromiseBase<T>::get_return_object() {
+  return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(
+      static_cast<TaskPromise<T>&>(*this)));
+}
+
+// Start task, which frees itself once it's done.
+void Spawn(Task<void> task);
+
+// Evaluates an Evaluator in slices on an Executor.
+class AsyncEvaluator {
+ public:
+  // Awaiting RunFor returns the RunStatus of the slice.
+  class RunForAwaiter {
+   public:
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> awaiting);
+    RunStatus await_resume() const { return status_; }
+
+   private:
+    friend class AsyncEvaluator;
+
+    RunForAwaiter(AsyncEvaluator* async, int64_t max_steps)
+        : async_(async), max_steps_(max_steps) {}
+
+    AsyncEvaluator* async_;
+    int64_t max_steps_;
+    RunStatus status_;
+  };
+
+  // Neither is owned. Only one coroutine at a time may await evaluator.
+  AsyncEvaluator(Evaluator* evaluator, Executor* executor)
+      : evaluator_(evaluator), executor_(executor) {}
+
+  // Execute up to max_steps steps from the executor, like Evaluator::Run.
+  RunForAwaiter RunFor(int64_t max_steps) { return {this, max_steps}; }
+
+  // Run slices of steps_per_run steps until the program prints something,
+  // and return what it printed, or nullopt once it has finished.
+  Task<std::optional<std::vector<std::string>>> NextOutput(
+      int64_t steps_per_run);
+
+  // The steps executed so far.
+  int64_t steps() const { return steps_; }
+
+  Evaluator* evaluator() const { return evaluator_; }
+
+ private:
+  Evaluator* evaluator_;
+  Executor* executor_;
+  int64_t steps_ = 0;
+  bool finished_ = false;
+};
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_ASYNC_EVALUATION_H_
@@ -0,0 +1,400 @@
+#include "lang/steinlang/bytecode.h"
+
+#include <sstream>
+
+namespace steinlang {
+
+namespace {
+
+class FunctionCompiler {
+ public:
+  FunctionCompiler(Bytecode* bytecode, Function* fn)
+      : bytecode_(bytecode), fn_(fn) {}
+
+  bool CompileBody(const google::protobuf::RepeatedPtrField<Statement>& stmts) {
+    for (const Statement& stmt : stmts) {
+      if (!Compile(stmt)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void AddParam(const Variable& param) { fn_->params.push_back(param.slot()); }
+
+  int Emit(OpCode op, int32_t a = 0, int32_t b = 0, int32_t c = 0) {
+    fn_->code.push_back({op, a, b, c});
+    return fn_->code.size() - 1;
+  }
+
+  // Point the jump at instruction index jump_pc to the next emitted
+  // instruction.
+  void PatchJump(int jump_pc) { fn_->code[jump_pc].b = fn_->code.size(); }
+
+ private:
+  int ConstIndex(const Literal& lit) {
+    fn_->constants.push_back(Value::FromLiteral(lit));
+    return fn_->constants.size() - 1;
+  }
+
+  // Registers are allocated like a stack: every register above the ones in use
+  // by enclosing expressions is free.
+  int PushRegister() {
+    int reg = top_++;
+    if (top_ > fn_->num_registers) {
+      fn_->num_registers = top_;
+    }
+    return reg;
+  }
+
+  void PopRegisters(int n) { top_ -= n; }
+
+  bool Compile(const Statement& stmt);
+  bool Compile(const Expression& exp, int dst);
+  bool Compile(const LambdaExpression& lambda_exp, int64_t source_id, int dst);
+
+  Bytecode* bytecode_;
+  Function* fn_;
+  int top_ = 0;
+};
+
+OpCode BinOpCode(BinArithOp op) {
+  switch (op) {
+    case BinArithOp::ADD:
+      return OpCode::kAdd;
+    case BinArithOp::SUB:
+      return OpCode::kSub;
+    case BinArithOp::MUL:
+      return OpCode::kMul;
+    case BinArithOp::DIV:
+      return OpCode::kDiv;
+    case BinArithOp::GT:
+      return OpCode::kGt;
+    case BinArithOp::GE:
+      return OpCode::kGe;
+    case BinArithOp::LT:
+      return OpCode::kLt;
+    case BinArithOp::LE:
+      return OpCode::kLe;
+    case BinArithOp::EQ:
+      return OpCode::kEq;
+    case BinArithOp::NE:
+      return OpCode::kNe;
+    case BinArithOp::AND:
+      return OpCode::kAnd;
+    case BinArithOp::OR:
+    default:
+      return OpCode::kOr;
+  }
+}
+
+// The evaluation order of sub-expressions matches Evaluator, since evaluating a
+// variable may bind it to a fresh store address.
+bool FunctionCompiler::Compile(const Expression& exp, int dst) {
+  switch (exp.type_case()) {
+    case Expression::kVarExp:
+      Emit(OpCode::kLoadVar, dst, exp.var_exp().slot());
+      return true;
+    case Expression::kLitExp:
+      Emit(OpCode::kLoadConst, dst, ConstIndex(exp.lit_exp()));
+      return true;
+    case Expression::kFuncAppExp: {
+      // Arguments are evaluated left to right, then the function.
+      const FuncAppExpression& func_app_exp = exp.func_app_exp();
+      const int num_args = func_app_exp.arg_size();
+      const int base = PushRegister();
+      for (int i = 0; i < num_args; ++i) {
+        PushRegister();
+      }
+      for (int i = 0; i < num_args; ++i) {
+        if (!Compile(func_app_exp.arg(i), base + 1 + i)) {
+          return false;
+        }
+      }
+      if (!Compile(func_app_exp.func(), base)) {
+        return false;
+      }
+      fn_->call_sites.push_back({exp.origin().source_id(), num_args});
+      Emit(OpCode::kCall, dst, base, fn_->call_sites.size() - 1);
+      PopRegisters(num_args + 1);
+      return true;
+    }
+    case Expression::kMonArithExp: {
+      const MonArithExpression& mon_exp = exp.mon_arith_exp();
+      if (!Compile(mon_exp.exp(), dst)) {
+        return false;
+      }
+      Emit(mon_exp.op() == MonArithOp::NOT ? OpCode::kNot : OpCode::kNeg, dst,
+           dst);
+      return true;
+    }
+    case Expression::kBinArithExp: {
+      const BinArithExpression& bin_exp = exp.bin_arith_exp();
+      const int rhs = PushRegister();
+      if (!Compile(bin_exp.lhs(), dst) || !Compile(bin_exp.rhs(), rhs)) {
+        return false;
+      }
+      Emit(BinOpCode(bin_exp.op()), dst, dst, rhs);
+      PopRegisters(1);
+      return true;
+    }
+    case Expression::kTernExp: {
+      const TernaryExpression& tern_exp = exp.tern_exp();
+      if (!Compile(tern_exp.cond_exp(), dst)) {
+        return false;
+      }
+      const int jump_else = Emit(OpCode::kJumpIfFalse, dst);
+      if (!Compile(tern_exp.if_exp(), dst)) {
+        return false;
+      }
+      const int jump_end = Emit(OpCode::kJump);
+      PatchJump(jump_else);
+      if (!Compile(tern_exp.else_exp(), dst)) {
+        return false;
+      }
+      PatchJump(jump_end);
+      return true;
+    }
+    case Expression::kTupleExp: {
+      // Elements are evaluated right to left.
+      const TupleExpression& tuple_exp = exp.tuple_exp();
+      const int size = tuple_exp.exp_size();
+      const int base = top_;
+      for (int i = 0; i < size; ++i) {
+        PushRegister();
+      }
+      for (int i = size; i-- > 0;) {
+        if (!Compile(tuple_exp.exp(i), base + i)) {
+          return false;
+        }
+      }
+      Emit(OpCode::kMakeTuple, dst, base, size);
+      PopRegisters(size);
+      return true;
+    }
+    case Expression::kLambdaExp:
+      return Compile(exp.lambda_exp(), exp.origin().source_id(), dst);
+    case Expression::TYPE_NOT_SET:
+      Emit(OpCode::kLoadConst, dst, ConstIndex(Literal()));
+      return true;
+  }
+  return false;
+}
+
+bool FunctionCompiler::Compile(const LambdaExpression& lambda_exp,
+                               int64_t source_id, int dst) {
+  // Reserve the function's index first; compiling the body may add more
+  // functions for nested lambdas.
+  const int fn_index = bytecode_->functions.size();
+  bytecode_->functions.emplace_back();
+  bytecode_->function_by_source_id[source_id] = fn_index;
+
+  Function fn;
+  fn.layout = &lambda_exp.layout();
+  fn.lambda = &lambda_exp;
+  fn.source_id = source_id;
+  FunctionCompiler compiler(bytecode_, &fn);
+  for (const Variable& param : lambda_exp.param()) {
+    compiler.AddParam(param);
+  }
+  if (!compiler.CompileBody(lambda_exp.body())) {
+    return false;
+  }
+  // Falling off the end of a function body returns None.
+  Literal none;
+  none.set_none_val(true);
+  const int ret = compiler.PushRegister();
+  compiler.Emit(OpCode::kLoadConst, ret, compiler.ConstIndex(none));
+  compiler.Emit(OpCode::kReturn, ret);
+  bytecode_->functions[fn_index] = std::move(fn);
+
+  Emit(OpCode::kMakeClosure, dst, fn_index);
+  return true;
+}
+
+bool FunctionCompiler::Compile(const Statement& stmt) {
+  switch (stmt.type_case()) {
+    case Statement::kExpStmt: {
+      const int reg = PushRegister();
+      const bool ok = Compile(stmt.exp_stmt(), reg);
+      PopRegisters(1);
+      return ok;
+    }
+    case Statement::kAssignStmt: {
+      const AssignStatement& assign_stmt = stmt.assign_stmt();
+      if (!assign_stmt.lhs().has_var_exp()) {
+        return false;
+      }
+      // The lhs is bound before the rhs is evaluated, so that closures on the
+      // rhs can refer to it (e.g. for recursion).
+      const int var = assign_stmt.lhs().var_exp().slot();
+      Emit(OpCode::kDeclareVar, var);
+      const int reg = PushRegister();
+      const bool ok = Compile(assign_stmt.rhs(), reg);
+      Emit(OpCode::kStoreVar, var, reg);
+      PopRegisters(1);
+      return ok;
+    }
+    case Statement::kRetStmt: {
+      const int reg = PushRegister();
+      const bool ok = Compile(stmt.ret_stmt(), reg);
+      Emit(OpCode::kReturn, reg);
+      PopRegisters(1);
+      return ok;
+    }
+    case Statement::kPrintStmt: {
+      const int reg = PushRegister();
+      const bool ok = Compile(stmt.print_stmt(), reg);
+      Emit(OpCode::kPrint, reg);
+      PopRegisters(1);
+      return ok;
+    }
+    case Statement::kIfElseStmt: {
+      const IfElseStatement& if_else_stmt = stmt.if_else_stmt();
+      const int reg = PushRegister();
+      const bool ok = Compile(if_else_stmt.cond(), reg);
+      const int jump_else = Emit(OpCode::kJumpIfFalse, reg);
+      PopRegisters(1);
+      if (!ok || !CompileBody(if_else_stmt.if_stmts())) {
+        return false;
+      }
+      const int jump_end = Emit(OpCode::kJump);
+      PatchJump(jump_else);
+      if (!CompileBody(if_else_stmt.else_stmts())) {
+        return false;
+      }
+      PatchJump(jump_end);
+      return true;
+    }
+    case Statement::kWhileStmt: {
+      const WhileStatement& while_stmt = stmt.while_stmt();
+      const int loop_start = fn_->code.size();
+      const int reg = PushRegister();
+      const bool ok = Compile(while_stmt.cond(), reg);
+      const int jump_end = Emit(OpCode::kJumpIfFalse, reg);
+      PopRegisters(1);
+      if (!ok || !CompileBody(while_stmt.body())) {
+        return false;
+      }
+      Emit(OpCode::kJump, 0, loop_start);
+      PatchJump(jump_end);
+      return true;
+    }
+    case Statement::kForStmt: {
+      const ForStatement& for_stmt = stmt.for_stmt();
+      if (!Compile(for_stmt.init())) {
+        return false;
+      }
+      const int loop_start = fn_->code.size();
+      const int reg = PushRegister();
+      const bool ok = Compile(for_stmt.cond(), reg);
+      const int jump_end = Emit(OpCode::kJumpIfFalse, reg);
+      PopRegisters(1);
+      if (!ok || !CompileBody(for_stmt.body()) || !Compile(for_stmt.inc())) {
+        return false;
+      }
+      Emit(OpCode::kJump, 0, loop_start);
+      PatchJump(jump_end);
+      return true;
+    }
+    case Statement::TYPE_NOT_SET:
+      return true;
+  }
+  return false;
+}
+
+const char* OpCodeName(OpCode op) {
+  switch (op) {
+    case OpCode::kLoadConst:
+      return "load_const";
+    case OpCode::kLoadVar:
+      return "load_var";
+    case OpCode::kDeclareVar:
+      return "declare_var";
+    case OpCode::kStoreVar:
+      return "store_var";
+    case OpCode::kNeg:
+      return "neg";
+    case OpCode::kNot:
+      return "not";
+    case OpCode::kAdd:
+      return "add";
+    case OpCode::kSub:
+      return "sub";
+    case OpCode::kMul:
+      return "mul";
+    case OpCode::kDiv:
+      return "div";
+    case OpCode::kGt:
+      return "gt";
+    case OpCode::kGe:
+      return "ge";
+    case OpCode::kLt:
+      return "lt";
+    case OpCode::kLe:
+      return "le";
+    case OpCode::kEq:
+      return "eq";
+    case OpCode::kNe:
+      return "ne";
+    case OpCode::kAnd:
+      return "and";
+    case OpCode::kOr:
+      return "or";
+    case OpCode::kMakeTuple:
+      return "make_tuple";
+    case OpCode::kMakeClosure:
+      return "make_closure";
+    case OpCode::kCall:
+      return "call";
+    case OpCode::kReturn:
+      return "return";
+    case OpCode::kJump:
+      return "jump";
+    case OpCode::kJumpIfFalse:
+      return "jump_if_false";
+    case OpCode::kPrint:
+      return "print";
+    case OpCode::kHalt:
+      return "halt";
+  }
+  return "?";
+}
+
+}  // namespace
+
+bool Compile(const Program& pgm, Bytecode* bytecode) {
+  bytecode->functions.clear();
+  bytecode->function_by_source_id.clear();
+  bytecode->functions.emplace_back();
+
+  Function top_level;
+  top_level.layout = &pgm.layout();
+  FunctionCompiler compiler(bytecode, &top_level);
+  if (!compiler.CompileBody(pgm.stmt())) {
+    return false;
+  }
+  compiler.Emit(OpCode::kHalt);
+  bytecode->functions[0] = std::move(top_level);
+  return true;
+}
+
+std::string Disassemble(const Bytecode& bytecode) {
+  std::ostringstream out;
+  for (size_t i = 0; i < bytecode.functions.size(); ++i) {
+    const Function& fn = bytecode.functions[i];
+    out << "function " << i << " (source_id " << fn.source_id << ", "
+        << fn.num_registers << " registers):\n";
+    for (int slot = 0; slot < fn.layout->name_size(); ++slot) {
+      out << "  v[" << slot << "] = " << fn.layout->name(slot) << "\n";
+    }
+    for (size_t pc = 0; pc < fn.code.size(); ++pc) {
+      const Instruction& instr = fn.code[pc];
+      out << "  " << pc << ": " << OpCodeName(instr.op) << " " << instr.a
+          << " " << instr.b << " " << instr.c << "\n";
+    }
+  }
+  return out.str();
+}
+
+}  // namespace steinlang
@@ -0,0 +1,99 @@
+// A compact register bytecode for steinlang programs, and a compiler from
+// Program syntax trees to bytecode.
+
+#ifndef LANG_STEINLANG_BYTECODE_H_
+#define LANG_STEINLANG_BYTECODE_H_
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "lang/steinlang/steinlang_syntax.pb.h"
+#include "lang/steinlang/value.h"
+
+namespace steinlang {
+
+// Operands are named a, b, c. r[x] is register x of the current frame,
+// k[x] is constant x and v[x] is the variable in slot x of the current frame.
+enum class OpCode : uint8_t {
+  kLoadConst,    // r[a] = k[b]
+  kLoadVar,      // r[a] = v[b]
+  kDeclareVar,   // bind v[a] to a fresh store address if it's unbound
+  kStoreVar,     // v[a] = r[b]
+  kNeg,          // r[a] = -r[b]
+  kNot,          // r[a] = !r[b]
+  kAdd,          // r[a] = r[b] + r[c]
+  kSub,          // r[a] = r[b] - r[c]
+  kMul,          // r[a] = r[b] * r[c]
+  kDiv,          // r[a] = r[b] / r[c]
+  kGt,           // r[a] = r[b] > r[c]
+  kGe,           // r[a] = r[b] >= r[c]
+  kLt,           // r[a] = r[b] < r[c]
+  kLe,           // r[a] = r[b] <= r[c]
+  kEq,           // r[a] = r[b] == r[c]
+  kNe,           // r[a] = r[b] != r[c]
+  kAnd,          // r[a] = r[b] && r[c]
+  kOr,           // r[a] = r[b] || r[c]
+  kMakeTuple,    // r[a] = (r[b], ..., r[b + c - 1])
+  kMakeClosure,  // r[a] = closure of function b over the current env
+  kCall,         // r[a] = r[b](r[b + 1], ..., r[b + n]) at call site c, where
+                 // n = call_sites[c].num_args
+  kReturn,       // return r[a] to the caller
+  kJump,         // pc = b
+  kJumpIfFalse,  // if !r[a]: pc = b
+  kPrint,        // print r[a]
+  kHalt,         // stop evaluation
+};
+
+struct Instruction {
+  OpCode op;
+  int32_t a;
+  int32_t b;
+  int32_t c;
+};
+
+struct CallSite {
+  // The Origin.source_id of the FuncAppExpression.
+  int64_t source_id;
+  int num_args;
+};
+
+// A compiled function body: either the top-level program, or the body of a
+// LambdaExpression.
+struct Function {
+  std::vector<Instruction> code;
+  std::vector<Value> constants;
+  std::vector<CallSite> call_sites;
+  // Frame slots of the parameters, in order.
+  std::vector<int> params;
+  int num_registers = 0;
+
+  // The frame layout, owned by the compiled Program.
+  const FrameLayout* layout = nullptr;
+  // The lambda this function was compiled from, or nullptr for the top-level
+  // program. Owned by the compiled Program.
+  const LambdaExpression* lambda = nullptr;
+  // The Origin.source_id of the lambda's Expression, or 0 for the top-level
+  // program.
+  int64_t source_id = 0;
+};
+
+// functions[0] is the top-level program.
+struct Bytecode {
+  std::vector<Function> functions;
+  std::unordered_map<int64_t, int> function_by_source_id;
+};
+
+// Compile pgm to bytecode. pgm must be annotated with AnnotateSource and
+// ResolveVariables, and must outlive the result.
+// Returns false if pgm uses a construct that has no bytecode equivalent (e.g.
+// assignment to something other than a variable).
+bool Compile(const Program& pgm, Bytecode* bytecode);
+
+// Human readable listing of the compiled functions.
+std::string Disassemble(const Bytecode& bytecode);
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_BYTECODE_H_
@@ -0,0 +1,288 @@
+#include "lang/steinlang/checkpoint.h"
+
+#include <fcntl.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sstream>
+#include <utility>
+
+namespace steinlang {
+
+namespace {
+
+constexpr char kMagic[] = "STEINCKP";
+constexpr int kMagicSize = 8;
+
+// Serialize msg deterministically, so that unchanged values compare equal.
+std::string Serialize(const google::protobuf::MessageLite& msg) {
+  std::string bytes;
+  google::protobuf::io::StringOutputStream raw(&bytes);
+  google::protobuf::io::CodedOutputStream out(&raw);
+  out.SetSerializationDeterministic(true);
+  msg.SerializeToCodedStream(&out);
+  out.Trim();
+  return bytes;
+}
+
+void WriteBytes(const std::string& bytes,
+                google::protobuf::io::CodedOutputStream* out) {
+  out->WriteVarint64(bytes.size());
+  out->WriteString(bytes);
+}
+
+// The bytes of a message in a mapped file.
+struct Span {
+  uint64_t offset = 0;
+  uint64_t size = 0;
+};
+
+// A read-only memory mapping of a whole file.
+class MappedFile {
+ public:
+  ~MappedFile() {
+    if (data_ != nullptr) {
+      munmap(data_, size_);
+    }
+  }
+
+  // Returns nullptr if path can't be mapped.
+  static std::shared_ptr<MappedFile> Open(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return nullptr;
+    }
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) {
+      return nullptr;
+    }
+    auto file = std::shared_ptr<MappedFile>(new MappedFile);
+    file->data_ = static_cast<uint8_t*>(data);
+    file->size_ = st.st_size;
+    return file;
+  }
+
+  const uint8_t* data() const { return data_; }
+  size_t size() const { return size_; }
+
+  template <typename Message>
+  bool Parse(Span span, Message* msg) const {
+    return msg->ParseFromArray(data_ + span.offset, span.size);
+  }
+
+ private:
+  MappedFile() = default;
+
+  uint8_t* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Reads store values from the latest checkpoint that has them.
+class MappedStore : public StoreSource {
+ public:
+  MappedStore(std::shared_ptr<MappedFile> file, std::vector<Span> values)
+      : file_(std::move(file)), values_(std::move(values)) {}
+
+  void Materialize(int64_t addr, Literal* value) override {
+    file_->Parse(values_[addr], value);
+  }
+
+ private:
+  std::shared_ptr<MappedFile> file_;
+  std::vector<Span> values_;
+};
+
+// Read the size of a message, and skip past it to the next field.
+bool ReadSpan(google::protobuf::io::CodedInputStream* in, Span* span) {
+  uint64_t size;
+  if (!in->ReadVarint64(&size)) {
+    return false;
+  }
+  span->offset = in->CurrentPosition();
+  span->size = size;
+  return in->Skip(size);
+}
+
+}  // namespace
+
+std::string CheckpointStats::DebugString() const {
+  std::ostringstream out;
+  out << "checkpoints: " << checkpoints << " written, " << bytes
+      << " bytes, " << values << " store values, " << frames
+      << " local contexts";
+  return out.str();
+}
+
+CheckpointWriter::~CheckpointWriter() {
+  if (file_ != nullptr) {
+    fclose(file_);
+  }
+}
+
+bool CheckpointWriter::Write(Evaluator* evaluator, int64_t steps) {
+  const bool first = file_ == nullptr;
+  std::vector<int64_t> addrs;
+  if (first) {
+    // The first checkpoint has every store value. Read those that a restored
+    // store hasn't yet before replacing path, which may be the file it's
+    // restored from.
+    evaluator->MaterializeStore();
+    evaluator->TrackStoreWrites();
+    file_ = fopen(path_.c_str(), "wb");
+    if (file_ == nullptr) {
+      return false;
+    }
+    for (int64_t addr = 0; addr < evaluator->ctx().store_size(); ++addr) {
+      addrs.push_back(addr);
+    }
+  } else {
+    addrs = evaluator->TakeStoreWrites();
+  }
+  const EvalContext& ctx = evaluator->ctx();
+
+  std::string buffer;
+  {
+    google::protobuf::io::StringOutputStream raw(&buffer);
+    google::protobuf::io::CodedOutputStream out(&raw);
+    if (first) {
+      out.WriteRaw(kMagic, kMagicSize);
+    }
+    out.WriteVarint64(steps);
+    WriteBytes(first ? Serialize(ctx.pgm()) : "", &out);
+
+    // The bottom of the stack, which is the first to be saved, tends to stay
+    // the same.
+    std::vector<std::string> frames;
+    for (const LocalContext& saved : ctx.saved_ctx()) {
+      frames.push_back(Serialize(saved));
+    }
+    frames.push_back(Serialize(ctx.cur_ctx()));
+    size_t kept = 0;
+    while (kept < frames.size() && kept < frames_.size() &&
+           frames_[kept] == frames[kept]) {
+      ++kept;
+    }
+    out.WriteVarint64(kept);
+    out.WriteVarint64(frames.size() - kept);
+    for (size_t i = kept; i < frames.size(); ++i) {
+      WriteBytes(frames[i], &out);
+    }
+    stats_.frames += frames.size() - kept;
+    frames_ = std::move(frames);
+
+    // Values that were written, but are the same as in the last checkpoint,
+    // e.g. after garbage collection, are left out.
+    const int64_t old_size = values_.size();
+    values_.resize(ctx.store_size());
+    std::vector<int64_t> changed;
+    for (int64_t addr : addrs) {
+      std::string value = Serialize(ctx.store(addr));
+      if (addr >= old_size || values_[addr] != value) {
+        values_[addr] = std::move(value);
+        changed.push_back(addr);
+      }
+    }
+    out.WriteVarint64(ctx.store_size());
+    out.WriteVarint64(changed.size());
+    for (int64_t addr : changed) {
+      out.WriteVarint64(addr);
+      WriteBytes(values_[addr], &out);
+    }
+    stats_.values += changed.size();
+  }
+
+  if (fwrite(buffer.data(), 1, buffer.size(), file_) != buffer.size() ||
+      fflush(file_) != 0) {
+    return false;
+  }
+  ++stats_.checkpoints;
+  stats_.bytes += buffer.size();
+  return true;
+}
+
+std::unique_ptr<Evaluator> RestoreCheckpoint(const std::string& path,
+                                             EvalContext* ctx,
+                                             PoolingArenaAllocator* allocator,
+                                             int64_t* steps) {
+  std::shared_ptr<MappedFile> file = MappedFile::Open(path);
+  if (file == nullptr || file->size() < kMagicSize ||
+      memcmp(file->data(), kMagic, kMagicSize) != 0) {
+    return nullptr;
+  }
+  google::protobuf::io::CodedInputStream in(file->data(), file->size());
+  in.Skip(kMagicSize);
+
+  // Replay the checkpoints, keeping track of where the latest version of each
+  // part of the state is.
+  Span pgm;
+  std::vector<Span> frames;
+  std::vector<Span> values;
+  bool restored = false;
+  while (static_cast<size_t>(in.CurrentPosition()) < file->size()) {
+    uint64_t checkpoint_steps, kept, num_frames, store_size, num_values;
+    Span checkpoint_pgm;
+    if (!in.ReadVarint64(&checkpoint_steps) ||
+        !ReadSpan(&in, &checkpoint_pgm) || !in.ReadVarint64(&kept) ||
+        kept > frames.size() || !in.ReadVarint64(&num_frames)) {
+      return nullptr;
+    }
+    if (!restored) {
+      pgm = checkpoint_pgm;
+    }
+    frames.resize(kept);
+    for (uint64_t i = 0; i < num_frames; ++i) {
+      frames.emplace_back();
+      if (!ReadSpan(&in, &frames.back())) {
+        return nullptr;
+      }
+    }
+    if (!in.ReadVarint64(&store_size) || !in.ReadVarint64(&num_values)) {
+      return nullptr;
+    }
+    values.resize(store_size);
+    for (uint64_t i = 0; i < num_values; ++i) {
+      uint64_t addr;
+      if (!in.ReadVarint64(&addr) || addr >= store_size ||
+          !ReadSpan(&in, &values[addr])) {
+        return nullptr;
+      }
+    }
+    *steps = checkpoint_steps;
+    restored = true;
+  }
+  if (!restored || frames.empty() || !file->Parse(pgm, ctx->mutable_pgm())) {
+    return nullptr;
+  }
+
+  for (size_t i = 0; i + 1 < frames.size(); ++i) {
+    if (!file->Parse(frames[i], ctx->add_saved_ctx())) {
+      return nullptr;
+    }
+  }
+  if (!file->Parse(frames.back(), ctx->mutable_cur_ctx())) {
+    return nullptr;
+  }
+  // Memo tables aren't checkpointed, and this run may not memoize, so the
+  // results of the calls in progress aren't cached.
+  for (LocalContext& saved : *ctx->mutable_saved_ctx()) {
+    saved.clear_memo_key();
+  }
+  ctx->mutable_cur_ctx()->clear_memo_key();
+  for (size_t addr = 0; addr < values.size(); ++addr) {
+    ctx->add_store();
+  }
+  auto evaluator = std::make_unique<Evaluator>(ctx, allocator);
+  evaluator->LoadStoreLazily(
+      std::make_unique<MappedStore>(std::move(file), std::move(values)));
+  return evaluator;
+}
+
+}  // namespace steinlang
@@ -0,0 +1,85 @@
+// Checkpoints of an Evaluator's state to a file, to resume evaluation from
+// later, e.g. in another process.
+//
+// A checkpoint file holds a sequence of checkpoints, each of which is a delta
+// against the one before: the first has the program, the whole stack of
+// LocalContexts and every store value, and later ones only have the
+// LocalContexts above the part of the stack that's unchanged, and the store
+// values that have changed. Restoring maps the file into memory, parses the
+// program and the stack, and only indexes the store, whose values are parsed
+// when the evaluation first uses them (see Evaluator::LoadStoreLazily).
+//
+// The format, in varints unless noted:
+//   file: "STEINCKP" (8 bytes), checkpoint*
+//   checkpoint: steps, program, kept_frames, num_frames, frame*, store_size,
+//       num_values, value*
+//   program: size, Program bytes (size 0 in every checkpoint but the first)
+//   frame: size, LocalContext bytes. The stack is the first kept_frames of
+//       the previous checkpoint's, followed by these, innermost last.
+//   value: addr, size, Literal bytes
+
+#ifndef LANG_STEINLANG_CHECKPOINT_H_
+#define LANG_STEINLANG_CHECKPOINT_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lang/steinlang/language_evaluation.h"
+#include "lang/steinlang/memory.h"
+
+namespace steinlang {
+
+struct CheckpointStats {
+  int64_t checkpoints = 0;
+  int64_t bytes = 0;
+  // Store values and LocalContexts written, over all checkpoints.
+  int64_t values = 0;
+  int64_t frames = 0;
+
+  std::string DebugString() const;
+};
+
+class CheckpointWriter {
+ public:
+  // path is replaced by the first checkpoint.
+  explicit CheckpointWriter(std::string path) : path_(std::move(path)) {}
+  ~CheckpointWriter();
+
+  CheckpointWriter(const CheckpointWriter&) = delete;
+  CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+  // Append a checkpoint of evaluator, which has evaluated steps steps so far.
+  // Only call this between calls to Evaluator::Run, after consuming its
+  // output, while it isn't forking, and always with the same evaluator. Returns false if the file
+  // can't be written.
+  bool Write(Evaluator* evaluator, int64_t steps);
+
+  const CheckpointStats& stats() const { return stats_; }
+
+ private:
+  const std::string path_;
+  FILE* file_ = nullptr;
+  // The serialized values and frames in the file as of the last checkpoint,
+  // by address and by depth, to leave out those that haven't changed.
+  std::vector<std::string> values_;
+  std::vector<std::string> frames_;
+  CheckpointStats stats_;
+};
+
+// Set up ctx, which must be empty and arena-allocated by allocator, to resume
+// from the last checkpoint in the file at path, and return an Evaluator of it
+// whose store is loaded lazily from the file. Sets steps to the number of
+// steps evaluated before the checkpoint. Calls in progress at the checkpoint
+// aren't memoized, since memo tables aren't saved. Returns nullptr if the file
+// can't be read or is corrupt.
+std::unique_ptr<Evaluator> RestoreCheckpoint(const std::string& path,
+                                             EvalContext* ctx,
+                                             PoolingArenaAllocator* allocator,
+                                             int64_t* steps);
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_CHECKPOINT_H_
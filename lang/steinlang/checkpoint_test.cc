@@ -0,0 +1,279 @@
+#include "lang/steinlang/checkpoint.h"
+
+#include <gflags/gflags.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lang/steinlang/language_evaluation.h"
+#include "lang/steinlang/memory.h"
+#include "lang/steinlang/run_status.h"
+#include "lang/steinlang/steinlang_parser.h"
+#include "util/file_io.h"
+
+DECLARE_bool(memoize);
+DECLARE_int64(gc_min_store_size);
+
+namespace steinlang {
+namespace {
+
+// Recursive calls, whose frames are checkpointed, and a loop that makes
+// garbage, so the store is collected between checkpoints.
+constexpr char kProgram[] =
+    "fib = lambda n: n if n <= 1 else fib(n - 1) + fib(n - 2);"
+    "i = 0;"
+    "while i < 12 { f = lambda x: x + i; print f(fib(i)); i = i + 1; }";
+constexpr int64_t kStepsPerRun = 97;
+
+std::string TempPath(const std::string& name) {
+  const char* dir = getenv("TEST_TMPDIR");
+  return std::string(dir != nullptr ? dir : "/tmp") + "/" + name;
+}
+
+void WriteFile(const std::string& path, const std::string& contents) {
+  std::ofstream(path, std::ios::binary | std::ios::trunc) << contents;
+}
+
+std::vector<std::string> RunToEnd(Evaluator* evaluator) {
+  std::vector<std::string> output;
+  RunStatus status;
+  do {
+    status = evaluator->Run(kStepsPerRun);
+    for (std::string& line : evaluator->consume_output()) {
+      output.push_back(std::move(line));
+    }
+  } while (status.reason != StopReason::kFinished);
+  return output;
+}
+
+// An evaluation that's checkpointed after every run of kStepsPerRun steps.
+struct Checkpointed {
+  // Everything the evaluation printed.
+  std::vector<std::string> output;
+  // Of each checkpoint: the size of the file after it was written, the
+  // number of lines printed before it, the steps evaluated before it, and
+  // the store size.
+  std::vector<int64_t> file_sizes;
+  std::vector<int64_t> printed;
+  std::vector<int64_t> steps;
+  std::vector<int64_t> store_sizes;
+};
+
+// Evaluate evaluator to the end, checkpointing it to path. prior_steps were
+// evaluated before it was restored.
+bool Checkpoint(Evaluator* evaluator, int64_t prior_steps,
+                const std::string& path, Checkpointed* result) {
+  CheckpointWriter writer(path);
+  int64_t steps = prior_steps;
+  RunStatus status;
+  do {
+    status = evaluator->Run(kStepsPerRun);
+    steps += status.steps;
+    for (std::string& line : evaluator->consume_output()) {
+      result->output.push_back(std::move(line));
+    }
+    if (status.reason == StopReason::kBudgetExhausted) {
+      if (!writer.Write(evaluator, steps)) {
+        fprintf(stderr, "failed to write %s\n", path.c_str());
+        return false;
+      }
+      result->file_sizes.push_back(writer.stats().bytes);
+      result->printed.push_back(result->output.size());
+      result->steps.push_back(steps);
+      result->store_sizes.push_back(evaluator->ctx().store_size());
+    }
+  } while (status.reason == StopReason::kBudgetExhausted);
+  return true;
+}
+
+bool Checkpoint(const std::string& path, Checkpointed* result) {
+  Program pgm;
+  if (!ParseProgram(kProgram, &pgm)) {
+    fprintf(stderr, "failed to parse the program\n");
+    return false;
+  }
+  PoolingArenaAllocator allocator;
+  EvalContext* ctx = allocator.AllocateEvalContext();
+  InitEvalContext(pgm, ctx);
+  Evaluator evaluator(ctx, &allocator);
+  return Checkpoint(&evaluator, 0, path, result);
+}
+
+// Restore every checkpoint in the file at path, written as checkpointed
+// says, by restoring a copy that's cut off after it, and check that the
+// restored evaluations print the rest of the output.
+bool ExpectRestores(const std::string& test, const std::string& path,
+                    const Checkpointed& checkpointed) {
+  const std::string contents = util::ReadFileToString(path);
+  const std::string prefix_path = path + ".prefix";
+  for (size_t i = 0; i < checkpointed.file_sizes.size(); ++i) {
+    WriteFile(prefix_path, contents.substr(0, checkpointed.file_sizes[i]));
+    PoolingArenaAllocator allocator;
+    int64_t steps;
+    std::unique_ptr<Evaluator> evaluator = RestoreCheckpoint(
+        prefix_path, allocator.AllocateEvalContext(), &allocator, &steps);
+    if (evaluator == nullptr) {
+      fprintf(stderr, "%s: failed to restore checkpoint %zu\n", test.c_str(),
+              i);
+      return false;
+    }
+    const std::vector<std::string> expected(
+        checkpointed.output.begin() + checkpointed.printed[i],
+        checkpointed.output.end());
+    if (steps != checkpointed.steps[i] ||
+        RunToEnd(evaluator.get()) != expected) {
+      fprintf(stderr, "%s: checkpoint %zu restored wrong\n", test.c_str(), i);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TestRestoresEveryCheckpoint() {
+  const std::string path = TempPath("checkpoint_test_every.ckpt");
+  Checkpointed checkpointed;
+  return Checkpoint(path, &checkpointed) &&
+         ExpectRestores("restores every checkpoint", path, checkpointed);
+}
+
+bool TestRestoresAfterGarbageCollection() {
+  const int64_t gc_min_store_size = FLAGS_gc_min_store_size;
+  FLAGS_gc_min_store_size = 16;
+  const std::string path = TempPath("checkpoint_test_gc.ckpt");
+  Checkpointed checkpointed;
+  const bool checkpointed_ok = Checkpoint(path, &checkpointed);
+  FLAGS_gc_min_store_size = gc_min_store_size;
+  if (!checkpointed_ok) {
+    return false;
+  }
+  bool shrunk = false;
+  for (size_t i = 1; i < checkpointed.store_sizes.size(); ++i) {
+    shrunk |= checkpointed.store_sizes[i] < checkpointed.store_sizes[i - 1];
+  }
+  if (!shrunk) {
+    fprintf(stderr, "restores after garbage collection: the store never "
+                    "shrank between checkpoints\n");
+    return false;
+  }
+  return ExpectRestores("restores after garbage collection", path,
+                        checkpointed);
+}
+
+// A restored evaluation is checkpointed to the file it's restored from, while
+// its store is still loaded from that file.
+bool TestRestoredCheckpointsToSamePath() {
+  const std::string path = TempPath("checkpoint_test_same_path.ckpt");
+  Checkpointed first;
+  if (!Checkpoint(path, &first)) {
+    return false;
+  }
+  const int middle = first.file_sizes.size() / 2;
+  WriteFile(path,
+            util::ReadFileToString(path).substr(0, first.file_sizes[middle]));
+  PoolingArenaAllocator allocator;
+  int64_t steps;
+  std::unique_ptr<Evaluator> evaluator = RestoreCheckpoint(
+      path, allocator.AllocateEvalContext(), &allocator, &steps);
+  if (evaluator == nullptr) {
+    fprintf(stderr, "restored checkpoints to the same path: failed to "
+                    "restore\n");
+    return false;
+  }
+  Checkpointed second;
+  if (!Checkpoint(evaluator.get(), steps, path, &second)) {
+    return false;
+  }
+  const std::vector<std::string> expected(
+      first.output.begin() + first.printed[middle], first.output.end());
+  if (second.output != expected) {
+    fprintf(stderr, "restored checkpoints to the same path: printed the "
+                    "wrong output\n");
+    return false;
+  }
+  // The file now has only the restored evaluation's checkpoints.
+  for (int64_t& printed : second.printed) {
+    printed += first.printed[middle];
+  }
+  second.output = first.output;
+  return ExpectRestores("restored checkpoints to the same path", path,
+                        second);
+}
+
+// Frames of memoized calls are restored, whether or not the restoring run
+// memoizes.
+bool TestRestoresMemoizedCalls() {
+  const std::string path = TempPath("checkpoint_test_memoize.ckpt");
+  Checkpointed checkpointed;
+  FLAGS_memoize = true;
+  const bool checkpointed_ok = Checkpoint(path, &checkpointed);
+  bool passed = checkpointed_ok &&
+                ExpectRestores("restores memoized calls with memoization",
+                               path, checkpointed);
+  FLAGS_memoize = false;
+  return checkpointed_ok &&
+         ExpectRestores("restores memoized calls without memoization", path,
+                        checkpointed) &&
+         passed;
+}
+
+bool TestRejectsCorruptFiles() {
+  const std::string path = TempPath("checkpoint_test_corrupt.ckpt");
+  Checkpointed checkpointed;
+  if (!Checkpoint(path, &checkpointed)) {
+    return false;
+  }
+  const std::string contents = util::ReadFileToString(path);
+  const std::string first = contents.substr(0, checkpointed.file_sizes[0]);
+  std::vector<std::pair<std::string, std::string>> corrupt = {
+      {"empty", ""},
+      {"bad magic", "STEINCKQ" + first.substr(8)},
+      {"trailing garbage", contents + "\xff"},
+      // A frame count that's more than the previous checkpoint had.
+      {"bad kept frames", contents + std::string("\x01\x00\x7f", 3)},
+      // A program size that's past the end of the file.
+      {"bad size", first.substr(0, 9) + "\xff\xff\x03"},
+  };
+  // Cut off anywhere within the first checkpoint.
+  for (size_t size = 1; size < first.size(); ++size) {
+    corrupt.emplace_back("cut off at " + std::to_string(size),
+                         first.substr(0, size));
+  }
+  bool passed = true;
+  for (const auto& name_contents : corrupt) {
+    WriteFile(path, name_contents.second);
+    PoolingArenaAllocator allocator;
+    int64_t steps;
+    if (RestoreCheckpoint(path, allocator.AllocateEvalContext(), &allocator,
+                          &steps) != nullptr) {
+      fprintf(stderr, "rejects corrupt files: restored %s\n",
+              name_contents.first.c_str());
+      passed = false;
+    }
+  }
+  PoolingArenaAllocator allocator;
+  int64_t steps;
+  if (RestoreCheckpoint(TempPath("checkpoint_test_missing.ckpt"),
+                        allocator.AllocateEvalContext(), &allocator,
+                        &steps) != nullptr) {
+    fprintf(stderr, "rejects corrupt files: restored a missing file\n");
+    passed = false;
+  }
+  return passed;
+}
+
+}  // namespace
+}  // namespace steinlang
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  bool passed = steinlang::TestRestoresEveryCheckpoint();
+  passed = steinlang::TestRestoresAfterGarbageCollection() && passed;
+  passed = steinlang::TestRestoredCheckpointsToSamePath() && passed;
+  passed = steinlang::TestRestoresMemoizedCalls() && passed;
+  passed = steinlang::TestRejectsCorruptFiles() && passed;
+  fprintf(stderr, passed ? "passed\n" : "failed\n");
+  return passed ? 0 : 1;
+}
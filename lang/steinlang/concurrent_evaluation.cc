@@ -0,0 +1,55 @@
+#include "lang/steinlang/concurrent_evaluation.h"
+
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+#include "lang/steinlang/language_evaluation.h"
+#include "lang/steinlang/memory.h"
+#include "lang/steinlang/run_status.h"
+
+namespace steinlang {
+
+namespace {
+
+void EvaluateContext(std::shared_ptr<const Program> pgm, int64_t steps_per_run,
+                     ContextResult* result) {
+  PoolingArenaAllocator allocator;
+  EvalContext* ctx = allocator.AllocateEvalContext();
+  Evaluator evaluator(std::move(pgm), ctx, &allocator);
+  RunStatus status;
+  do {
+    status = evaluator.Run(steps_per_run);
+    result->steps += status.steps;
+    result->peak_allocated_size =
+        std::max(result->peak_allocated_size, allocator.allocated_size());
+    for (std::string& output : evaluator.consume_output()) {
+      result->output.push_back(std::move(output));
+    }
+  } while (status.reason == StopReason::kBudgetExhausted);
+}
+
+}  // namespace
+
+std::vector<ContextResult> EvaluateConcurrently(
+    std::shared_ptr<const Program> pgm, int num_contexts, ForkJoinPool* pool,
+    int64_t steps_per_run) {
+  std::vector<ContextResult> results(num_contexts);
+  std::vector<std::function<void()>> tasks;
+  for (ContextResult& result : results) {
+    ContextResult* result_ptr = &result;
+    tasks.push_back([pgm, steps_per_run, result_ptr] {
+      EvaluateContext(pgm, steps_per_run, result_ptr);
+    });
+  }
+  if (pool != nullptr) {
+    pool->Invoke(std::move(tasks));
+  } else {
+    for (const auto& task : tasks) {
+      task();
+    }
+  }
+  return results;
+}
+
+}  // namespace steinlang
@@ -0,0 +1,38 @@
+// Evaluation of a program in many independent EvalContexts at once, e.g. to
+// serve many requests with the same script. The contexts share one prepared
+// Program, read only, and each has an allocator of its own, so they don't
+// contend for anything but the pool's deques.
+
+#ifndef LANG_STEINLANG_CONCURRENT_EVALUATION_H_
+#define LANG_STEINLANG_CONCURRENT_EVALUATION_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lang/steinlang/fork_join.h"
+#include "lang/steinlang/steinlang_syntax.pb.h"
+
+namespace steinlang {
+
+struct ContextResult {
+  std::vector<std::string> output;
+  int64_t steps = 0;
+  // The most that the context's allocator had allocated, as of the ends of
+  // its calls to Evaluator::Run.
+  size_t peak_allocated_size = 0;
+};
+
+// Evaluate pgm, as returned by PrepareProgram, to completion in num_contexts
+// independent EvalContexts, on the threads of pool, or on the calling thread
+// if pool is nullptr. Each context runs steps_per_run steps at a time.
+// Returns the results in the order of the contexts.
+std::vector<ContextResult> EvaluateConcurrently(
+    std::shared_ptr<const Program> pgm, int num_contexts, ForkJoinPool* pool,
+    int64_t steps_per_run);
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_CONCURRENT_EVALUATION_H_
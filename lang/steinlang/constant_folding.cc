@@ -0,0 +1,382 @@
+#include "lang/steinlang/constant_folding.h"
+
+#include <limits>
+#include <sstream>
+#include <unordered_set>
+
+#include "lang/steinlang/literal_ops.h"
+#include "lang/steinlang/program_analysis.h"
+
+namespace steinlang {
+
+namespace {
+
+// Evaluator steps saved by folding each kind of expression whose operands are
+// already literals. E.g. a BinArithExpression takes a step for itself, one for
+// each operand and one for its BinExpFinal, and its literal value takes one.
+// With --superinstructions, a BinArithExpression of literals already takes one
+// step, so these are upper bounds.
+constexpr int kBinArithStepsSaved = 3;
+constexpr int kMonArithStepsSaved = 2;
+// The TernaryExpression, its literal condition and its IfElseFinal.
+constexpr int kTernaryStepsSaved = 3;
+
+// Like Evaluator::Evaluate(const BinExpFinal&). Returns false if the operation
+// can't be folded, e.g. because it would trap.
+bool FoldBinOp(BinArithOp op, Literal* x, Literal* y) {
+  switch (op) {
+    case BinArithOp::ADD:
+      Add(x, y);
+      return true;
+    case BinArithOp::SUB:
+      Sub(x, y);
+      return true;
+    case BinArithOp::MUL:
+      Mul(x, y);
+      return true;
+    case BinArithOp::DIV:
+      // Leave integer division by zero to fail at runtime, after any output
+      // that comes before it.
+      if (x->has_int_val() && !y->has_float_val() &&
+          (y->int_val() == 0 ||
+           (x->int_val() == std::numeric_limits<int64_t>::min() &&
+            y->int_val() == -1))) {
+        return false;
+      }
+      Div(x, y);
+      return true;
+    case BinArithOp::GT:
+      CompareGt(x, y);
+      return true;
+    case BinArithOp::GE:
+      CompareGe(x, y);
+      return true;
+    case BinArithOp::LT:
+      CompareLt(x, y);
+      return true;
+    case BinArithOp::LE:
+      CompareLe(x, y);
+      return true;
+    case BinArithOp::EQ:
+      CompareEq(x, y);
+      return true;
+    case BinArithOp::NE:
+      CompareNe(x, y);
+      return true;
+    case BinArithOp::AND:
+      BoolAnd(x, y);
+      return true;
+    case BinArithOp::OR:
+      BoolOr(x, y);
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Like Evaluator::Evaluate(const MonExpFinal&).
+bool FoldMonOp(MonArithOp op, Literal* x) {
+  switch (op) {
+    case MonArithOp::NOT:
+      BoolNot(x);
+      return true;
+    case MonArithOp::NEG:
+      Neg(x);
+      return true;
+    default:
+      return false;
+  }
+}
+
+class Folder {
+ public:
+  explicit Folder(ConstantFoldingStats* stats) : stats_(stats) {}
+
+  void Fold(Statement* stmt) {
+    switch (stmt->type_case()) {
+      case Statement::kExpStmt:
+        Fold(stmt->mutable_exp_stmt());
+        break;
+      case Statement::kAssignStmt:
+        Fold(stmt->mutable_assign_stmt()->mutable_lhs());
+        Fold(stmt->mutable_assign_stmt()->mutable_rhs());
+        break;
+      case Statement::kRetStmt:
+        Fold(stmt->mutable_ret_stmt());
+        break;
+      case Statement::kPrintStmt:
+        Fold(stmt->mutable_print_stmt());
+        break;
+      case Statement::kIfElseStmt: {
+        IfElseStatement* if_else_stmt = stmt->mutable_if_else_stmt();
+        Fold(if_else_stmt->mutable_cond());
+        for (Statement& s : *if_else_stmt->mutable_if_stmts()) {
+          Fold(&s);
+        }
+        for (Statement& s : *if_else_stmt->mutable_else_stmts()) {
+          Fold(&s);
+        }
+        break;
+      }
+      case Statement::kWhileStmt:
+        Fold(stmt->mutable_while_stmt()->mutable_cond());
+        for (Statement& s : *stmt->mutable_while_stmt()->mutable_body()) {
+          Fold(&s);
+        }
+        break;
+      case Statement::kForStmt: {
+        ForStatement* for_stmt = stmt->mutable_for_stmt();
+        Fold(for_stmt->mutable_init());
+        Fold(for_stmt->mutable_cond());
+        Fold(for_stmt->mutable_inc());
+        for (Statement& s : *for_stmt->mutable_body()) {
+          Fold(&s);
+        }
+        break;
+      }
+      case Statement::TYPE_NOT_SET:
+        break;
+    }
+  }
+
+  void Fold(Expression* exp) {
+    switch (exp->type_case()) {
+      case Expression::kFuncAppExp:
+        Fold(exp->mutable_func_app_exp()->mutable_func());
+        for (Expression& arg : *exp->mutable_func_app_exp()->mutable_arg()) {
+          Fold(&arg);
+        }
+        break;
+      case Expression::kMonArithExp: {
+        MonArithExpression* mon_exp = exp->mutable_mon_arith_exp();
+        Fold(mon_exp->mutable_exp());
+        if (!mon_exp->exp().has_lit_exp()) {
+          break;
+        }
+        Literal value = mon_exp->exp().lit_exp();
+        if (FoldMonOp(mon_exp->op(), &value)) {
+          exp->mutable_lit_exp()->Swap(&value);
+          Record(kMonArithStepsSaved);
+        }
+        break;
+      }
+      case Expression::kBinArithExp: {
+        BinArithExpression* bin_exp = exp->mutable_bin_arith_exp();
+        Fold(bin_exp->mutable_lhs());
+        Fold(bin_exp->mutable_rhs());
+        if (!bin_exp->lhs().has_lit_exp() || !bin_exp->rhs().has_lit_exp()) {
+          break;
+        }
+        Literal value = bin_exp->lhs().lit_exp();
+        Literal rhs = bin_exp->rhs().lit_exp();
+        if (FoldBinOp(bin_exp->op(), &value, &rhs)) {
+          exp->mutable_lit_exp()->Swap(&value);
+          Record(kBinArithStepsSaved);
+        }
+        break;
+      }
+      case Expression::kTernExp: {
+        TernaryExpression* tern_exp = exp->mutable_tern_exp();
+        Fold(tern_exp->mutable_if_exp());
+        Fold(tern_exp->mutable_cond_exp());
+        Fold(tern_exp->mutable_else_exp());
+        if (!tern_exp->cond_exp().has_lit_exp()) {
+          break;
+        }
+        Expression taken;
+        taken.Swap(tern_exp->cond_exp().lit_exp().bool_val()
+                       ? tern_exp->mutable_if_exp()
+                       : tern_exp->mutable_else_exp());
+        exp->Swap(&taken);
+        Record(kTernaryStepsSaved);
+        break;
+      }
+      case Expression::kTupleExp:
+        for (Expression& e : *exp->mutable_tuple_exp()->mutable_exp()) {
+          Fold(&e);
+        }
+        break;
+      case Expression::kLambdaExp:
+        for (Statement& s : *exp->mutable_lambda_exp()->mutable_body()) {
+          Fold(&s);
+        }
+        break;
+      case Expression::kVarExp:
+      case Expression::kLitExp:
+      case Expression::TYPE_NOT_SET:
+        break;
+    }
+  }
+
+ private:
+  void Record(int steps_saved) {
+    ++stats_->folded_expressions;
+    stats_->steps_saved += steps_saved;
+  }
+
+  ConstantFoldingStats* stats_;
+};
+
+// Replace reads of the variable name with value. Returns the number of
+// variables replaced.
+int Substitute(const std::string& name, const Literal& value, Statement* stmt);
+
+int Substitute(const std::string& name, const Literal& value,
+               Expression* exp) {
+  int replaced = 0;
+  switch (exp->type_case()) {
+    case Expression::kVarExp:
+      if (exp->var_exp().name() == name) {
+        *exp->mutable_lit_exp() = value;
+        ++replaced;
+      }
+      break;
+    case Expression::kFuncAppExp:
+      replaced +=
+          Substitute(name, value, exp->mutable_func_app_exp()->mutable_func());
+      for (Expression& arg : *exp->mutable_func_app_exp()->mutable_arg()) {
+        replaced += Substitute(name, value, &arg);
+      }
+      break;
+    case Expression::kMonArithExp:
+      replaced +=
+          Substitute(name, value, exp->mutable_mon_arith_exp()->mutable_exp());
+      break;
+    case Expression::kBinArithExp:
+      replaced +=
+          Substitute(name, value, exp->mutable_bin_arith_exp()->mutable_lhs());
+      replaced +=
+          Substitute(name, value, exp->mutable_bin_arith_exp()->mutable_rhs());
+      break;
+    case Expression::kTernExp:
+      replaced +=
+          Substitute(name, value, exp->mutable_tern_exp()->mutable_if_exp());
+      replaced +=
+          Substitute(name, value, exp->mutable_tern_exp()->mutable_cond_exp());
+      replaced +=
+          Substitute(name, value, exp->mutable_tern_exp()->mutable_else_exp());
+      break;
+    case Expression::kTupleExp:
+      for (Expression& e : *exp->mutable_tuple_exp()->mutable_exp()) {
+        replaced += Substitute(name, value, &e);
+      }
+      break;
+    case Expression::kLambdaExp:
+      for (Statement& s : *exp->mutable_lambda_exp()->mutable_body()) {
+        replaced += Substitute(name, value, &s);
+      }
+      break;
+    case Expression::kLitExp:
+    case Expression::TYPE_NOT_SET:
+      break;
+  }
+  return replaced;
+}
+
+int Substitute(const std::string& name, const Literal& value,
+               Statement* stmt) {
+  int replaced = 0;
+  switch (stmt->type_case()) {
+    case Statement::kExpStmt:
+      replaced += Substitute(name, value, stmt->mutable_exp_stmt());
+      break;
+    case Statement::kAssignStmt:
+      // The variable is never assigned again, so it can't be on the lhs.
+      replaced +=
+          Substitute(name, value, stmt->mutable_assign_stmt()->mutable_rhs());
+      break;
+    case Statement::kRetStmt:
+      replaced += Substitute(name, value, stmt->mutable_ret_stmt());
+      break;
+    case Statement::kPrintStmt:
+      replaced += Substitute(name, value, stmt->mutable_print_stmt());
+      break;
+    case Statement::kIfElseStmt: {
+      IfElseStatement* if_else_stmt = stmt->mutable_if_else_stmt();
+      replaced += Substitute(name, value, if_else_stmt->mutable_cond());
+      for (Statement& s : *if_else_stmt->mutable_if_stmts()) {
+        replaced += Substitute(name, value, &s);
+      }
+      for (Statement& s : *if_else_stmt->mutable_else_stmts()) {
+        replaced += Substitute(name, value, &s);
+      }
+      break;
+    }
+    case Statement::kWhileStmt:
+      replaced +=
+          Substitute(name, value, stmt->mutable_while_stmt()->mutable_cond());
+      for (Statement& s : *stmt->mutable_while_stmt()->mutable_body()) {
+        replaced += Substitute(name, value, &s);
+      }
+      break;
+    case Statement::kForStmt: {
+      ForStatement* for_stmt = stmt->mutable_for_stmt();
+      replaced += Substitute(name, value, for_stmt->mutable_init());
+      replaced += Substitute(name, value, for_stmt->mutable_cond());
+      replaced += Substitute(name, value, for_stmt->mutable_inc());
+      for (Statement& s : *for_stmt->mutable_body()) {
+        replaced += Substitute(name, value, &s);
+      }
+      break;
+    }
+    case Statement::TYPE_NOT_SET:
+      break;
+  }
+  return replaced;
+}
+
+}  // namespace
+
+std::string ConstantFoldingStats::DebugString() const {
+  if (prints_closures) {
+    return "constant folding: skipped, the program may print closures";
+  }
+  std::ostringstream out;
+  out << "constant folding: " << folded_expressions << " expressions folded, "
+      << propagated_variables << " variables propagated, " << steps_saved
+      << " steps saved per evaluation of the folded expressions";
+  return out.str();
+}
+
+void FoldConstants(Program* pgm, ConstantFoldingStats* stats) {
+  if (MayPrintClosures(*pgm)) {
+    stats->prints_closures = true;
+    return;
+  }
+  Folder folder(stats);
+  std::unordered_set<std::string> propagated;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (Statement& stmt : *pgm->mutable_stmt()) {
+      folder.Fold(&stmt);
+    }
+
+    const Assignments assignments = CollectAssignments(*pgm);
+    // A top-level statement runs exactly once, before the statements after
+    // it. Reads before it, including from closures created before it, see
+    // the variable unbound, so they're left alone.
+    for (int i = 0; i < pgm->stmt_size(); ++i) {
+      const Statement& stmt = pgm->stmt(i);
+      if (!stmt.has_assign_stmt() || !stmt.assign_stmt().lhs().has_var_exp() ||
+          !stmt.assign_stmt().rhs().has_lit_exp()) {
+        continue;
+      }
+      const std::string name = stmt.assign_stmt().lhs().var_exp().name();
+      if (!assignments.AssignedOnce(name) || !propagated.insert(name).second) {
+        continue;
+      }
+      const Literal value = stmt.assign_stmt().rhs().lit_exp();
+      int replaced = 0;
+      for (int j = i + 1; j < pgm->stmt_size(); ++j) {
+        replaced += Substitute(name, value, pgm->mutable_stmt(j));
+      }
+      if (replaced > 0) {
+        ++stats->propagated_variables;
+        changed = true;
+      }
+    }
+  }
+}
+
+}  // namespace steinlang
@@ -0,0 +1,43 @@
+// Constant folding and propagation over Program syntax trees, before they're
+// annotated and evaluated.
+
+#ifndef LANG_STEINLANG_CONSTANT_FOLDING_H_
+#define LANG_STEINLANG_CONSTANT_FOLDING_H_
+
+#include <stdint.h>
+#include <string>
+
+#include "lang/steinlang/steinlang_syntax.pb.h"
+
+namespace steinlang {
+
+struct ConstantFoldingStats {
+  int64_t folded_expressions = 0;
+  int64_t propagated_variables = 0;
+  // Evaluator steps saved by one evaluation of each folded expression. An
+  // expression in a loop or function body saves this many steps each time it's
+  // evaluated.
+  int64_t steps_saved = 0;
+  // True if the program was left unchanged because it may print a closure.
+  bool prints_closures = false;
+
+  std::string DebugString() const;
+};
+
+// Replace MonArithExpressions and BinArithExpressions whose operands are
+// literals with their values, and TernaryExpressions whose condition is a
+// literal with the branch that would be taken. Evaluation results are the same.
+//
+// Variables that are only ever assigned once, by a top-level statement with a
+// literal rhs, are replaced by that literal in the statements after it, and
+// folding is repeated.
+//
+// Programs for which MayPrintClosures holds are left unchanged.
+//
+// pgm is changed by variable name, so it mustn't be annotated with
+// AnnotateSource or ResolveVariables yet.
+void FoldConstants(Program* pgm, ConstantFoldingStats* stats);
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_CONSTANT_FOLDING_H_
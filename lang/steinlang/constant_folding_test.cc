@@ -0,0 +1,74 @@
+#include "lang/steinlang/constant_folding.h"
+
+#include <stdio.h>
+#include <limits>
+
+#include "lang/steinlang/optimization_test_util.h"
+
+namespace steinlang {
+namespace {
+
+const std::vector<RewriteTest> kTests = {
+    {"folds arithmetic", "print 1 + (2 * 3);", "print 7;"},
+    {"folds comparisons", "print (1 + 1) < 3;", "print True;"},
+    {"folds the taken branch", "print 1 if 2 > 1 else 2;", "print 1;"},
+    {"drops a trap in the untaken branch",
+     "print 1 if True else 5 / 0;", "print 1;"},
+    {"leaves division by zero", "print 1; print 5 / 0;", nullptr,
+     /*traps=*/true},
+    {"folds float division by zero", "print (5.0 / 0.0) > 1.0;",
+     "print True;"},
+    {"folds division by -1", "print (-6) / (-1);", "print 6;"},
+    {"propagates a constant", "x = 2; print x * 3;", "x = 2; print 6;"},
+    {"propagates into lambdas after the assignment",
+     "x = 2; f = lambda y: x + y; print f(1);",
+     "x = 2; f = lambda y: 2 + y; print f(1);"},
+    {"leaves reads before the assignment",
+     "def f() { return x; } x = 2; print f();", nullptr},
+    {"leaves a variable assigned twice", "x = 2; x = 3; print x;", nullptr},
+    // Calling f binds its parameter to the top-level x.
+    {"leaves a variable that's also a parameter",
+     "x = 2; def f(x) { return x; } print f(5); print x;", nullptr},
+    {"leaves a variable assigned in a lambda",
+     "x = 2; def set() { x = 3; return 0; } print set(); print x;", nullptr},
+    {"leaves a for loop's variable",
+     "for i = 1 + 1; i < 4; i = i + 1; { print i; }",
+     "for i = 2; i < 4; i = i + 1; { print i; }"},
+    {"leaves a program that prints a closure",
+     "x = 2; g = lambda q: q + (x * 3); print g;", nullptr},
+    {"leaves a program that prints a returned closure",
+     "def mk(a) { return lambda b: a + (1 + 2); } h = mk(1); print h;",
+     nullptr},
+};
+
+// INT64_MIN / -1 traps. INT64_MIN has no literal, so it's checked directly.
+bool TestLeavesSmallestIntDividedByMinusOne() {
+  Program pgm =
+      ParseTestProgram("print ((0 - 9223372036854775807) - 1) / (-1);");
+  ConstantFoldingStats stats;
+  FoldConstants(&pgm, &stats);
+  const Expression& exp = pgm.stmt(0).print_stmt();
+  if (!exp.has_bin_arith_exp() || exp.bin_arith_exp().op() != DIV ||
+      exp.bin_arith_exp().lhs().lit_exp().int_val() !=
+          std::numeric_limits<int64_t>::min() ||
+      exp.bin_arith_exp().rhs().lit_exp().int_val() != -1) {
+    fprintf(stderr, "leaves INT64_MIN / -1: folded to\n%s\n",
+            exp.DebugString().c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+}  // namespace steinlang
+
+int main() {
+  bool passed = steinlang::RunRewriteTests(
+      [](steinlang::Program* pgm) {
+        steinlang::ConstantFoldingStats stats;
+        steinlang::FoldConstants(pgm, &stats);
+      },
+      steinlang::kTests);
+  passed = steinlang::TestLeavesSmallestIntDividedByMinusOne() && passed;
+  return passed ? 0 : 1;
+}
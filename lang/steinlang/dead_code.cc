@@ -0,0 +1,335 @@
+#include "lang/steinlang/dead_code.h"
+
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+#include <google/protobuf/reflection.h>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "lang/steinlang/program_analysis.h"
+
+namespace steinlang {
+
+namespace {
+
+using Statements = google::protobuf::RepeatedPtrField<Statement>;
+using Names = std::unordered_set<std::string>;
+
+// The number of Statements and Expressions in msg.
+int64_t CountNodes(const google::protobuf::Message& msg) {
+  const google::protobuf::Descriptor* descriptor = msg.GetDescriptor();
+  int64_t count = descriptor->full_name() == "steinlang.Expression" ||
+                  descriptor->full_name() == "steinlang.Statement";
+  const google::protobuf::Reflection* refl = msg.GetReflection();
+  for (int i = 0; i < descriptor->field_count(); ++i) {
+    const google::protobuf::FieldDescriptor* field = descriptor->field(i);
+    if (field->type() == google::protobuf::FieldDescriptor::TYPE_MESSAGE) {
+      if (field->is_repeated()) {
+        for (int j = 0; j < refl->FieldSize(msg, field); ++j) {
+          count += CountNodes(refl->GetRepeatedMessage(msg, field, j));
+        }
+      } else if (refl->HasField(msg, field)) {
+        count += CountNodes(refl->GetMessage(msg, field));
+      }
+    }
+  }
+  return count;
+}
+
+// Call f(lambda_exp) for every lambda in msg, outermost first.
+template <typename F>
+void ForEachLambda(google::protobuf::Message* msg, F f) {
+  const google::protobuf::Descriptor* descriptor = msg->GetDescriptor();
+  if (descriptor->full_name() == "steinlang.LambdaExpression") {
+    f(static_cast<LambdaExpression*>(msg));
+  }
+  const google::protobuf::Reflection* refl = msg->GetReflection();
+  for (int i = 0; i < descriptor->field_count(); ++i) {
+    const google::protobuf::FieldDescriptor* field = descriptor->field(i);
+    if (field->type() == google::protobuf::FieldDescriptor::TYPE_MESSAGE) {
+      if (field->is_repeated()) {
+        for (int j = 0; j < refl->FieldSize(*msg, field); ++j) {
+          ForEachLambda(refl->MutableRepeatedMessage(msg, field, j), f);
+        }
+      } else if (refl->HasField(*msg, field)) {
+        ForEachLambda(refl->MutableMessage(msg, field), f);
+      }
+    }
+  }
+}
+
+// True if exp is a literal condition, which is only true if it's True.
+bool IsLiteral(const Expression& exp, bool* value) {
+  if (!exp.has_lit_exp()) {
+    return false;
+  }
+  *value = exp.lit_exp().bool_val();
+  return true;
+}
+
+// Removes unreachable statements from a statement list, and the lists nested in
+// its statements, but not in lambda bodies.
+class UnreachableCode {
+ public:
+  explicit UnreachableCode(DeadCodeStats* stats) : stats_(stats) {}
+
+  void Eliminate(Statements* stmts) {
+    Statements result;
+    for (Statement& stmt : *stmts) {
+      if (!result.empty() && result.rbegin()->has_ret_stmt()) {
+        stats_->eliminated_nodes += CountNodes(stmt);
+        continue;
+      }
+      EliminateNested(&stmt);
+      bool cond;
+      if (stmt.has_if_else_stmt() &&
+          IsLiteral(stmt.if_else_stmt().cond(), &cond)) {
+        IfElseStatement* if_else_stmt = stmt.mutable_if_else_stmt();
+        Statements* taken = cond ? if_else_stmt->mutable_if_stmts()
+                                 : if_else_stmt->mutable_else_stmts();
+        int64_t nodes = CountNodes(stmt);
+        for (Statement& s : *taken) {
+          if (!result.empty() && result.rbegin()->has_ret_stmt()) {
+            break;
+          }
+          nodes -= CountNodes(s);
+          result.Add()->Swap(&s);
+        }
+        stats_->eliminated_nodes += nodes;
+      } else if (stmt.has_while_stmt() &&
+                 IsLiteral(stmt.while_stmt().cond(), &cond) && !cond) {
+        stats_->eliminated_nodes += CountNodes(stmt);
+      } else if (stmt.has_for_stmt() &&
+                 IsLiteral(stmt.for_stmt().cond(), &cond) && !cond) {
+        // The init statement still runs once.
+        Statement init;
+        init.Swap(stmt.mutable_for_stmt()->mutable_init());
+        stats_->eliminated_nodes += CountNodes(stmt);
+        if (init.type_case() != Statement::TYPE_NOT_SET) {
+          result.Add()->Swap(&init);
+        }
+      } else {
+        result.Add()->Swap(&stmt);
+      }
+    }
+    stmts->Swap(&result);
+  }
+
+ private:
+  void EliminateNested(Statement* stmt) {
+    switch (stmt->type_case()) {
+      case Statement::kIfElseStmt:
+        Eliminate(stmt->mutable_if_else_stmt()->mutable_if_stmts());
+        Eliminate(stmt->mutable_if_else_stmt()->mutable_else_stmts());
+        break;
+      case Statement::kWhileStmt:
+        Eliminate(stmt->mutable_while_stmt()->mutable_body());
+        break;
+      case Statement::kForStmt:
+        Eliminate(stmt->mutable_for_stmt()->mutable_body());
+        break;
+      default:
+        break;
+    }
+  }
+
+  DeadCodeStats* stats_;
+};
+
+// Removes dead stores from the statements of one frame, by computing which
+// variables are live, i.e. may be read before they're assigned again, going
+// backwards from the end of the frame.
+class DeadStores {
+ public:
+  DeadStores(const Names& local, DeadCodeStats* stats)
+      : local_(local), stats_(stats) {}
+
+  // Return the variables live before stmts, given those live after them. If
+  // remove is true, also remove the dead stores in stmts.
+  Names Live(Statements* stmts, Names live, bool remove) {
+    for (int i = stmts->size() - 1; i >= 0; --i) {
+      Statement* stmt = stmts->Mutable(i);
+      if (remove && IsDeadStore(*stmt, live)) {
+        stats_->eliminated_nodes += CountNodes(*stmt);
+        stmts->DeleteSubrange(i, 1);
+        continue;
+      }
+      live = Live(stmt, std::move(live), remove);
+    }
+    return live;
+  }
+
+ private:
+  bool IsDeadStore(const Statement& stmt, const Names& live) const {
+    if (!stmt.has_assign_stmt() || !stmt.assign_stmt().lhs().has_var_exp()) {
+      return false;
+    }
+    const std::string& name = stmt.assign_stmt().lhs().var_exp().name();
+    if (!local_.count(name) || live.count(name) ||
+        HasSideEffects(stmt.assign_stmt().rhs())) {
+      return false;
+    }
+    // Reading a variable binds it if it's unbound, which a closure could
+    // observe if the variable isn't local.
+    Names reads;
+    CollectFrameNames(stmt.assign_stmt().rhs(), &reads);
+    for (const std::string& read : reads) {
+      if (!local_.count(read)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  Names Live(Statement* stmt, Names live, bool remove) {
+    switch (stmt->type_case()) {
+      case Statement::kExpStmt:
+        CollectFrameNames(stmt->exp_stmt(), &live);
+        break;
+      case Statement::kAssignStmt: {
+        const Expression& lhs = stmt->assign_stmt().lhs();
+        if (lhs.has_var_exp()) {
+          live.erase(lhs.var_exp().name());
+        } else {
+          // Only one of the variables in lhs is assigned.
+          CollectFrameNames(lhs, &live);
+        }
+        CollectFrameNames(stmt->assign_stmt().rhs(), &live);
+        break;
+      }
+      case Statement::kRetStmt:
+        // Nothing after a return statement runs.
+        live.clear();
+        CollectFrameNames(stmt->ret_stmt(), &live);
+        break;
+      case Statement::kPrintStmt:
+        CollectFrameNames(stmt->print_stmt(), &live);
+        break;
+      case Statement::kIfElseStmt: {
+        IfElseStatement* if_else_stmt = stmt->mutable_if_else_stmt();
+        Names if_live = Live(if_else_stmt->mutable_if_stmts(), live, remove);
+        live = Live(if_else_stmt->mutable_else_stmts(), std::move(live),
+                    remove);
+        live.insert(if_live.begin(), if_live.end());
+        CollectFrameNames(if_else_stmt->cond(), &live);
+        break;
+      }
+      case Statement::kWhileStmt: {
+        // The variables live before the condition are live after it, before
+        // the body, and after the body.
+        WhileStatement* while_stmt = stmt->mutable_while_stmt();
+        Names cond_live = std::move(live);
+        CollectFrameNames(while_stmt->cond(), &cond_live);
+        for (;;) {
+          Names next = Live(while_stmt->mutable_body(), cond_live, false);
+          next.insert(cond_live.begin(), cond_live.end());
+          if (next.size() == cond_live.size()) {
+            break;
+          }
+          cond_live = std::move(next);
+        }
+        if (remove) {
+          Live(while_stmt->mutable_body(), cond_live, true);
+        }
+        live = std::move(cond_live);
+        break;
+      }
+      case Statement::kForStmt: {
+        // Like a while loop, with inc at the end of the body. init and inc
+        // aren't in a statement list, so they're never removed.
+        ForStatement* for_stmt = stmt->mutable_for_stmt();
+        Names cond_live = std::move(live);
+        CollectFrameNames(for_stmt->cond(), &cond_live);
+        for (;;) {
+          Names next = Live(for_stmt->mutable_body(),
+                            Live(for_stmt->mutable_inc(), cond_live, false),
+                            false);
+          next.insert(cond_live.begin(), cond_live.end());
+          if (next.size() == cond_live.size()) {
+            break;
+          }
+          cond_live = std::move(next);
+        }
+        if (remove) {
+          Live(for_stmt->mutable_body(),
+               Live(for_stmt->mutable_inc(), cond_live, false), true);
+        }
+        live = Live(for_stmt->mutable_init(), std::move(cond_live), false);
+        break;
+      }
+      case Statement::TYPE_NOT_SET:
+        break;
+    }
+    return live;
+  }
+
+  // The variables that are only used in this frame.
+  const Names& local_;
+  DeadCodeStats* stats_;
+};
+
+// Add 1 to frames[name] for every name used in the frame of stmts, which are
+// the body of lambda_exp, or the top-level statements if it's nullptr.
+void CountFrames(const LambdaExpression* lambda_exp, const Statements& stmts,
+                 std::unordered_map<std::string, int>* frames) {
+  Names names;
+  if (lambda_exp != nullptr) {
+    for (const Variable& param : lambda_exp->param()) {
+      names.insert(param.name());
+    }
+  }
+  for (const Statement& stmt : stmts) {
+    CollectFrameNames(stmt, &names);
+  }
+  for (const std::string& name : names) {
+    ++(*frames)[name];
+  }
+}
+
+}  // namespace
+
+std::string DeadCodeStats::DebugString() const {
+  if (prints_closures) {
+    return "dead code: skipped, the program may print closures";
+  }
+  std::ostringstream out;
+  out << "dead code: " << eliminated_nodes << " nodes eliminated";
+  return out.str();
+}
+
+void EliminateDeadCode(Program* pgm, DeadCodeStats* stats) {
+  if (MayPrintClosures(*pgm)) {
+    stats->prints_closures = true;
+    return;
+  }
+  UnreachableCode unreachable_code(stats);
+  unreachable_code.Eliminate(pgm->mutable_stmt());
+  ForEachLambda(pgm, [&unreachable_code](LambdaExpression* lambda_exp) {
+    unreachable_code.Eliminate(lambda_exp->mutable_body());
+  });
+
+  // A variable that is used by a single frame is never captured by a closure,
+  // nor is it a closure's capture, so it's only accessed by that frame's
+  // statements.
+  std::unordered_map<std::string, int> frames;
+  CountFrames(nullptr, pgm->stmt(), &frames);
+  ForEachLambda(pgm, [&frames](LambdaExpression* lambda_exp) {
+    CountFrames(lambda_exp, lambda_exp->body(), &frames);
+  });
+  Names local;
+  for (const auto& name_frames : frames) {
+    if (name_frames.second == 1) {
+      local.insert(name_frames.first);
+    }
+  }
+
+  // No variable of a frame is read after its last statement.
+  DeadStores dead_stores(local, stats);
+  dead_stores.Live(pgm->mutable_stmt(), {}, true);
+  ForEachLambda(pgm, [&dead_stores](LambdaExpression* lambda_exp) {
+    dead_stores.Live(lambda_exp->mutable_body(), {}, true);
+  });
+}
+
+}  // namespace steinlang
@@ -0,0 +1,41 @@
+// Dead code elimination over Program syntax trees, before they're annotated
+// and evaluated.
+
+#ifndef LANG_STEINLANG_DEAD_CODE_H_
+#define LANG_STEINLANG_DEAD_CODE_H_
+
+#include <stdint.h>
+#include <string>
+
+#include "lang/steinlang/steinlang_syntax.pb.h"
+
+namespace steinlang {
+
+struct DeadCodeStats {
+  // Statements and expressions removed from the program.
+  int64_t eliminated_nodes = 0;
+  // True if the program was left unchanged because it may print a closure.
+  bool prints_closures = false;
+
+  std::string DebugString() const;
+};
+
+// Remove code that can't affect the program's results:
+// - statements after a return statement, which are unreachable,
+// - if statements whose condition is a literal, which are replaced by the
+//   statements of the branch that's taken, and while and for loops whose
+//   condition is a literal other than True, which never run their bodies,
+// - assignments to variables that are never read afterwards, if their rhs has
+//   no side effects. Only variables that are used in a single frame, and so
+//   can't be shared with a closure, are considered, and only if the rhs reads
+//   such variables too.
+// Evaluation results are the same. Programs for which MayPrintClosures holds
+// are left unchanged.
+//
+// pgm is changed by variable name, so it mustn't be annotated with
+// AnnotateSource or ResolveVariables yet.
+void EliminateDeadCode(Program* pgm, DeadCodeStats* stats);
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_DEAD_CODE_H_
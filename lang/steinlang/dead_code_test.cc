@@ -0,0 +1,65 @@
+#include "lang/steinlang/dead_code.h"
+
+#include "lang/steinlang/optimization_test_util.h"
+
+namespace steinlang {
+namespace {
+
+const std::vector<RewriteTest> kTests = {
+    {"removes statements after a return",
+     "def f() { return 1; print 2; } print f();",
+     "def f() { return 1; } print f();"},
+    {"removes statements after a return in the taken branch",
+     "def f() { if True { return 1; } else { print 3; } print 2; }"
+     "print f();",
+     "def f() { return 1; } print f();"},
+    {"replaces an if with the taken branch",
+     "if False { print 1; } else { print 2; }", "print 2;"},
+    {"removes a while loop that never runs",
+     "while False { print 1; } print 2;", "print 2;"},
+    {"keeps the init of a for loop that never runs",
+     "def p(a) { print a; return a; }"
+     "for i = p(1); False; i = i + 1; { print i; } print i;",
+     "def p(a) { print a; return a; } i = p(1); print i;"},
+    {"removes a dead store", "x = 1; x = 2; print x;", "x = 2; print x;"},
+    {"removes a dead store with a safe divisor",
+     "z = 4; x = z / 2; x = 2; print x;", "x = 2; print x;"},
+    {"removes a dead store in a loop",
+     "i = 0; while i < 2 { y = i; i = i + 1; }",
+     "i = 0; while i < 2 { i = i + 1; }"},
+    {"removes a dead store in a lambda",
+     "def f() { y = 1; y = 2; return y; } print f();",
+     "def f() { y = 2; return y; } print f();"},
+    {"leaves a dead store with a call",
+     "def p(a) { print a; return a; } x = p(1); x = 2; print x;", nullptr},
+    {"leaves a dead store that may trap",
+     "z = 0; x = 5 / z; x = 2; print x;", nullptr, /*traps=*/true},
+    {"leaves a dead store that divides by a variable",
+     "z = 0 - 1; x = 5 / z; x = 2; print x;", nullptr},
+    {"leaves a store read later in the loop",
+     "x = 0; i = 0; while i < 2 { print x; x = i; i = i + 1; }", nullptr},
+    {"leaves a store to a variable that a closure reads",
+     "x = 1; def f() { return x; } print f(); x = 2;", nullptr},
+    // Calling f binds its parameter to the top-level x.
+    {"leaves a store to a variable that's also a parameter",
+     "x = 1; def f(x) { return x; } x = 2; print f(5);", nullptr},
+    {"leaves a store to a variable assigned in a lambda",
+     "y = 0; def f() { y = 1; return 0; } print f(); print y;", nullptr},
+    {"leaves a store that reads a shared variable",
+     "x = 1; def f() { return x; } y = x; print f();", nullptr},
+    {"leaves a program that prints a closure",
+     "def g(q) { return q; print q; } print g;", nullptr},
+};
+
+}  // namespace
+}  // namespace steinlang
+
+int main() {
+  const bool passed = steinlang::RunRewriteTests(
+      [](steinlang::Program* pgm) {
+        steinlang::DeadCodeStats stats;
+        steinlang::EliminateDeadCode(pgm, &stats);
+      },
+      steinlang::kTests);
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,176 @@
+// Compares Evaluator::Run with switch dispatch and with threaded dispatch
+// (--threaded_dispatch) on the programs named on the command line. Where the
+// kernel exposes hardware performance counters, it also reports branch misses,
+// which is what threaded dispatch is meant to reduce.
+//
+// Example:
+// dispatch_benchmark lang/steinlang/pgms/*.stein.txt
+
+#include <gflags/gflags.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "lang/steinlang/language_evaluation.h"
+#include "lang/steinlang/memory.h"
+#include "lang/steinlang/steinlang_parser.h"
+#include "util/file_io.h"
+
+DECLARE_bool(threaded_dispatch);
+
+DEFINE_int32(repetitions, 5,
+             "Run each program this many times per dispatch mode, and report "
+             "the fastest run.");
+DEFINE_int64(steps_per_run, 4096, "Budget for each call to Evaluator::Run.");
+
+namespace steinlang {
+namespace {
+
+// Counts a hardware event of this thread in user space, if the kernel allows
+// it.
+class HardwareCounter {
+ public:
+  explicit HardwareCounter(uint64_t config) {
+#ifdef __linux__
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd_ = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+  }
+
+  ~HardwareCounter() {
+#ifdef __linux__
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+#endif
+  }
+
+  HardwareCounter(const HardwareCounter&) = delete;
+  HardwareCounter& operator=(const HardwareCounter&) = delete;
+
+  bool available() const { return fd_ >= 0; }
+
+  void Start() {
+#ifdef __linux__
+    if (available()) {
+      ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  }
+
+  // The count since Start(), or -1 if the counter isn't available.
+  int64_t Stop() {
+    int64_t count = -1;
+#ifdef __linux__
+    if (available()) {
+      ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+      if (read(fd_, &count, sizeof(count)) != sizeof(count)) {
+        count = -1;
+      }
+    }
+#endif
+    return count;
+  }
+
+ private:
+  int fd_ = -1;
+};
+
+struct Measurement {
+  int64_t steps = 0;
+  double us = std::numeric_limits<double>::max();
+  int64_t branches = -1;
+  int64_t branch_misses = -1;
+};
+
+Measurement RunProgram(const Program& pgm) {
+#ifdef __linux__
+  HardwareCounter branches(PERF_COUNT_HW_BRANCH_INSTRUCTIONS);
+  HardwareCounter branch_misses(PERF_COUNT_HW_BRANCH_MISSES);
+#else
+  HardwareCounter branches(0);
+  HardwareCounter branch_misses(0);
+#endif
+  Measurement best;
+  for (int i = 0; i < FLAGS_repetitions; ++i) {
+    PoolingArenaAllocator allocator;
+    EvalContext* ctx = allocator.AllocateEvalContext();
+    InitEvalContext(pgm, ctx);
+    Evaluator evaluator(ctx, &allocator);
+
+    Measurement m;
+    auto start = std::chrono::steady_clock::now();
+    branches.Start();
+    branch_misses.Start();
+    RunStatus status;
+    do {
+      status = evaluator.Run(FLAGS_steps_per_run);
+      m.steps += status.steps;
+      evaluator.consume_output();
+    } while (status.reason == StopReason::kBudgetExhausted);
+    m.branch_misses = branch_misses.Stop();
+    m.branches = branches.Stop();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    m.us = std::chrono::duration<double, std::micro>(elapsed).count();
+    if (m.us < best.us) {
+      best = m;
+    }
+  }
+  return best;
+}
+
+void Print(const char* mode, const Measurement& m) {
+  printf("  %-8s %10lld steps %10.0f us %8.1f ns/step", mode,
+         static_cast<long long>(m.steps), m.us, 1000 * m.us / m.steps);
+  if (m.branch_misses >= 0 && m.branches > 0) {
+    printf(" %8.3f branch misses/step (%.2f%% of branches)",
+           static_cast<double>(m.branch_misses) / m.steps,
+           100.0 * m.branch_misses / m.branches);
+  }
+  printf("\n");
+}
+
+}  // namespace
+}  // namespace steinlang
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (!STEINLANG_COMPUTED_GOTO) {
+    printf("built without computed goto; both modes use switch dispatch.\n");
+  }
+  if (!steinlang::HardwareCounter(0).available()) {
+    printf("hardware counters unavailable; branch misses aren't reported.\n");
+  }
+  for (int i = 1; i < argc; ++i) {
+    steinlang::Program pgm;
+    if (!steinlang::ParseProgram(util::ReadFileToString(argv[i]), &pgm)) {
+      printf("%s: failed to parse.\n", argv[i]);
+      continue;
+    }
+    printf("%s:\n", argv[i]);
+    FLAGS_threaded_dispatch = false;
+    steinlang::Print("switch", steinlang::RunProgram(pgm));
+    FLAGS_threaded_dispatch = true;
+    steinlang::Print("threaded", steinlang::RunProgram(pgm));
+  }
+  return 0;
+}
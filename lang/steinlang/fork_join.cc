@@ -0,0 +1,140 @@
+#include "lang/steinlang/fork_join.h"
+
+#include <gflags/gflags.h>
+#include <algorithm>
+#include <sstream>
+
+DEFINE_int32(threads, 1,
+             "Number of threads to evaluate independent pure calls on in "
+             "parallel. 1 evaluates everything on the calling thread.");
+
+namespace steinlang {
+
+namespace {
+
+// The pool and deque of the calling thread, if it's a worker.
+thread_local const ForkJoinPool* current_pool = nullptr;
+thread_local int current_deque = 0;
+
+}  // namespace
+
+std::string ForkStats::DebugString() const {
+  std::ostringstream out;
+  out << "fork-join: " << forks << " forks of " << calls << " calls, "
+      << steps << " steps in forked calls";
+  return out.str();
+}
+
+ForkJoinPool::ForkJoinPool(int num_threads) {
+  for (int i = 0; i < std::max(num_threads, 1); ++i) {
+    deques_.push_back(std::make_unique<Deque>());
+  }
+  const int num_deques = deques_.size();
+  for (int i = 1; i < num_deques; ++i) {
+    workers_.emplace_back([this, i] { Work(i); });
+  }
+}
+
+ForkJoinPool::~ForkJoinPool() {
+  {
+    std::lock_guard<std::mutex> lock(idle_mu_);
+    stop_ = true;
+  }
+  idle_cv_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+ForkJoinPool* ForkJoinPool::Default() {
+  static ForkJoinPool* pool =
+      FLAGS_threads > 1 ? new ForkJoinPool(FLAGS_threads) : nullptr;
+  return pool;
+}
+
+int ForkJoinPool::ThisDeque() const {
+  return current_pool == this ? current_deque : 0;
+}
+
+void ForkJoinPool::Invoke(std::vector<std::function<void()>> tasks) {
+  if (tasks.empty()) {
+    return;
+  }
+  std::atomic<int> pending(tasks.size());
+  const int self = ThisDeque();
+  if (tasks.size() > 1) {
+    {
+      std::lock_guard<std::mutex> lock(deques_[self]->mu);
+      for (size_t i = 1; i < tasks.size(); ++i) {
+        deques_[self]->tasks.push_back({std::move(tasks[i]), &pending});
+      }
+    }
+    queued_ += tasks.size() - 1;
+    // Taking the lock orders this with a worker deciding to sleep.
+    { std::lock_guard<std::mutex> lock(idle_mu_); }
+    idle_cv_.notify_all();
+  }
+  Task first = {std::move(tasks[0]), &pending};
+  RunTask(&first);
+  // Help out until the forked tasks are done, with them if they haven't been
+  // stolen, or else with others.
+  while (pending.load() > 0) {
+    Task task;
+    if (Take(self, &task)) {
+      RunTask(&task);
+    } else {
+      std::this_thread::yield();
+    }
+  }
+}
+
+bool ForkJoinPool::Take(int i, Task* task) {
+  {
+    Deque& own = *deques_[i];
+    std::lock_guard<std::mutex> lock(own.mu);
+    if (!own.tasks.empty()) {
+      *task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      --queued_;
+      return true;
+    }
+  }
+  const int num_deques = deques_.size();
+  for (int j = 1; j < num_deques; ++j) {
+    Deque& victim = *deques_[(i + j) % num_deques];
+    std::lock_guard<std::mutex> lock(victim.mu);
+    if (!victim.tasks.empty()) {
+      *task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      --queued_;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ForkJoinPool::RunTask(Task* task) {
+  task->fn();
+  // The forking thread may return from Invoke as soon as this reaches 0, so
+  // it's the last use of task->pending.
+  --*task->pending;
+}
+
+void ForkJoinPool::Work(int i) {
+  current_pool = this;
+  current_deque = i;
+  while (true) {
+    Task task;
+    if (Take(i, &task)) {
+      RunTask(&task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(idle_mu_);
+    idle_cv_.wait(lock, [this] { return stop_ || queued_.load() > 0; });
+    if (stop_) {
+      return;
+    }
+  }
+}
+
+}  // namespace steinlang
@@ -0,0 +1,88 @@
+// A work-stealing thread pool for fork-join parallelism. Each thread has a
+// deque of tasks: it pushes the tasks it forks onto the back of its own deque
+// and pops them from there, newest first, while idle threads steal the oldest
+// task from the front of another thread's deque, which in divide-and-conquer
+// code is the largest one.
+
+#ifndef LANG_STEINLANG_FORK_JOIN_H_
+#define LANG_STEINLANG_FORK_JOIN_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace steinlang {
+
+struct ForkStats {
+  // Forks, and the calls they evaluated in parallel.
+  int64_t forks = 0;
+  int64_t calls = 0;
+  // Steps evaluated by forked calls, including those of nested forks.
+  int64_t steps = 0;
+
+  std::string DebugString() const;
+};
+
+class ForkJoinPool {
+ public:
+  // Runs tasks on num_threads threads: the threads that call Invoke, and
+  // num_threads - 1 workers.
+  explicit ForkJoinPool(int num_threads);
+  ~ForkJoinPool();
+
+  ForkJoinPool(const ForkJoinPool&) = delete;
+  ForkJoinPool& operator=(const ForkJoinPool&) = delete;
+
+  // The pool of --threads threads, or nullptr if --threads is 1 or less.
+  static ForkJoinPool* Default();
+
+  int num_threads() const { return deques_.size(); }
+
+  // Run tasks in parallel, and return once all of them have finished. The
+  // calling thread runs tasks too while it waits, so tasks may fork tasks of
+  // their own.
+  void Invoke(std::vector<std::function<void()>> tasks);
+
+ private:
+  struct Task {
+    std::function<void()> fn;
+    // The number of unfinished tasks of the Invoke that forked this one.
+    std::atomic<int>* pending;
+  };
+
+  struct Deque {
+    std::mutex mu;
+    std::deque<Task> tasks;
+  };
+
+  // The deque of the calling thread. Threads other than the workers share
+  // deques_[0].
+  int ThisDeque() const;
+
+  // Pop a task from deque i, or steal one from another deque. Returns false
+  // if there are none.
+  bool Take(int i, Task* task);
+
+  void RunTask(Task* task);
+
+  void Work(int i);
+
+  std::vector<std::unique_ptr<Deque>> deques_;
+  std::vector<std::thread> workers_;
+  // The number of tasks in all deques. Idle workers sleep until it's nonzero.
+  std::atomic<int> queued_{0};
+  std::mutex idle_mu_;
+  std::condition_variable idle_cv_;
+  bool stop_ = false;
+};
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_FORK_JOIN_H_
@@ -0,0 +1,39 @@
+#include "lang/steinlang/garbage_collection.h"
+
+#include <gflags/gflags.h>
+#include <algorithm>
+#include <sstream>
+
+DEFINE_int64(gc_min_store_size, 64 * 1024,
+             "Don't garbage collect the store until it holds at least this "
+             "many literals. 0 disables store garbage collection.");
+DEFINE_double(gc_growth_factor, 2.0,
+              "After a garbage collection, collect the store again once it "
+              "grows to this multiple of the live literals.");
+
+namespace steinlang {
+
+std::string GcStats::DebugString() const {
+  std::ostringstream out;
+  out << "store gc: " << collections << " collections, " << reclaimed
+      << " literals reclaimed, total pause " << total_pause_us
+      << " us, max pause " << max_pause_us << " us";
+  return out.str();
+}
+
+bool GcSchedule::enabled() const { return FLAGS_gc_min_store_size > 0; }
+
+bool GcSchedule::ShouldCollect(int64_t store_size) const {
+  return enabled() &&
+         store_size >= std::max(next_collection_, FLAGS_gc_min_store_size);
+}
+
+void GcSchedule::Record(int64_t store_size, int64_t live, int64_t pause_us) {
+  ++stats_.collections;
+  stats_.reclaimed += store_size - live;
+  stats_.total_pause_us += pause_us;
+  stats_.max_pause_us = std::max(stats_.max_pause_us, pause_us);
+  next_collection_ = static_cast<int64_t>(live * FLAGS_gc_growth_factor);
+}
+
+}  // namespace steinlang
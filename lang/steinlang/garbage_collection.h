@@ -0,0 +1,184 @@
+// Mark-and-compact garbage collection for the store of values that variables
+// are bound to. Closures refer to store addresses through their captures, so
+// those are traced, and rewritten once live values have been moved.
+
+#ifndef LANG_STEINLANG_GARBAGE_COLLECTION_H_
+#define LANG_STEINLANG_GARBAGE_COLLECTION_H_
+
+#include <stdint.h>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "lang/steinlang/steinlang_syntax.pb.h"
+
+namespace steinlang {
+
+// Call f(addr) for every store address captured by closures in lit.
+template <typename F>
+void ForEachCapture(const Literal& lit, F f) {
+  if (lit.has_closure_val()) {
+    for (int64_t addr : lit.closure_val().capture()) {
+      f(addr);
+    }
+  } else if (lit.has_tuple_val()) {
+    for (const Literal& elem : lit.tuple_val().elem()) {
+      ForEachCapture(elem, f);
+    }
+  }
+}
+
+// Replace every store address addr captured by closures in lit with f(addr).
+template <typename F>
+void ForwardCaptures(Literal* lit, F f) {
+  if (lit->has_closure_val()) {
+    for (int64_t& addr : *lit->mutable_closure_val()->mutable_capture()) {
+      addr = f(addr);
+    }
+  } else if (lit->has_tuple_val()) {
+    for (Literal& elem : *lit->mutable_tuple_val()->mutable_elem()) {
+      ForwardCaptures(&elem, f);
+    }
+  }
+}
+
+// One collection of a store of T, which is Literal or Value. Usage:
+//
+// StoreCollector<T> gc(store_size, get);
+// for each root address: gc.MarkAddress(addr);
+// for each root value: gc.MarkValue(value);
+// live = gc.Compact();
+// gc.Forward() every root address and value, then truncate the store to live.
+template <typename T>
+class StoreCollector {
+ public:
+  // get(addr) returns the value at store address addr.
+  StoreCollector(int64_t store_size, std::function<T*(int64_t)> get)
+      : get_(std::move(get)), forward_(store_size, kDead) {}
+
+  StoreCollector(const StoreCollector&) = delete;
+  StoreCollector& operator=(const StoreCollector&) = delete;
+
+  // Mark addr and everything reachable from it as live. Negative addresses
+  // (unbound slots) are ignored.
+  void MarkAddress(int64_t addr) {
+    Push(addr);
+    Trace();
+  }
+
+  // Mark everything reachable from closures in value as live.
+  void MarkValue(const T& value) {
+    ForEachCapture(value, [this](int64_t addr) { Push(addr); });
+    Trace();
+  }
+
+  // Move the live values to the front of the store, preserving their order,
+  // and rewrite the captures of the live closures in the store.
+  // Returns the number of live values. The store can be truncated to that
+  // size once the roots have been forwarded.
+  int64_t Compact() {
+    int64_t live = 0;
+    const int64_t store_size = forward_.size();
+    for (int64_t addr = 0; addr < store_size; ++addr) {
+      if (forward_[addr] != kMarked) {
+        continue;
+      }
+      if (live != addr) {
+        using std::swap;
+        swap(*get_(live), *get_(addr));
+      }
+      forward_[addr] = live++;
+    }
+    for (int64_t addr = 0; addr < live; ++addr) {
+      Forward(get_(addr));
+    }
+    return live;
+  }
+
+  // The new address of a live address. Negative addresses stay unbound.
+  int64_t Forward(int64_t addr) const {
+    return addr < 0 ? addr : forward_[addr];
+  }
+
+  void Forward(int64_t* addr) const { *addr = Forward(*addr); }
+
+  // Rewrite the captures of closures in value.
+  void Forward(T* value) const {
+    ForwardCaptures(value, [this](int64_t addr) { return Forward(addr); });
+  }
+
+ private:
+  static constexpr int64_t kDead = -1;
+  static constexpr int64_t kMarked = -2;
+
+  // Mark addr, to be traced by Trace().
+  void Push(int64_t addr) {
+    if (addr >= 0 && forward_[addr] != kMarked) {
+      forward_[addr] = kMarked;
+      worklist_.push_back(addr);
+    }
+  }
+
+  // Mark everything reachable from the pushed addresses.
+  void Trace() {
+    while (!worklist_.empty()) {
+      const int64_t addr = worklist_.back();
+      worklist_.pop_back();
+      ForEachCapture(*get_(addr), [this](int64_t addr) { Push(addr); });
+    }
+  }
+
+  std::function<T*(int64_t)> get_;
+  // Before Compact(): kDead or kMarked. After: new address, or kDead.
+  std::vector<int64_t> forward_;
+  std::vector<int64_t> worklist_;
+};
+
+template <typename T>
+constexpr int64_t StoreCollector<T>::kDead;
+template <typename T>
+constexpr int64_t StoreCollector<T>::kMarked;
+
+struct GcStats {
+  int64_t collections = 0;
+  int64_t reclaimed = 0;
+  int64_t total_pause_us = 0;
+  int64_t max_pause_us = 0;
+
+  std::string DebugString() const;
+};
+
+// Decides when a store should be collected, per --gc_min_store_size and
+// --gc_growth_factor, and keeps statistics of the collections.
+class GcSchedule {
+ public:
+  // False if collection is disabled by --gc_min_store_size.
+  bool enabled() const;
+
+  bool ShouldCollect(int64_t store_size) const;
+
+  // Run collect(), which returns the number of live literals left in the
+  // store, and record its statistics.
+  template <typename F>
+  void Collect(int64_t store_size, F collect) {
+    auto start = std::chrono::steady_clock::now();
+    const int64_t live = collect();
+    auto pause = std::chrono::steady_clock::now() - start;
+    Record(store_size, live,
+           std::chrono::duration_cast<std::chrono::microseconds>(pause).count());
+  }
+
+  const GcStats& stats() const { return stats_; }
+
+ private:
+  void Record(int64_t store_size, int64_t live, int64_t pause_us);
+
+  // Collect once the store grows past this size; 0 means use the minimum.
+  int64_t next_collection_ = 0;
+  GcStats stats_;
+};
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_GARBAGE_COLLECTION_H_
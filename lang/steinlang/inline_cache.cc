@@ -0,0 +1,15 @@
+#include "lang/steinlang/inline_cache.h"
+
+#include <sstream>
+
+namespace steinlang {
+
+std::string InlineCacheStats::DebugString() const {
+  std::ostringstream out;
+  out << "inline caches: " << hits << " hits, " << misses << " misses, "
+      << monomorphic_sites << " monomorphic, " << polymorphic_sites
+      << " polymorphic and " << megamorphic_sites << " megamorphic call sites";
+  return out.str();
+}
+
+}  // namespace steinlang
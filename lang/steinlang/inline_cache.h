@@ -0,0 +1,103 @@
+// Inline caches for function application. Each call site, identified by the
+// Origin.source_id of its FuncAppExpression, remembers the closures it has
+// called and what they resolved to, so that calling one of them again skips
+// resolving the callee. A site with one cached callee is monomorphic, and one
+// with up to kMaxTargets is polymorphic. A site that calls more distinct
+// callees than that is megamorphic, and stops caching new ones.
+
+#ifndef LANG_STEINLANG_INLINE_CACHE_H_
+#define LANG_STEINLANG_INLINE_CACHE_H_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace steinlang {
+
+struct InlineCacheStats {
+  int64_t hits = 0;
+  int64_t misses = 0;
+  int64_t monomorphic_sites = 0;
+  int64_t polymorphic_sites = 0;
+  int64_t megamorphic_sites = 0;
+
+  std::string DebugString() const;
+};
+
+// Target is what a callee resolves to, e.g. the compiled Function.
+// Callees are identified by the lambda_id of their closure.
+template <typename Target>
+class InlineCache {
+ public:
+  static constexpr int kMaxTargets = 4;
+
+  InlineCache() = default;
+  InlineCache(const InlineCache&) = delete;
+  InlineCache& operator=(const InlineCache&) = delete;
+
+  // The cached target of callee at the call site site_id, or nullptr on a
+  // miss.
+  const Target* Lookup(int64_t site_id, int64_t callee) {
+    if (static_cast<size_t>(site_id) < sites_.size()) {
+      const Site& site = sites_[site_id];
+      for (int i = 0; i < site.size; ++i) {
+        if (site.callee[i] == callee) {
+          ++hits_;
+          return &site.target[i];
+        }
+      }
+    }
+    ++misses_;
+    return nullptr;
+  }
+
+  // Cache target for callee at the call site site_id, after a miss.
+  void Insert(int64_t site_id, int64_t callee, const Target& target) {
+    if (static_cast<size_t>(site_id) >= sites_.size()) {
+      sites_.resize(site_id + 1);
+    }
+    Site& site = sites_[site_id];
+    if (site.size == kMaxTargets) {
+      site.megamorphic = true;
+      return;
+    }
+    site.callee[site.size] = callee;
+    site.target[site.size] = target;
+    ++site.size;
+  }
+
+  InlineCacheStats stats() const {
+    InlineCacheStats stats;
+    stats.hits = hits_;
+    stats.misses = misses_;
+    for (const Site& site : sites_) {
+      if (site.megamorphic) {
+        ++stats.megamorphic_sites;
+      } else if (site.size > 1) {
+        ++stats.polymorphic_sites;
+      } else if (site.size == 1) {
+        ++stats.monomorphic_sites;
+      }
+    }
+    return stats;
+  }
+
+ private:
+  struct Site {
+    int size = 0;
+    bool megamorphic = false;
+    int64_t callee[kMaxTargets];
+    Target target[kMaxTargets];
+  };
+
+  std::vector<Site> sites_;
+  int64_t hits_ = 0;
+  int64_t misses_ = 0;
+};
+
+template <typename Target>
+constexpr int InlineCache<Target>::kMaxTargets;
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_INLINE_CACHE_H_
@@ -0,0 +1,307 @@
+#include "lang/steinlang/inlining.h"
+
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "lang/steinlang/program_analysis.h"
+
+namespace steinlang {
+
+namespace {
+
+// True if exp has no calls or lambdas. If params isn't nullptr, exp may also
+// only use the variables in it.
+bool IsPure(const Expression& exp,
+            const std::unordered_set<std::string>* params) {
+  switch (exp.type_case()) {
+    case Expression::kVarExp:
+      return params == nullptr || params->count(exp.var_exp().name()) > 0;
+    case Expression::kLitExp:
+      return true;
+    case Expression::kMonArithExp:
+      return IsPure(exp.mon_arith_exp().exp(), params);
+    case Expression::kBinArithExp:
+      return IsPure(exp.bin_arith_exp().lhs(), params) &&
+             IsPure(exp.bin_arith_exp().rhs(), params);
+    case Expression::kTernExp:
+      return IsPure(exp.tern_exp().if_exp(), params) &&
+             IsPure(exp.tern_exp().cond_exp(), params) &&
+             IsPure(exp.tern_exp().else_exp(), params);
+    case Expression::kTupleExp:
+      for (const Expression& e : exp.tuple_exp().exp()) {
+        if (!IsPure(e, params)) {
+          return false;
+        }
+      }
+      return true;
+    case Expression::kFuncAppExp:
+    case Expression::kLambdaExp:
+    case Expression::TYPE_NOT_SET:
+      return false;
+  }
+  return false;
+}
+
+// The number of nodes in a pure expression.
+int Size(const Expression& exp) {
+  switch (exp.type_case()) {
+    case Expression::kMonArithExp:
+      return 1 + Size(exp.mon_arith_exp().exp());
+    case Expression::kBinArithExp:
+      return 1 + Size(exp.bin_arith_exp().lhs()) +
+             Size(exp.bin_arith_exp().rhs());
+    case Expression::kTernExp:
+      return 1 + Size(exp.tern_exp().if_exp()) +
+             Size(exp.tern_exp().cond_exp()) + Size(exp.tern_exp().else_exp());
+    case Expression::kTupleExp: {
+      int size = 1;
+      for (const Expression& e : exp.tuple_exp().exp()) {
+        size += Size(e);
+      }
+      return size;
+    }
+    default:
+      return 1;
+  }
+}
+
+// Replace the parameters in a pure expression with their arguments.
+void Substitute(const std::unordered_map<std::string, const Expression*>& args,
+                Expression* exp) {
+  switch (exp->type_case()) {
+    case Expression::kVarExp:
+      *exp = *args.at(exp->var_exp().name());
+      break;
+    case Expression::kMonArithExp:
+      Substitute(args, exp->mutable_mon_arith_exp()->mutable_exp());
+      break;
+    case Expression::kBinArithExp:
+      Substitute(args, exp->mutable_bin_arith_exp()->mutable_lhs());
+      Substitute(args, exp->mutable_bin_arith_exp()->mutable_rhs());
+      break;
+    case Expression::kTernExp:
+      Substitute(args, exp->mutable_tern_exp()->mutable_if_exp());
+      Substitute(args, exp->mutable_tern_exp()->mutable_cond_exp());
+      Substitute(args, exp->mutable_tern_exp()->mutable_else_exp());
+      break;
+    case Expression::kTupleExp:
+      for (Expression& e : *exp->mutable_tuple_exp()->mutable_exp()) {
+        Substitute(args, &e);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+class Inliner {
+ public:
+  Inliner(int max_size, InliningStats* stats)
+      : max_size_(max_size), stats_(stats) {}
+
+  void Inline(Program* pgm) {
+    const Assignments assignments = CollectAssignments(*pgm);
+    for (const Statement& stmt : pgm->stmt()) {
+      CollectFrameNames(stmt, &top_level_names_);
+    }
+    // A top-level statement runs exactly once, before the statements after
+    // it, so from then on, a variable that it assigns and that is never
+    // assigned again is constant.
+    for (Statement& stmt : *pgm->mutable_stmt()) {
+      Inline(&stmt);
+      if (!stmt.has_assign_stmt() || !stmt.assign_stmt().lhs().has_var_exp()) {
+        continue;
+      }
+      const std::string& name = stmt.assign_stmt().lhs().var_exp().name();
+      if (!assignments.AssignedOnce(name)) {
+        continue;
+      }
+      constants_.insert(name);
+      if (stmt.assign_stmt().rhs().has_lambda_exp() &&
+          IsInlinable(stmt.assign_stmt().rhs().lambda_exp())) {
+        callees_[name] = stmt.assign_stmt().rhs().lambda_exp();
+      }
+    }
+  }
+
+ private:
+  bool IsInlinable(const LambdaExpression& lambda_exp) const {
+    if (lambda_exp.body_size() != 1 || !lambda_exp.body(0).has_ret_stmt()) {
+      return false;
+    }
+    std::unordered_set<std::string> params;
+    for (const Variable& param : lambda_exp.param()) {
+      // If the top-level frame binds a variable with the parameter's name, the
+      // closure shares it, and calling the closure assigns to it.
+      if (!params.insert(param.name()).second ||
+          top_level_names_.count(param.name())) {
+        return false;
+      }
+    }
+    const Expression& body = lambda_exp.body(0).ret_stmt();
+    return IsPure(body, &params) && Size(body) <= max_size_;
+  }
+
+  // True if exp evaluates to a variable reference only for constant
+  // variables. A call always returns an rvalue, so an inlined body may only
+  // return a variable reference that is dereferenced to the same value no
+  // matter when that happens.
+  bool IsConstantIfLvalue(const Expression& exp) const {
+    switch (exp.type_case()) {
+      case Expression::kVarExp:
+        return constants_.count(exp.var_exp().name()) > 0;
+      case Expression::kTernExp:
+        return IsConstantIfLvalue(exp.tern_exp().if_exp()) &&
+               IsConstantIfLvalue(exp.tern_exp().else_exp());
+      default:
+        return true;
+    }
+  }
+
+  void Inline(Statement* stmt) {
+    switch (stmt->type_case()) {
+      case Statement::kExpStmt:
+        Inline(stmt->mutable_exp_stmt());
+        break;
+      case Statement::kAssignStmt:
+        Inline(stmt->mutable_assign_stmt()->mutable_rhs());
+        break;
+      case Statement::kRetStmt:
+        Inline(stmt->mutable_ret_stmt());
+        break;
+      case Statement::kPrintStmt:
+        Inline(stmt->mutable_print_stmt());
+        break;
+      case Statement::kIfElseStmt: {
+        IfElseStatement* if_else_stmt = stmt->mutable_if_else_stmt();
+        Inline(if_else_stmt->mutable_cond());
+        for (Statement& s : *if_else_stmt->mutable_if_stmts()) {
+          Inline(&s);
+        }
+        for (Statement& s : *if_else_stmt->mutable_else_stmts()) {
+          Inline(&s);
+        }
+        break;
+      }
+      case Statement::kWhileStmt:
+        Inline(stmt->mutable_while_stmt()->mutable_cond());
+        for (Statement& s : *stmt->mutable_while_stmt()->mutable_body()) {
+          Inline(&s);
+        }
+        break;
+      case Statement::kForStmt: {
+        ForStatement* for_stmt = stmt->mutable_for_stmt();
+        Inline(for_stmt->mutable_init());
+        Inline(for_stmt->mutable_cond());
+        Inline(for_stmt->mutable_inc());
+        for (Statement& s : *for_stmt->mutable_body()) {
+          Inline(&s);
+        }
+        break;
+      }
+      case Statement::TYPE_NOT_SET:
+        break;
+    }
+  }
+
+  void Inline(Expression* exp) {
+    switch (exp->type_case()) {
+      case Expression::kFuncAppExp:
+        Inline(exp->mutable_func_app_exp()->mutable_func());
+        for (Expression& arg : *exp->mutable_func_app_exp()->mutable_arg()) {
+          Inline(&arg);
+        }
+        InlineCall(exp);
+        break;
+      case Expression::kMonArithExp:
+        Inline(exp->mutable_mon_arith_exp()->mutable_exp());
+        break;
+      case Expression::kBinArithExp:
+        Inline(exp->mutable_bin_arith_exp()->mutable_lhs());
+        Inline(exp->mutable_bin_arith_exp()->mutable_rhs());
+        break;
+      case Expression::kTernExp:
+        Inline(exp->mutable_tern_exp()->mutable_if_exp());
+        Inline(exp->mutable_tern_exp()->mutable_cond_exp());
+        Inline(exp->mutable_tern_exp()->mutable_else_exp());
+        break;
+      case Expression::kTupleExp:
+        for (Expression& e : *exp->mutable_tuple_exp()->mutable_exp()) {
+          Inline(&e);
+        }
+        break;
+      case Expression::kLambdaExp:
+        for (Statement& s : *exp->mutable_lambda_exp()->mutable_body()) {
+          Inline(&s);
+        }
+        break;
+      case Expression::kVarExp:
+      case Expression::kLitExp:
+      case Expression::TYPE_NOT_SET:
+        break;
+    }
+  }
+
+  void InlineCall(Expression* exp) {
+    const FuncAppExpression& func_app_exp = exp->func_app_exp();
+    if (!func_app_exp.func().has_var_exp()) {
+      return;
+    }
+    auto callee_it = callees_.find(func_app_exp.func().var_exp().name());
+    if (callee_it == callees_.end()) {
+      return;
+    }
+    const LambdaExpression& lambda_exp = callee_it->second;
+    if (func_app_exp.arg_size() != lambda_exp.param_size()) {
+      return;
+    }
+    std::unordered_map<std::string, const Expression*> args;
+    for (int i = 0; i < lambda_exp.param_size(); ++i) {
+      // An argument that's dropped, e.g. because its parameter is unused,
+      // mustn't take a trap with it.
+      if (!IsPure(func_app_exp.arg(i), nullptr) ||
+          HasSideEffects(func_app_exp.arg(i))) {
+        return;
+      }
+      args[lambda_exp.param(i).name()] = &func_app_exp.arg(i);
+    }
+    Expression inlined = lambda_exp.body(0).ret_stmt();
+    Substitute(args, &inlined);
+    if (!IsConstantIfLvalue(inlined)) {
+      return;
+    }
+    exp->Swap(&inlined);
+    ++stats_->inlined_calls;
+  }
+
+  const int max_size_;
+  InliningStats* stats_;
+  // Names that the top-level frame reads or assigns.
+  std::unordered_set<std::string> top_level_names_;
+  // Variables that are constant from the current top-level statement on.
+  std::unordered_set<std::string> constants_;
+  // The inlinable lambdas that constant variables are bound to.
+  std::unordered_map<std::string, LambdaExpression> callees_;
+};
+
+}  // namespace
+
+std::string InliningStats::DebugString() const {
+  if (prints_closures) {
+    return "inlining: skipped, the program may print closures";
+  }
+  std::ostringstream out;
+  out << "inlining: " << inlined_calls << " calls inlined";
+  return out.str();
+}
+
+void InlineLambdas(Program* pgm, int max_size, InliningStats* stats) {
+  if (MayPrintClosures(*pgm)) {
+    stats->prints_closures = true;
+    return;
+  }
+  Inliner(max_size, stats).Inline(pgm);
+}
+
+}  // namespace steinlang
@@ -0,0 +1,41 @@
+// Inlining of small lambdas at their call sites, before the program is
+// annotated and evaluated.
+
+#ifndef LANG_STEINLANG_INLINING_H_
+#define LANG_STEINLANG_INLINING_H_
+
+#include <stdint.h>
+#include <string>
+
+#include "lang/steinlang/steinlang_syntax.pb.h"
+
+namespace steinlang {
+
+struct InliningStats {
+  int64_t inlined_calls = 0;
+  // True if the program was left unchanged because it may print a closure.
+  bool prints_closures = false;
+
+  std::string DebugString() const;
+};
+
+// Replace calls f(a, b, ...) with the body of f, with its parameters replaced
+// by the arguments, when:
+// - f is a variable assigned exactly once, by a top-level statement before the
+//   call, to a lambda whose body is a single return statement,
+// - that returned expression only uses the lambda's parameters and literals,
+//   and has no calls, so it's not recursive and has no side effects,
+// - it has at most max_size nodes,
+// - the arguments have no calls either, and no divisions that may trap, so
+//   evaluating them in a different order, more than once or not at all
+//   doesn't change the result.
+// Evaluation results are the same. Calls in assignment lhs aren't inlined, and
+// programs for which MayPrintClosures holds are left unchanged.
+//
+// pgm is changed by variable name, so it mustn't be annotated with
+// AnnotateSource or ResolveVariables yet.
+void InlineLambdas(Program* pgm, int max_size, InliningStats* stats);
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_INLINING_H_
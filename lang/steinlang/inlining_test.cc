@@ -0,0 +1,60 @@
+#include "lang/steinlang/inlining.h"
+
+#include "lang/steinlang/optimization_test_util.h"
+
+namespace steinlang {
+namespace {
+
+const std::vector<RewriteTest> kTests = {
+    {"inlines a small lambda",
+     "def add(a, b) { return a + b; } print add(1, 2);",
+     "def add(a, b) { return a + b; } print 1 + 2;"},
+    {"inlines into later lambdas",
+     "def inc(a) { return a + 1; } f = lambda x: inc(x); print f(1);",
+     "def inc(a) { return a + 1; } f = lambda x: x + 1; print 1 + 1;"},
+    {"drops an argument with a safe divisor",
+     "def k(a, b) { return a; } z = 4; print k(1, z / 2);",
+     "def k(a, b) { return a; } z = 4; print 1;"},
+    {"leaves a trapping argument to an unused parameter",
+     "def k(a, b) { return a; } z = 0; print k(1, 5 / z); print 7;", nullptr,
+     /*traps=*/true},
+    {"leaves a trapping argument to an untaken branch",
+     "def pick(c, a, b) { return a if c else b; } z = 0;"
+     "print pick(True, 1, 5 / z);",
+     nullptr, /*traps=*/true},
+    {"leaves an argument with a call",
+     "def p(a) { print a; return a; } def k(a, b) { return a; }"
+     "print k(1, p(2));",
+     nullptr},
+    // Calling k binds its parameter to the top-level a.
+    {"leaves a parameter named like a top-level variable",
+     "a = 5; def k(a) { return a + 1; } print k(1); print a;", nullptr},
+    {"leaves a body that reads other variables",
+     "y = 2; def k(a) { return a + y; } print k(1);", nullptr},
+    {"leaves a callee assigned twice",
+     "def k(a) { return a; } print k(1); def k(a) { return a + 1; }"
+     "print k(1);",
+     nullptr},
+    {"leaves a callee assigned in a lambda",
+     "def k(a) { return a; } def r() { k = 0; return 0; } print k(1);",
+     nullptr},
+    {"leaves calls before the assignment",
+     "def f() { return k(1); } def k(a) { return a; } print f();", nullptr},
+    {"leaves a body with more than a return",
+     "def k(a) { print a; return a; } print k(1);", nullptr},
+    {"leaves a program that prints a closure",
+     "def inc(a) { return a + 1; } g = lambda q: inc(q); print g;", nullptr},
+};
+
+}  // namespace
+}  // namespace steinlang
+
+int main() {
+  const bool passed = steinlang::RunRewriteTests(
+      [](steinlang::Program* pgm) {
+        steinlang::InliningStats stats;
+        steinlang::InlineLambdas(pgm, /*max_size=*/16, &stats);
+      },
+      steinlang::kTests);
+  return passed ? 0 : 1;
+}
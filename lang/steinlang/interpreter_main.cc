@@ -4,9 +4,14 @@
 #include <iostream>
 
 #include "absl/types/optional.h"
+#include "lang/steinlang/bytecode.h"
+#include "lang/steinlang/checkpoint.h"
 #include "lang/steinlang/language_evaluation.h"
-#include "lang/steinlang/source_util.h"
+#include "lang/steinlang/optimization.h"
+#include "lang/steinlang/resolution.h"
+#include "lang/steinlang/run_status.h"
 #include "lang/steinlang/steinlang_parser.h"
+#include "lang/steinlang/virtual_machine.h"
 #include "util/file_io.h"
 
 DEFINE_bool(debug_print_parse_trees, false, "");
@@ -15,6 +20,29 @@ DEFINE_bool(debug_print_steps, false,
             "If true, print verbose evaluation state after each step. This "
             "slows down execution significantly.");
 DEFINE_bool(debug_print_timing, false, "");
+DEFINE_bool(bytecode, true,
+            "If true, compile the program to bytecode and run it on the "
+            "virtual machine. Otherwise, evaluate it by rewriting the "
+            "EvalContext.");
+DEFINE_bool(debug_print_bytecode, false, "");
+DEFINE_int64(steps_per_run, 4096,
+             "Number of steps to evaluate between printing output and checking "
+             "memory usage. --debug_print_steps implies 1.");
+
+DEFINE_int64(checkpoint_every_steps, 0,
+             "If positive, checkpoint the evaluation state to "
+             "--checkpoint_path about every this many steps, so that it can "
+             "be resumed with --restore_from. Requires --bytecode=false.");
+DEFINE_string(checkpoint_path, "steinlang.ckpt",
+              "File to write checkpoints to. Each checkpoint after the first "
+              "is appended as a delta against the previous one.");
+DEFINE_string(restore_from, "",
+              "If set, resume evaluation from the last checkpoint in this "
+              "file, rather than evaluating a program from stdin.");
+
+DECLARE_bool(jit);
+DECLARE_bool(memoize);
+DECLARE_int32(threads);
 
 namespace {
 
@@ -57,9 +85,12 @@ void DebugPrint(const EvalContext& ctx) {
   }
   printf("\n--------\n");
   printf("env:\n");
-  for (const auto& kv : ctx.cur_ctx().env()) {
-    printf("  env[%s] = %s\n", kv.first.c_str(),
-           ctx.store(kv.second).ShortDebugString().c_str());
+  const FrameLayout& layout = FindLayout(ctx.pgm(), ctx.cur_ctx().lambda_id());
+  for (int i = 0; i < ctx.cur_ctx().env_size(); ++i) {
+    if (ctx.cur_ctx().env(i) >= 0) {
+      printf("  env[%s] = %s\n", layout.name(i).c_str(),
+             ctx.store(ctx.cur_ctx().env(i)).ShortDebugString().c_str());
+    }
   }
   printf("\n--------\n");
   printf("comps: .");
@@ -69,29 +100,128 @@ void DebugPrint(const EvalContext& ctx) {
   printf("\n--------\n");
 }
 
-int evaluate(std::unique_ptr<Evaluator> evaluator) {
-  int steps = 0;
-  while (evaluator->HasComputation()) {
-    evaluator->Step();
+void DebugPrint(const Evaluator& evaluator) { DebugPrint(evaluator.ctx()); }
+
+void DebugPrint(const VirtualMachine& vm) {
+  printf("================\n");
+  printf("%s", vm.DebugString().c_str());
+  printf("--------\n");
+}
+
+// Only the VirtualMachine has a JIT.
+void GetJitStats(const Evaluator&, JitStats*) {}
+
+void GetJitStats(const VirtualMachine& vm, JitStats* jit_stats) {
+  *jit_stats = vm.jit_stats();
+}
+
+// Only the Evaluator forks calls.
+void GetForkStats(const Evaluator& evaluator, ForkStats* fork_stats) {
+  *fork_stats = evaluator.fork_stats();
+}
+
+void GetForkStats(const VirtualMachine&, ForkStats*) {}
+
+// Only the Evaluator's state can be checkpointed, so checkpoints is always
+// nullptr for the VirtualMachine.
+bool Checkpoint(Evaluator* evaluator, int64_t steps,
+                CheckpointWriter* checkpoints) {
+  return checkpoints->Write(evaluator, steps);
+}
+
+bool Checkpoint(VirtualMachine*, int64_t, CheckpointWriter*) {
+  return false;
+}
+
+// The calls of a fork that hasn't joined are evaluated outside the
+// Evaluator's EvalContext, so it's checkpointed after a later Run instead.
+bool CanCheckpoint(const Evaluator& evaluator) {
+  return !evaluator.forking();
+}
+
+bool CanCheckpoint(const VirtualMachine&) { return false; }
+
+struct EvalStats {
+  GcStats gc;
+  InlineCacheStats inline_cache;
+  JitStats jit;
+  MemoStats memo;
+  ForkStats fork;
+};
+
+// Evaluate to completion, and return the number of steps. prior_steps were
+// evaluated before a checkpoint that evaluator was restored from. If
+// checkpoints isn't nullptr, checkpoint every --checkpoint_every_steps steps.
+template <typename E>
+int64_t evaluate(std::unique_ptr<E> evaluator, int64_t prior_steps,
+                 CheckpointWriter* checkpoints, EvalStats* stats) {
+  const int64_t steps_per_run =
+      FLAGS_debug_print_steps ? 1 : FLAGS_steps_per_run;
+  int64_t steps = 0;
+  int64_t next_checkpoint = FLAGS_checkpoint_every_steps;
+  RunStatus status;
+  do {
+    status = evaluator->Run(steps_per_run);
+    steps += status.steps;
     for (const std::string& output : evaluator->consume_output()) {
       printf("output: %s\n", output.c_str());
     }
-    ++steps;
     if (FLAGS_debug_print_steps) {
-      DebugPrint(evaluator->ctx());
+      DebugPrint(*evaluator);
     }
-  }
+    if (checkpoints != nullptr &&
+        status.reason == StopReason::kBudgetExhausted &&
+        steps >= next_checkpoint && CanCheckpoint(*evaluator)) {
+      if (!Checkpoint(evaluator.get(), prior_steps + steps, checkpoints)) {
+        printf("failed to write checkpoint to %s.\n",
+               FLAGS_checkpoint_path.c_str());
+        checkpoints = nullptr;
+      }
+      next_checkpoint = steps + FLAGS_checkpoint_every_steps;
+    }
+  } while (status.reason == StopReason::kBudgetExhausted);
+  stats->gc = evaluator->gc_stats();
+  stats->inline_cache = evaluator->inline_cache_stats();
+  GetJitStats(*evaluator, &stats->jit);
+  stats->memo = evaluator->memo_stats();
+  GetForkStats(*evaluator, &stats->fork);
   return steps;
 }
 
-void InitCtx(const Program& pgm, EvalContext* ctx) {
-  *ctx->mutable_pgm() = pgm;
-  AnnotateSource(ctx->mutable_pgm());
-  for (int i = pgm.stmt_size(); i-- > 0;) {
-    *ctx->mutable_cur_ctx()->add_comp()->mutable_stmt() = pgm.stmt(i);
+void PrintTiming(int64_t num_steps, long long microseconds,
+                 const EvalStats& stats,
+                 const OptimizationStats* optimization_stats,
+                 const CheckpointWriter* checkpoints) {
+  printf("total num steps evaluated: %lld\n",
+         static_cast<long long>(num_steps));
+  printf("total time: %lld us\n", microseconds);
+  printf("avg: %f us / step\n", static_cast<float>(microseconds) / num_steps);
+  printf("%s\n", stats.gc.DebugString().c_str());
+  printf("%s\n", stats.inline_cache.DebugString().c_str());
+  if (FLAGS_bytecode && FLAGS_jit) {
+    printf("%s\n", stats.jit.DebugString().c_str());
+  }
+  if (FLAGS_memoize) {
+    printf("%s\n", stats.memo.DebugString().c_str());
+  }
+  if (!FLAGS_bytecode && FLAGS_threads > 1) {
+    printf("%s\n", stats.fork.DebugString().c_str());
+  }
+  if (checkpoints != nullptr) {
+    printf("%s\n", checkpoints->stats().DebugString().c_str());
+  }
+  if (optimization_stats != nullptr) {
+    printf("%s\n", optimization_stats->DebugString().c_str());
   }
 }
 
+long long MicrosecondsSince(
+    std::chrono::high_resolution_clock::time_point start) {
+  auto elapsed = std::chrono::high_resolution_clock::now() - start;
+  return std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+      .count();
+}
+
 bool Evaluate(const std::string& input, EvalContext* ctx,
               PoolingArenaAllocator* allocator) {
   const absl::optional<steinlang::Parser::ParseTreeNode> parse_result =
@@ -105,18 +235,73 @@ bool Evaluate(const std::string& input, EvalContext* ctx,
   if (FLAGS_debug_print_syntax_tree) {
     std::cout << pgm.DebugString() << "\n";
   }
+  OptimizationStats optimization_stats;
+  Optimize(&pgm, &optimization_stats);
 
-  steinlang::InitCtx(pgm, ctx);
-  auto evaluator = std::make_unique<steinlang::Evaluator>(ctx, allocator);
+  if (FLAGS_bytecode && FLAGS_checkpoint_every_steps > 0) {
+    std::cout << "checkpoints require --bytecode=false.\n";
+    return false;
+  }
+  InitEvalContext(pgm, ctx);
+  Bytecode bytecode;
+  if (FLAGS_bytecode && !Compile(ctx->pgm(), &bytecode)) {
+    std::cout << "failed to compile program to bytecode.\n";
+    return false;
+  }
+  if (FLAGS_bytecode && FLAGS_debug_print_bytecode) {
+    std::cout << Disassemble(bytecode) << "\n";
+  }
+
+  std::unique_ptr<CheckpointWriter> checkpoints;
+  if (FLAGS_checkpoint_every_steps > 0) {
+    checkpoints = std::make_unique<CheckpointWriter>(FLAGS_checkpoint_path);
+  }
   auto start = std::chrono::high_resolution_clock::now();
-  int num_steps = evaluate(std::move(evaluator));
-  auto elapsed = std::chrono::high_resolution_clock::now() - start;
-  long long microseconds =
-      std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+  int64_t num_steps;
+  EvalStats stats;
+  if (FLAGS_bytecode) {
+    num_steps = evaluate(std::make_unique<VirtualMachine>(&bytecode), 0,
+                         checkpoints.get(), &stats);
+  } else {
+    num_steps = evaluate(std::make_unique<Evaluator>(ctx, allocator), 0,
+                         checkpoints.get(), &stats);
+  }
+  const long long microseconds = MicrosecondsSince(start);
+  if (FLAGS_debug_print_timing) {
+    PrintTiming(num_steps, microseconds, stats, &optimization_stats,
+                checkpoints.get());
+  }
+  return true;
+}
+
+// Resume evaluation from the last checkpoint in path.
+bool Resume(const std::string& path, EvalContext* ctx,
+            PoolingArenaAllocator* allocator) {
+  // Checkpoints are of the Evaluator's state.
+  FLAGS_bytecode = false;
+  auto start = std::chrono::high_resolution_clock::now();
+  int64_t prior_steps;
+  std::unique_ptr<Evaluator> evaluator =
+      RestoreCheckpoint(path, ctx, allocator, &prior_steps);
+  if (evaluator == nullptr) {
+    std::cout << "failed to restore checkpoint from " << path << ".\n";
+    return false;
+  }
+  const long long restore_microseconds = MicrosecondsSince(start);
+
+  std::unique_ptr<CheckpointWriter> checkpoints;
+  if (FLAGS_checkpoint_every_steps > 0) {
+    checkpoints = std::make_unique<CheckpointWriter>(FLAGS_checkpoint_path);
+  }
+  start = std::chrono::high_resolution_clock::now();
+  EvalStats stats;
+  const int64_t num_steps = evaluate(std::move(evaluator), prior_steps,
+                                     checkpoints.get(), &stats);
+  const long long microseconds = MicrosecondsSince(start);
   if (FLAGS_debug_print_timing) {
-    printf("total num steps evaluated: %d\n", num_steps);
-    printf("total time: %lld us\n", microseconds);
-    printf("avg: %f us / step\n", static_cast<float>(microseconds) / num_steps);
+    printf("restored checkpoint after %lld steps in %lld us\n",
+           static_cast<long long>(prior_steps), restore_microseconds);
+    PrintTiming(num_steps, microseconds, stats, nullptr, checkpoints.get());
   }
   return true;
 }
@@ -128,6 +313,9 @@ int main(int argc, char** argv) {
 
   steinlang::PoolingArenaAllocator allocator;
   steinlang::EvalContext* ctx = allocator.AllocateEvalContext();
+  if (!FLAGS_restore_from.empty()) {
+    return steinlang::Resume(FLAGS_restore_from, ctx, &allocator) ? 0 : 1;
+  }
   Evaluate(util::ReadStdInToString(), ctx, &allocator);
   return 0;
 }
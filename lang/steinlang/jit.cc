@@ -0,0 +1,654 @@
+#include "lang/steinlang/jit.h"
+
+#include <string.h>
+#include <sstream>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define STEINLANG_JIT 1
+#else
+#define STEINLANG_JIT 0
+#endif
+
+namespace steinlang {
+
+std::string JitStats::DebugString() const {
+  std::ostringstream out;
+  out << "jit: " << compiled_functions << " functions compiled, " << code_bytes
+      << " bytes of code, " << native_steps << " steps run natively";
+  return out.str();
+}
+
+bool JitSupported() { return STEINLANG_JIT; }
+
+#if STEINLANG_JIT
+
+namespace {
+
+enum Reg {
+  kRax = 0,
+  kRcx = 1,
+  kRdx = 2,
+  kRbx = 3,
+  kRsi = 6,
+  kRdi = 7,
+  kR12 = 12,
+  kR13 = 13,
+  kR14 = 14,
+  kR15 = 15,
+};
+
+// Condition codes, as encoded in Jcc and SETcc.
+enum Cond {
+  kAboveEqual = 0x3,
+  kEqual = 0x4,
+  kNotEqual = 0x5,
+  kSign = 0x8,
+  kLess = 0xc,
+  kGreaterEqual = 0xd,
+  kLessEqual = 0xe,
+  kGreater = 0xf,
+};
+
+struct Label {
+  int pos = -1;
+  // Offsets of the rel32 operands of jumps to the label, until it's bound.
+  std::vector<int> uses;
+};
+
+// Encodes the few x86-64 instructions that the templates need. Memory
+// operands are always [base + disp32].
+class Assembler {
+ public:
+  std::vector<uint8_t>* code() { return &code_; }
+  int pos() const { return code_.size(); }
+
+  void Bind(Label* label) {
+    label->pos = pos();
+    for (int use : label->uses) {
+      Patch32(use, label->pos - (use + 4));
+    }
+    label->uses.clear();
+  }
+
+  // 64-bit loads and stores.
+  void Load(Reg dst, Reg base, int32_t disp) {
+    Rex(true, dst, base);
+    Emit(0x8b);
+    Mem(dst, base, disp);
+  }
+  void Store(Reg base, int32_t disp, Reg src) {
+    Rex(true, src, base);
+    Emit(0x89);
+    Mem(src, base, disp);
+  }
+  // Sign extends imm to 64 bits.
+  void StoreImm(Reg base, int32_t disp, int32_t imm) {
+    Rex(true, 0, base);
+    Emit(0xc7);
+    Mem(0, base, disp);
+    Emit32(imm);
+  }
+  void StoreByte(Reg base, int32_t disp, uint8_t imm) {
+    Rex(false, 0, base);
+    Emit(0xc6);
+    Mem(0, base, disp);
+    Emit(imm);
+  }
+  // Zero extends the byte to 64 bits.
+  void LoadByte(Reg dst, Reg base, int32_t disp) {
+    Rex(false, dst, base);
+    Emit(0x0f);
+    Emit(0xb6);
+    Mem(dst, base, disp);
+  }
+  void CmpByte(Reg base, int32_t disp, uint8_t imm) {
+    Rex(false, 0, base);
+    Emit(0x80);
+    Mem(7, base, disp);
+    Emit(imm);
+  }
+  void Lea(Reg dst, Reg base, int32_t disp) {
+    Rex(true, dst, base);
+    Emit(0x8d);
+    Mem(dst, base, disp);
+  }
+  void MovImm64(Reg dst, int64_t imm) {
+    Rex(true, 0, dst);
+    Emit(0xb8 + (dst & 7));
+    Emit32(imm);
+    Emit32(imm >> 32);
+  }
+  void MovImm32(Reg dst, int32_t imm) {
+    Rex(false, 0, dst);
+    Emit(0xb8 + (dst & 7));
+    Emit32(imm);
+  }
+
+  void Mov(Reg dst, Reg src) { RegReg(true, 0x89, src, dst); }
+  void Add(Reg dst, Reg src) { RegReg(true, 0x01, src, dst); }
+  void Sub(Reg dst, Reg src) { RegReg(true, 0x29, src, dst); }
+  void Cmp(Reg x, Reg y) { RegReg(true, 0x39, y, x); }
+  void Test(Reg x, Reg y) { RegReg(true, 0x85, y, x); }
+  void And32(Reg dst, Reg src) { RegReg(false, 0x21, src, dst); }
+  void Or32(Reg dst, Reg src) { RegReg(false, 0x09, src, dst); }
+  void Imul(Reg dst, Reg src) {
+    Rex(true, dst, src);
+    Emit(0x0f);
+    Emit(0xaf);
+    ModRm(3, dst, src);
+  }
+
+  void Neg(Reg r) { Unary(true, 0xf7, 3, r); }
+  // rax = rdx:rax / r, rdx = rdx:rax % r.
+  void Idiv(Reg r) { Unary(true, 0xf7, 7, r); }
+  // Sign extend rax into rdx.
+  void Cqo() {
+    Emit(0x48);
+    Emit(0x99);
+  }
+  void Dec(Reg r) { Unary(true, 0xff, 1, r); }
+  void Shl(Reg r, uint8_t bits) {
+    Unary(true, 0xc1, 4, r);
+    Emit(bits);
+  }
+  void CmpImm(Reg r, int8_t imm) {
+    Unary(true, 0x83, 7, r);
+    Emit(imm);
+  }
+  void Xor32Imm(Reg r, int8_t imm) {
+    Unary(false, 0x83, 6, r);
+    Emit(imm);
+  }
+  // r = 1 if cond else 0. Only for rax, rcx, rdx and rbx.
+  void SetZeroExtended(Cond cond, Reg r) {
+    Emit(0x0f);
+    Emit(0x90 + cond);
+    ModRm(3, 0, r);
+    Emit(0x0f);
+    Emit(0xb6);
+    ModRm(3, r, r);
+  }
+
+  void Push(Reg r) {
+    Rex(false, 0, r);
+    Emit(0x50 + (r & 7));
+  }
+  void Pop(Reg r) {
+    Rex(false, 0, r);
+    Emit(0x58 + (r & 7));
+  }
+  void Ret() { Emit(0xc3); }
+  void JmpReg(Reg r) { Unary(false, 0xff, 4, r); }
+  void Jmp(Label* label) {
+    Emit(0xe9);
+    Use(label);
+  }
+  void J(Cond cond, Label* label) {
+    Emit(0x0f);
+    Emit(0x80 + cond);
+    Use(label);
+  }
+
+ private:
+  void Emit(uint8_t byte) { code_.push_back(byte); }
+  void Emit32(uint32_t x) {
+    for (int i = 0; i < 4; ++i) {
+      Emit(x >> (8 * i));
+    }
+  }
+  void Patch32(int pos, uint32_t x) {
+    for (int i = 0; i < 4; ++i) {
+      code_[pos + i] = x >> (8 * i);
+    }
+  }
+
+  void Rex(bool wide, int reg, int rm) {
+    const uint8_t rex = 0x40 | (wide ? 8 : 0) | ((reg >> 3) << 2) | (rm >> 3);
+    if (rex != 0x40) {
+      Emit(rex);
+    }
+  }
+  void ModRm(int mod, int reg, int rm) {
+    Emit((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+  }
+  void Mem(int reg, Reg base, int32_t disp) {
+    ModRm(2, reg, base);
+    if ((base & 7) == 4) {
+      // rsp and r12 as a base need a SIB byte.
+      Emit(0x24);
+    }
+    Emit32(disp);
+  }
+  void RegReg(bool wide, uint8_t op, Reg reg, Reg rm) {
+    Rex(wide, reg, rm);
+    Emit(op);
+    ModRm(3, reg, rm);
+  }
+  // An instruction whose ModRM reg field extends the opcode.
+  void Unary(bool wide, uint8_t op, int ext, Reg rm) {
+    Rex(wide, 0, rm);
+    Emit(op);
+    ModRm(3, ext, rm);
+  }
+
+  void Use(Label* label) {
+    if (label->pos >= 0) {
+      Emit32(label->pos - (pos() + 4));
+    } else {
+      label->uses.push_back(pos());
+      Emit32(0);
+    }
+  }
+
+  std::vector<uint8_t> code_;
+};
+
+// Native code is entered as int64_t f(JitFrame* frame, const uint8_t* entry),
+// and keeps the frame in callee-saved registers while it runs.
+constexpr Reg kRegisters = kRbx;
+constexpr Reg kStore = kR12;
+constexpr Reg kEnv = kR13;
+constexpr Reg kStepsLeft = kR14;
+constexpr Reg kFrame = kR15;
+
+static_assert(sizeof(Value) == 16, "Store addresses are scaled by shifting");
+static_assert(sizeof(int64_t) == 8, "Env slots are scaled by 8");
+
+// Values are copied 8 bytes at a time, at these displacements.
+constexpr int32_t kValueSize = sizeof(Value);
+
+uint8_t TypeByte(Value::Type type) { return static_cast<uint8_t>(type); }
+
+class Compiler {
+ public:
+  Compiler(const Function& fn, const JitRegisterLayout& layout)
+      : fn_(fn),
+        layout_(layout),
+        labels_(fn.code.size() + 1),
+        exits_(fn.code.size() + 1) {}
+
+  // Returns the code, and in entries the offset of each instruction's code,
+  // or -1 if it's unsupported.
+  std::vector<uint8_t> Compile(std::vector<int>* entries) {
+    Prologue();
+    const int code_size = fn_.code.size();
+    for (int pc = 0; pc < code_size; ++pc) {
+      asm_.Bind(&labels_[pc]);
+      if (Supported(fn_.code[pc])) {
+        entries->push_back(asm_.pos());
+        Translate(pc);
+      } else {
+        entries->push_back(-1);
+        Exit(pc);
+      }
+    }
+    asm_.Bind(&labels_[code_size]);
+    Exit(code_size);
+    const int num_exits = exits_.size();
+    for (int pc = 0; pc < num_exits; ++pc) {
+      if (!exits_[pc].uses.empty()) {
+        asm_.Bind(&exits_[pc]);
+        Exit(pc);
+      }
+    }
+    Epilogue();
+    return std::move(*asm_.code());
+  }
+
+ private:
+  bool Supported(const Instruction& instr) const {
+    switch (instr.op) {
+      case OpCode::kLoadConst:
+        return fn_.constants[instr.b].type() < Value::Type::kStr;
+      case OpCode::kLoadVar:
+      case OpCode::kDeclareVar:
+      case OpCode::kStoreVar:
+      case OpCode::kNeg:
+      case OpCode::kNot:
+      case OpCode::kAdd:
+      case OpCode::kSub:
+      case OpCode::kMul:
+      case OpCode::kDiv:
+      case OpCode::kGt:
+      case OpCode::kGe:
+      case OpCode::kLt:
+      case OpCode::kLe:
+      case OpCode::kEq:
+      case OpCode::kNe:
+      case OpCode::kAnd:
+      case OpCode::kOr:
+      case OpCode::kJump:
+      case OpCode::kJumpIfFalse:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  void Prologue() {
+    asm_.Push(kRbx);
+    asm_.Push(kR12);
+    asm_.Push(kR13);
+    asm_.Push(kR14);
+    asm_.Push(kR15);
+    asm_.Mov(kFrame, kRdi);
+    asm_.Load(kRegisters, kFrame, offsetof(JitFrame, registers));
+    asm_.Load(kStore, kFrame, offsetof(JitFrame, store));
+    asm_.Load(kEnv, kFrame, offsetof(JitFrame, env));
+    asm_.Load(kStepsLeft, kFrame, offsetof(JitFrame, steps_left));
+    asm_.JmpReg(kRsi);
+  }
+
+  // Return the pc in rax.
+  void Epilogue() {
+    asm_.Bind(&epilogue_);
+    asm_.Store(kFrame, offsetof(JitFrame, steps_left), kStepsLeft);
+    asm_.Pop(kR15);
+    asm_.Pop(kR14);
+    asm_.Pop(kR13);
+    asm_.Pop(kR12);
+    asm_.Pop(kRbx);
+    asm_.Ret();
+  }
+
+  void Exit(int pc) {
+    asm_.MovImm32(kRax, pc);
+    asm_.Jmp(&epilogue_);
+  }
+
+  // Where to go to leave native code before executing the instruction at pc,
+  // which may not have changed any state yet.
+  Label* Leave(int pc) { return &exits_[pc]; }
+
+  int32_t Ref(int r) const { return r * layout_.size + layout_.ref_offset; }
+  int32_t Type(int r) const {
+    return r * layout_.size + layout_.value_offset + Value::kTypeOffset;
+  }
+  int32_t Payload(int r) const {
+    return r * layout_.size + layout_.value_offset + Value::kPayloadOffset;
+  }
+  int32_t Slot(int slot) const { return slot * 8; }
+
+  // dst = VirtualMachine::ValueOf(r[r]). Clobbers rax.
+  void ValueOf(Reg dst, int r) {
+    Label rvalue;
+    asm_.Load(kRax, kRegisters, Ref(r));
+    asm_.Lea(dst, kRegisters, r * layout_.size + layout_.value_offset);
+    asm_.Test(kRax, kRax);
+    asm_.J(kSign, &rvalue);
+    asm_.Shl(kRax, 4);
+    asm_.Mov(dst, kStore);
+    asm_.Add(dst, kRax);
+    asm_.Bind(&rvalue);
+  }
+
+  void GuardType(Reg value, Value::Type type, int pc) {
+    asm_.CmpByte(value, Value::kTypeOffset, TypeByte(type));
+    asm_.J(kNotEqual, Leave(pc));
+  }
+
+  // Overwriting a heap value would have to release it, so leave that to the
+  // interpreter.
+  void GuardScalar(Reg value, int pc) {
+    asm_.CmpByte(value, Value::kTypeOffset, TypeByte(Value::Type::kStr));
+    asm_.J(kAboveEqual, Leave(pc));
+  }
+  void GuardScalarRegister(int r, int pc) {
+    asm_.CmpByte(kRegisters, Type(r), TypeByte(Value::Type::kStr));
+    asm_.J(kAboveEqual, Leave(pc));
+  }
+
+  // Make r[r] an rvalue of type with the payload in src.
+  void SetScalar(int r, Value::Type type, Reg src) {
+    asm_.StoreImm(kRegisters, Ref(r), -1);
+    asm_.StoreByte(kRegisters, Type(r), TypeByte(type));
+    asm_.Store(kRegisters, Payload(r), src);
+  }
+
+  // rax = the address bound to env slot, or leave if it's unbound.
+  void LoadAddress(int slot, int pc) {
+    asm_.Load(kRax, kEnv, Slot(slot));
+    asm_.Test(kRax, kRax);
+    asm_.J(kSign, Leave(pc));
+  }
+
+  void Translate(int pc) {
+    const Instruction& instr = fn_.code[pc];
+    asm_.Test(kStepsLeft, kStepsLeft);
+    asm_.J(kEqual, Leave(pc));
+    switch (instr.op) {
+      case OpCode::kLoadConst: {
+        const Value& k = fn_.constants[instr.b];
+        int64_t payload;
+        memcpy(&payload,
+               reinterpret_cast<const char*>(&k) + Value::kPayloadOffset,
+               sizeof(payload));
+        GuardScalarRegister(instr.a, pc);
+        asm_.MovImm64(kRax, payload);
+        SetScalar(instr.a, k.type(), kRax);
+        break;
+      }
+      case OpCode::kLoadVar:
+        LoadAddress(instr.b, pc);
+        asm_.Store(kRegisters, Ref(instr.a), kRax);
+        break;
+      case OpCode::kDeclareVar:
+        LoadAddress(instr.a, pc);
+        break;
+      case OpCode::kStoreVar:
+        TranslateStoreVar(instr, pc);
+        break;
+      case OpCode::kNeg:
+        ValueOf(kRsi, instr.b);
+        GuardType(kRsi, Value::Type::kInt, pc);
+        GuardScalarRegister(instr.a, pc);
+        asm_.Load(kRax, kRsi, Value::kPayloadOffset);
+        asm_.Neg(kRax);
+        SetScalar(instr.a, Value::Type::kInt, kRax);
+        break;
+      case OpCode::kNot:
+        ValueOf(kRsi, instr.b);
+        GuardType(kRsi, Value::Type::kBool, pc);
+        GuardScalarRegister(instr.a, pc);
+        asm_.LoadByte(kRax, kRsi, Value::kPayloadOffset);
+        asm_.Xor32Imm(kRax, 1);
+        SetScalar(instr.a, Value::Type::kBool, kRax);
+        break;
+      case OpCode::kAnd:
+      case OpCode::kOr:
+        TranslateBoolOp(instr, pc);
+        break;
+      case OpCode::kJump:
+        asm_.Dec(kStepsLeft);
+        asm_.Jmp(&labels_[instr.b]);
+        return;
+      case OpCode::kJumpIfFalse:
+        ValueOf(kRsi, instr.a);
+        asm_.Dec(kStepsLeft);
+        asm_.CmpByte(kRsi, Value::kTypeOffset, TypeByte(Value::Type::kBool));
+        asm_.J(kNotEqual, &labels_[instr.b]);
+        asm_.CmpByte(kRsi, Value::kPayloadOffset, 0);
+        asm_.J(kEqual, &labels_[instr.b]);
+        return;
+      default:
+        TranslateIntOp(instr, pc);
+        break;
+    }
+    asm_.Dec(kStepsLeft);
+  }
+
+  void TranslateStoreVar(const Instruction& instr, int pc) {
+    Label rvalue, done;
+    LoadAddress(instr.a, pc);
+    asm_.Shl(kRax, 4);
+    asm_.Mov(kRdi, kStore);
+    asm_.Add(kRdi, kRax);
+    asm_.Load(kRcx, kRegisters, Ref(instr.b));
+    asm_.Test(kRcx, kRcx);
+    asm_.J(kSign, &rvalue);
+    // Copy one scalar in the store to another.
+    asm_.Shl(kRcx, 4);
+    asm_.Mov(kRsi, kStore);
+    asm_.Add(kRsi, kRcx);
+    GuardScalar(kRsi, pc);
+    GuardScalar(kRdi, pc);
+    for (int32_t offset = 0; offset < kValueSize; offset += 8) {
+      asm_.Load(kRax, kRsi, offset);
+      asm_.Store(kRdi, offset, kRax);
+    }
+    asm_.Jmp(&done);
+    // Swap the rvalue into the store, whatever its type.
+    asm_.Bind(&rvalue);
+    asm_.Lea(kRsi, kRegisters, instr.b * layout_.size + layout_.value_offset);
+    for (int32_t offset = 0; offset < kValueSize; offset += 8) {
+      asm_.Load(kRax, kRdi, offset);
+      asm_.Load(kRcx, kRsi, offset);
+      asm_.Store(kRdi, offset, kRcx);
+      asm_.Store(kRsi, offset, kRax);
+    }
+    asm_.Bind(&done);
+  }
+
+  // Loads the payloads of r[b] and r[c] into rax and rcx, if both are of type.
+  void LoadOperands(const Instruction& instr, Value::Type type, int pc) {
+    ValueOf(kRsi, instr.b);
+    GuardType(kRsi, type, pc);
+    ValueOf(kRdi, instr.c);
+    GuardType(kRdi, type, pc);
+    GuardScalarRegister(instr.a, pc);
+  }
+
+  void TranslateBoolOp(const Instruction& instr, int pc) {
+    LoadOperands(instr, Value::Type::kBool, pc);
+    asm_.LoadByte(kRax, kRsi, Value::kPayloadOffset);
+    asm_.LoadByte(kRcx, kRdi, Value::kPayloadOffset);
+    if (instr.op == OpCode::kAnd) {
+      asm_.And32(kRax, kRcx);
+    } else {
+      asm_.Or32(kRax, kRcx);
+    }
+    SetScalar(instr.a, Value::Type::kBool, kRax);
+  }
+
+  void TranslateIntOp(const Instruction& instr, int pc) {
+    LoadOperands(instr, Value::Type::kInt, pc);
+    asm_.Load(kRax, kRsi, Value::kPayloadOffset);
+    asm_.Load(kRcx, kRdi, Value::kPayloadOffset);
+    Value::Type type = Value::Type::kBool;
+    switch (instr.op) {
+      case OpCode::kAdd:
+        asm_.Add(kRax, kRcx);
+        type = Value::Type::kInt;
+        break;
+      case OpCode::kSub:
+        asm_.Sub(kRax, kRcx);
+        type = Value::Type::kInt;
+        break;
+      case OpCode::kMul:
+        asm_.Imul(kRax, kRcx);
+        type = Value::Type::kInt;
+        break;
+      case OpCode::kDiv:
+        // Dividing by 0, or the minimum by -1, traps; let the interpreter do
+        // that where it would.
+        asm_.Test(kRcx, kRcx);
+        asm_.J(kEqual, Leave(pc));
+        asm_.CmpImm(kRcx, -1);
+        asm_.J(kEqual, Leave(pc));
+        asm_.Cqo();
+        asm_.Idiv(kRcx);
+        type = Value::Type::kInt;
+        break;
+      case OpCode::kGt:
+        asm_.Cmp(kRax, kRcx);
+        asm_.SetZeroExtended(kGreater, kRax);
+        break;
+      case OpCode::kGe:
+        asm_.Cmp(kRax, kRcx);
+        asm_.SetZeroExtended(kGreaterEqual, kRax);
+        break;
+      case OpCode::kLt:
+        asm_.Cmp(kRax, kRcx);
+        asm_.SetZeroExtended(kLess, kRax);
+        break;
+      case OpCode::kLe:
+        asm_.Cmp(kRax, kRcx);
+        asm_.SetZeroExtended(kLessEqual, kRax);
+        break;
+      case OpCode::kEq:
+        asm_.Cmp(kRax, kRcx);
+        asm_.SetZeroExtended(kEqual, kRax);
+        break;
+      case OpCode::kNe:
+        asm_.Cmp(kRax, kRcx);
+        asm_.SetZeroExtended(kNotEqual, kRax);
+        break;
+      default:
+        break;
+    }
+    SetScalar(instr.a, type, kRax);
+  }
+
+  const Function& fn_;
+  const JitRegisterLayout layout_;
+  Assembler asm_;
+  // The code of each instruction, and of the end of the function.
+  std::vector<Label> labels_;
+  // Exits which leave before each instruction.
+  std::vector<Label> exits_;
+  Label epilogue_;
+};
+
+}  // namespace
+
+std::unique_ptr<NativeCode> NativeCode::Compile(
+    const Function& fn, const JitRegisterLayout& layout) {
+  std::vector<int> offsets;
+  const std::vector<uint8_t> code = Compiler(fn, layout).Compile(&offsets);
+
+  void* mem = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    return nullptr;
+  }
+  memcpy(mem, code.data(), code.size());
+  if (mprotect(mem, code.size(), PROT_READ | PROT_EXEC) != 0) {
+    munmap(mem, code.size());
+    return nullptr;
+  }
+
+  std::unique_ptr<NativeCode> native(new NativeCode);
+  native->code_ = static_cast<uint8_t*>(mem);
+  native->size_ = code.size();
+  for (int offset : offsets) {
+    native->entries_.push_back(offset < 0 ? nullptr : native->code_ + offset);
+  }
+  return native;
+}
+
+NativeCode::~NativeCode() {
+  if (code_ != nullptr) {
+    munmap(code_, size_);
+  }
+}
+
+int NativeCode::Run(int pc, JitFrame* frame) const {
+  using Entry = int64_t (*)(JitFrame*, const uint8_t*);
+  return reinterpret_cast<Entry>(code_)(frame, entries_[pc]);
+}
+
+#else  // !STEINLANG_JIT
+
+std::unique_ptr<NativeCode> NativeCode::Compile(
+    const Function& fn, const JitRegisterLayout& layout) {
+  return nullptr;
+}
+
+NativeCode::~NativeCode() {}
+
+int NativeCode::Run(int pc, JitFrame* frame) const { return pc; }
+
+#endif  // STEINLANG_JIT
+
+}  // namespace steinlang
@@ -0,0 +1,87 @@
+// A baseline JIT for the VirtualMachine: each instruction of a hot Function is
+// translated to a fixed template of x86-64 code, which works on the VM's
+// registers, env and store in place. Only scalar loads, stores and int and
+// bool arithmetic are translated. Anything else (calls, returns, printing,
+// heap values, floats, and operands of an unexpected type) leaves native code
+// at that instruction, so the VM can interpret it and re-enter at the next.
+
+#ifndef LANG_STEINLANG_JIT_H_
+#define LANG_STEINLANG_JIT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lang/steinlang/bytecode.h"
+#include "lang/steinlang/value.h"
+
+namespace steinlang {
+
+// True if native code can be generated on this platform.
+bool JitSupported();
+
+// How the VM lays out a register: a store address, or -1 and an rvalue.
+struct JitRegisterLayout {
+  size_t size;
+  size_t ref_offset;
+  size_t value_offset;
+};
+
+// The state of the frame that native code runs in.
+struct JitFrame {
+  // The frame's first register.
+  void* registers;
+  Value* store;
+  // The frame's first env slot.
+  int64_t* env;
+  // Native code returns when this reaches 0, and decrements it for every
+  // instruction it executes.
+  int64_t steps_left;
+};
+
+struct JitStats {
+  int64_t compiled_functions = 0;
+  int64_t code_bytes = 0;
+  int64_t native_steps = 0;
+
+  std::string DebugString() const;
+};
+
+// The native code of one Function.
+class NativeCode {
+ public:
+  // Returns nullptr if the JIT isn't supported on this platform.
+  static std::unique_ptr<NativeCode> Compile(const Function& fn,
+                                             const JitRegisterLayout& layout);
+
+  ~NativeCode();
+
+  NativeCode(const NativeCode&) = delete;
+  NativeCode& operator=(const NativeCode&) = delete;
+
+  // Whether the instruction at pc has a native translation. Native code may
+  // still leave at pc, if the operands aren't what the translation expects.
+  bool supported(int pc) const { return entries_[pc] != nullptr; }
+
+  size_t size() const { return size_; }
+
+  // Execute instructions from pc, which must be supported, until an
+  // instruction has to be interpreted or frame->steps_left runs out. Returns
+  // the pc of the next instruction.
+  int Run(int pc, JitFrame* frame) const;
+
+ private:
+  NativeCode() = default;
+
+  // mmap'd, executable.
+  uint8_t* code_ = nullptr;
+  size_t size_ = 0;
+  // The native code of each instruction, or nullptr if it's unsupported.
+  std::vector<const uint8_t*> entries_;
+};
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_JIT_H_
@@ -1,103 +1,439 @@
 #include "lang/steinlang/language_evaluation.h"
 
 #include <gflags/gflags.h>
+#include <algorithm>
+#include <iterator>
 
 #include "lang/steinlang/literal_ops.h"
+#include "lang/steinlang/program_analysis.h"
+#include "lang/steinlang/resolution.h"
+#include "lang/steinlang/source_util.h"
+#include "lang/steinlang/superinstructions.h"
 
 DEFINE_int64(max_arena_allocation_usage, 64 * 1024 * 1024,
-             "Max memory allocated by protobuf arena before freeing memory by "
-             "forcing an arena reset. Actual allocation may go over by the max "
-             "block size.");
+             "Max memory allocated by each Evaluator's protobuf arena before "
+             "freeing memory by forcing an arena reset. Actual allocation may "
+             "go over by the max block size.");
+DEFINE_bool(semispace_arena, true,
+            "If true, relieve arena memory pressure by garbage collecting the "
+            "store and evacuating the EvalContext to a second arena. "
+            "Otherwise, copy the EvalContext to the heap, reset the arena and "
+            "copy it back.");
+DEFINE_bool(threaded_dispatch, true,
+            "If true, and computed goto is supported, Run() dispatches "
+            "computations by jumping through a table of labels rather than "
+            "with a switch.");
+DEFINE_bool(superinstructions, true,
+            "If true, evaluate binary expressions of variables and literals, "
+            "and assignments of them to variables, in a single step.");
+DEFINE_int32(max_fork_depth, 6,
+             "With --threads, calls are only forked this many forks deep, so "
+             "that forked calls are big enough to be worth the overhead.");
 
 namespace steinlang {
 
-int Evaluator::Lookup(const std::string& var_name) {
+namespace {
+
+// Steps that a forked call runs between checking memory.
+constexpr int64_t kForkedStepsPerRun = 4096;
+
+// True if evaluating exp can do nothing but read variables, whose slots are
+// added to slots: it has no side effects, and creates no closures.
+bool OnlyReads(const Expression& exp, std::vector<int>* slots) {
+  switch (exp.type_case()) {
+    case Expression::kVarExp:
+      slots->push_back(exp.var_exp().slot());
+      return true;
+    case Expression::kLitExp:
+      return true;
+    case Expression::kMonArithExp:
+      return OnlyReads(exp.mon_arith_exp().exp(), slots);
+    case Expression::kBinArithExp:
+      return (exp.bin_arith_exp().op() != DIV ||
+              IsSafeDivisor(exp.bin_arith_exp().rhs())) &&
+             OnlyReads(exp.bin_arith_exp().lhs(), slots) &&
+             OnlyReads(exp.bin_arith_exp().rhs(), slots);
+    case Expression::kTernExp:
+      return OnlyReads(exp.tern_exp().if_exp(), slots) &&
+             OnlyReads(exp.tern_exp().cond_exp(), slots) &&
+             OnlyReads(exp.tern_exp().else_exp(), slots);
+    case Expression::kTupleExp:
+      for (const Expression& e : exp.tuple_exp().exp()) {
+        if (!OnlyReads(e, slots)) {
+          return false;
+        }
+      }
+      return true;
+    case Expression::kFuncAppExp:
+    case Expression::kLambdaExp:
+    case Expression::TYPE_NOT_SET:
+      return false;
+  }
+  return false;
+}
+
+}  // namespace
+
+namespace {
+
+void Annotate(Program* pgm) {
+  AnnotateSource(pgm);
+  ResolveVariables(pgm);
+  if (FLAGS_superinstructions) {
+    SelectSuperinstructions(pgm);
+  }
+}
+
+// Schedule the statements of pgm, the first one last.
+void ScheduleProgram(const Program& pgm, EvalContext* ctx) {
+  for (int i = pgm.stmt_size(); i-- > 0;) {
+    ctx->mutable_cur_ctx()->add_comp()->set_stmt_ref(
+        pgm.stmt(i).origin().source_id());
+  }
+}
+
+}  // namespace
+
+void InitEvalContext(const Program& pgm, EvalContext* ctx) {
+  *ctx->mutable_pgm() = pgm;
+  Annotate(ctx->mutable_pgm());
+  ScheduleProgram(ctx->pgm(), ctx);
+}
+
+std::shared_ptr<const Program> PrepareProgram(const Program& pgm) {
+  auto prepared = std::make_shared<Program>(pgm);
+  Annotate(prepared.get());
+  return prepared;
+}
+
+Evaluator::Evaluator(EvalContext* ctx, PoolingArenaAllocator* allocator)
+    : Evaluator(std::make_shared<const Program>(ctx->pgm()), ctx, allocator,
+                /*schedule=*/false) {}
+
+Evaluator::Evaluator(std::shared_ptr<const Program> pgm, EvalContext* ctx,
+                     PoolingArenaAllocator* allocator)
+    : Evaluator(std::move(pgm), ctx, allocator, /*schedule=*/true) {}
+
+Evaluator::Evaluator(std::shared_ptr<const Program> pgm, EvalContext* ctx,
+                     PoolingArenaAllocator* allocator, bool schedule)
+    : ctx_(ctx),
+      allocator_(allocator),
+      pgm_(std::move(pgm)),
+      arena_limit_(FLAGS_max_arena_allocation_usage) {
+  SetProgram();
+  if (schedule) {
+    ScheduleProgram(*pgm_, ctx_);
+  }
+  IndexSource(*pgm_, &source_);
+  // Forked calls bind their variables in their children's stores rather than
+  // in this one, which shifts the addresses that printed closures show.
+  if (FLAGS_max_fork_depth > 0 && !MayPrintClosures(*pgm_)) {
+    fork_pool_ = ForkJoinPool::Default();
+  }
+  pure_lambdas_ = std::make_shared<PureLambdas>();
+  if (memo_.enabled() || fork_pool_ != nullptr) {
+    for (size_t id = 0; id < source_.exp.size(); ++id) {
+      if (source_.exp[id] != nullptr && source_.exp[id]->has_lambda_exp()) {
+        pure_lambdas_->Add(id, source_.exp[id]->lambda_exp());
+      }
+    }
+  }
+}
+
+Evaluator::Evaluator(EvalContext* ctx, PoolingArenaAllocator* allocator,
+                     const Evaluator& parent)
+    : ctx_(ctx),
+      allocator_(allocator),
+      pgm_(parent.pgm_),
+      source_(parent.source_),
+      arena_limit_(FLAGS_max_arena_allocation_usage),
+      pure_lambdas_(parent.pure_lambdas_),
+      fork_depth_(parent.fork_depth_ + 1) {
+  SetProgram();
+  if (fork_depth_ < FLAGS_max_fork_depth) {
+    fork_pool_ = parent.fork_pool_;
+  }
+}
+
+int64_t Evaluator::Lookup(int slot) {
   auto* env = ctx_->mutable_cur_ctx()->mutable_env();
-  auto it = env->find(var_name);
-  if (it == env->end()) {
-    int new_addr = (*env)[var_name] = ctx_->store_size();
+  while (env->size() <= slot) {
+    env->Add(-1);
+  }
+  if (env->Get(slot) < 0) {
+    env->Set(slot, ctx_->store_size());
+    RecordWrite(ctx_->store_size());
     PoolPtr<Literal> new_val = allocator_->Allocate<Literal>();
     ctx_->mutable_store()->UnsafeArenaAddAllocated(new_val.release());
-    return new_addr;
-  } else {
-    return it->second;
   }
+  return env->Get(slot);
 }
 
-void Evaluator::Assign(const std::string& var_name, PoolPtr<Literal> value) {
+void Evaluator::Assign(int slot, PoolPtr<Literal> value) {
   auto* env = ctx_->mutable_cur_ctx()->mutable_env();
-  auto it = env->find(var_name);
-  if (it == env->end()) {
-    (*env)[var_name] = ctx_->store_size();
+  while (env->size() <= slot) {
+    env->Add(-1);
+  }
+  if (env->Get(slot) < 0) {
+    env->Set(slot, ctx_->store_size());
+    RecordWrite(ctx_->store_size());
     ctx_->mutable_store()->UnsafeArenaAddAllocated(value.release());
   } else {
-    ctx_->mutable_store(it->second)->Swap(value.get());
+    Overwrite(env->Get(slot))->Swap(value.get());
   }
 }
 
 bool Evaluator::HasComputation() const {
-  return !ctx_->cur_ctx().comp().empty();
+  return !forked_calls_.empty() || !ctx_->cur_ctx().comp().empty();
 }
 
-void Evaluator::Step() {
-  size_t mem_usage = PoolingArenaAllocator::allocated_size();
-  if (mem_usage > FLAGS_max_arena_allocation_usage) {
-    EvalContext ctx_cpy = *ctx_;
-    allocator_->Reset();
-    ctx_ = allocator_->AllocateEvalContext();
-    *ctx_ = ctx_cpy;
-  }
+void Evaluator::Step() { Run(1); }
 
-  if (HasComputation()) {
-    auto cur_comp = allocator_->WrapPoolPtr(
-        ctx_->mutable_cur_ctx()->mutable_comp()->UnsafeArenaReleaseLast());
-    switch (cur_comp->type_case()) {
-      case Computation::kExp:
-        Evaluate(allocator_->WrapPoolPtr(cur_comp->unsafe_arena_release_exp()));
-        break;
-      case Computation::kStmt:
-        Evaluate(cur_comp->unsafe_arena_release_stmt());
-        break;
-      case Computation::kBinExpFinal:
-        Evaluate(cur_comp->bin_exp_final());
-        break;
-      case Computation::kMonExpFinal:
-        Evaluate(cur_comp->mon_exp_final());
-        break;
-      case Computation::kTupleExpFinal:
-        Evaluate(cur_comp->unsafe_arena_release_tuple_exp_final());
-        break;
-      case Computation::kIgnoreOneResult:
-        PopResultOrDie();
-        break;
-      case Computation::kAssignStmtFinal:
-        EvaluateAssignStmtFinal();
-        break;
-      case Computation::kFuncAppExpFinal:
-        Evaluate(cur_comp->unsafe_arena_release_func_app_exp_final());
-        break;
-      case Computation::kReturnFromCtx:
-        EvaluateReturnFromLocalContext();
-        break;
-      case Computation::kIfElseFinal:
-        Evaluate(cur_comp->unsafe_arena_release_if_else_final());
-        break;
-      case Computation::kPrintFinal:
-        EvaluatePrint();
-        break;
-      case Computation::TYPE_NOT_SET:
-        break;
+RunStatus Evaluator::Run(int64_t max_steps) {
+  // Compacting the store would move the values that forked calls' results
+  // refer to.
+  if (forked_calls_.empty()) {
+    CheckMemory();
+  }
+  int64_t steps = 0;
+  while (steps < max_steps && HasComputation()) {
+    if (!forked_calls_.empty()) {
+      steps += RunForked(max_steps - steps);
+      continue;
+    }
+#if STEINLANG_COMPUTED_GOTO
+    if (FLAGS_threaded_dispatch) {
+      steps += RunThreaded(max_steps - steps);
+      continue;
+    }
+#endif
+    while (steps < max_steps && CanExecute()) {
+      Execute();
+      ++steps;
     }
   }
+  return {HasComputation() ? StopReason::kBudgetExhausted
+                           : StopReason::kFinished,
+          steps};
 }
 
+size_t Evaluator::forked_allocated_size() const {
+  size_t size = 0;
+  for (const ForkedCall& call : forked_calls_) {
+    size += call.allocator->allocated_size() +
+            call.child->forked_allocated_size();
+  }
+  return size;
+}
+
+void Evaluator::CheckMemory() {
+  if (allocator_->allocated_size() > arena_limit_) {
+    RelieveArenaPressure();
+  }
+  if (gc_.ShouldCollect(ctx_->store_size())) {
+    gc_.Collect(ctx_->store_size(), [this] { return CollectGarbage(); });
+  }
+}
+
+void Evaluator::Execute() {
+  auto cur_comp = allocator_->WrapPoolPtr(
+      ctx_->mutable_cur_ctx()->mutable_comp()->UnsafeArenaReleaseLast());
+  Computation* comp = cur_comp.get();
+  switch (comp->type_case()) {
+    case Computation::kExpRef:
+      Evaluate(*source_.exp[comp->exp_ref()]);
+      break;
+    case Computation::kStmtRef:
+      Evaluate(*source_.stmt[comp->stmt_ref()]);
+      break;
+    case Computation::kBinExpFinal:
+      Evaluate(*ReleaseFinal(
+          comp, &Computation::unsafe_arena_release_bin_exp_final));
+      break;
+    case Computation::kMonExpFinal:
+      Evaluate(*ReleaseFinal(
+          comp, &Computation::unsafe_arena_release_mon_exp_final));
+      break;
+    case Computation::kTupleExpFinal:
+      Evaluate(ReleaseFinal(comp,
+                            &Computation::unsafe_arena_release_tuple_exp_final)
+                   .get());
+      break;
+    case Computation::kIgnoreOneResult:
+      ReleaseFinal(comp, &Computation::unsafe_arena_release_ignore_one_result);
+      Release(PopResultOrDie());
+      break;
+    case Computation::kAssignStmtFinal:
+      ReleaseFinal(comp, &Computation::unsafe_arena_release_assign_stmt_final);
+      EvaluateAssignStmtFinal();
+      break;
+    case Computation::kFuncAppExpFinal:
+      Evaluate(ReleaseFinal(
+                   comp, &Computation::unsafe_arena_release_func_app_exp_final)
+                   .get());
+      break;
+    case Computation::kReturnFromCtx:
+      ReleaseFinal(comp, &Computation::unsafe_arena_release_return_from_ctx);
+      EvaluateReturnFromLocalContext();
+      break;
+    case Computation::kIfElseFinal:
+      Evaluate(ReleaseFinal(comp,
+                            &Computation::unsafe_arena_release_if_else_final)
+                   .get());
+      break;
+    case Computation::kPrintFinal:
+      ReleaseFinal(comp, &Computation::unsafe_arena_release_print_final);
+      EvaluatePrint();
+      break;
+    case Computation::kLoop:
+      EvaluateLoop(std::move(cur_comp));
+      break;
+    case Computation::TYPE_NOT_SET:
+      break;
+  }
+}
+
+#if STEINLANG_COMPUTED_GOTO
+int64_t Evaluator::RunThreaded(int64_t max_steps) {
+  // Indexed by Computation::TypeCase and Expression::TypeCase. Label addresses
+  // can't escape this function, so the tables are filled in on every call.
+  const void* comp_labels[Computation::kLoop + 1];
+  const void* exp_labels[Expression::kLambdaExp + 1];
+  std::fill(std::begin(comp_labels), std::end(comp_labels), &&not_set);
+  std::fill(std::begin(exp_labels), std::end(exp_labels), &&not_set);
+  comp_labels[Computation::kExpRef] = &&exp_ref;
+  comp_labels[Computation::kStmtRef] = &&stmt_ref;
+  comp_labels[Computation::kBinExpFinal] = &&bin_exp_final;
+  comp_labels[Computation::kMonExpFinal] = &&mon_exp_final;
+  comp_labels[Computation::kTupleExpFinal] = &&tuple_exp_final;
+  comp_labels[Computation::kIgnoreOneResult] = &&ignore_one_result;
+  comp_labels[Computation::kAssignStmtFinal] = &&assign_stmt_final;
+  comp_labels[Computation::kFuncAppExpFinal] = &&func_app_exp_final;
+  comp_labels[Computation::kReturnFromCtx] = &&return_from_ctx;
+  comp_labels[Computation::kIfElseFinal] = &&if_else_final;
+  comp_labels[Computation::kPrintFinal] = &&print_final;
+  comp_labels[Computation::kLoop] = &&loop;
+  exp_labels[Expression::kVarExp] = &&var_exp;
+  exp_labels[Expression::kLitExp] = &&lit_exp;
+  exp_labels[Expression::kFuncAppExp] = &&func_app_exp;
+  exp_labels[Expression::kMonArithExp] = &&mon_arith_exp;
+  exp_labels[Expression::kBinArithExp] = &&bin_arith_exp;
+  exp_labels[Expression::kTernExp] = &&tern_exp;
+  exp_labels[Expression::kTupleExp] = &&tuple_exp;
+  exp_labels[Expression::kLambdaExp] = &&lambda_exp;
+
+  int64_t steps = 0;
+  PoolPtr<Computation> cur_comp =
+      allocator_->WrapPoolPtr(static_cast<Computation*>(nullptr));
+  Computation* comp = nullptr;
+  const Expression* exp = nullptr;
+
+// Pop the next computation, returning the previous one to its pool, and jump
+// to its handler. Every handler ends with its own copy of this, so each has
+// its own indirect branch history.
+#define DISPATCH()                                                     \
+  do {                                                                 \
+    if (steps == max_steps || !CanExecute()) {                         \
+      goto done;                                                       \
+    }                                                                  \
+    ++steps;                                                           \
+    cur_comp.reset(                                                    \
+        ctx_->mutable_cur_ctx()->mutable_comp()->UnsafeArenaReleaseLast()); \
+    comp = cur_comp.get();                                             \
+    goto* comp_labels[comp->type_case()];                              \
+  } while (0)
+
+  DISPATCH();
+
+exp_ref:
+  exp = source_.exp[comp->exp_ref()];
+  goto* exp_labels[exp->type_case()];
+var_exp:
+  Evaluate(exp->var_exp());
+  DISPATCH();
+lit_exp:
+  Evaluate(exp->lit_exp());
+  DISPATCH();
+func_app_exp:
+  Evaluate(exp->func_app_exp(), exp->origin().source_id());
+  DISPATCH();
+mon_arith_exp:
+  Evaluate(exp->mon_arith_exp());
+  DISPATCH();
+bin_arith_exp:
+  Evaluate(exp->bin_arith_exp());
+  DISPATCH();
+tern_exp:
+  Evaluate(exp->tern_exp());
+  DISPATCH();
+tuple_exp:
+  Evaluate(exp->tuple_exp());
+  DISPATCH();
+lambda_exp:
+  Evaluate(exp->lambda_exp(), exp->origin().source_id());
+  DISPATCH();
+stmt_ref:
+  Evaluate(*source_.stmt[comp->stmt_ref()]);
+  DISPATCH();
+bin_exp_final:
+  Evaluate(
+      *ReleaseFinal(comp, &Computation::unsafe_arena_release_bin_exp_final));
+  DISPATCH();
+mon_exp_final:
+  Evaluate(
+      *ReleaseFinal(comp, &Computation::unsafe_arena_release_mon_exp_final));
+  DISPATCH();
+tuple_exp_final:
+  Evaluate(
+      ReleaseFinal(comp, &Computation::unsafe_arena_release_tuple_exp_final)
+          .get());
+  DISPATCH();
+ignore_one_result:
+  ReleaseFinal(comp, &Computation::unsafe_arena_release_ignore_one_result);
+  Release(PopResultOrDie());
+  DISPATCH();
+assign_stmt_final:
+  ReleaseFinal(comp, &Computation::unsafe_arena_release_assign_stmt_final);
+  EvaluateAssignStmtFinal();
+  DISPATCH();
+func_app_exp_final:
+  Evaluate(
+      ReleaseFinal(comp, &Computation::unsafe_arena_release_func_app_exp_final)
+          .get());
+  DISPATCH();
+return_from_ctx:
+  ReleaseFinal(comp, &Computation::unsafe_arena_release_return_from_ctx);
+  EvaluateReturnFromLocalContext();
+  DISPATCH();
+if_else_final:
+  Evaluate(ReleaseFinal(comp, &Computation::unsafe_arena_release_if_else_final)
+               .get());
+  DISPATCH();
+print_final:
+  ReleaseFinal(comp, &Computation::unsafe_arena_release_print_final);
+  EvaluatePrint();
+  DISPATCH();
+loop:
+  EvaluateLoop(std::move(cur_comp));
+  DISPATCH();
+not_set:
+  DISPATCH();
+
+#undef DISPATCH
+
+done:
+  cur_comp.reset();
+  return steps;
+}
+#endif  // STEINLANG_COMPUTED_GOTO
+
 PoolPtr<Literal> Evaluator::ValueOf(PoolPtr<Result> result) {
   switch (result->type_case()) {
     case Result::kRvalue:
       return allocator_->WrapPoolPtr(result->unsafe_arena_release_rvalue());
     case Result::kLvalueRef: {
       PoolPtr<Literal> lit = allocator_->Allocate<Literal>();
-      allocator_->Copy(ctx_->store(result->lvalue_ref()), lit.get());
+      allocator_->Copy(Load(result->lvalue_ref()), lit.get());
       return lit;
     }
     case Result::TYPE_NOT_SET:
@@ -110,10 +446,126 @@ const Literal& Evaluator::ValueOf(const Result& result) {
     case Result::kRvalue:
       return result.rvalue();
     case Result::kLvalueRef:
-      return ctx_->store(result.lvalue_ref());
+      return Load(result.lvalue_ref());
     case Result::TYPE_NOT_SET:
-      return *allocator_->Allocate<Literal>();
+      break;
+  }
+  return Literal::default_instance();
+}
+
+PoolPtr<Literal> Evaluator::TakeRvalue(PoolPtr<Result> a, PoolPtr<Result> b) {
+  if (a->has_rvalue()) {
+    Release(std::move(b));
+    return allocator_->WrapPoolPtr(a->unsafe_arena_release_rvalue());
+  } else if (b->has_rvalue()) {
+    return allocator_->WrapPoolPtr(b->unsafe_arena_release_rvalue());
+  }
+  return allocator_->Allocate<Literal>();
+}
+
+void Evaluator::RelieveArenaPressure() {
+  if (FLAGS_semispace_arena) {
+    if (gc_.enabled()) {
+      gc_.Collect(ctx_->store_size(), [this] { return CollectGarbage(); });
+    }
+    ctx_ = allocator_->Evacuate(ctx_);
+  } else {
+    EvalContext ctx_cpy = *ctx_;
+    allocator_->Reset();
+    ctx_ = allocator_->AllocateEvalContext();
+    *ctx_ = ctx_cpy;
+    SetProgram();
+  }
+  // Don't thrash if the live state alone is near the limit.
+  arena_limit_ = std::max<size_t>(FLAGS_max_arena_allocation_usage,
+                                  2 * allocator_->allocated_size());
+}
+
+void Evaluator::LoadStoreLazily(std::unique_ptr<StoreSource> source) {
+  store_source_ = std::move(source);
+  unloaded_.assign(ctx_->store_size(), true);
+}
+
+void Evaluator::MaterializeStore() {
+  const int64_t store_size = unloaded_.size();
+  for (int64_t addr = 0; addr < store_size; ++addr) {
+    Materialize(addr);
+  }
+  unloaded_.clear();
+  store_source_.reset();
+}
+
+void Evaluator::TrackStoreWrites() {
+  track_writes_ = true;
+  written_.clear();
+}
+
+std::vector<int64_t> Evaluator::TakeStoreWrites() {
+  std::vector<int64_t> addrs;
+  const int64_t num_written = written_.size();
+  for (int64_t addr = 0; addr < num_written; ++addr) {
+    if (written_[addr] && addr < ctx_->store_size()) {
+      addrs.push_back(addr);
+    }
+  }
+  written_.clear();
+  return addrs;
+}
+
+int64_t Evaluator::CollectGarbage() {
+  auto* store = ctx_->mutable_store();
+  // Marking reads every live value of a lazily loaded store, and nothing
+  // else, so dead values are never loaded.
+  StoreCollector<Literal> gc(store->size(), [this, store](int64_t addr) {
+    Materialize(addr);
+    return store->Mutable(addr);
+  });
+
+  // The roots are the env and the pending results of every frame.
+  std::vector<LocalContext*> frames = {ctx_->mutable_cur_ctx()};
+  for (LocalContext& saved : *ctx_->mutable_saved_ctx()) {
+    frames.push_back(&saved);
+  }
+  // Marking every pinned address keeps them in place.
+  for (int64_t addr = 0; addr < pinned_store_size_; ++addr) {
+    gc.MarkAddress(addr);
+  }
+  for (const LocalContext* frame : frames) {
+    for (int64_t addr : frame->env()) {
+      gc.MarkAddress(addr);
+    }
+    for (const Result& result : frame->result()) {
+      if (result.has_lvalue_ref()) {
+        gc.MarkAddress(result.lvalue_ref());
+      } else if (result.has_rvalue()) {
+        gc.MarkValue(result.rvalue());
+      }
+    }
+  }
+
+  unloaded_.clear();
+  store_source_.reset();
+  const int64_t live = gc.Compact();
+  // Live values may have moved.
+  for (int64_t addr = 0; addr < live; ++addr) {
+    RecordWrite(addr);
+  }
+  for (LocalContext* frame : frames) {
+    for (int64_t& addr : *frame->mutable_env()) {
+      gc.Forward(&addr);
+    }
+    for (Result& result : *frame->mutable_result()) {
+      if (result.has_lvalue_ref()) {
+        result.set_lvalue_ref(gc.Forward(result.lvalue_ref()));
+      } else if (result.has_rvalue()) {
+        gc.Forward(result.mutable_rvalue());
+      }
+    }
+  }
+  while (store->size() > live) {
+    allocator_->WrapPoolPtr(store->UnsafeArenaReleaseLast());
   }
+  return live;
 }
 
 void Evaluator::SaveLocalContext() {
@@ -129,97 +581,147 @@ void Evaluator::RestoreLocalContext() {
       ctx_->mutable_saved_ctx()->UnsafeArenaReleaseLast());
 }
 
-void Evaluator::Evaluate(PoolPtr<Expression> exp) {
-  switch (exp->type_case()) {
+void Evaluator::ReplaceLocalContext() {
+  auto old_ctx = allocator_->WrapPoolPtr(ctx_->unsafe_arena_release_cur_ctx());
+  ctx_->unsafe_arena_set_allocated_cur_ctx(
+      allocator_->Allocate<LocalContext>().release());
+}
+
+bool Evaluator::InTailPosition() const {
+  const LocalContext& cur = ctx_->cur_ctx();
+  return ctx_->saved_ctx_size() > 0 && cur.comp_size() > 0 &&
+         cur.comp(cur.comp_size() - 1).has_return_from_ctx();
+}
+
+void Evaluator::Evaluate(const Expression& exp) {
+  switch (exp.type_case()) {
     case Expression::kVarExp:
-      Evaluate(exp->var_exp());
+      Evaluate(exp.var_exp());
       break;
     case Expression::kLitExp:
-      Evaluate(allocator_->WrapPoolPtr(exp->unsafe_arena_release_lit_exp()));
+      Evaluate(exp.lit_exp());
       break;
     case Expression::kFuncAppExp:
-      Evaluate(exp->unsafe_arena_release_func_app_exp());
+      Evaluate(exp.func_app_exp(), exp.origin().source_id());
       break;
     case Expression::kMonArithExp:
-      Evaluate(exp->unsafe_arena_release_mon_arith_exp());
+      Evaluate(exp.mon_arith_exp());
       break;
     case Expression::kBinArithExp:
-      Evaluate(exp->unsafe_arena_release_bin_arith_exp());
+      Evaluate(exp.bin_arith_exp());
       break;
     case Expression::kTernExp:
-      Evaluate(exp->unsafe_arena_release_tern_exp());
+      Evaluate(exp.tern_exp());
       break;
     case Expression::kTupleExp:
-      Evaluate(exp->unsafe_arena_release_tuple_exp());
+      Evaluate(exp.tuple_exp());
       break;
     case Expression::kLambdaExp:
-      Evaluate(exp->unsafe_arena_release_lambda_exp());
+      Evaluate(exp.lambda_exp(), exp.origin().source_id());
       break;
     case Expression::TYPE_NOT_SET:
       break;
   }
 }
 
-void Evaluator::Evaluate(BinArithExpression* bin_exp) {
-  Schedule()->mutable_bin_exp_final()->set_op(bin_exp->op());
-  Schedule()->unsafe_arena_set_allocated_exp(
-      bin_exp->unsafe_arena_release_rhs());
-  Schedule()->unsafe_arena_set_allocated_exp(
-      bin_exp->unsafe_arena_release_lhs());
+void Evaluator::Evaluate(const BinArithExpression& bin_exp) {
+  if (bin_exp.fused()) {
+    PoolPtr<Literal> out = allocator_->Allocate<Literal>();
+    EvaluateFused(bin_exp, out.get());
+    AddResult()->unsafe_arena_set_allocated_rvalue(out.release());
+    return;
+  }
+  ScheduleFinal(&Computation::unsafe_arena_set_allocated_bin_exp_final)
+      ->set_op(bin_exp.op());
+  if (fork_pool_ != nullptr && Fork({&bin_exp.lhs(), &bin_exp.rhs()})) {
+    return;
+  }
+  ScheduleRef(bin_exp.rhs());
+  ScheduleRef(bin_exp.lhs());
 }
 
-void Evaluator::Evaluate(const BinExpFinal& fnl) {
-  PoolPtr<Literal> rhs = ValueOf(PopResultOrDie());
-  PoolPtr<Literal> lhs = ValueOf(PopResultOrDie());
-  Result* result = AddResult();
-  switch (fnl.op()) {
-    case BinArithOp::ADD:
-      Add(lhs.get(), rhs.get());
-      break;
-    case BinArithOp::SUB:
-      Sub(lhs.get(), rhs.get());
-      break;
-    case BinArithOp::MUL:
-      Mul(lhs.get(), rhs.get());
-      break;
-    case BinArithOp::DIV:
-      Div(lhs.get(), rhs.get());
-      break;
-    case BinArithOp::GT:
-      CompareGt(lhs.get(), rhs.get());
-      break;
-    case BinArithOp::GE:
-      CompareGe(lhs.get(), rhs.get());
-      break;
-    case BinArithOp::LT:
-      CompareLt(lhs.get(), rhs.get());
-      break;
-    case BinArithOp::LE:
-      CompareLe(lhs.get(), rhs.get());
-      break;
-    case BinArithOp::EQ:
-      CompareEq(lhs.get(), rhs.get());
-      break;
-    case BinArithOp::NE:
-      CompareNe(lhs.get(), rhs.get());
+const Literal& Evaluator::Operand(const Expression& exp) {
+  return exp.has_var_exp() ? Load(Lookup(exp.var_exp().slot()))
+                           : exp.lit_exp();
+}
+
+void Evaluator::EvaluateFused(const BinArithExpression& bin_exp, Literal* out) {
+  // Like evaluating lhs, then rhs, then their BinExpFinal. Looking up rhs may
+  // add to the store, but store Literals don't move.
+  const Literal& x = Operand(bin_exp.lhs());
+  const Literal& y = Operand(bin_exp.rhs());
+  switch (GetOperandTypes(x, y)) {
+    case OperandTypes::kIntInt:
+      IntBinOp(bin_exp.op(), x.int_val(), y.int_val(), out);
       break;
-    case BinArithOp::AND:
-      BoolAnd(lhs.get(), rhs.get());
+    case OperandTypes::kFloatFloat:
+    case OperandTypes::kMixed:
+      FloatBinOp(bin_exp.op(), AsFloat(x), AsFloat(y), out);
       break;
-    case BinArithOp::OR:
-      BoolOr(lhs.get(), rhs.get());
+    case OperandTypes::kOther: {
+      PoolPtr<Literal> rhs = allocator_->Allocate<Literal>();
+      allocator_->Copy(y, rhs.get());
+      allocator_->Copy(x, out);
+      BinOp(bin_exp.op(), out, rhs.get());
       break;
-    default:
-      lhs.reset();
+    }
+  }
+}
+
+void Evaluator::EvaluateFused(const AssignStatement& assign_stmt) {
+  // Like evaluating lhs, then rhs, then their AssignStmtFinal.
+  const int64_t addr = Lookup(assign_stmt.lhs().var_exp().slot());
+  const Expression& rhs = assign_stmt.rhs();
+  PoolPtr<Literal> value = allocator_->Allocate<Literal>();
+  if (rhs.has_bin_arith_exp()) {
+    EvaluateFused(rhs.bin_arith_exp(), value.get());
+  } else {
+    allocator_->Copy(Operand(rhs), value.get());
+  }
+  Overwrite(addr)->UnsafeArenaSwap(value.get());
+}
+
+void Evaluator::Evaluate(const BinExpFinal& fnl) {
+  PoolPtr<Result> rhs_result = PopResultOrDie();
+  PoolPtr<Result> lhs_result = PopResultOrDie();
+  const Literal& x = ValueOf(*lhs_result);
+  const Literal& y = ValueOf(*rhs_result);
+  // Numbers are read in place, rather than copied out of the store, and the
+  // result reuses an operand's Literal if it's an rvalue.
+  switch (GetOperandTypes(x, y)) {
+    case OperandTypes::kIntInt: {
+      const int64_t a = x.int_val();
+      const int64_t b = y.int_val();
+      PoolPtr<Literal> out = TakeRvalue(std::move(lhs_result),
+                                        std::move(rhs_result));
+      IntBinOp(fnl.op(), a, b, out.get());
+      AddResult()->unsafe_arena_set_allocated_rvalue(out.release());
+      return;
+    }
+    case OperandTypes::kFloatFloat:
+    case OperandTypes::kMixed: {
+      const float a = AsFloat(x);
+      const float b = AsFloat(y);
+      PoolPtr<Literal> out = TakeRvalue(std::move(lhs_result),
+                                        std::move(rhs_result));
+      FloatBinOp(fnl.op(), a, b, out.get());
+      AddResult()->unsafe_arena_set_allocated_rvalue(out.release());
+      return;
+    }
+    case OperandTypes::kOther:
       break;
   }
-  result->unsafe_arena_set_allocated_rvalue(lhs.release());
+
+  PoolPtr<Literal> rhs = ValueOf(std::move(rhs_result));
+  PoolPtr<Literal> lhs = ValueOf(std::move(lhs_result));
+  BinOp(fnl.op(), lhs.get(), rhs.get());
+  AddResult()->unsafe_arena_set_allocated_rvalue(lhs.release());
 }
 
-void Evaluator::Evaluate(MonArithExpression* mon_exp) {
-  Schedule()->mutable_mon_exp_final()->set_op(mon_exp->op());
-  Schedule()->unsafe_arena_set_allocated_exp(
-      mon_exp->unsafe_arena_release_exp());
+void Evaluator::Evaluate(const MonArithExpression& mon_exp) {
+  ScheduleFinal(&Computation::unsafe_arena_set_allocated_mon_exp_final)
+      ->set_op(mon_exp.op());
+  ScheduleRef(mon_exp.exp());
 }
 
 void Evaluator::Evaluate(const MonExpFinal& fnl) {
@@ -239,196 +741,469 @@ void Evaluator::Evaluate(const MonExpFinal& fnl) {
   result->unsafe_arena_set_allocated_rvalue(arg_v.release());
 }
 
-void Evaluator::Evaluate(TupleExpression* tuple_exp) {
-  Schedule()->mutable_tuple_exp_final()->set_size(tuple_exp->exp_size());
+void Evaluator::Evaluate(const TupleExpression& tuple_exp) {
+  ScheduleFinal(&Computation::unsafe_arena_set_allocated_tuple_exp_final)
+      ->set_size(tuple_exp.exp_size());
+  if (fork_pool_ != nullptr) {
+    std::vector<const Expression*> exps;
+    for (int i = tuple_exp.exp_size(); i-- > 0;) {
+      exps.push_back(&tuple_exp.exp(i));
+    }
+    if (Fork(exps)) {
+      return;
+    }
+  }
   // This makes the evaluation order right --> left, but it means the evaluated
   // results can be popped off in order.
-  std::vector<Expression*> es;
-  for (int i = tuple_exp->exp_size(); i-- > 0;) {
-    es.push_back(tuple_exp->mutable_exp()->UnsafeArenaReleaseLast());
-  }
-  for (int i = es.size(); i-- > 0;) {
-    Schedule()->unsafe_arena_set_allocated_exp(es[i]);
+  for (const Expression& e : tuple_exp.exp()) {
+    ScheduleRef(e);
   }
 }
 
 void Evaluator::Evaluate(TupleExpFinal* fnl) {
-  Result* result = AddResult();
+  PoolPtr<Literal> tuple = allocator_->Allocate<Literal>();
+  tuple->mutable_tuple_val();
   for (int i = 0; i < fnl->size(); ++i) {
     PoolPtr<Literal> elem_val = ValueOf(PopResultOrDie());
-    result->mutable_rvalue()
-        ->mutable_tuple_val()
-        ->mutable_elem()
-        ->UnsafeArenaAddAllocated(elem_val.release());
+    tuple->mutable_tuple_val()->mutable_elem()->UnsafeArenaAddAllocated(
+        elem_val.release());
   }
+  AddResult()->unsafe_arena_set_allocated_rvalue(tuple.release());
 }
 
-void Evaluator::Evaluate(LambdaExpression* lambda_exp) {
-  Closure* closure = AddResult()->mutable_rvalue()->mutable_closure_val();
-  closure->mutable_param()->UnsafeArenaSwap(lambda_exp->mutable_param());
-  closure->mutable_body()->UnsafeArenaSwap(lambda_exp->mutable_body());
-  *closure->mutable_env() = ctx_->cur_ctx().env();
+void Evaluator::Evaluate(const LambdaExpression& lambda_exp,
+                         int64_t source_id) {
+  PoolPtr<Literal> val = allocator_->Allocate<Literal>();
+  Closure* closure = val->mutable_closure_val();
+  closure->set_lambda_id(source_id);
+  const auto& env = ctx_->cur_ctx().env();
+  for (int enclosing_slot : lambda_exp.layout().capture()) {
+    closure->add_capture(enclosing_slot < env.size() ? env.Get(enclosing_slot)
+                                                     : -1);
+  }
+  AddResult()->unsafe_arena_set_allocated_rvalue(val.release());
 }
 
-void Evaluator::Evaluate(Statement* stmt) {
-  switch (stmt->type_case()) {
+void Evaluator::Evaluate(const Statement& stmt) {
+  switch (stmt.type_case()) {
     case Statement::kExpStmt:
-      Schedule()->mutable_ignore_one_result();
-      Schedule()->unsafe_arena_set_allocated_exp(
-          stmt->unsafe_arena_release_exp_stmt());
+      ScheduleFinal(&Computation::unsafe_arena_set_allocated_ignore_one_result);
+      ScheduleRef(stmt.exp_stmt());
       break;
     case Statement::kAssignStmt:
-      Schedule()->mutable_assign_stmt_final();
-      Schedule()->unsafe_arena_set_allocated_exp(
-          stmt->mutable_assign_stmt()->unsafe_arena_release_rhs());
-      Schedule()->unsafe_arena_set_allocated_exp(
-          stmt->mutable_assign_stmt()->unsafe_arena_release_lhs());
+      if (stmt.assign_stmt().fused()) {
+        EvaluateFused(stmt.assign_stmt());
+        break;
+      }
+      ScheduleFinal(&Computation::unsafe_arena_set_allocated_assign_stmt_final);
+      ScheduleRef(stmt.assign_stmt().rhs());
+      ScheduleRef(stmt.assign_stmt().lhs());
       break;
     case Statement::kRetStmt:
-      Schedule()->mutable_return_from_ctx();
-      Schedule()->unsafe_arena_set_allocated_exp(
-          stmt->unsafe_arena_release_ret_stmt());
+      ScheduleFinal(&Computation::unsafe_arena_set_allocated_return_from_ctx);
+      ScheduleRef(stmt.ret_stmt());
       break;
     case Statement::kPrintStmt:
-      Schedule()->mutable_print_final();
-      Schedule()->unsafe_arena_set_allocated_exp(
-          stmt->unsafe_arena_release_print_stmt());
+      ScheduleFinal(&Computation::unsafe_arena_set_allocated_print_final);
+      ScheduleRef(stmt.print_stmt());
       break;
     case Statement::kIfElseStmt:
-      Evaluate(stmt->mutable_if_else_stmt());
+      Evaluate(stmt.if_else_stmt());
       break;
     case Statement::kWhileStmt:
-      Evaluate(stmt->mutable_while_stmt());
+      Evaluate(stmt.while_stmt(), stmt.origin().source_id());
       break;
     case Statement::kForStmt:
-      Evaluate(stmt->mutable_for_stmt());
+      Evaluate(stmt.for_stmt(), stmt.origin().source_id());
       break;
     case Statement::TYPE_NOT_SET:
       break;
   }
 }
 
-void Evaluator::Evaluate(IfElseStatement* stmt) {
-  IfElseFinal* fnl = Schedule()->mutable_if_else_final();
-  google::protobuf::RepeatedPtrField<Computation> reversed_comps;
-  while (!stmt->if_stmts().empty()) {
-    PoolPtr<Computation> if_comp = allocator_->Allocate<Computation>();
-    if_comp->unsafe_arena_set_allocated_stmt(
-        stmt->mutable_if_stmts()->UnsafeArenaReleaseLast());
-    reversed_comps.UnsafeArenaAddAllocated(if_comp.release());
-  }
-  while (!reversed_comps.empty()) {
-    fnl->mutable_if_case()->UnsafeArenaAddAllocated(
-        reversed_comps.UnsafeArenaReleaseLast());
-  }
-  while (!stmt->else_stmts().empty()) {
-    PoolPtr<Computation> else_comp = allocator_->Allocate<Computation>();
-    else_comp->unsafe_arena_set_allocated_stmt(
-        stmt->mutable_else_stmts()->UnsafeArenaReleaseLast());
-    reversed_comps.UnsafeArenaAddAllocated(else_comp.release());
+void Evaluator::Evaluate(const IfElseStatement& stmt) {
+  IfElseFinal* fnl =
+      ScheduleFinal(&Computation::unsafe_arena_set_allocated_if_else_final);
+  for (const Statement& s : stmt.if_stmts()) {
+    AddRef(s, fnl->mutable_if_case());
   }
-  while (!reversed_comps.empty()) {
-    fnl->mutable_else_case()->UnsafeArenaAddAllocated(
-        reversed_comps.UnsafeArenaReleaseLast());
+  for (const Statement& s : stmt.else_stmts()) {
+    AddRef(s, fnl->mutable_else_case());
   }
-
-  Schedule()->unsafe_arena_set_allocated_exp(stmt->unsafe_arena_release_cond());
+  ScheduleRef(stmt.cond());
 }
 
-void Evaluator::Evaluate(WhileStatement* while_stmt) {
-  // TODO: while is implemented by unrolling. This won't work for hotswapping.
-  PoolPtr<Expression> cond_cpy = allocator_->Allocate<Expression>();
-  allocator_->Copy(while_stmt->cond(), cond_cpy.get());
-
-  IfElseFinal* fnl = Schedule()->mutable_if_else_final();
-  for (const Statement& s : while_stmt->body()) {
-    PoolPtr<Computation> comp = allocator_->Allocate<Computation>();
-    allocator_->Copy(s, comp->mutable_stmt());
-    fnl->mutable_if_case()->UnsafeArenaAddAllocated(comp.release());
-  }
-  PoolPtr<Computation> repeat_while_stmt = allocator_->Allocate<Computation>();
-  repeat_while_stmt->mutable_stmt()->mutable_while_stmt()->UnsafeArenaSwap(while_stmt);
-  fnl->mutable_if_case()->UnsafeArenaAddAllocated(repeat_while_stmt.release());
+void Evaluator::Evaluate(const WhileStatement&, int64_t source_id) {
+  ScheduleFinal(&Computation::unsafe_arena_set_allocated_loop)
+      ->set_source_id(source_id);
+}
 
-  Schedule()->unsafe_arena_set_allocated_exp(cond_cpy.release());
+void Evaluator::Evaluate(const ForStatement& for_stmt, int64_t source_id) {
+  ScheduleFinal(&Computation::unsafe_arena_set_allocated_loop)
+      ->set_source_id(source_id);
+  ScheduleRef(for_stmt.init());
 }
 
-void Evaluator::Evaluate(ForStatement* for_stmt) {
-  // TODO: for is implemented by desugaring to while. This won't work for
-  // hotswapping.
-  WhileStatement* while_stmt = Schedule()->mutable_stmt()->mutable_while_stmt();
-  while_stmt->unsafe_arena_set_allocated_cond(
-      for_stmt->unsafe_arena_release_cond());
-  while_stmt->mutable_body()->UnsafeArenaSwap(for_stmt->mutable_body());
-  while_stmt->mutable_body()->UnsafeArenaAddAllocated(
-      for_stmt->unsafe_arena_release_inc());
+void Evaluator::EvaluateLoop(PoolPtr<Computation> comp) {
+  LoopFrame* loop = comp->mutable_loop();
+  const Statement& stmt = *source_.stmt[loop->source_id()];
+  const bool is_for = stmt.has_for_stmt();
+  const auto& body =
+      is_for ? stmt.for_stmt().body() : stmt.while_stmt().body();
+  switch (loop->stage()) {
+    case LoopFrame::BRANCH: {
+      PoolPtr<Result> cond = PopResultOrDie();
+      const bool cond_val = ValueOf(*cond).bool_val();
+      Release(std::move(cond));
+      if (!cond_val) {
+        ReleaseFinal(comp.get(), &Computation::unsafe_arena_release_loop);
+        return;
+      }
+      loop->set_stage(LoopFrame::BODY);
+      loop->set_body_index(0);
+      break;
+    }
+    case LoopFrame::BODY:
+      break;
+    case LoopFrame::COND:
+    default:
+      loop->set_stage(LoopFrame::BRANCH);
+      ScheduleAllocated(comp.release());
+      ScheduleRef(is_for ? stmt.for_stmt().cond() : stmt.while_stmt().cond());
+      return;
+  }
 
-  Schedule()->unsafe_arena_set_allocated_stmt(for_stmt->unsafe_arena_release_init());
+  // The loop frame goes back on the stack underneath the next body statement.
+  const int i = loop->body_index();
+  if (i < body.size()) {
+    loop->set_body_index(i + 1);
+    ScheduleAllocated(comp.release());
+    ScheduleRef(body.Get(i));
+  } else {
+    loop->set_stage(LoopFrame::COND);
+    ScheduleAllocated(comp.release());
+    if (is_for) {
+      ScheduleRef(stmt.for_stmt().inc());
+    }
+  }
 }
 
 void Evaluator::EvaluateAssignStmtFinal() {
   PoolPtr<Literal> rhs_val = ValueOf(PopResultOrDie());
   PoolPtr<Result> lhs_result = PopResultOrDie();
-  ctx_->mutable_store(lhs_result->lvalue_ref())->UnsafeArenaSwap(rhs_val.get());
+  Overwrite(lhs_result->lvalue_ref())->UnsafeArenaSwap(rhs_val.get());
 }
 
-void Evaluator::Evaluate(TernaryExpression* tern_exp) {
-  IfElseFinal* fnl = Schedule()->mutable_if_else_final();
+void Evaluator::Evaluate(const TernaryExpression& tern_exp) {
+  IfElseFinal* fnl =
+      ScheduleFinal(&Computation::unsafe_arena_set_allocated_if_else_final);
   PoolPtr<Computation> if_comp = allocator_->Allocate<Computation>();
-  if_comp->unsafe_arena_set_allocated_exp(
-      tern_exp->unsafe_arena_release_if_exp());
+  if_comp->set_exp_ref(tern_exp.if_exp().origin().source_id());
   fnl->mutable_if_case()->UnsafeArenaAddAllocated(if_comp.release());
   PoolPtr<Computation> else_comp = allocator_->Allocate<Computation>();
-  else_comp->unsafe_arena_set_allocated_exp(
-      tern_exp->unsafe_arena_release_else_exp());
+  else_comp->set_exp_ref(tern_exp.else_exp().origin().source_id());
   fnl->mutable_else_case()->UnsafeArenaAddAllocated(else_comp.release());
-  Schedule()->unsafe_arena_set_allocated_exp(
-      tern_exp->unsafe_arena_release_cond_exp());
+  ScheduleRef(tern_exp.cond_exp());
 }
 
 void Evaluator::Evaluate(IfElseFinal* fnl) {
-  PoolPtr<Literal> cond_val = ValueOf(PopResultOrDie());
-  if (cond_val->bool_val()) {
-    while (!fnl->if_case().empty()) {
-      ScheduleAllocated(fnl->mutable_if_case()->UnsafeArenaReleaseLast());
-    }
-  } else {
-    while (!fnl->else_case().empty()) {
-      ScheduleAllocated(fnl->mutable_else_case()->UnsafeArenaReleaseLast());
-    }
+  PoolPtr<Result> cond = PopResultOrDie();
+  const bool cond_val = ValueOf(*cond).bool_val();
+  Release(std::move(cond));
+  auto* taken = cond_val ? fnl->mutable_if_case() : fnl->mutable_else_case();
+  auto* not_taken = cond_val ? fnl->mutable_else_case() : fnl->mutable_if_case();
+  while (!taken->empty()) {
+    ScheduleAllocated(taken->UnsafeArenaReleaseLast());
+  }
+  while (!not_taken->empty()) {
+    allocator_->WrapPoolPtr(not_taken->UnsafeArenaReleaseLast());
   }
 }
 
-void Evaluator::Evaluate(FuncAppExpression* func_app_exp) {
-  Schedule()->mutable_func_app_exp_final()->set_num_args(
-      func_app_exp->arg_size());
-  Schedule()->unsafe_arena_set_allocated_exp(
-      func_app_exp->unsafe_arena_release_func());
-  for (int i = func_app_exp->arg_size(); i-- > 0;) {
-    Schedule()->unsafe_arena_set_allocated_exp(
-        func_app_exp->mutable_arg()->UnsafeArenaReleaseLast());
+void Evaluator::Evaluate(const FuncAppExpression& func_app_exp,
+                         int64_t source_id) {
+  FuncAppExpFinal* fnl =
+      ScheduleFinal(&Computation::unsafe_arena_set_allocated_func_app_exp_final);
+  fnl->set_num_args(func_app_exp.arg_size());
+  fnl->set_source_id(source_id);
+  ScheduleRef(func_app_exp.func());
+  if (fork_pool_ != nullptr) {
+    std::vector<const Expression*> args;
+    for (const Expression& arg : func_app_exp.arg()) {
+      args.push_back(&arg);
+    }
+    if (Fork(args)) {
+      return;
+    }
+  }
+  for (int i = func_app_exp.arg_size(); i-- > 0;) {
+    ScheduleRef(func_app_exp.arg(i));
   }
 }
 
 void Evaluator::Evaluate(FuncAppExpFinal* fnl) {
-  PoolPtr<Literal> func_val = ValueOf(PopResultOrDie());
-  Closure* closure = func_val->mutable_closure_val();
+  PoolPtr<Result> func_result = PopResultOrDie();
+  const Closure& closure = ValueOf(*func_result).closure_val();
   std::vector<PoolPtr<Literal>> arg_results;
   for (int i = 0; i < fnl->num_args(); ++i) {
     arg_results.emplace(arg_results.begin(), ValueOf(PopResultOrDie()));
   }
+  CallTarget target;
+  if (const CallTarget* cached =
+          call_cache_.Lookup(fnl->source_id(), closure.lambda_id())) {
+    target = *cached;
+  } else if (ResolveCall(closure.lambda_id(), &target)) {
+    call_cache_.Insert(fnl->source_id(), closure.lambda_id(), target);
+  } else {
+    PoolPtr<Literal> none = allocator_->Allocate<Literal>();
+    none->set_none_val(true);
+    AddResult()->unsafe_arena_set_allocated_rvalue(none.release());
+    Release(std::move(func_result));
+    return;
+  }
+  const LambdaExpression& lambda_exp = *target.lambda;
 
-  SaveLocalContext();
-  *ctx_->mutable_cur_ctx()->mutable_env() = closure->env();
-  for (int i = 0; i < fnl->num_args(); ++i) {
-    const std::string& param_name = closure->param(i).name();
-    Assign(param_name, std::move(arg_results[i]));
+  std::string memo_key;
+  if (memo_.enabled() && MemoKey(closure, arg_results, &memo_key)) {
+    if (const Literal* cached = memo_.Lookup(closure.lambda_id(), memo_key)) {
+      PoolPtr<Literal> val = allocator_->Allocate<Literal>();
+      allocator_->Copy(*cached, val.get());
+      AddResult()->unsafe_arena_set_allocated_rvalue(val.release());
+      Release(std::move(func_result));
+      return;
+    }
+  }
+
+  if (InTailPosition()) {
+    // The caller would return the callee's result as soon as it gets it, so
+    // the callee takes over the caller's LocalContext instead of saving it.
+    // Tail recursion then runs in constant frame memory.
+    ReplaceLocalContext();
+  } else {
+    SaveLocalContext();
+  }
+  auto* env = ctx_->mutable_cur_ctx()->mutable_env();
+  env->CopyFrom(closure.capture());
+  // Size the frame up front, so binding the parameters doesn't grow it.
+  if (env->size() < target.frame_size) {
+    env->Resize(target.frame_size, -1);
+  }
+  ctx_->mutable_cur_ctx()->set_lambda_id(closure.lambda_id());
+  if (!memo_key.empty()) {
+    ctx_->mutable_cur_ctx()->set_memo_key(std::move(memo_key));
   }
-  Schedule()->mutable_return_from_ctx();
-  for (int i = closure->body_size(); i-- > 0;) {
-    Schedule()->unsafe_arena_set_allocated_stmt(
-        closure->mutable_body()->UnsafeArenaReleaseLast());
+  for (int i = 0; i < fnl->num_args() && i < lambda_exp.param_size(); ++i) {
+    Assign(lambda_exp.param(i).slot(), std::move(arg_results[i]));
+  }
+  ScheduleFinal(&Computation::unsafe_arena_set_allocated_return_from_ctx);
+  for (int i = lambda_exp.body_size(); i-- > 0;) {
+    ScheduleRef(lambda_exp.body(i));
+  }
+  Release(std::move(func_result));
+}
+
+bool Evaluator::ResolveCall(int64_t lambda_id, CallTarget* target) const {
+  const Expression* lambda = nullptr;
+  if (static_cast<size_t>(lambda_id) < source_.exp.size()) {
+    lambda = source_.exp[lambda_id];
+  }
+  if (lambda == nullptr || !lambda->has_lambda_exp()) {
+    return false;
+  }
+  target->lambda = &lambda->lambda_exp();
+  target->frame_size = lambda->lambda_exp().layout().name_size();
+  return true;
+}
+
+const google::protobuf::RepeatedField<int64_t>* Evaluator::ClosureAt(
+    int64_t addr, int64_t* lambda_id) const {
+  const Literal& lit = Load(addr);
+  if (!lit.has_closure_val()) {
+    return nullptr;
   }
+  *lambda_id = lit.closure_val().lambda_id();
+  return &lit.closure_val().capture();
+}
+
+bool Evaluator::MemoKey(const Closure& closure,
+                        const std::vector<PoolPtr<Literal>>& args,
+                        std::string* key) const {
+  std::vector<int64_t> reads;
+  const auto closure_at = [this](int64_t addr, int64_t* lambda_id) {
+    return ClosureAt(addr, lambda_id);
+  };
+  if (!pure_lambdas_->IsPure(closure.lambda_id(), closure.capture(),
+                             closure_at, &reads)) {
+    return false;
+  }
+  Literal key_lit;
+  Tuple* tuple = key_lit.mutable_tuple_val();
+  for (const PoolPtr<Literal>& arg : args) {
+    *tuple->add_elem() = *arg;
+  }
+  for (int64_t addr : reads) {
+    *tuple->add_elem() = Load(addr);
+  }
+  return key_lit.SerializeToString(key);
+}
+
+bool Evaluator::Fork(const std::vector<const Expression*>& exps) {
+  if (exps.size() < 2) {
+    return false;
+  }
+  std::vector<ForkedCall> calls(exps.size());
+  for (size_t i = 0; i < exps.size(); ++i) {
+    if (!PrepareFork(*exps[i], &calls[i])) {
+      return false;
+    }
+  }
+  for (ForkedCall& call : calls) {
+    StartForked(&call);
+  }
+  forked_calls_ = std::move(calls);
+  ++fork_stats_.forks;
+  return true;
+}
+
+bool Evaluator::PrepareFork(const Expression& exp, ForkedCall* call) const {
+  if (!exp.has_func_app_exp() || !exp.func_app_exp().func().has_var_exp()) {
+    return false;
+  }
+  const int func_slot = exp.func_app_exp().func().var_exp().slot();
+  std::vector<int> slots = {func_slot};
+  for (const Expression& arg : exp.func_app_exp().arg()) {
+    if (!OnlyReads(arg, &slots)) {
+      return false;
+    }
+  }
+  // Looking up an unbound variable would bind it, in the child's frame rather
+  // than in this one.
+  const auto& env = ctx_->cur_ctx().env();
+  std::vector<int64_t>* addrs = &call->addrs;
+  for (int slot : slots) {
+    if (slot >= env.size() || env.Get(slot) < 0) {
+      return false;
+    }
+    if (std::find(addrs->begin(), addrs->end(), env.Get(slot)) ==
+        addrs->end()) {
+      addrs->push_back(env.Get(slot));
+    }
+  }
+  const Literal& func = Load(env.Get(func_slot));
+  const auto closure_at = [this](int64_t addr, int64_t* lambda_id) {
+    return ClosureAt(addr, lambda_id);
+  };
+  if (!func.has_closure_val() ||
+      !pure_lambdas_->IsPure(func.closure_val().lambda_id(),
+                             func.closure_val().capture(), closure_at,
+                             addrs)) {
+    return false;
+  }
+
+  // Copy the values the call may read. Closures among them must only capture
+  // each other, so that their captures can be forwarded to the copies.
+  std::unordered_map<int64_t, int64_t> child_addr;
+  for (size_t i = 0; i < addrs->size(); ++i) {
+    child_addr[(*addrs)[i]] = i;
+  }
+  for (int64_t addr : *addrs) {
+    Literal value = Load(addr);
+    bool closed = true;
+    ForEachCapture(value, [&](int64_t captured) {
+      closed = closed && (captured < 0 || child_addr.count(captured) > 0);
+    });
+    if (!closed) {
+      return false;
+    }
+    ForwardCaptures(&value, [&](int64_t captured) {
+      return captured < 0 ? captured : child_addr[captured];
+    });
+    call->store.push_back(std::move(value));
+  }
+  call->env.assign(env.size(), -1);
+  for (int slot : slots) {
+    call->env[slot] = child_addr[env.Get(slot)];
+  }
+  call->exp = &exp;
+  call->lambda_id = ctx_->cur_ctx().lambda_id();
+  return true;
+}
+
+void Evaluator::StartForked(ForkedCall* call) const {
+  call->allocator = std::make_unique<PoolingArenaAllocator>();
+  EvalContext* ctx = call->allocator->AllocateEvalContext();
+  for (Literal& value : call->store) {
+    ctx->add_store()->Swap(&value);
+  }
+  LocalContext* local = ctx->mutable_cur_ctx();
+  for (int64_t addr : call->env) {
+    local->add_env(addr);
+  }
+  local->set_lambda_id(call->lambda_id);
+  local->add_comp()->set_exp_ref(call->exp->origin().source_id());
+
+  call->child.reset(new Evaluator(ctx, call->allocator.get(), *this));
+  call->child->pinned_store_size_ = call->store.size();
+}
+
+int64_t Evaluator::RunForked(int64_t max_steps) {
+  std::vector<ForkedCall*> running;
+  for (ForkedCall& call : forked_calls_) {
+    if (call.child->HasComputation()) {
+      running.push_back(&call);
+    }
+  }
+  // Split the steps between the calls, so that together they run no more
+  // than max_steps.
+  const int64_t num_running = running.size();
+  std::vector<int64_t> steps(num_running, 0);
+  std::vector<std::function<void()>> tasks;
+  for (int64_t i = 0; i < num_running; ++i) {
+    const int64_t budget =
+        std::min(kForkedStepsPerRun, max_steps / num_running +
+                                         (i < max_steps % num_running ? 1 : 0));
+    if (budget > 0) {
+      ForkedCall* call = running[i];
+      int64_t* call_steps = &steps[i];
+      tasks.push_back([call, budget, call_steps] {
+        *call_steps = call->child->Run(budget).steps;
+      });
+    }
+  }
+  fork_pool_->Invoke(std::move(tasks));
+
+  int64_t total = 0;
+  for (int64_t i = 0; i < num_running; ++i) {
+    running[i]->steps += steps[i];
+    total += steps[i];
+  }
+  if (std::none_of(forked_calls_.begin(), forked_calls_.end(),
+                   [](const ForkedCall& call) {
+                     return call.child->HasComputation();
+                   })) {
+    JoinForked();
+  }
+  return total;
+}
+
+void Evaluator::JoinForked() {
+  for (ForkedCall& call : forked_calls_) {
+    Evaluator& child = *call.child;
+    PoolPtr<Literal> val = allocator_->Allocate<Literal>();
+    allocator_->Copy(child.ValueOf(child.ctx_->cur_ctx().result(0)),
+                     val.get());
+    // The child's pinned addresses are still the copies of call.addrs, and
+    // pure calls create no closures, so those are all the result may capture.
+    ForwardCaptures(val.get(), [&call](int64_t addr) {
+      return addr < 0 ? addr : call.addrs[addr];
+    });
+    AddResult()->unsafe_arena_set_allocated_rvalue(val.release());
+    ++fork_stats_.calls;
+    fork_stats_.steps += call.steps;
+    fork_stats_.forks += child.fork_stats_.forks;
+    fork_stats_.calls += child.fork_stats_.calls;
+  }
+  forked_calls_.clear();
 }
 
 void Evaluator::EvaluateReturnFromLocalContext() {
@@ -441,12 +1216,41 @@ void Evaluator::EvaluateReturnFromLocalContext() {
     --comp_i;
   }
   PoolPtr<Literal> return_val = ValueOf(PopResultOrDie());
+  if (memo_.enabled() && !ctx_->cur_ctx().memo_key().empty()) {
+    // Store addresses in a cached closure would dangle once the store is
+    // garbage collected.
+    bool has_captures = false;
+    ForEachCapture(*return_val, [&](int64_t) { has_captures = true; });
+    if (!has_captures) {
+      memo_.Insert(ctx_->cur_ctx().lambda_id(), ctx_->cur_ctx().memo_key(),
+                   *return_val);
+    }
+  }
   RestoreLocalContext();
   AddResult()->unsafe_arena_set_allocated_rvalue(return_val.release());
 }
 
+void Evaluator::FillClosuresForPrinting(Literal* lit) {
+  if (lit->has_closure_val()) {
+    Closure* closure = lit->mutable_closure_val();
+    const LambdaExpression& lambda_exp =
+        source_.exp[closure->lambda_id()]->lambda_exp();
+    *closure->mutable_param() = lambda_exp.param();
+    *closure->mutable_body() = lambda_exp.body();
+    ClearAnnotations(closure);
+    FillEnv(lambda_exp.layout(), closure);
+    closure->clear_lambda_id();
+    closure->clear_capture();
+  } else if (lit->has_tuple_val()) {
+    for (Literal& elem : *lit->mutable_tuple_val()->mutable_elem()) {
+      FillClosuresForPrinting(&elem);
+    }
+  }
+}
+
 void Evaluator::EvaluatePrint() {
   PoolPtr<Literal> v = ValueOf(PopResultOrDie());
+  FillClosuresForPrinting(v.get());
   Output(v->ShortDebugString());
 }
 
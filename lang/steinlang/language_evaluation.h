@@ -1,28 +1,70 @@
 #ifndef LANG_STEINLANG_LANGUAGE_EVALUATION_H_
 #define LANG_STEINLANG_LANGUAGE_EVALUATION_H_
 
+#include <memory>
 #include <string>
 #include <vector>
 
+#include "lang/steinlang/fork_join.h"
+#include "lang/steinlang/garbage_collection.h"
+#include "lang/steinlang/inline_cache.h"
+#include "lang/steinlang/memoization.h"
 #include "lang/steinlang/memory.h"
+#include "lang/steinlang/run_status.h"
+#include "lang/steinlang/source_util.h"
 #include "lang/steinlang/steinlang_syntax.pb.h"
 
+// Threaded dispatch uses the labels as values extension of GCC and Clang.
+// Define STEINLANG_NO_COMPUTED_GOTO to build only the portable switch.
+#if defined(__GNUC__) && !defined(STEINLANG_NO_COMPUTED_GOTO)
+#define STEINLANG_COMPUTED_GOTO 1
+#else
+#define STEINLANG_COMPUTED_GOTO 0
+#endif
+
 namespace steinlang {
 
+// Set up ctx to evaluate pgm from the beginning. This annotates the copy of
+// pgm in ctx with AnnotateSource and ResolveVariables.
+void InitEvalContext(const Program& pgm, EvalContext* ctx);
+
+// A copy of pgm annotated like InitEvalContext's, for Evaluators to share.
+std::shared_ptr<const Program> PrepareProgram(const Program& pgm);
+
+// Where the values of a store restored from a checkpoint are read from.
+class StoreSource {
+ public:
+  virtual ~StoreSource() = default;
+
+  // Set value, an empty placeholder, to the value at addr.
+  virtual void Materialize(int64_t addr, Literal* value) = 0;
+};
+
 // Evaluator handles dynamic evaluation of an EvalContext, step by step.
 // Example evaluation loop:
 // 
 // PoolingArenaAllocator allocator;
 // EvalContext* ctx = allocator.AllocateEvalContext();
+// InitEvalContext(pgm, ctx);
 // Evaluator evaluator(ctx, &allocator);
-// while (evaluator.HasComputation()) {
-//   evaluator.Step();
+// while (evaluator.Run(4096).reason != StopReason::kFinished) {
+//   evaluator.consume_output();
 // }
 class Evaluator {
  public:
   // ctx must be arena-allocated by allocator.
-  Evaluator(EvalContext* ctx, PoolingArenaAllocator* allocator)
-      : ctx_(ctx), allocator_(allocator) {}
+  // ctx->pgm() must be annotated with AnnotateSource and ResolveVariables, and
+  // computations refer to its Expressions and Statements by source_id.
+  // The Evaluator keeps the program off the arena, and owns it from now on.
+  Evaluator(EvalContext* ctx, PoolingArenaAllocator* allocator);
+
+  // Evaluate pgm, as returned by PrepareProgram, from the beginning in ctx,
+  // which must be empty and arena-allocated by allocator. Any number of
+  // Evaluators may share pgm, on any threads, since they only read it. Each
+  // needs an allocator of its own, though, and may only be run by one thread
+  // at a time.
+  Evaluator(std::shared_ptr<const Program> pgm, EvalContext* ctx,
+            PoolingArenaAllocator* allocator);
 
   Evaluator(const Evaluator&) = delete;
   Evaluator& operator=(const Evaluator&) = delete;
@@ -31,12 +73,55 @@ class Evaluator {
 
   void Step();
 
-  int Lookup(const std::string& var_name);
+  // Execute up to max_steps steps. Memory pressure and garbage collection are
+  // only checked once per call, so the arena and store may outgrow their
+  // limits by what max_steps steps allocate. The steps of forked calls count
+  // towards max_steps, and a fork whose calls haven't finished when it runs
+  // out is resumed by the next call.
+  RunStatus Run(int64_t max_steps);
 
-  void Assign(const std::string& var_name, PoolPtr<Literal> value);
+  // True while the calls of a fork are still being evaluated, outside of
+  // ctx(), which is then incomplete.
+  bool forking() const { return !forked_calls_.empty(); }
+
+  // What the allocators of forked calls that haven't finished have allocated,
+  // including those of their own forks.
+  size_t forked_allocated_size() const;
+
+  // Return the store address bound to the given slot of the current frame,
+  // binding it to a fresh address if it's unbound.
+  int64_t Lookup(int slot);
+
+  void Assign(int slot, PoolPtr<Literal> value);
 
   const EvalContext& ctx() const { return *ctx_; }
 
+  // Every value in ctx's store is a placeholder, which is only read from
+  // source when it's first used, so that restoring a large store takes time
+  // in proportion to what's used. Garbage collection reads every live value,
+  // and releases source.
+  void LoadStoreLazily(std::unique_ptr<StoreSource> source);
+
+  // Read every value that hasn't been since LoadStoreLazily.
+  void MaterializeStore();
+
+  // Record which store addresses are written from now on, for incremental
+  // checkpoints. Adding to the store writes the new address, and garbage
+  // collection writes every address, since values may move.
+  void TrackStoreWrites();
+
+  // The store addresses written since TrackStoreWrites or the last call, in
+  // increasing order.
+  std::vector<int64_t> TakeStoreWrites();
+
+  const GcStats& gc_stats() const { return gc_.stats(); }
+
+  InlineCacheStats inline_cache_stats() const { return call_cache_.stats(); }
+
+  const MemoStats& memo_stats() const { return memo_.stats(); }
+
+  const ForkStats& fork_stats() const { return fork_stats_; }
+
   std::vector<std::string> consume_output() {
     std::vector<std::string> output;
     for (auto& x : *ctx_->mutable_output()) {
@@ -47,36 +132,176 @@ class Evaluator {
   }
 
  private:
-  void Evaluate(PoolPtr<Expression> exp);
+  // A call that's evaluated by a child Evaluator, on its own thread, in a
+  // store holding copies of the values it may read.
+  struct ForkedCall {
+    // The FuncAppExpression.
+    const Expression* exp;
+    // Where the call's frame is: the LocalContext's lambda_id, and its env
+    // with addresses in the child's store.
+    int64_t lambda_id;
+    std::vector<int64_t> env;
+    // The child's store, and the address in this store of each value in it.
+    std::vector<Literal> store;
+    std::vector<int64_t> addrs;
+
+    // The child evaluating the call, until the fork joins.
+    std::unique_ptr<PoolingArenaAllocator> allocator;
+    std::unique_ptr<Evaluator> child;
+    // The steps that the child, and any forks of its own, have run.
+    int64_t steps = 0;
+  };
+
+  // If schedule, schedule pgm's statements in ctx.
+  Evaluator(std::shared_ptr<const Program> pgm, EvalContext* ctx,
+            PoolingArenaAllocator* allocator, bool schedule);
+
+  // A child of parent, which shares its program, for a ForkedCall.
+  Evaluator(EvalContext* ctx, PoolingArenaAllocator* allocator,
+            const Evaluator& parent);
+
+  // What calls to a closure resolve to, cached per call site.
+  struct CallTarget {
+    const LambdaExpression* lambda;
+    // The number of slots in the lambda's frame.
+    int frame_size;
+  };
+
+  // Point ctx_->pgm() at pgm_, which stays off the arena.
+  void SetProgram() {
+    // The program is never modified through ctx_.
+    ctx_->unsafe_arena_set_allocated_pgm(const_cast<Program*>(pgm_.get()));
+  }
+
+  // Relieve arena pressure and garbage collect the store if they're due.
+  void CheckMemory();
+
+  // The value at addr, read from store_source_ if it hasn't been yet.
+  const Literal& Load(int64_t addr) const {
+    Materialize(addr);
+    return ctx_->store(addr);
+  }
+
+  // The value at addr, to be replaced.
+  Literal* Overwrite(int64_t addr) {
+    if (addr < static_cast<int64_t>(unloaded_.size())) {
+      unloaded_[addr] = false;
+    }
+    RecordWrite(addr);
+    return ctx_->mutable_store(addr);
+  }
+
+  void Materialize(int64_t addr) const {
+    if (addr < static_cast<int64_t>(unloaded_.size()) && unloaded_[addr]) {
+      store_source_->Materialize(addr, ctx_->mutable_store(addr));
+      unloaded_[addr] = false;
+    }
+  }
+
+  void RecordWrite(int64_t addr) {
+    if (track_writes_) {
+      if (addr >= static_cast<int64_t>(written_.size())) {
+        written_.resize(addr + 1);
+      }
+      written_[addr] = true;
+    }
+  }
+
+  // Pop and evaluate the next computation, which must exist.
+  void Execute();
+
+#if STEINLANG_COMPUTED_GOTO
+  // Like the loop in Run, but each computation jumps directly to the next one's
+  // handler through a table of labels, and expression references jump
+  // straight to the handler for their type. Returns the steps executed, and
+  // stops early when a computation forks.
+  int64_t RunThreaded(int64_t max_steps);
+#endif
+
+  void Evaluate(const Expression& exp);
 
   void Evaluate(const Variable& var) {
-    AddResult()->set_lvalue_ref(Lookup(var.name()));
+    AddResult()->set_lvalue_ref(Lookup(var.slot()));
   }
 
-  void Evaluate(PoolPtr<Literal> lit) {
-    AddResult()->unsafe_arena_set_allocated_rvalue(lit.release());
+  void Evaluate(const Literal& lit) {
+    PoolPtr<Literal> val = allocator_->Allocate<Literal>();
+    allocator_->Copy(lit, val.get());
+    AddResult()->unsafe_arena_set_allocated_rvalue(val.release());
   }
 
-  void Evaluate(FuncAppExpression* func_app_exp);
-  void Evaluate(BinArithExpression* bin_exp);
-  void Evaluate(MonArithExpression* mon_exp);
-  void Evaluate(TernaryExpression* tern_exp);
-  void Evaluate(TupleExpression* tuple_exp);
-  void Evaluate(LambdaExpression* lambda_exp);
+  void Evaluate(const FuncAppExpression& func_app_exp, int64_t source_id);
+  void Evaluate(const BinArithExpression& bin_exp);
+  void Evaluate(const MonArithExpression& mon_exp);
+  void Evaluate(const TernaryExpression& tern_exp);
+  void Evaluate(const TupleExpression& tuple_exp);
+  void Evaluate(const LambdaExpression& lambda_exp, int64_t source_id);
 
-  void Evaluate(Statement* stmt);
-  void Evaluate(IfElseStatement* if_else_stmt);
-  void Evaluate(WhileStatement* while_stmt);
-  void Evaluate(ForStatement* for_stmt);
+  void Evaluate(const Statement& stmt);
+  void Evaluate(const IfElseStatement& if_else_stmt);
+  void Evaluate(const WhileStatement& while_stmt, int64_t source_id);
+  void Evaluate(const ForStatement& for_stmt, int64_t source_id);
 
   void Evaluate(const BinExpFinal& fnl);
+  // Superinstructions, selected by SelectSuperinstructions.
+  void EvaluateFused(const BinArithExpression& bin_exp, Literal* out);
+  void EvaluateFused(const AssignStatement& assign_stmt);
+  // The value of a variable or literal operand of a superinstruction.
+  const Literal& Operand(const Expression& exp);
   void Evaluate(const MonExpFinal& fnl);
   void Evaluate(TupleExpFinal* fnl);
   void EvaluateAssignStmtFinal();
   void Evaluate(FuncAppExpFinal* fnl);
+  // What a closure with the given lambda_id calls, or false if it isn't a
+  // closure.
+  bool ResolveCall(int64_t lambda_id, CallTarget* target) const;
+  // The captures of the closure stored at addr, and its lambda_id, or nullptr
+  // if there is none. For PureLambdas::IsPure.
+  const google::protobuf::RepeatedField<int64_t>* ClosureAt(
+      int64_t addr, int64_t* lambda_id) const;
+  // If calling closure with args can be memoized, set key to what its result
+  // is cached under and return true.
+  bool MemoKey(const Closure& closure,
+               const std::vector<PoolPtr<Literal>>& args,
+               std::string* key) const;
   void EvaluateReturnFromLocalContext();
+  // If the exps, evaluated in order, are all calls to pure closures, with
+  // arguments that only read variables, start evaluating them in child
+  // Evaluators. Run evaluates them in parallel before anything else, and
+  // pushes their results once they've all finished. Returns false, having
+  // done nothing, if they aren't.
+  bool Fork(const std::vector<const Expression*>& exps);
+  bool PrepareFork(const Expression& exp, ForkedCall* call) const;
+  // Set up the child Evaluator of a prepared call.
+  void StartForked(ForkedCall* call) const;
+  // Run the unfinished forked calls for up to max_steps steps between them,
+  // and join the fork if they're all finished. Returns the steps run.
+  int64_t RunForked(int64_t max_steps);
+  void JoinForked();
+  // True if the next computation can be executed: there is one, and no fork
+  // is waiting to join.
+  bool CanExecute() const {
+    return forked_calls_.empty() && !ctx_->cur_ctx().comp().empty();
+  }
   void Evaluate(IfElseFinal* fnl);
   void EvaluatePrint();
+  void EvaluateLoop(PoolPtr<Computation> comp);
+
+  void ScheduleRef(const Expression& exp) {
+    Schedule()->set_exp_ref(exp.origin().source_id());
+  }
+
+  void ScheduleRef(const Statement& stmt) {
+    Schedule()->set_stmt_ref(stmt.origin().source_id());
+  }
+
+  // Add a reference to stmt to the given list of computations.
+  void AddRef(const Statement& stmt,
+              google::protobuf::RepeatedPtrField<Computation>* comps) {
+    PoolPtr<Computation> comp = allocator_->Allocate<Computation>();
+    comp->set_stmt_ref(stmt.origin().source_id());
+    comps->UnsafeArenaAddAllocated(comp.release());
+  }
 
   Computation* Schedule() {
     Computation* new_comp = allocator_->Allocate<Computation>().release();
@@ -90,25 +315,96 @@ class Evaluator {
     return result;
   }
 
+  // Schedule a computation whose (pooled) type is set by set_allocated, e.g.
+  // &Computation::unsafe_arena_set_allocated_print_final.
+  template <typename T>
+  T* ScheduleFinal(void (Computation::*set_allocated)(T*)) {
+    T* fnl = allocator_->Allocate<T>().release();
+    (Schedule()->*set_allocated)(fnl);
+    return fnl;
+  }
+
+  // Return the type of comp released by release to its pool.
+  template <typename T>
+  PoolPtr<T> ReleaseFinal(Computation* comp, T* (Computation::*release)()) {
+    return allocator_->WrapPoolPtr((comp->*release)());
+  }
+
   void ScheduleAllocated(Computation* comp) {
     ctx_->mutable_cur_ctx()->mutable_comp()->UnsafeArenaAddAllocated(comp);
   }
 
   PoolPtr<Literal> ValueOf(PoolPtr<Result> result);
   const Literal& ValueOf(const Result& result);
+  // A Literal to store a result computed from a and b in: the rvalue of a or
+  // b if either has one, or a new one. a and b are returned to their pools.
+  PoolPtr<Literal> TakeRvalue(PoolPtr<Result> a, PoolPtr<Result> b);
 
   PoolPtr<Result> PopResultOrDie() {
     return allocator_->WrapPoolPtr(
         ctx_->mutable_cur_ctx()->mutable_result()->UnsafeArenaReleaseLast());
   }
 
+  // Return result, and its rvalue if it has one, to their pools.
+  void Release(PoolPtr<Result> result) {
+    if (result->has_rvalue()) {
+      allocator_->WrapPoolPtr(result->unsafe_arena_release_rvalue());
+    }
+  }
+
   void Output(const std::string& x) { ctx_->add_output(x); }
 
+  // Fill in the params, body and name-based env of closures for printing.
+  void FillClosuresForPrinting(Literal* lit);
+
+  // Free arena memory that's no longer used by ctx_, per --semispace_arena.
+  void RelieveArenaPressure();
+
+  // Garbage collect the store. Returns the number of live literals.
+  int64_t CollectGarbage();
+
   void SaveLocalContext();
   void RestoreLocalContext();
+  // Replace the innermost LocalContext with an empty one, rather than saving
+  // it.
+  void ReplaceLocalContext();
+  // True if the innermost LocalContext is a function's, and returns as soon as
+  // a result is pushed, i.e. a call evaluated now is a tail call.
+  bool InTailPosition() const;
 
   EvalContext* ctx_;
   PoolingArenaAllocator* allocator_;
+  // Shared with forked children, and with other Evaluators of the same
+  // prepared program.
+  std::shared_ptr<const Program> pgm_;
+  SourceIndex source_;
+  // Relieve arena pressure when allocator_'s allocated size grows past this.
+  size_t arena_limit_;
+  GcSchedule gc_;
+  InlineCache<CallTarget> call_cache_;
+  // Analyzed if calls are memoized or forked.
+  std::shared_ptr<PureLambdas> pure_lambdas_;
+  Memoizer<Literal> memo_;
+  // The number of forks this Evaluator is nested in.
+  int fork_depth_ = 0;
+  // nullptr unless calls may be forked, i.e. --threads is more than 1 and
+  // fork_depth_ is less than --max_fork_depth.
+  ForkJoinPool* fork_pool_ = nullptr;
+  ForkStats fork_stats_;
+  // The calls of the fork in progress, whose results the computations are
+  // waiting for.
+  std::vector<ForkedCall> forked_calls_;
+  // Store addresses below this are never garbage collected. A forked call's
+  // result may refer to them, since they hold copies of the parent's values.
+  int64_t pinned_store_size_ = 0;
+  // Set by LoadStoreLazily, until every value that's used has been read.
+  std::unique_ptr<StoreSource> store_source_;
+  // By store address, whether the value is yet to be read from
+  // store_source_. Addresses past its end never were.
+  mutable std::vector<bool> unloaded_;
+  bool track_writes_ = false;
+  // By store address, for TakeStoreWrites.
+  std::vector<bool> written_;
 };
 
 }  // namespace steinlang
@@ -30,8 +30,97 @@ void BoolNot(Literal* x) {
   }
 }
 
-#define NUM_BIN_OP(name, op)                                \
+void IntBinOp(BinArithOp op, int64_t x, int64_t y, Literal* out) {
+  switch (op) {
+    case BinArithOp::ADD:
+      out->set_int_val(x + y);
+      break;
+    case BinArithOp::SUB:
+      out->set_int_val(x - y);
+      break;
+    case BinArithOp::MUL:
+      out->set_int_val(x * y);
+      break;
+    case BinArithOp::DIV:
+      out->set_int_val(x / y);
+      break;
+    case BinArithOp::GT:
+      out->set_bool_val(x > y);
+      break;
+    case BinArithOp::GE:
+      out->set_bool_val(x >= y);
+      break;
+    case BinArithOp::LT:
+      out->set_bool_val(x < y);
+      break;
+    case BinArithOp::LE:
+      out->set_bool_val(x <= y);
+      break;
+    case BinArithOp::EQ:
+      out->set_bool_val(x == y);
+      break;
+    case BinArithOp::NE:
+      out->set_bool_val(x != y);
+      break;
+    default:
+      out->set_none_val(true);
+      break;
+  }
+}
+
+void FloatBinOp(BinArithOp op, float x, float y, Literal* out) {
+  switch (op) {
+    case BinArithOp::ADD:
+      out->set_float_val(x + y);
+      break;
+    case BinArithOp::SUB:
+      out->set_float_val(x - y);
+      break;
+    case BinArithOp::MUL:
+      out->set_float_val(x * y);
+      break;
+    case BinArithOp::DIV:
+      out->set_float_val(x / y);
+      break;
+    case BinArithOp::GT:
+      out->set_bool_val(x > y);
+      break;
+    case BinArithOp::GE:
+      out->set_bool_val(x >= y);
+      break;
+    case BinArithOp::LT:
+      out->set_bool_val(x < y);
+      break;
+    case BinArithOp::LE:
+      out->set_bool_val(x <= y);
+      break;
+    case BinArithOp::EQ:
+      out->set_bool_val(x == y);
+      break;
+    case BinArithOp::NE:
+      out->set_bool_val(x != y);
+      break;
+    default:
+      out->set_none_val(true);
+      break;
+  }
+}
+
+// Numbers go through the kernels above. Otherwise, the result depends on the
+// type of x only.
+#define NUM_BIN_OP(name, bin_op, op)                        \
   void name(Literal* x, Literal* y) {                       \
+    switch (GetOperandTypes(*x, *y)) {                      \
+      case OperandTypes::kIntInt:                           \
+        IntBinOp(bin_op, x->int_val(), y->int_val(), x);    \
+        return;                                             \
+      case OperandTypes::kFloatFloat:                       \
+      case OperandTypes::kMixed:                            \
+        FloatBinOp(bin_op, AsFloat(*x), AsFloat(*y), x);    \
+        return;                                             \
+      case OperandTypes::kOther:                            \
+        break;                                              \
+    }                                                       \
     switch (x->type_case()) {                               \
       case Literal::kIntVal:                                \
         x->set_int_val(x->int_val() op y->int_val());       \
@@ -45,13 +134,24 @@ void BoolNot(Literal* x) {
     }                                                       \
   }
 
-NUM_BIN_OP(Add, +)
-NUM_BIN_OP(Sub, -)
-NUM_BIN_OP(Mul, *)
-NUM_BIN_OP(Div, / )
+NUM_BIN_OP(Add, BinArithOp::ADD, +)
+NUM_BIN_OP(Sub, BinArithOp::SUB, -)
+NUM_BIN_OP(Mul, BinArithOp::MUL, *)
+NUM_BIN_OP(Div, BinArithOp::DIV, / )
 
-#define NUM_CMP_OP(name, op)                               \
+#define NUM_CMP_OP(name, bin_op, op)                       \
   void name(Literal* x, Literal* y) {                      \
+    switch (GetOperandTypes(*x, *y)) {                     \
+      case OperandTypes::kIntInt:                          \
+        IntBinOp(bin_op, x->int_val(), y->int_val(), x);   \
+        return;                                            \
+      case OperandTypes::kFloatFloat:                      \
+      case OperandTypes::kMixed:                           \
+        FloatBinOp(bin_op, AsFloat(*x), AsFloat(*y), x);   \
+        return;                                            \
+      case OperandTypes::kOther:                           \
+        break;                                             \
+    }                                                      \
     switch (x->type_case()) {                              \
       case Literal::kBoolVal:                              \
         x->set_bool_val(x->bool_val() op y->bool_val());   \
@@ -71,12 +171,12 @@ NUM_BIN_OP(Div, / )
     }                                                      \
   }
 
-NUM_CMP_OP(CompareGt, > )
-NUM_CMP_OP(CompareGe, >= )
-NUM_CMP_OP(CompareLt, < )
-NUM_CMP_OP(CompareLe, <= )
-NUM_CMP_OP(CompareEq, == )
-NUM_CMP_OP(CompareNe, != )
+NUM_CMP_OP(CompareGt, BinArithOp::GT, > )
+NUM_CMP_OP(CompareGe, BinArithOp::GE, >= )
+NUM_CMP_OP(CompareLt, BinArithOp::LT, < )
+NUM_CMP_OP(CompareLe, BinArithOp::LE, <= )
+NUM_CMP_OP(CompareEq, BinArithOp::EQ, == )
+NUM_CMP_OP(CompareNe, BinArithOp::NE, != )
 
 void BoolAnd(Literal* x, Literal* y) {
   switch (x->type_case()) {
@@ -100,4 +200,48 @@ void BoolOr(Literal* x, Literal* y) {
   }
 }
 
+void BinOp(BinArithOp op, Literal* x, Literal* y) {
+  switch (op) {
+    case BinArithOp::ADD:
+      Add(x, y);
+      break;
+    case BinArithOp::SUB:
+      Sub(x, y);
+      break;
+    case BinArithOp::MUL:
+      Mul(x, y);
+      break;
+    case BinArithOp::DIV:
+      Div(x, y);
+      break;
+    case BinArithOp::GT:
+      CompareGt(x, y);
+      break;
+    case BinArithOp::GE:
+      CompareGe(x, y);
+      break;
+    case BinArithOp::LT:
+      CompareLt(x, y);
+      break;
+    case BinArithOp::LE:
+      CompareLe(x, y);
+      break;
+    case BinArithOp::EQ:
+      CompareEq(x, y);
+      break;
+    case BinArithOp::NE:
+      CompareNe(x, y);
+      break;
+    case BinArithOp::AND:
+      BoolAnd(x, y);
+      break;
+    case BinArithOp::OR:
+      BoolOr(x, y);
+      break;
+    default:
+      x->Clear();
+      break;
+  }
+}
+
 }  // namespace steinlang
@@ -6,6 +6,7 @@
 
 #include "lang/steinlang/steinlang_syntax.pb.h"
 
+#include <stdint.h>
 #include <string>
 
 namespace steinlang {
@@ -18,15 +19,52 @@ void Neg(Literal* x);
 // x should be a bool val.
 void BoolNot(Literal* x);
 
+// The combination of operand types of a binary operation, so that kernels for
+// the common ones can be selected up front.
+enum class OperandTypes {
+  kIntInt,
+  kFloatFloat,
+  // An int and a float. The int is promoted to float.
+  kMixed,
+  kOther,
+};
+
+inline OperandTypes GetOperandTypes(const Literal& x, const Literal& y) {
+  const bool x_int = x.type_case() == Literal::kIntVal;
+  const bool y_int = y.type_case() == Literal::kIntVal;
+  const bool x_float = x.type_case() == Literal::kFloatVal;
+  const bool y_float = y.type_case() == Literal::kFloatVal;
+  if (x_int && y_int) {
+    return OperandTypes::kIntInt;
+  } else if (x_float && y_float) {
+    return OperandTypes::kFloatFloat;
+  } else if ((x_int || x_float) && (y_int || y_float)) {
+    return OperandTypes::kMixed;
+  }
+  return OperandTypes::kOther;
+}
+
+// The value of an int or float literal as a float.
+inline float AsFloat(const Literal& x) {
+  return x.type_case() == Literal::kIntVal ? x.int_val() : x.float_val();
+}
+
+// x op y for ints and for floats, stored into out. Arithmetic results have the
+// operands' type, comparisons are bools, and AND and OR are none.
+void IntBinOp(BinArithOp op, int64_t x, int64_t y, Literal* out);
+void FloatBinOp(BinArithOp op, float x, float y, Literal* out);
+
 // x and y are inputs, the result is stored into x.
-// x and y should both be the same type: bool, int, or float.
+// x and y should both be the same type: bool, int, or float. If one is an int
+// and the other a float, the int is promoted to float.
 void Add(Literal* x, Literal* y);
 void Sub(Literal* x, Literal* y);
 void Mul(Literal* x, Literal* y);
 void Div(Literal* x, Literal* y);
 
 // x and y are inputs, the result is stored into x.
-// x and y should both be the same type: bool, int, float, or string.
+// x and y should both be the same type: bool, int, float, or string. If one is
+// an int and the other a float, the int is promoted to float.
 void CompareGt(Literal* x, Literal* y);
 void CompareGe(Literal* x, Literal* y);
 void CompareLt(Literal* x, Literal* y);
@@ -39,6 +77,10 @@ void CompareNe(Literal* x, Literal* y);
 void BoolAnd(Literal* x, Literal* y);
 void BoolOr(Literal* x, Literal* y);
 
+// x op y for any BinArithOp, using the functions above. The result is stored
+// into x.
+void BinOp(BinArithOp op, Literal* x, Literal* y);
+
 }  // namespace steinlang
 
 #endif  // LANG_STEINLANG_LITERAL_OPS_H_
@@ -0,0 +1,454 @@
+#include "lang/steinlang/loop_invariants.h"
+
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "lang/steinlang/program_analysis.h"
+
+namespace steinlang {
+
+namespace {
+
+using Statements = google::protobuf::RepeatedPtrField<Statement>;
+using Names = std::unordered_set<std::string>;
+
+bool HasVariable(const Expression& exp) {
+  switch (exp.type_case()) {
+    case Expression::kVarExp:
+      return true;
+    case Expression::kMonArithExp:
+      return HasVariable(exp.mon_arith_exp().exp());
+    case Expression::kBinArithExp:
+      return HasVariable(exp.bin_arith_exp().lhs()) ||
+             HasVariable(exp.bin_arith_exp().rhs());
+    case Expression::kTernExp:
+      return HasVariable(exp.tern_exp().if_exp()) ||
+             HasVariable(exp.tern_exp().cond_exp()) ||
+             HasVariable(exp.tern_exp().else_exp());
+    case Expression::kTupleExp:
+      for (const Expression& e : exp.tuple_exp().exp()) {
+        if (HasVariable(e)) {
+          return true;
+        }
+      }
+      return false;
+    default:
+      return false;
+  }
+}
+
+bool HasCall(const Expression& exp) {
+  switch (exp.type_case()) {
+    case Expression::kFuncAppExp:
+      return true;
+    case Expression::kMonArithExp:
+      return HasCall(exp.mon_arith_exp().exp());
+    case Expression::kBinArithExp:
+      return HasCall(exp.bin_arith_exp().lhs()) ||
+             HasCall(exp.bin_arith_exp().rhs());
+    case Expression::kTernExp:
+      return HasCall(exp.tern_exp().if_exp()) ||
+             HasCall(exp.tern_exp().cond_exp()) ||
+             HasCall(exp.tern_exp().else_exp());
+    case Expression::kTupleExp:
+      for (const Expression& e : exp.tuple_exp().exp()) {
+        if (HasCall(e)) {
+          return true;
+        }
+      }
+      return false;
+    default:
+      // Lambda bodies run in their own frame, when the lambda is called.
+      return false;
+  }
+}
+
+bool HasCall(const Statement& stmt) {
+  switch (stmt.type_case()) {
+    case Statement::kExpStmt:
+      return HasCall(stmt.exp_stmt());
+    case Statement::kAssignStmt:
+      return HasCall(stmt.assign_stmt().lhs()) ||
+             HasCall(stmt.assign_stmt().rhs());
+    case Statement::kRetStmt:
+      return HasCall(stmt.ret_stmt());
+    case Statement::kPrintStmt:
+      return HasCall(stmt.print_stmt());
+    case Statement::kIfElseStmt:
+      if (HasCall(stmt.if_else_stmt().cond())) {
+        return true;
+      }
+      for (const Statement& s : stmt.if_else_stmt().if_stmts()) {
+        if (HasCall(s)) {
+          return true;
+        }
+      }
+      for (const Statement& s : stmt.if_else_stmt().else_stmts()) {
+        if (HasCall(s)) {
+          return true;
+        }
+      }
+      return false;
+    case Statement::kWhileStmt:
+      if (HasCall(stmt.while_stmt().cond())) {
+        return true;
+      }
+      for (const Statement& s : stmt.while_stmt().body()) {
+        if (HasCall(s)) {
+          return true;
+        }
+      }
+      return false;
+    case Statement::kForStmt:
+      if (HasCall(stmt.for_stmt().init()) || HasCall(stmt.for_stmt().cond()) ||
+          HasCall(stmt.for_stmt().inc())) {
+        return true;
+      }
+      for (const Statement& s : stmt.for_stmt().body()) {
+        if (HasCall(s)) {
+          return true;
+        }
+      }
+      return false;
+    case Statement::TYPE_NOT_SET:
+      return false;
+  }
+  return false;
+}
+
+// The invariants hoisted out of one loop.
+struct Loop {
+  // The variables that are definitely bound before the loop.
+  const Names* bound = nullptr;
+  // The variables that the loop's frame assigns to while it runs.
+  Names assigned;
+  // Whether the loop calls functions, which may assign to shared variables.
+  bool has_call = false;
+  // The assignments of the hoisted expressions to their temporaries.
+  std::vector<Statement> hoisted;
+  // The temporary of each hoisted expression, by its serialization, so that
+  // repeated expressions are evaluated once.
+  std::unordered_map<std::string, std::string> temporaries;
+};
+
+class Hoister {
+ public:
+  Hoister(const Program& pgm, LoopInvariantStats* stats) : stats_(stats) {
+    const Assignments assignments = CollectAssignments(pgm);
+    shared_ = assignments.in_lambdas;
+    shared_.insert(assignments.params.begin(), assignments.params.end());
+  }
+
+  // Hoist the invariants of the loops in stmts, which run in a frame where
+  // bound are definitely bound before stmts.
+  void Hoist(Statements* stmts, Names bound) {
+    Statements result;
+    for (Statement& stmt : *stmts) {
+      if (stmt.has_while_stmt() || stmt.has_for_stmt()) {
+        for (Statement& hoisted : HoistLoop(&stmt, bound)) {
+          bound.insert(hoisted.assign_stmt().lhs().var_exp().name());
+          result.Add()->Swap(&hoisted);
+        }
+      }
+      HoistNested(&stmt, bound);
+      if (stmt.has_assign_stmt() && stmt.assign_stmt().lhs().has_var_exp()) {
+        bound.insert(stmt.assign_stmt().lhs().var_exp().name());
+      }
+      result.Add()->Swap(&stmt);
+    }
+    stmts->Swap(&result);
+  }
+
+ private:
+  // Rewrite the invariant expressions in loop_stmt, and return the
+  // assignments to their temporaries.
+  std::vector<Statement> HoistLoop(Statement* loop_stmt, const Names& bound) {
+    ++stats_->loops;
+    Loop loop;
+    loop.bound = &bound;
+    CollectFrameAssignments(*loop_stmt, &loop.assigned);
+    loop.has_call = HasCall(*loop_stmt);
+    if (loop_stmt->has_while_stmt()) {
+      WhileStatement* while_stmt = loop_stmt->mutable_while_stmt();
+      HoistFrom(while_stmt->mutable_cond(), &loop);
+      for (Statement& s : *while_stmt->mutable_body()) {
+        HoistFrom(&s, &loop);
+      }
+    } else {
+      // The init statement runs once, before the loop.
+      ForStatement* for_stmt = loop_stmt->mutable_for_stmt();
+      HoistFrom(for_stmt->mutable_cond(), &loop);
+      HoistFrom(for_stmt->mutable_inc(), &loop);
+      for (Statement& s : *for_stmt->mutable_body()) {
+        HoistFrom(&s, &loop);
+      }
+    }
+    return std::move(loop.hoisted);
+  }
+
+  // Hoist the invariants of loops nested in stmt, and in the bodies of lambdas
+  // in stmt.
+  void HoistNested(Statement* stmt, const Names& bound) {
+    switch (stmt->type_case()) {
+      case Statement::kExpStmt:
+        HoistInLambdas(stmt->mutable_exp_stmt());
+        break;
+      case Statement::kAssignStmt:
+        HoistInLambdas(stmt->mutable_assign_stmt()->mutable_rhs());
+        break;
+      case Statement::kRetStmt:
+        HoistInLambdas(stmt->mutable_ret_stmt());
+        break;
+      case Statement::kPrintStmt:
+        HoistInLambdas(stmt->mutable_print_stmt());
+        break;
+      case Statement::kIfElseStmt:
+        HoistInLambdas(stmt->mutable_if_else_stmt()->mutable_cond());
+        Hoist(stmt->mutable_if_else_stmt()->mutable_if_stmts(), bound);
+        Hoist(stmt->mutable_if_else_stmt()->mutable_else_stmts(), bound);
+        break;
+      case Statement::kWhileStmt:
+        HoistInLambdas(stmt->mutable_while_stmt()->mutable_cond());
+        Hoist(stmt->mutable_while_stmt()->mutable_body(), bound);
+        break;
+      case Statement::kForStmt: {
+        ForStatement* for_stmt = stmt->mutable_for_stmt();
+        Names body_bound = bound;
+        HoistNested(for_stmt->mutable_init(), bound);
+        const Statement& init = for_stmt->init();
+        if (init.has_assign_stmt() && init.assign_stmt().lhs().has_var_exp()) {
+          body_bound.insert(init.assign_stmt().lhs().var_exp().name());
+        }
+        HoistInLambdas(for_stmt->mutable_cond());
+        HoistNested(for_stmt->mutable_inc(), body_bound);
+        Hoist(for_stmt->mutable_body(), body_bound);
+        break;
+      }
+      case Statement::TYPE_NOT_SET:
+        break;
+    }
+  }
+
+  void HoistInLambdas(Expression* exp) {
+    switch (exp->type_case()) {
+      case Expression::kLambdaExp: {
+        // Parameters are bound when the lambda is called.
+        Names params;
+        for (const Variable& param : exp->lambda_exp().param()) {
+          params.insert(param.name());
+        }
+        Hoist(exp->mutable_lambda_exp()->mutable_body(), std::move(params));
+        break;
+      }
+      case Expression::kFuncAppExp:
+        HoistInLambdas(exp->mutable_func_app_exp()->mutable_func());
+        for (Expression& arg : *exp->mutable_func_app_exp()->mutable_arg()) {
+          HoistInLambdas(&arg);
+        }
+        break;
+      case Expression::kMonArithExp:
+        HoistInLambdas(exp->mutable_mon_arith_exp()->mutable_exp());
+        break;
+      case Expression::kBinArithExp:
+        HoistInLambdas(exp->mutable_bin_arith_exp()->mutable_lhs());
+        HoistInLambdas(exp->mutable_bin_arith_exp()->mutable_rhs());
+        break;
+      case Expression::kTernExp:
+        HoistInLambdas(exp->mutable_tern_exp()->mutable_if_exp());
+        HoistInLambdas(exp->mutable_tern_exp()->mutable_cond_exp());
+        HoistInLambdas(exp->mutable_tern_exp()->mutable_else_exp());
+        break;
+      case Expression::kTupleExp:
+        for (Expression& e : *exp->mutable_tuple_exp()->mutable_exp()) {
+          HoistInLambdas(&e);
+        }
+        break;
+      case Expression::kVarExp:
+      case Expression::kLitExp:
+      case Expression::TYPE_NOT_SET:
+        break;
+    }
+  }
+
+  // True if the value of the variable name doesn't change while loop runs.
+  bool IsInvariant(const std::string& name, const Loop& loop) const {
+    return loop.bound->count(name) > 0 && loop.assigned.count(name) == 0 &&
+           !(loop.has_call && shared_.count(name) > 0);
+  }
+
+  bool IsInvariant(const Expression& exp, const Loop& loop) const {
+    switch (exp.type_case()) {
+      case Expression::kVarExp:
+        return IsInvariant(exp.var_exp().name(), loop);
+      case Expression::kLitExp:
+        return true;
+      case Expression::kMonArithExp:
+        return IsInvariant(exp.mon_arith_exp().exp(), loop);
+      case Expression::kBinArithExp:
+        if (exp.bin_arith_exp().op() == DIV &&
+            !IsSafeDivisor(exp.bin_arith_exp().rhs())) {
+          return false;
+        }
+        return IsInvariant(exp.bin_arith_exp().lhs(), loop) &&
+               IsInvariant(exp.bin_arith_exp().rhs(), loop);
+      case Expression::kTernExp:
+        return IsInvariant(exp.tern_exp().if_exp(), loop) &&
+               IsInvariant(exp.tern_exp().cond_exp(), loop) &&
+               IsInvariant(exp.tern_exp().else_exp(), loop);
+      case Expression::kTupleExp:
+        for (const Expression& e : exp.tuple_exp().exp()) {
+          if (!IsInvariant(e, loop)) {
+            return false;
+          }
+        }
+        return true;
+      case Expression::kFuncAppExp:
+      case Expression::kLambdaExp:
+      case Expression::TYPE_NOT_SET:
+        return false;
+    }
+    return false;
+  }
+
+  // Replace the largest invariant expressions in the loop's frame in stmt with
+  // temporaries.
+  void HoistFrom(Statement* stmt, Loop* loop) {
+    switch (stmt->type_case()) {
+      case Statement::kExpStmt:
+        HoistFrom(stmt->mutable_exp_stmt(), loop);
+        break;
+      case Statement::kAssignStmt:
+        // The lhs is evaluated to a reference, not a value.
+        HoistFrom(stmt->mutable_assign_stmt()->mutable_rhs(), loop);
+        break;
+      case Statement::kRetStmt:
+        HoistFrom(stmt->mutable_ret_stmt(), loop);
+        break;
+      case Statement::kPrintStmt:
+        HoistFrom(stmt->mutable_print_stmt(), loop);
+        break;
+      case Statement::kIfElseStmt:
+        HoistFrom(stmt->mutable_if_else_stmt()->mutable_cond(), loop);
+        for (Statement& s : *stmt->mutable_if_else_stmt()->mutable_if_stmts()) {
+          HoistFrom(&s, loop);
+        }
+        for (Statement& s :
+             *stmt->mutable_if_else_stmt()->mutable_else_stmts()) {
+          HoistFrom(&s, loop);
+        }
+        break;
+      case Statement::kWhileStmt:
+        HoistFrom(stmt->mutable_while_stmt()->mutable_cond(), loop);
+        for (Statement& s : *stmt->mutable_while_stmt()->mutable_body()) {
+          HoistFrom(&s, loop);
+        }
+        break;
+      case Statement::kForStmt:
+        HoistFrom(stmt->mutable_for_stmt()->mutable_init(), loop);
+        HoistFrom(stmt->mutable_for_stmt()->mutable_cond(), loop);
+        HoistFrom(stmt->mutable_for_stmt()->mutable_inc(), loop);
+        for (Statement& s : *stmt->mutable_for_stmt()->mutable_body()) {
+          HoistFrom(&s, loop);
+        }
+        break;
+      case Statement::TYPE_NOT_SET:
+        break;
+    }
+  }
+
+  void HoistFrom(Expression* exp, Loop* loop) {
+    switch (exp->type_case()) {
+      case Expression::kMonArithExp:
+      case Expression::kBinArithExp:
+      case Expression::kTernExp:
+      case Expression::kTupleExp:
+        // Expressions of literals only are left to constant folding.
+        if (HasVariable(*exp) && IsInvariant(*exp, *loop)) {
+          Replace(exp, loop);
+          return;
+        }
+        break;
+      default:
+        break;
+    }
+    switch (exp->type_case()) {
+      case Expression::kFuncAppExp:
+        HoistFrom(exp->mutable_func_app_exp()->mutable_func(), loop);
+        for (Expression& arg : *exp->mutable_func_app_exp()->mutable_arg()) {
+          HoistFrom(&arg, loop);
+        }
+        break;
+      case Expression::kMonArithExp:
+        HoistFrom(exp->mutable_mon_arith_exp()->mutable_exp(), loop);
+        break;
+      case Expression::kBinArithExp:
+        HoistFrom(exp->mutable_bin_arith_exp()->mutable_lhs(), loop);
+        HoistFrom(exp->mutable_bin_arith_exp()->mutable_rhs(), loop);
+        break;
+      case Expression::kTernExp:
+        HoistFrom(exp->mutable_tern_exp()->mutable_if_exp(), loop);
+        HoistFrom(exp->mutable_tern_exp()->mutable_cond_exp(), loop);
+        HoistFrom(exp->mutable_tern_exp()->mutable_else_exp(), loop);
+        break;
+      case Expression::kTupleExp:
+        for (Expression& e : *exp->mutable_tuple_exp()->mutable_exp()) {
+          HoistFrom(&e, loop);
+        }
+        break;
+      case Expression::kVarExp:
+      case Expression::kLitExp:
+      case Expression::kLambdaExp:
+      case Expression::TYPE_NOT_SET:
+        break;
+    }
+  }
+
+  // Replace exp with a temporary variable, assigned exp before the loop.
+  void Replace(Expression* exp, Loop* loop) {
+    std::string& temporary = loop->temporaries[exp->SerializeAsString()];
+    if (temporary.empty()) {
+      // The parser never produces names with a '$', so this can't collide with
+      // a variable of the program.
+      temporary = "$invariant" + std::to_string(next_temporary_++);
+      Statement hoisted;
+      AssignStatement* assign_stmt = hoisted.mutable_assign_stmt();
+      assign_stmt->mutable_lhs()->mutable_var_exp()->set_name(temporary);
+      assign_stmt->mutable_rhs()->Swap(exp);
+      loop->hoisted.push_back(std::move(hoisted));
+      ++stats_->hoisted_expressions;
+    }
+    exp->Clear();
+    exp->mutable_var_exp()->set_name(temporary);
+  }
+
+  LoopInvariantStats* stats_;
+  // Names of variables that calling a closure may assign to.
+  Names shared_;
+  int64_t next_temporary_ = 0;
+};
+
+}  // namespace
+
+std::string LoopInvariantStats::DebugString() const {
+  if (prints_closures) {
+    return "loop invariants: skipped, the program may print closures";
+  }
+  std::ostringstream out;
+  out << "loop invariants: " << hoisted_expressions
+      << " expressions hoisted out of " << loops << " loops";
+  return out.str();
+}
+
+void HoistLoopInvariants(Program* pgm, LoopInvariantStats* stats) {
+  if (MayPrintClosures(*pgm)) {
+    stats->prints_closures = true;
+    return;
+  }
+  Hoister hoister(*pgm, stats);
+  hoister.Hoist(pgm->mutable_stmt(), {});
+}
+
+}  // namespace steinlang
@@ -0,0 +1,43 @@
+// Loop-invariant code motion over Program syntax trees, before they're
+// annotated and evaluated.
+
+#ifndef LANG_STEINLANG_LOOP_INVARIANTS_H_
+#define LANG_STEINLANG_LOOP_INVARIANTS_H_
+
+#include <stdint.h>
+#include <string>
+
+#include "lang/steinlang/steinlang_syntax.pb.h"
+
+namespace steinlang {
+
+struct LoopInvariantStats {
+  int64_t loops = 0;
+  int64_t hoisted_expressions = 0;
+  // True if the program was left unchanged because it may print a closure.
+  bool prints_closures = false;
+
+  std::string DebugString() const;
+};
+
+// Move the arithmetic in while and for loops whose operands don't change while
+// the loop runs into temporary variables assigned before the loop. An operand
+// variable is invariant if:
+// - it's definitely bound before the loop, by an assignment earlier in the same
+//   frame that always runs,
+// - the loop doesn't assign to it, and
+// - if the loop calls a function, no lambda body assigns to a variable of that
+//   name, and no lambda has a parameter of that name, since a closure may share
+//   the variable.
+// Hoisted expressions have no calls, and divide only by literals that can't
+// trap, so evaluating them when the loop runs no iterations is harmless.
+// Evaluation results are the same. Programs for which MayPrintClosures holds
+// are left unchanged.
+//
+// pgm is changed by variable name, so it mustn't be annotated with
+// AnnotateSource or ResolveVariables yet.
+void HoistLoopInvariants(Program* pgm, LoopInvariantStats* stats);
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_LOOP_INVARIANTS_H_
@@ -0,0 +1,98 @@
+#include "lang/steinlang/loop_invariants.h"
+
+#include <stdio.h>
+
+#include "lang/steinlang/optimization_test_util.h"
+
+namespace steinlang {
+namespace {
+
+const std::vector<RewriteTest> kTests = {
+    {"hoists out of a while loop",
+     "n = 3; i = 0; while i < 2 { print n * 2; i = i + 1; }",
+     "n = 3; i = 0; invariant0 = n * 2;"
+     "while i < 2 { print invariant0; i = i + 1; }"},
+    {"hoists a repeated expression once",
+     "n = 3; i = 0; while i < 2 { print n * 2; print (n * 2) + i; i = i + 1; }",
+     "n = 3; i = 0; invariant0 = n * 2;"
+     "while i < 2 { print invariant0; print invariant0 + i; i = i + 1; }"},
+    {"hoists out of a for loop, but not its variable",
+     "n = 3; for i = 0; i < 2; i = i + 1; { print (n * 2) + i; }",
+     "n = 3; invariant0 = n * 2;"
+     "for i = 0; i < 2; i = i + 1; { print invariant0 + i; }"},
+    {"hoists out of a loop in a lambda",
+     "def f(n) { i = 0; while i < 2 { print n * 2; i = i + 1; } return 0; }"
+     "print f(3);",
+     "def f(n) { i = 0; invariant0 = n * 2;"
+     "while i < 2 { print invariant0; i = i + 1; } return 0; }"
+     "print f(3);"},
+    {"hoists division by a safe literal",
+     "n = 3; i = 0; while i < 2 { print n / 2; i = i + 1; }",
+     "n = 3; i = 0; invariant0 = n / 2;"
+     "while i < 2 { print invariant0; i = i + 1; }"},
+    {"leaves division by a variable",
+     "n = 0; i = 0; while i < 0 { print 5 / n; i = i + 1; }", nullptr},
+    {"leaves division by zero",
+     "n = 3; i = 0; while i < 0 { print n / 0; i = i + 1; }", nullptr},
+    {"leaves a variable that the loop assigns",
+     "n = 3; i = 0; while i < 2 { n = n + 1; print n * 2; i = i + 1; }",
+     nullptr},
+    {"leaves a variable that may be unbound",
+     "i = 0; if i > 0 { n = 3; } else { m = 4; }"
+     "while i < 0 { print n * 2; i = i + 1; }",
+     nullptr},
+    {"leaves a variable assigned in a lambda that the loop calls",
+     "n = 3; def bump() { n = n + 1; return 0; } i = 0;"
+     "while i < 2 { bump(); print n * 2; i = i + 1; }",
+     nullptr},
+    // Calling f binds its parameter to the top-level n.
+    {"leaves a variable that's also a parameter",
+     "n = 3; def f(n) { return n; } i = 0;"
+     "while i < 2 { print f(5); print n * 2; i = i + 1; }",
+     nullptr},
+    {"leaves a variable that a for loop's init may assign",
+     "n = 3; def bump() { n = n + 1; return 0; }"
+     "for i = bump(); i < 2; i = i + 1; { print n * 2; }",
+     nullptr},
+    {"leaves a program that prints a closure",
+     "def f(n) { s = 0; for i = 0; i < n; i = i + 1; { s = s + (n * 2); } "
+     "return lambda q: s + q; } print f(3);",
+     nullptr},
+};
+
+// The parser reads -1 as a negation, so the literal is set directly, as
+// constant folding would leave it.
+bool TestLeavesDivisionByMinusOne() {
+  Program pgm = ParseTestProgram(
+      "n = 3; i = 0; while i < 2 { print n / 1; i = i + 1; }");
+  Expression* divisor = pgm.mutable_stmt(2)
+                            ->mutable_while_stmt()
+                            ->mutable_body(0)
+                            ->mutable_print_stmt()
+                            ->mutable_bin_arith_exp()
+                            ->mutable_rhs();
+  divisor->mutable_lit_exp()->set_int_val(-1);
+  const Program before = pgm;
+  LoopInvariantStats stats;
+  HoistLoopInvariants(&pgm, &stats);
+  if (pgm.SerializeAsString() != before.SerializeAsString()) {
+    fprintf(stderr, "leaves division by -1: rewritten to\n%s\n",
+            pgm.DebugString().c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+}  // namespace steinlang
+
+int main() {
+  bool passed = steinlang::RunRewriteTests(
+      [](steinlang::Program* pgm) {
+        steinlang::LoopInvariantStats stats;
+        steinlang::HoistLoopInvariants(pgm, &stats);
+      },
+      steinlang::kTests);
+  passed = steinlang::TestLeavesDivisionByMinusOne() && passed;
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+#include "lang/steinlang/memoization.h"
+
+#include <gflags/gflags.h>
+#include <sstream>
+#include <unordered_set>
+
+#include "lang/steinlang/program_analysis.h"
+
+DEFINE_bool(memoize, false,
+            "If true, cache the results of calls to pure closures, keyed by "
+            "their arguments.");
+DEFINE_int64(memo_table_size, 1024,
+             "The maximum number of results cached per lambda by --memoize.");
+
+namespace steinlang {
+
+namespace {
+
+// Add the names of the variables that exp calls to called. Returns false if
+// exp creates a closure, or calls anything but a variable.
+bool CollectCalls(const Expression& exp,
+                  std::unordered_set<std::string>* called) {
+  switch (exp.type_case()) {
+    case Expression::kFuncAppExp: {
+      const FuncAppExpression& app = exp.func_app_exp();
+      if (!app.func().has_var_exp()) {
+        return false;
+      }
+      called->insert(app.func().var_exp().name());
+      for (const Expression& arg : app.arg()) {
+        if (!CollectCalls(arg, called)) {
+          return false;
+        }
+      }
+      return true;
+    }
+    case Expression::kMonArithExp:
+      return CollectCalls(exp.mon_arith_exp().exp(), called);
+    case Expression::kBinArithExp:
+      return CollectCalls(exp.bin_arith_exp().lhs(), called) &&
+             CollectCalls(exp.bin_arith_exp().rhs(), called);
+    case Expression::kTernExp:
+      return CollectCalls(exp.tern_exp().if_exp(), called) &&
+             CollectCalls(exp.tern_exp().cond_exp(), called) &&
+             CollectCalls(exp.tern_exp().else_exp(), called);
+    case Expression::kTupleExp:
+      for (const Expression& e : exp.tuple_exp().exp()) {
+        if (!CollectCalls(e, called)) {
+          return false;
+        }
+      }
+      return true;
+    case Expression::kLambdaExp:
+      return false;
+    case Expression::kVarExp:
+    case Expression::kLitExp:
+    case Expression::TYPE_NOT_SET:
+      return true;
+  }
+  return true;
+}
+
+// Likewise for a statement, which also may not print.
+bool CollectCalls(const Statement& stmt,
+                  std::unordered_set<std::string>* called) {
+  switch (stmt.type_case()) {
+    case Statement::kExpStmt:
+      return CollectCalls(stmt.exp_stmt(), called);
+    case Statement::kAssignStmt:
+      return CollectCalls(stmt.assign_stmt().lhs(), called) &&
+             CollectCalls(stmt.assign_stmt().rhs(), called);
+    case Statement::kRetStmt:
+      return CollectCalls(stmt.ret_stmt(), called);
+    case Statement::kPrintStmt:
+      return false;
+    case Statement::kIfElseStmt:
+      if (!CollectCalls(stmt.if_else_stmt().cond(), called)) {
+        return false;
+      }
+      for (const Statement& s : stmt.if_else_stmt().if_stmts()) {
+        if (!CollectCalls(s, called)) {
+          return false;
+        }
+      }
+      for (const Statement& s : stmt.if_else_stmt().else_stmts()) {
+        if (!CollectCalls(s, called)) {
+          return false;
+        }
+      }
+      return true;
+    case Statement::kWhileStmt:
+      if (!CollectCalls(stmt.while_stmt().cond(), called)) {
+        return false;
+      }
+      for (const Statement& s : stmt.while_stmt().body()) {
+        if (!CollectCalls(s, called)) {
+          return false;
+        }
+      }
+      return true;
+    case Statement::kForStmt:
+      if (!CollectCalls(stmt.for_stmt().init(), called) ||
+          !CollectCalls(stmt.for_stmt().cond(), called) ||
+          !CollectCalls(stmt.for_stmt().inc(), called)) {
+        return false;
+      }
+      for (const Statement& s : stmt.for_stmt().body()) {
+        if (!CollectCalls(s, called)) {
+          return false;
+        }
+      }
+      return true;
+    case Statement::TYPE_NOT_SET:
+      return true;
+  }
+  return true;
+}
+
+}  // namespace
+
+std::string MemoStats::DebugString() const {
+  std::ostringstream out;
+  out << "memoization: " << hits << " hits, " << misses << " misses, "
+      << evictions << " evictions";
+  return out.str();
+}
+
+bool AnalyzePurity(const LambdaExpression& lambda, PureLambda* pure) {
+  std::unordered_set<std::string> called;
+  std::unordered_set<std::string> written;
+  for (const Variable& param : lambda.param()) {
+    written.insert(param.name());
+  }
+  for (const Statement& stmt : lambda.body()) {
+    if (!CollectCalls(stmt, &called)) {
+      return false;
+    }
+    CollectFrameAssignments(stmt, &written);
+  }
+  // Calling a variable the lambda assigns may call anything.
+  for (const std::string& name : called) {
+    if (written.count(name) > 0) {
+      return false;
+    }
+  }
+  const FrameLayout& layout = lambda.layout();
+  for (int slot = 0; slot < layout.name_size(); ++slot) {
+    if (written.count(layout.name(slot)) > 0) {
+      pure->written.push_back(slot);
+    }
+    if (called.count(layout.name(slot)) > 0) {
+      pure->called.push_back(slot);
+    }
+  }
+  return true;
+}
+
+int64_t MemoTableSize() { return FLAGS_memoize ? FLAGS_memo_table_size : 0; }
+
+}  // namespace steinlang
@@ -0,0 +1,193 @@
+// Memoization of calls to pure closures, enabled by --memoize.
+//
+// A lambda is pure if its body doesn't print, doesn't create closures, and
+// only calls variables that it doesn't assign. Whether calling a closure of a
+// pure lambda is free of side effects is only known when it's called, though:
+// a closure's parameters and assigned variables share the binding of the
+// enclosing variable of the same name if it was bound when the closure was
+// created (see Assignments::params), so none of them may have captured one,
+// and the closures it calls must be pure too.
+//
+// The result of such a call only depends on its arguments and on the values
+// of the variables that it and its callees captured, so it's cached under
+// those, serialized as a tuple Literal. Each lambda has its own table of up to
+// --memo_table_size results, which evicts the least recently used one.
+//
+// The fork-join evaluator (see fork_join.h) uses the same analysis to find
+// calls that may be evaluated in parallel.
+
+#ifndef LANG_STEINLANG_MEMOIZATION_H_
+#define LANG_STEINLANG_MEMOIZATION_H_
+
+#include <stdint.h>
+#include <algorithm>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "lang/steinlang/steinlang_syntax.pb.h"
+
+namespace steinlang {
+
+struct MemoStats {
+  int64_t hits = 0;
+  int64_t misses = 0;
+  int64_t evictions = 0;
+
+  std::string DebugString() const;
+};
+
+// The variables a pure lambda writes and calls, by slot.
+struct PureLambda {
+  // The parameters and assigned variables.
+  std::vector<int> written;
+  // The variables that are called.
+  std::vector<int> called;
+};
+
+// Returns false if lambda isn't pure. lambda must be resolved.
+bool AnalyzePurity(const LambdaExpression& lambda, PureLambda* pure);
+
+// The maximum number of results cached per lambda, or 0 if memoization is
+// disabled.
+int64_t MemoTableSize();
+
+// The pure lambdas of a program.
+class PureLambdas {
+ public:
+  // Analyze the lambda whose Origin.source_id is lambda_id. Closures of
+  // lambdas that weren't added aren't pure.
+  void Add(int64_t lambda_id, const LambdaExpression& lambda) {
+    PureLambda pure;
+    if (AnalyzePurity(lambda, &pure)) {
+      pure_.emplace(lambda_id, std::move(pure));
+    }
+  }
+
+  // Whether calling a closure of lambda_id which captured capture is pure. If
+  // it is, the store addresses that the call may read are added to reads, in
+  // a deterministic order. closure_at(addr, &lambda_id) returns the captures
+  // of the closure stored at addr, and sets its lambda_id, or returns nullptr
+  // if there is no closure there.
+  template <typename Capture, typename ClosureAt>
+  bool IsPure(int64_t lambda_id, const Capture& capture, ClosureAt closure_at,
+              std::vector<int64_t>* reads) const {
+    std::vector<int64_t> visited;
+    return IsPure(lambda_id, capture, closure_at, &visited, reads);
+  }
+
+ private:
+  // visited holds the addresses of the callees checked so far, so that
+  // recursion terminates.
+  template <typename Capture, typename ClosureAt>
+  bool IsPure(int64_t lambda_id, const Capture& capture, ClosureAt closure_at,
+              std::vector<int64_t>* visited,
+              std::vector<int64_t>* reads) const {
+    auto pure_it = pure_.find(lambda_id);
+    if (pure_it == pure_.end()) {
+      return false;
+    }
+    const PureLambda& pure = pure_it->second;
+    const int num_captures = capture.size();
+    for (int slot : pure.written) {
+      if (slot < num_captures && capture[slot] >= 0) {
+        return false;
+      }
+    }
+    for (int64_t addr : capture) {
+      if (addr >= 0 &&
+          std::find(reads->begin(), reads->end(), addr) == reads->end()) {
+        reads->push_back(addr);
+      }
+    }
+    // A variable that was unbound when the closure was created, or that holds
+    // anything but a closure, calls nothing.
+    for (int slot : pure.called) {
+      if (slot >= num_captures || capture[slot] < 0 ||
+          std::find(visited->begin(), visited->end(), capture[slot]) !=
+              visited->end()) {
+        continue;
+      }
+      visited->push_back(capture[slot]);
+      int64_t callee_id;
+      const Capture* callee = closure_at(capture[slot], &callee_id);
+      if (callee != nullptr &&
+          !IsPure(callee_id, *callee, closure_at, visited, reads)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // By lambda_id.
+  std::unordered_map<int64_t, PureLambda> pure_;
+};
+
+// The memo tables of calls to pure closures. T is the type of results,
+// Literal or Value.
+template <typename T>
+class Memoizer {
+ public:
+  Memoizer() : table_size_(MemoTableSize()) {}
+
+  Memoizer(const Memoizer&) = delete;
+  Memoizer& operator=(const Memoizer&) = delete;
+
+  bool enabled() const { return table_size_ > 0; }
+
+  // The result cached for key by a call to lambda_id, or nullptr on a miss.
+  const T* Lookup(int64_t lambda_id, const std::string& key) {
+    auto table_it = tables_.find(lambda_id);
+    if (table_it != tables_.end()) {
+      Table& table = table_it->second;
+      auto it = table.index.find(key);
+      if (it != table.index.end()) {
+        ++stats_.hits;
+        table.entries.splice(table.entries.begin(), table.entries, it->second);
+        return &it->second->second;
+      }
+    }
+    ++stats_.misses;
+    return nullptr;
+  }
+
+  // Cache the result of a call to lambda_id after a miss. Does nothing if
+  // memoization is disabled.
+  void Insert(int64_t lambda_id, std::string key, T result) {
+    if (!enabled()) {
+      return;
+    }
+    Table& table = tables_[lambda_id];
+    if (table.index.count(key) > 0) {
+      return;
+    }
+    if (table.entries.size() >= static_cast<size_t>(table_size_)) {
+      table.index.erase(table.entries.back().first);
+      table.entries.pop_back();
+      ++stats_.evictions;
+    }
+    table.entries.emplace_front(std::move(key), std::move(result));
+    table.index.emplace(table.entries.front().first, table.entries.begin());
+  }
+
+  const MemoStats& stats() const { return stats_; }
+
+ private:
+  // Most recently used first.
+  struct Table {
+    std::list<std::pair<std::string, T>> entries;
+    std::unordered_map<std::string,
+                       typename std::list<std::pair<std::string, T>>::iterator>
+        index;
+  };
+
+  const int64_t table_size_;
+  std::unordered_map<int64_t, Table> tables_;
+  MemoStats stats_;
+};
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_MEMOIZATION_H_
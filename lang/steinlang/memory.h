@@ -5,6 +5,9 @@
 
 #include <google/protobuf/arena.h>
 #include <stdlib.h>
+#include <atomic>
+#include <future>
+#include <memory>
 #include <string>
 #include <tuple>
 #include <vector>
@@ -43,6 +46,12 @@ class Pool {
 
   void clear() { data_.clear(); }
 
+  // Clear the pool and create new objects on arena from now on.
+  void reset(google::protobuf::Arena* arena) {
+    data_.clear();
+    arena_ = arena;
+  }
+
   size_t size() const { return data_.size(); }
 
  private:
@@ -129,6 +138,18 @@ class PoolTuple {
     return &(std::get<Pool<T>>(pools_));
   }
 
+  // Clear all of the pools.
+  void clear() {
+    int unused[] = {(std::get<Pool<Ts>>(pools_).clear(), 0)...};
+    (void)unused;
+  }
+
+  // Clear all of the pools, and create new objects on arena from now on.
+  void reset(google::protobuf::Arena* arena) {
+    int unused[] = {(std::get<Pool<Ts>>(pools_).reset(arena), 0)...};
+    (void)unused;
+  }
+
  private:
   std::tuple<Pool<Ts>...> pools_;
 };
@@ -142,18 +163,18 @@ class PoolTuple {
 // and doing protobuf deep copies with pooling.
 class PoolingArenaAllocator {
  public:
-  PoolingArenaAllocator() : arena_(MakeArenaOptions()), pools_(&arena_) {}
+  PoolingArenaAllocator()
+      : arena_(new google::protobuf::Arena(MakeArenaOptions())),
+        spare_arena_(new google::protobuf::Arena(MakeArenaOptions())),
+        pools_(arena_.get()) {}
 
   // Reset the arena and clear the pools.
   // After a call to Reset(), all pointers previously returned by this allocator
   // will be deleted and invalidated.
   void Reset() {
-    pools_.get<Result>()->clear();
-    pools_.get<LocalContext>()->clear();
-    pools_.get<Literal>()->clear();
-    pools_.get<Computation>()->clear();
-    pools_.get<Expression>()->clear();
-    arena_.Reset();
+    WaitForSpareArena();
+    pools_.clear();
+    arena_->Reset();
   }
 
   template <typename T>
@@ -169,52 +190,75 @@ class PoolingArenaAllocator {
   }
 
   // Deep copy helpers for important steinlang message types.
-  // The way function application is currently implemented, we do a Closure deep
-  // copy for every function application, which may involve recursive copies of
-  // sub-statements and sub-expressions, so these copies need to be fast.
+  // Closures only refer to the immutable lambda they were created from, so
+  // these never need to copy syntax trees.
   void Copy(const Literal& lit, Literal* dst);
   void Copy(const Tuple& tuple, Tuple* dst);
-  void Copy(const Closure& closure, Closure* dst);
-  void Copy(const Statement& stmt, Statement* dst);
-  void Copy(const Expression& exp, Expression* dst);
-  void Copy(const FuncAppExpression& func_app_exp, FuncAppExpression* dst);
-  void Copy(const MonArithExpression& mon_arith_exp, MonArithExpression* dst);
-  void Copy(const BinArithExpression& bin_arith_exp, BinArithExpression* dst);
-  void Copy(const TernaryExpression& tern_exp, TernaryExpression* dst);
-  void Copy(const TupleExpression& tuple_exp, TupleExpression* dst);
-  void Copy(const LambdaExpression& lambda_exp, LambdaExpression* dst);
 
   EvalContext* AllocateEvalContext() {
-    return google::protobuf::Arena::CreateMessage<EvalContext>(&arena_);
+    return google::protobuf::Arena::CreateMessage<EvalContext>(arena_.get());
   }
 
+  // Semispace collection: copy ctx to a second arena, then reset the arena
+  // everything was allocated on, so only the live ctx is kept. Returns the
+  // copy; all other pointers previously returned by this allocator are
+  // invalidated.
+  // Resetting an arena runs the destructors of everything on it, so the old
+  // arena is reset in the background, off the evaluation thread.
+  // ctx->pgm() is shared with the copy rather than copied, so it must not be
+  // allocated on this allocator's arena.
+  EvalContext* Evacuate(EvalContext* ctx);
+
   // Callback method for arena block allocation. A wrapper around malloc with
   // some extra accounting.
   static void* AllocateBlock(size_t size) {
-    allocated_size_ += size;
+    total_allocated_size_ += size;
     return malloc(size);
   }
 
   // Callback method for arena block deallocation. A wrapper around free with
   // some extra accounting.
   static void DeallocateBlock(void* ptr, size_t size) {
-    allocated_size_ -= size;
+    total_allocated_size_ -= size;
     return free(ptr);
   }
 
-  // Total allocated minus deallocated block size.
-  static size_t allocated_size() { return allocated_size_; }
+  // The block size allocated by this allocator's arena, not counting a spare
+  // arena that's being reset after Evacuate(). An allocator is only used by
+  // one thread at a time, so this is also what that thread allocated for it.
+  size_t allocated_size() const { return arena_->SpaceAllocated(); }
+
+  // Total allocated minus deallocated block size, of all allocators in the
+  // process.
+  static size_t total_allocated_size() { return total_allocated_size_; }
 
  private:
   google::protobuf::ArenaOptions MakeArenaOptions();
 
-  google::protobuf::Arena arena_;
+  void WaitForSpareArena() {
+    if (spare_arena_reset_.valid()) {
+      spare_arena_reset_.wait();
+    }
+  }
+
+  // New messages are allocated on arena_. spare_arena_ is empty, except
+  // during Evacuate().
+  std::unique_ptr<google::protobuf::Arena> arena_;
+  std::unique_ptr<google::protobuf::Arena> spare_arena_;
+  // Resets spare_arena_ after Evacuate().
+  std::future<void> spare_arena_reset_;
 
-  static size_t allocated_size_;
+  static std::atomic<size_t> total_allocated_size_;
 
   // Template magic makes adding a new poolable type as easy as adding it to the
   // list of template arguments here.
-  PoolTuple<Result, LocalContext, Literal, Computation, Expression> pools_;
+  // Computation's oneof messages are pooled too, since clearing a Computation
+  // on an arena would otherwise leak them.
+  PoolTuple<Result, LocalContext, Literal, Computation, BinExpFinal,
+            MonExpFinal, TupleExpFinal, IgnoreOneResult, AssignStmtFinal,
+            FuncAppExpFinal, ReturnFromLocalContext, IfElseFinal, PrintFinal,
+            LoopFrame>
+      pools_;
 };
 
 }  // namespace steinlang
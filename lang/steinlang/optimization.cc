@@ -0,0 +1,45 @@
+#include "lang/steinlang/optimization.h"
+
+#include <gflags/gflags.h>
+
+DEFINE_bool(constant_folding, true,
+            "If true, fold constant expressions and propagate constant "
+            "variables before evaluation.");
+DEFINE_int32(inline_max_size, 16,
+             "Inline calls to constant lambdas whose body is a single return "
+             "of an expression with at most this many nodes. 0 disables "
+             "inlining.");
+DEFINE_bool(eliminate_dead_code, true,
+            "If true, remove unreachable statements, branches that are never "
+            "taken, and assignments that are never read.");
+DEFINE_bool(hoist_loop_invariants, true,
+            "If true, evaluate arithmetic that doesn't change while a loop "
+            "runs once, before the loop.");
+
+namespace steinlang {
+
+std::string OptimizationStats::DebugString() const {
+  return folding.DebugString() + "\n" + inlining.DebugString() + "\n" +
+         dead_code.DebugString() + "\n" + loop_invariants.DebugString();
+}
+
+void Optimize(Program* pgm, OptimizationStats* stats) {
+  if (FLAGS_constant_folding) {
+    FoldConstants(pgm, &stats->folding);
+  }
+  if (FLAGS_inline_max_size > 0) {
+    InlineLambdas(pgm, FLAGS_inline_max_size, &stats->inlining);
+    // Inlined bodies are often constant once their arguments are.
+    if (FLAGS_constant_folding && stats->inlining.inlined_calls > 0) {
+      FoldConstants(pgm, &stats->folding);
+    }
+  }
+  if (FLAGS_eliminate_dead_code) {
+    EliminateDeadCode(pgm, &stats->dead_code);
+  }
+  if (FLAGS_hoist_loop_invariants) {
+    HoistLoopInvariants(pgm, &stats->loop_invariants);
+  }
+}
+
+}  // namespace steinlang
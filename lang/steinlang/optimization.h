@@ -0,0 +1,34 @@
+// The syntax tree optimization passes that run before evaluation, in order,
+// as configured by flags. Shared by everything that runs or compiles programs.
+
+#ifndef LANG_STEINLANG_OPTIMIZATION_H_
+#define LANG_STEINLANG_OPTIMIZATION_H_
+
+#include <string>
+
+#include "lang/steinlang/constant_folding.h"
+#include "lang/steinlang/dead_code.h"
+#include "lang/steinlang/inlining.h"
+#include "lang/steinlang/loop_invariants.h"
+#include "lang/steinlang/steinlang_syntax.pb.h"
+
+namespace steinlang {
+
+struct OptimizationStats {
+  ConstantFoldingStats folding;
+  InliningStats inlining;
+  DeadCodeStats dead_code;
+  LoopInvariantStats loop_invariants;
+
+  // One line per pass.
+  std::string DebugString() const;
+};
+
+// Run the passes enabled by --constant_folding, --inline_max_size,
+// --eliminate_dead_code and --hoist_loop_invariants on pgm, which must not be
+// annotated yet.
+void Optimize(Program* pgm, OptimizationStats* stats);
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_OPTIMIZATION_H_
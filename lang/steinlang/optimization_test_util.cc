@@ -0,0 +1,102 @@
+#include "lang/steinlang/optimization_test_util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory>
+
+#include "lang/steinlang/language_evaluation.h"
+#include "lang/steinlang/memory.h"
+#include "lang/steinlang/run_status.h"
+#include "lang/steinlang/steinlang_parser.h"
+
+namespace steinlang {
+
+namespace {
+
+// The syntax tree of pgm, without the '$' of temporaries.
+std::string Canonical(const Program& pgm) {
+  std::string text = pgm.DebugString();
+  std::string canonical;
+  for (char c : text) {
+    if (c != '$') {
+      canonical += c;
+    }
+  }
+  return canonical;
+}
+
+std::string Join(const std::vector<std::string>& lines) {
+  std::string joined;
+  for (const std::string& line : lines) {
+    joined += "  " + line + "\n";
+  }
+  return joined;
+}
+
+bool Run(const OptimizationPass& pass, const RewriteTest& test) {
+  const Program before = ParseTestProgram(test.before);
+  Program actual = before;
+  pass(&actual);
+  const Program expected =
+      test.after == nullptr ? before : ParseTestProgram(test.after);
+  if (Canonical(actual) != Canonical(expected)) {
+    fprintf(stderr, "%s: rewritten to\n%s\nexpected\n%s\n", test.name,
+            Canonical(actual).c_str(), Canonical(expected).c_str());
+    return false;
+  }
+  if (test.traps) {
+    return true;
+  }
+  const std::vector<std::string> before_output = EvaluateTestProgram(before);
+  const std::vector<std::string> actual_output = EvaluateTestProgram(actual);
+  if (before_output != actual_output) {
+    fprintf(stderr, "%s: rewritten program prints\n%sinstead of\n%s",
+            test.name, Join(actual_output).c_str(),
+            Join(before_output).c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+Program ParseTestProgram(const std::string& text) {
+  Program pgm;
+  if (!ParseProgram(text, &pgm)) {
+    fprintf(stderr, "failed to parse:\n%s\n", text.c_str());
+    abort();
+  }
+  return pgm;
+}
+
+std::vector<std::string> EvaluateTestProgram(const Program& pgm) {
+  PoolingArenaAllocator allocator;
+  EvalContext* ctx = allocator.AllocateEvalContext();
+  InitEvalContext(pgm, ctx);
+  Evaluator evaluator(ctx, &allocator);
+  std::vector<std::string> output;
+  RunStatus status;
+  do {
+    status = evaluator.Run(4096);
+    for (std::string& line : evaluator.consume_output()) {
+      output.push_back(std::move(line));
+    }
+  } while (status.reason != StopReason::kFinished);
+  return output;
+}
+
+bool RunRewriteTests(const OptimizationPass& pass,
+                     const std::vector<RewriteTest>& tests) {
+  int failed = 0;
+  for (const RewriteTest& test : tests) {
+    if (!Run(pass, test)) {
+      ++failed;
+    }
+  }
+  fprintf(stderr, "%d of %d tests passed\n",
+          static_cast<int>(tests.size()) - failed,
+          static_cast<int>(tests.size()));
+  return failed == 0;
+}
+
+}  // namespace steinlang
@@ -0,0 +1,43 @@
+// Helpers for tests of the syntax tree optimization passes, which check that a
+// pass rewrites programs into the expected ones, and that the rewritten
+// programs print the same as the originals.
+
+#ifndef LANG_STEINLANG_OPTIMIZATION_TEST_UTIL_H_
+#define LANG_STEINLANG_OPTIMIZATION_TEST_UTIL_H_
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "lang/steinlang/steinlang_syntax.pb.h"
+
+namespace steinlang {
+
+using OptimizationPass = std::function<void(Program*)>;
+
+struct RewriteTest {
+  const char* name;
+  const char* before;
+  // What the pass should rewrite before into, or nullptr if it should leave
+  // it unchanged. Temporary variables that a pass introduces are named with a
+  // '$', which the parser doesn't accept, so it's dropped before comparing.
+  const char* after;
+  // The program traps, e.g. on division by zero, so it's only rewritten, not
+  // evaluated.
+  bool traps = false;
+};
+
+// Parse text, which must be a valid program.
+Program ParseTestProgram(const std::string& text);
+
+// Everything that pgm prints, evaluated by the Evaluator as is.
+std::vector<std::string> EvaluateTestProgram(const Program& pgm);
+
+// Run pass on each test's program, and print the tests that fail to stderr.
+// Returns true if they all pass.
+bool RunRewriteTests(const OptimizationPass& pass,
+                     const std::vector<RewriteTest>& tests);
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_OPTIMIZATION_TEST_UTIL_H_
@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lang/steinlang/bytecode.h"
+#include "lang/steinlang/constant_folding.h"
+#include "lang/steinlang/dead_code.h"
+#include "lang/steinlang/inlining.h"
+#include "lang/steinlang/language_evaluation.h"
+#include "lang/steinlang/loop_invariants.h"
+#include "lang/steinlang/memory.h"
+#include "lang/steinlang/optimization.h"
+#include "lang/steinlang/steinlang_parser.h"
+#include "lang/steinlang/virtual_machine.h"
+
+namespace steinlang {
+namespace {
+
+// Programs that print closures, which are printed with the params and body of
+// their lambda.
+const std::vector<const char*> kPrograms = {
+    "f = lambda q: q; print f;",
+    "x = 1; g = lambda q: q + x; print g;",
+    "def counter(k) { c = 4 + 8; return lambda y: c + (x + y); }"
+    "x = 1; h = counter(0); print h; print h(1);",
+    "def mk(a) { return lambda b: lambda c: a + (b + c); }"
+    "print mk(1); print mk(1)(2);",
+    "def mk(a) { return lambda b: a + b; } print mk(1);",
+    "f = lambda n: lambda m: n + 1; print f;",
+    // Each of these would be rewritten by a pass.
+    "inc = lambda x: x + 1; g = lambda q: inc(q); print g;",
+    "def f(n) { s = 0; for i = 0; i < n; i = i + 1; { s = s + (n * 2); } "
+    "return lambda q: s + q; } print f(3);",
+    "def g(q) { return q; print q; } print g;",
+    "y = 5; x = 1; g = lambda q: q + x; print g;",
+    "def apply(f) { return f; } print apply(lambda q: q + (1 * 2));",
+    "def id(v) { return v; } k = 2 * 3; print id(lambda q: q + k);",
+};
+
+// A closure's env only has the variables that its lambda captured, so y and g
+// aren't in it.
+const char kCaptureProgram[] = "x = 1; y = 2; g = lambda q: q + x; print g;";
+const char kCaptureOutput[] =
+    "closure_val { param { name: \"q\" } body { ret_stmt { bin_arith_exp { "
+    "lhs { var_exp { name: \"q\" } origin { } } rhs { var_exp { name: "
+    "\"x\" } origin { } } } origin { } } origin { } } env { key: \"x\" "
+    "value: 0 } }";
+
+// Programs that can't print closures, which the passes rewrite.
+const std::vector<const char*> kOptimizedPrograms = {
+    "x = 2; print x * 3;",
+    "def scale(n) { return n * (2 + 3); } print scale(scale(4));",
+    "f = lambda q: q + 1; g = f; print g(1 + 1);",
+};
+
+struct Pass {
+  const char* name;
+  std::function<void(Program*)> run;
+};
+
+const std::vector<Pass> kPasses = {
+    {"constant folding",
+     [](Program* pgm) {
+       ConstantFoldingStats stats;
+       FoldConstants(pgm, &stats);
+     }},
+    {"inlining",
+     [](Program* pgm) {
+       InliningStats stats;
+       InlineLambdas(pgm, 16, &stats);
+     }},
+    {"loop invariant hoisting",
+     [](Program* pgm) {
+       LoopInvariantStats stats;
+       HoistLoopInvariants(pgm, &stats);
+     }},
+    {"dead code elimination",
+     [](Program* pgm) {
+       DeadCodeStats stats;
+       EliminateDeadCode(pgm, &stats);
+     }},
+    {"all passes",
+     [](Program* pgm) {
+       OptimizationStats stats;
+       Optimize(pgm, &stats);
+     }},
+};
+
+// Fields that evaluation annotates the program with, which a printed closure
+// mustn't show.
+const std::vector<const char*> kAnnotations = {"source_id", "slot", "layout",
+                                               "fused"};
+
+Program Parse(const std::string& text) {
+  Program pgm;
+  if (!ParseProgram(text, &pgm)) {
+    fprintf(stderr, "failed to parse:\n%s\n", text.c_str());
+    abort();
+  }
+  return pgm;
+}
+
+template <typename E>
+std::vector<std::string> Run(E* evaluator) {
+  std::vector<std::string> output;
+  while (evaluator->HasComputation()) {
+    evaluator->Step();
+    for (std::string& line : evaluator->consume_output()) {
+      output.push_back(std::move(line));
+    }
+  }
+  return output;
+}
+
+std::vector<std::string> Evaluate(const Program& pgm) {
+  PoolingArenaAllocator allocator;
+  EvalContext* ctx = allocator.AllocateEvalContext();
+  InitEvalContext(pgm, ctx);
+  Evaluator evaluator(ctx, &allocator);
+  return Run(&evaluator);
+}
+
+std::vector<std::string> RunVirtualMachine(const Program& pgm) {
+  PoolingArenaAllocator allocator;
+  EvalContext* ctx = allocator.AllocateEvalContext();
+  InitEvalContext(pgm, ctx);
+  Bytecode bytecode;
+  if (!Compile(ctx->pgm(), &bytecode)) {
+    fprintf(stderr, "failed to compile:\n%s\n", pgm.DebugString().c_str());
+    abort();
+  }
+  VirtualMachine vm(&bytecode);
+  return Run(&vm);
+}
+
+void PrintOutput(const char* engine, const std::vector<std::string>& output) {
+  fprintf(stderr, "%s printed:\n", engine);
+  for (const std::string& line : output) {
+    fprintf(stderr, "  %s\n", line.c_str());
+  }
+}
+
+bool TestEnginesPrintTheSame(const char* text) {
+  const Program pgm = Parse(text);
+  const std::vector<std::string> evaluated = Evaluate(pgm);
+  const std::vector<std::string> run = RunVirtualMachine(pgm);
+  bool passed = true;
+  if (evaluated != run) {
+    fprintf(stderr, "%s\nprints differently in each engine\n", text);
+    passed = false;
+  }
+  for (const std::string& line : evaluated) {
+    for (const char* annotation : kAnnotations) {
+      if (line.find(annotation) != std::string::npos) {
+        fprintf(stderr, "%s\nprints a closure with %s\n", text, annotation);
+        passed = false;
+      }
+    }
+  }
+  if (!passed) {
+    PrintOutput("Evaluator", evaluated);
+    PrintOutput("VirtualMachine", run);
+  }
+  return passed;
+}
+
+// Each pass must leave what the program prints unchanged.
+bool TestPassesPrintTheSame(const char* text) {
+  const Program pgm = Parse(text);
+  const std::vector<std::string> expected = Evaluate(pgm);
+  bool passed = true;
+  for (const Pass& pass : kPasses) {
+    Program optimized = pgm;
+    pass.run(&optimized);
+    const std::vector<std::string> output = Evaluate(optimized);
+    if (output != expected) {
+      fprintf(stderr, "%s\nprints differently after %s\n", text, pass.name);
+      PrintOutput("The program", expected);
+      PrintOutput("The optimized program", output);
+      passed = false;
+    }
+  }
+  return passed;
+}
+
+bool TestPassesRewrite(const char* text) {
+  const Program pgm = Parse(text);
+  Program optimized = pgm;
+  for (const Pass& pass : kPasses) {
+    pass.run(&optimized);
+  }
+  if (optimized.SerializeAsString() == pgm.SerializeAsString()) {
+    fprintf(stderr, "%s\nisn't optimized\n", text);
+    return false;
+  }
+  return Evaluate(optimized) == Evaluate(pgm);
+}
+
+bool TestEnvHasCapturedVariables() {
+  const std::vector<std::string> output = Evaluate(Parse(kCaptureProgram));
+  if (output != std::vector<std::string>{kCaptureOutput}) {
+    fprintf(stderr, "%s\ndoesn't print\n  %s\n", kCaptureProgram,
+            kCaptureOutput);
+    PrintOutput("Evaluator", output);
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+}  // namespace steinlang
+
+int main() {
+  int failed = 0;
+  for (const char* text : steinlang::kPrograms) {
+    if (!steinlang::TestEnginesPrintTheSame(text)) {
+      ++failed;
+    }
+    if (!steinlang::TestPassesPrintTheSame(text)) {
+      ++failed;
+    }
+  }
+  for (const char* text : steinlang::kOptimizedPrograms) {
+    if (!steinlang::TestPassesRewrite(text)) {
+      ++failed;
+    }
+  }
+  if (!steinlang::TestEnvHasCapturedVariables()) {
+    ++failed;
+  }
+  const int total = 2 * steinlang::kPrograms.size() +
+                    steinlang::kOptimizedPrograms.size() + 1;
+  fprintf(stderr, "%d of %d tests passed\n", total - failed, total);
+  return failed == 0 ? 0 : 1;
+}
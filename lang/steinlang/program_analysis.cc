@@ -0,0 +1,468 @@
+#include "lang/steinlang/program_analysis.h"
+
+namespace steinlang {
+
+namespace {
+
+void CollectAssignments(const Statement& stmt, Assignments* assignments);
+
+// Count every variable in exp as assigned.
+void CollectAssigned(const Expression& exp, Assignments* assignments);
+
+void CollectAssignments(const Expression& exp, Assignments* assignments) {
+  switch (exp.type_case()) {
+    case Expression::kFuncAppExp:
+      CollectAssignments(exp.func_app_exp().func(), assignments);
+      for (const Expression& arg : exp.func_app_exp().arg()) {
+        CollectAssignments(arg, assignments);
+      }
+      break;
+    case Expression::kMonArithExp:
+      CollectAssignments(exp.mon_arith_exp().exp(), assignments);
+      break;
+    case Expression::kBinArithExp:
+      CollectAssignments(exp.bin_arith_exp().lhs(), assignments);
+      CollectAssignments(exp.bin_arith_exp().rhs(), assignments);
+      break;
+    case Expression::kTernExp:
+      CollectAssignments(exp.tern_exp().if_exp(), assignments);
+      CollectAssignments(exp.tern_exp().cond_exp(), assignments);
+      CollectAssignments(exp.tern_exp().else_exp(), assignments);
+      break;
+    case Expression::kTupleExp:
+      for (const Expression& e : exp.tuple_exp().exp()) {
+        CollectAssignments(e, assignments);
+      }
+      break;
+    case Expression::kLambdaExp: {
+      for (const Variable& param : exp.lambda_exp().param()) {
+        assignments->params.insert(param.name());
+      }
+      Assignments body;
+      for (const Statement& s : exp.lambda_exp().body()) {
+        CollectAssignments(s, &body);
+      }
+      for (const auto& name_count : body.count) {
+        assignments->count[name_count.first] += name_count.second;
+        assignments->in_lambdas.insert(name_count.first);
+      }
+      assignments->params.insert(body.params.begin(), body.params.end());
+      break;
+    }
+    case Expression::kVarExp:
+    case Expression::kLitExp:
+    case Expression::TYPE_NOT_SET:
+      break;
+  }
+}
+
+void CollectAssigned(const Expression& exp, Assignments* assignments) {
+  switch (exp.type_case()) {
+    case Expression::kVarExp:
+      ++assignments->count[exp.var_exp().name()];
+      break;
+    case Expression::kFuncAppExp:
+      CollectAssigned(exp.func_app_exp().func(), assignments);
+      for (const Expression& arg : exp.func_app_exp().arg()) {
+        CollectAssigned(arg, assignments);
+      }
+      break;
+    case Expression::kMonArithExp:
+      CollectAssigned(exp.mon_arith_exp().exp(), assignments);
+      break;
+    case Expression::kBinArithExp:
+      CollectAssigned(exp.bin_arith_exp().lhs(), assignments);
+      CollectAssigned(exp.bin_arith_exp().rhs(), assignments);
+      break;
+    case Expression::kTernExp:
+      CollectAssigned(exp.tern_exp().if_exp(), assignments);
+      CollectAssigned(exp.tern_exp().cond_exp(), assignments);
+      CollectAssigned(exp.tern_exp().else_exp(), assignments);
+      break;
+    case Expression::kTupleExp:
+      for (const Expression& e : exp.tuple_exp().exp()) {
+        CollectAssigned(e, assignments);
+      }
+      break;
+    case Expression::kLambdaExp:
+      CollectAssignments(exp, assignments);
+      break;
+    case Expression::kLitExp:
+    case Expression::TYPE_NOT_SET:
+      break;
+  }
+}
+
+void CollectAssignments(const Statement& stmt, Assignments* assignments) {
+  switch (stmt.type_case()) {
+    case Statement::kExpStmt:
+      CollectAssignments(stmt.exp_stmt(), assignments);
+      break;
+    case Statement::kAssignStmt:
+      CollectAssigned(stmt.assign_stmt().lhs(), assignments);
+      CollectAssignments(stmt.assign_stmt().rhs(), assignments);
+      break;
+    case Statement::kRetStmt:
+      CollectAssignments(stmt.ret_stmt(), assignments);
+      break;
+    case Statement::kPrintStmt:
+      CollectAssignments(stmt.print_stmt(), assignments);
+      break;
+    case Statement::kIfElseStmt:
+      CollectAssignments(stmt.if_else_stmt().cond(), assignments);
+      for (const Statement& s : stmt.if_else_stmt().if_stmts()) {
+        CollectAssignments(s, assignments);
+      }
+      for (const Statement& s : stmt.if_else_stmt().else_stmts()) {
+        CollectAssignments(s, assignments);
+      }
+      break;
+    case Statement::kWhileStmt:
+      CollectAssignments(stmt.while_stmt().cond(), assignments);
+      for (const Statement& s : stmt.while_stmt().body()) {
+        CollectAssignments(s, assignments);
+      }
+      break;
+    case Statement::kForStmt:
+      CollectAssignments(stmt.for_stmt().init(), assignments);
+      CollectAssignments(stmt.for_stmt().cond(), assignments);
+      CollectAssignments(stmt.for_stmt().inc(), assignments);
+      for (const Statement& s : stmt.for_stmt().body()) {
+        CollectAssignments(s, assignments);
+      }
+      break;
+    case Statement::TYPE_NOT_SET:
+      break;
+  }
+}
+
+// What may hold a closure, found by propagating through the program until
+// nothing changes.
+struct ClosureFlow {
+  // The lambda parameters, which may be closures if args is.
+  std::unordered_set<std::string> params;
+  // The names of variables that may hold closures.
+  std::unordered_set<std::string> vars;
+  // True if some lambda may return a closure.
+  bool returns = false;
+  // True if some call may be passed a closure.
+  bool args = false;
+  // True if some print statement may print a closure.
+  bool prints = false;
+  bool changed = false;
+};
+
+bool MayBeClosure(const Expression& exp, const ClosureFlow& flow) {
+  switch (exp.type_case()) {
+    case Expression::kLambdaExp:
+      return true;
+    case Expression::kVarExp:
+      return flow.vars.count(exp.var_exp().name()) > 0;
+    case Expression::kFuncAppExp:
+      return flow.returns;
+    case Expression::kTernExp:
+      return MayBeClosure(exp.tern_exp().if_exp(), flow) ||
+             MayBeClosure(exp.tern_exp().else_exp(), flow);
+    case Expression::kTupleExp:
+      for (const Expression& e : exp.tuple_exp().exp()) {
+        if (MayBeClosure(e, flow)) {
+          return true;
+        }
+      }
+      return false;
+    // Arithmetic on a closure results in None.
+    case Expression::kMonArithExp:
+    case Expression::kBinArithExp:
+    case Expression::kLitExp:
+    case Expression::TYPE_NOT_SET:
+      return false;
+  }
+  return false;
+}
+
+void SetFlag(bool value, ClosureFlow* flow, bool* flag) {
+  if (value && !*flag) {
+    *flag = true;
+    flow->changed = true;
+  }
+}
+
+void FlowClosures(const Statement& stmt, ClosureFlow* flow);
+
+void FlowClosures(const Expression& exp, ClosureFlow* flow) {
+  switch (exp.type_case()) {
+    case Expression::kFuncAppExp:
+      FlowClosures(exp.func_app_exp().func(), flow);
+      for (const Expression& arg : exp.func_app_exp().arg()) {
+        SetFlag(MayBeClosure(arg, *flow), flow, &flow->args);
+        FlowClosures(arg, flow);
+      }
+      break;
+    case Expression::kMonArithExp:
+      FlowClosures(exp.mon_arith_exp().exp(), flow);
+      break;
+    case Expression::kBinArithExp:
+      FlowClosures(exp.bin_arith_exp().lhs(), flow);
+      FlowClosures(exp.bin_arith_exp().rhs(), flow);
+      break;
+    case Expression::kTernExp:
+      FlowClosures(exp.tern_exp().if_exp(), flow);
+      FlowClosures(exp.tern_exp().cond_exp(), flow);
+      FlowClosures(exp.tern_exp().else_exp(), flow);
+      break;
+    case Expression::kTupleExp:
+      for (const Expression& e : exp.tuple_exp().exp()) {
+        FlowClosures(e, flow);
+      }
+      break;
+    case Expression::kLambdaExp:
+      for (const Statement& s : exp.lambda_exp().body()) {
+        FlowClosures(s, flow);
+      }
+      break;
+    case Expression::kVarExp:
+    case Expression::kLitExp:
+    case Expression::TYPE_NOT_SET:
+      break;
+  }
+}
+
+void FlowClosures(const Statement& stmt, ClosureFlow* flow) {
+  switch (stmt.type_case()) {
+    case Statement::kExpStmt:
+      FlowClosures(stmt.exp_stmt(), flow);
+      break;
+    case Statement::kAssignStmt:
+      if (MayBeClosure(stmt.assign_stmt().rhs(), *flow)) {
+        std::unordered_set<std::string> names;
+        CollectFrameNames(stmt.assign_stmt().lhs(), &names);
+        for (const std::string& name : names) {
+          flow->changed = flow->vars.insert(name).second || flow->changed;
+        }
+      }
+      FlowClosures(stmt.assign_stmt().lhs(), flow);
+      FlowClosures(stmt.assign_stmt().rhs(), flow);
+      break;
+    case Statement::kRetStmt:
+      SetFlag(MayBeClosure(stmt.ret_stmt(), *flow), flow, &flow->returns);
+      FlowClosures(stmt.ret_stmt(), flow);
+      break;
+    case Statement::kPrintStmt:
+      SetFlag(MayBeClosure(stmt.print_stmt(), *flow), flow, &flow->prints);
+      FlowClosures(stmt.print_stmt(), flow);
+      break;
+    case Statement::kIfElseStmt:
+      FlowClosures(stmt.if_else_stmt().cond(), flow);
+      for (const Statement& s : stmt.if_else_stmt().if_stmts()) {
+        FlowClosures(s, flow);
+      }
+      for (const Statement& s : stmt.if_else_stmt().else_stmts()) {
+        FlowClosures(s, flow);
+      }
+      break;
+    case Statement::kWhileStmt:
+      FlowClosures(stmt.while_stmt().cond(), flow);
+      for (const Statement& s : stmt.while_stmt().body()) {
+        FlowClosures(s, flow);
+      }
+      break;
+    case Statement::kForStmt:
+      FlowClosures(stmt.for_stmt().init(), flow);
+      FlowClosures(stmt.for_stmt().cond(), flow);
+      FlowClosures(stmt.for_stmt().inc(), flow);
+      for (const Statement& s : stmt.for_stmt().body()) {
+        FlowClosures(s, flow);
+      }
+      break;
+    case Statement::TYPE_NOT_SET:
+      break;
+  }
+}
+
+}  // namespace
+
+void CollectFrameNames(const Expression& exp,
+                       std::unordered_set<std::string>* names) {
+  switch (exp.type_case()) {
+    case Expression::kVarExp:
+      names->insert(exp.var_exp().name());
+      break;
+    case Expression::kFuncAppExp:
+      CollectFrameNames(exp.func_app_exp().func(), names);
+      for (const Expression& arg : exp.func_app_exp().arg()) {
+        CollectFrameNames(arg, names);
+      }
+      break;
+    case Expression::kMonArithExp:
+      CollectFrameNames(exp.mon_arith_exp().exp(), names);
+      break;
+    case Expression::kBinArithExp:
+      CollectFrameNames(exp.bin_arith_exp().lhs(), names);
+      CollectFrameNames(exp.bin_arith_exp().rhs(), names);
+      break;
+    case Expression::kTernExp:
+      CollectFrameNames(exp.tern_exp().if_exp(), names);
+      CollectFrameNames(exp.tern_exp().cond_exp(), names);
+      CollectFrameNames(exp.tern_exp().else_exp(), names);
+      break;
+    case Expression::kTupleExp:
+      for (const Expression& e : exp.tuple_exp().exp()) {
+        CollectFrameNames(e, names);
+      }
+      break;
+    case Expression::kLambdaExp:
+    case Expression::kLitExp:
+    case Expression::TYPE_NOT_SET:
+      break;
+  }
+}
+
+bool Assignments::AssignedOnce(const std::string& name) const {
+  auto it = count.find(name);
+  return it != count.end() && it->second == 1 && params.count(name) == 0;
+}
+
+Assignments CollectAssignments(const Program& pgm) {
+  Assignments assignments;
+  for (const Statement& stmt : pgm.stmt()) {
+    CollectAssignments(stmt, &assignments);
+  }
+  return assignments;
+}
+
+bool MayPrintClosures(const Program& pgm) {
+  ClosureFlow flow;
+  flow.params = CollectAssignments(pgm).params;
+  do {
+    flow.changed = false;
+    if (flow.args) {
+      for (const std::string& param : flow.params) {
+        flow.changed = flow.vars.insert(param).second || flow.changed;
+      }
+    }
+    for (const Statement& stmt : pgm.stmt()) {
+      FlowClosures(stmt, &flow);
+    }
+  } while (flow.changed && !flow.prints);
+  return flow.prints;
+}
+
+void CollectFrameAssignments(const Statement& stmt,
+                             std::unordered_set<std::string>* names) {
+  switch (stmt.type_case()) {
+    case Statement::kAssignStmt:
+      CollectFrameNames(stmt.assign_stmt().lhs(), names);
+      break;
+    case Statement::kIfElseStmt:
+      for (const Statement& s : stmt.if_else_stmt().if_stmts()) {
+        CollectFrameAssignments(s, names);
+      }
+      for (const Statement& s : stmt.if_else_stmt().else_stmts()) {
+        CollectFrameAssignments(s, names);
+      }
+      break;
+    case Statement::kWhileStmt:
+      for (const Statement& s : stmt.while_stmt().body()) {
+        CollectFrameAssignments(s, names);
+      }
+      break;
+    case Statement::kForStmt:
+      CollectFrameAssignments(stmt.for_stmt().init(), names);
+      CollectFrameAssignments(stmt.for_stmt().inc(), names);
+      for (const Statement& s : stmt.for_stmt().body()) {
+        CollectFrameAssignments(s, names);
+      }
+      break;
+    case Statement::kExpStmt:
+    case Statement::kRetStmt:
+    case Statement::kPrintStmt:
+    case Statement::TYPE_NOT_SET:
+      break;
+  }
+}
+
+void CollectFrameNames(const Statement& stmt,
+                       std::unordered_set<std::string>* names) {
+  switch (stmt.type_case()) {
+    case Statement::kExpStmt:
+      CollectFrameNames(stmt.exp_stmt(), names);
+      break;
+    case Statement::kAssignStmt:
+      CollectFrameNames(stmt.assign_stmt().lhs(), names);
+      CollectFrameNames(stmt.assign_stmt().rhs(), names);
+      break;
+    case Statement::kRetStmt:
+      CollectFrameNames(stmt.ret_stmt(), names);
+      break;
+    case Statement::kPrintStmt:
+      CollectFrameNames(stmt.print_stmt(), names);
+      break;
+    case Statement::kIfElseStmt:
+      CollectFrameNames(stmt.if_else_stmt().cond(), names);
+      for (const Statement& s : stmt.if_else_stmt().if_stmts()) {
+        CollectFrameNames(s, names);
+      }
+      for (const Statement& s : stmt.if_else_stmt().else_stmts()) {
+        CollectFrameNames(s, names);
+      }
+      break;
+    case Statement::kWhileStmt:
+      CollectFrameNames(stmt.while_stmt().cond(), names);
+      for (const Statement& s : stmt.while_stmt().body()) {
+        CollectFrameNames(s, names);
+      }
+      break;
+    case Statement::kForStmt:
+      CollectFrameNames(stmt.for_stmt().init(), names);
+      CollectFrameNames(stmt.for_stmt().cond(), names);
+      CollectFrameNames(stmt.for_stmt().inc(), names);
+      for (const Statement& s : stmt.for_stmt().body()) {
+        CollectFrameNames(s, names);
+      }
+      break;
+    case Statement::TYPE_NOT_SET:
+      break;
+  }
+}
+
+bool IsSafeDivisor(const Expression& exp) {
+  if (!exp.has_lit_exp()) {
+    return false;
+  }
+  const Literal& lit = exp.lit_exp();
+  return lit.has_float_val() ||
+         (lit.has_int_val() && lit.int_val() != 0 && lit.int_val() != -1);
+}
+
+bool HasSideEffects(const Expression& exp) {
+  switch (exp.type_case()) {
+    case Expression::kFuncAppExp:
+      return true;
+    case Expression::kMonArithExp:
+      return HasSideEffects(exp.mon_arith_exp().exp());
+    case Expression::kBinArithExp:
+      return (exp.bin_arith_exp().op() == DIV &&
+              !IsSafeDivisor(exp.bin_arith_exp().rhs())) ||
+             HasSideEffects(exp.bin_arith_exp().lhs()) ||
+             HasSideEffects(exp.bin_arith_exp().rhs());
+    case Expression::kTernExp:
+      return HasSideEffects(exp.tern_exp().if_exp()) ||
+             HasSideEffects(exp.tern_exp().cond_exp()) ||
+             HasSideEffects(exp.tern_exp().else_exp());
+    case Expression::kTupleExp:
+      for (const Expression& e : exp.tuple_exp().exp()) {
+        if (HasSideEffects(e)) {
+          return true;
+        }
+      }
+      return false;
+    case Expression::kVarExp:
+    case Expression::kLitExp:
+    case Expression::kLambdaExp:
+    case Expression::TYPE_NOT_SET:
+      return false;
+  }
+  return false;
+}
+
+}  // namespace steinlang
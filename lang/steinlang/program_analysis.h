@@ -0,0 +1,66 @@
+// Static analyses of Program syntax trees shared by the optimization passes,
+// which run before the program is annotated and work by variable name.
+
+#ifndef LANG_STEINLANG_PROGRAM_ANALYSIS_H_
+#define LANG_STEINLANG_PROGRAM_ANALYSIS_H_
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "lang/steinlang/steinlang_syntax.pb.h"
+
+namespace steinlang {
+
+// The names that are assigned to anywhere in a program, including in lambda
+// bodies.
+struct Assignments {
+  // The number of assignments to each name.
+  std::unordered_map<std::string, int> count;
+  // The names of lambda parameters. A closure's parameter shares the binding
+  // of the enclosing variable of the same name, if it was bound when the
+  // closure was created, so binding it is like an assignment.
+  std::unordered_set<std::string> params;
+  // The names assigned in lambda bodies. Calling a closure may assign to the
+  // variables of these names that it captured.
+  std::unordered_set<std::string> in_lambdas;
+
+  // True if name is assigned exactly once, and is never a parameter.
+  bool AssignedOnce(const std::string& name) const;
+};
+
+Assignments CollectAssignments(const Program& pgm);
+
+// Add the names that stmt assigns in the frame it runs in to names, not
+// including assignments in the bodies of lambdas in stmt.
+void CollectFrameAssignments(const Statement& stmt,
+                             std::unordered_set<std::string>* names);
+
+// Add the names that stmt reads or assigns in the frame it runs in to names.
+// Names in the bodies of lambdas in stmt are bound in the lambda's frame, so
+// they aren't included.
+void CollectFrameNames(const Statement& stmt,
+                       std::unordered_set<std::string>* names);
+void CollectFrameNames(const Expression& exp,
+                       std::unordered_set<std::string>* names);
+
+// True if a print statement in pgm may print a closure, or a tuple with one in
+// it. Closures print their lambda's body and the store addresses of the
+// variables they captured, which the optimization passes change. Conservative:
+// variables are told apart by name only, any call may return a closure if any
+// lambda returns one, and any parameter may be one if any call is passed one.
+bool MayPrintClosures(const Program& pgm);
+
+// True if exp is a literal that division can't trap on: a float, which makes
+// it float division, or an int other than 0 and -1, which traps with the
+// smallest dividend. Any other divisor may be read as 0 by integer division.
+bool IsSafeDivisor(const Expression& exp);
+
+// True if evaluating exp may do anything but compute a value: call a function,
+// which may assign variables or print, or divide by a divisor that may trap.
+// Lambda bodies aren't run when the lambda is evaluated, so they don't count.
+bool HasSideEffects(const Expression& exp);
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_PROGRAM_ANALYSIS_H_
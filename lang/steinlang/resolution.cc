@@ -0,0 +1,354 @@
+#include "lang/steinlang/resolution.h"
+
+#include <string>
+#include <unordered_map>
+
+namespace steinlang {
+
+namespace {
+
+// Names of a frame in order of first use, with their slots.
+class Slots {
+ public:
+  explicit Slots(FrameLayout* layout) : layout_(layout) {}
+
+  void Add(const std::string& name) {
+    if (slot_.emplace(name, layout_->name_size()).second) {
+      layout_->add_name(name);
+    }
+  }
+
+  int Get(const std::string& name) const { return slot_.at(name); }
+
+ private:
+  FrameLayout* layout_;
+  std::unordered_map<std::string, int> slot_;
+};
+
+void CollectNames(const Statement& stmt, Slots* slots);
+
+void CollectNames(const Expression& exp, Slots* slots) {
+  switch (exp.type_case()) {
+    case Expression::kVarExp:
+      slots->Add(exp.var_exp().name());
+      break;
+    case Expression::kFuncAppExp:
+      CollectNames(exp.func_app_exp().func(), slots);
+      for (const Expression& arg : exp.func_app_exp().arg()) {
+        CollectNames(arg, slots);
+      }
+      break;
+    case Expression::kMonArithExp:
+      CollectNames(exp.mon_arith_exp().exp(), slots);
+      break;
+    case Expression::kBinArithExp:
+      CollectNames(exp.bin_arith_exp().lhs(), slots);
+      CollectNames(exp.bin_arith_exp().rhs(), slots);
+      break;
+    case Expression::kTernExp:
+      CollectNames(exp.tern_exp().if_exp(), slots);
+      CollectNames(exp.tern_exp().cond_exp(), slots);
+      CollectNames(exp.tern_exp().else_exp(), slots);
+      break;
+    case Expression::kTupleExp:
+      for (const Expression& e : exp.tuple_exp().exp()) {
+        CollectNames(e, slots);
+      }
+      break;
+    case Expression::kLambdaExp:
+      // Any name used by a nested lambda may be captured from this frame.
+      for (const Variable& param : exp.lambda_exp().param()) {
+        slots->Add(param.name());
+      }
+      for (const Statement& s : exp.lambda_exp().body()) {
+        CollectNames(s, slots);
+      }
+      break;
+    case Expression::kLitExp:
+    case Expression::TYPE_NOT_SET:
+      break;
+  }
+}
+
+void CollectNames(const Statement& stmt, Slots* slots) {
+  switch (stmt.type_case()) {
+    case Statement::kExpStmt:
+      CollectNames(stmt.exp_stmt(), slots);
+      break;
+    case Statement::kAssignStmt:
+      CollectNames(stmt.assign_stmt().lhs(), slots);
+      CollectNames(stmt.assign_stmt().rhs(), slots);
+      break;
+    case Statement::kRetStmt:
+      CollectNames(stmt.ret_stmt(), slots);
+      break;
+    case Statement::kPrintStmt:
+      CollectNames(stmt.print_stmt(), slots);
+      break;
+    case Statement::kIfElseStmt:
+      CollectNames(stmt.if_else_stmt().cond(), slots);
+      for (const Statement& s : stmt.if_else_stmt().if_stmts()) {
+        CollectNames(s, slots);
+      }
+      for (const Statement& s : stmt.if_else_stmt().else_stmts()) {
+        CollectNames(s, slots);
+      }
+      break;
+    case Statement::kWhileStmt:
+      CollectNames(stmt.while_stmt().cond(), slots);
+      for (const Statement& s : stmt.while_stmt().body()) {
+        CollectNames(s, slots);
+      }
+      break;
+    case Statement::kForStmt:
+      CollectNames(stmt.for_stmt().init(), slots);
+      CollectNames(stmt.for_stmt().cond(), slots);
+      CollectNames(stmt.for_stmt().inc(), slots);
+      for (const Statement& s : stmt.for_stmt().body()) {
+        CollectNames(s, slots);
+      }
+      break;
+    case Statement::TYPE_NOT_SET:
+      break;
+  }
+}
+
+void Resolve(Statement* stmt, const Slots& slots);
+
+void Resolve(LambdaExpression* lambda_exp, const Slots& enclosing) {
+  FrameLayout* layout = lambda_exp->mutable_layout();
+  layout->Clear();
+  Slots slots(layout);
+  for (const Variable& param : lambda_exp->param()) {
+    slots.Add(param.name());
+  }
+  for (const Statement& s : lambda_exp->body()) {
+    CollectNames(s, &slots);
+  }
+  for (const std::string& name : layout->name()) {
+    layout->add_capture(enclosing.Get(name));
+  }
+
+  for (Variable& param : *lambda_exp->mutable_param()) {
+    param.set_slot(slots.Get(param.name()));
+  }
+  for (Statement& s : *lambda_exp->mutable_body()) {
+    Resolve(&s, slots);
+  }
+}
+
+void Resolve(Expression* exp, const Slots& slots) {
+  switch (exp->type_case()) {
+    case Expression::kVarExp:
+      exp->mutable_var_exp()->set_slot(slots.Get(exp->var_exp().name()));
+      break;
+    case Expression::kFuncAppExp:
+      Resolve(exp->mutable_func_app_exp()->mutable_func(), slots);
+      for (Expression& arg : *exp->mutable_func_app_exp()->mutable_arg()) {
+        Resolve(&arg, slots);
+      }
+      break;
+    case Expression::kMonArithExp:
+      Resolve(exp->mutable_mon_arith_exp()->mutable_exp(), slots);
+      break;
+    case Expression::kBinArithExp:
+      Resolve(exp->mutable_bin_arith_exp()->mutable_lhs(), slots);
+      Resolve(exp->mutable_bin_arith_exp()->mutable_rhs(), slots);
+      break;
+    case Expression::kTernExp:
+      Resolve(exp->mutable_tern_exp()->mutable_if_exp(), slots);
+      Resolve(exp->mutable_tern_exp()->mutable_cond_exp(), slots);
+      Resolve(exp->mutable_tern_exp()->mutable_else_exp(), slots);
+      break;
+    case Expression::kTupleExp:
+      for (Expression& e : *exp->mutable_tuple_exp()->mutable_exp()) {
+        Resolve(&e, slots);
+      }
+      break;
+    case Expression::kLambdaExp:
+      Resolve(exp->mutable_lambda_exp(), slots);
+      break;
+    case Expression::kLitExp:
+    case Expression::TYPE_NOT_SET:
+      break;
+  }
+}
+
+void Resolve(Statement* stmt, const Slots& slots) {
+  switch (stmt->type_case()) {
+    case Statement::kExpStmt:
+      Resolve(stmt->mutable_exp_stmt(), slots);
+      break;
+    case Statement::kAssignStmt:
+      Resolve(stmt->mutable_assign_stmt()->mutable_lhs(), slots);
+      Resolve(stmt->mutable_assign_stmt()->mutable_rhs(), slots);
+      break;
+    case Statement::kRetStmt:
+      Resolve(stmt->mutable_ret_stmt(), slots);
+      break;
+    case Statement::kPrintStmt:
+      Resolve(stmt->mutable_print_stmt(), slots);
+      break;
+    case Statement::kIfElseStmt:
+      Resolve(stmt->mutable_if_else_stmt()->mutable_cond(), slots);
+      for (Statement& s : *stmt->mutable_if_else_stmt()->mutable_if_stmts()) {
+        Resolve(&s, slots);
+      }
+      for (Statement& s : *stmt->mutable_if_else_stmt()->mutable_else_stmts()) {
+        Resolve(&s, slots);
+      }
+      break;
+    case Statement::kWhileStmt:
+      Resolve(stmt->mutable_while_stmt()->mutable_cond(), slots);
+      for (Statement& s : *stmt->mutable_while_stmt()->mutable_body()) {
+        Resolve(&s, slots);
+      }
+      break;
+    case Statement::kForStmt:
+      Resolve(stmt->mutable_for_stmt()->mutable_init(), slots);
+      Resolve(stmt->mutable_for_stmt()->mutable_cond(), slots);
+      Resolve(stmt->mutable_for_stmt()->mutable_inc(), slots);
+      for (Statement& s : *stmt->mutable_for_stmt()->mutable_body()) {
+        Resolve(&s, slots);
+      }
+      break;
+    case Statement::TYPE_NOT_SET:
+      break;
+  }
+}
+
+const LambdaExpression* FindLambda(const Statement& stmt, int64_t source_id);
+
+const LambdaExpression* FindLambda(const Expression& exp, int64_t source_id) {
+  const LambdaExpression* found = nullptr;
+  switch (exp.type_case()) {
+    case Expression::kFuncAppExp:
+      found = FindLambda(exp.func_app_exp().func(), source_id);
+      for (int i = 0; !found && i < exp.func_app_exp().arg_size(); ++i) {
+        found = FindLambda(exp.func_app_exp().arg(i), source_id);
+      }
+      break;
+    case Expression::kMonArithExp:
+      found = FindLambda(exp.mon_arith_exp().exp(), source_id);
+      break;
+    case Expression::kBinArithExp:
+      found = FindLambda(exp.bin_arith_exp().lhs(), source_id);
+      if (!found) {
+        found = FindLambda(exp.bin_arith_exp().rhs(), source_id);
+      }
+      break;
+    case Expression::kTernExp:
+      found = FindLambda(exp.tern_exp().if_exp(), source_id);
+      if (!found) {
+        found = FindLambda(exp.tern_exp().cond_exp(), source_id);
+      }
+      if (!found) {
+        found = FindLambda(exp.tern_exp().else_exp(), source_id);
+      }
+      break;
+    case Expression::kTupleExp:
+      for (int i = 0; !found && i < exp.tuple_exp().exp_size(); ++i) {
+        found = FindLambda(exp.tuple_exp().exp(i), source_id);
+      }
+      break;
+    case Expression::kLambdaExp:
+      if (exp.origin().source_id() == source_id) {
+        return &exp.lambda_exp();
+      }
+      for (int i = 0; !found && i < exp.lambda_exp().body_size(); ++i) {
+        found = FindLambda(exp.lambda_exp().body(i), source_id);
+      }
+      break;
+    default:
+      break;
+  }
+  return found;
+}
+
+template <typename Stmts>
+const LambdaExpression* FindLambdaInStmts(const Stmts& stmts,
+                                          int64_t source_id) {
+  for (const Statement& s : stmts) {
+    const LambdaExpression* found = FindLambda(s, source_id);
+    if (found) {
+      return found;
+    }
+  }
+  return nullptr;
+}
+
+const LambdaExpression* FindLambda(const Statement& stmt, int64_t source_id) {
+  const LambdaExpression* found = nullptr;
+  switch (stmt.type_case()) {
+    case Statement::kExpStmt:
+      return FindLambda(stmt.exp_stmt(), source_id);
+    case Statement::kAssignStmt:
+      found = FindLambda(stmt.assign_stmt().lhs(), source_id);
+      return found ? found : FindLambda(stmt.assign_stmt().rhs(), source_id);
+    case Statement::kRetStmt:
+      return FindLambda(stmt.ret_stmt(), source_id);
+    case Statement::kPrintStmt:
+      return FindLambda(stmt.print_stmt(), source_id);
+    case Statement::kIfElseStmt:
+      found = FindLambda(stmt.if_else_stmt().cond(), source_id);
+      if (!found) {
+        found = FindLambdaInStmts(stmt.if_else_stmt().if_stmts(), source_id);
+      }
+      if (!found) {
+        found = FindLambdaInStmts(stmt.if_else_stmt().else_stmts(), source_id);
+      }
+      return found;
+    case Statement::kWhileStmt:
+      found = FindLambda(stmt.while_stmt().cond(), source_id);
+      return found ? found
+                   : FindLambdaInStmts(stmt.while_stmt().body(), source_id);
+    case Statement::kForStmt:
+      found = FindLambda(stmt.for_stmt().init(), source_id);
+      if (!found) {
+        found = FindLambda(stmt.for_stmt().cond(), source_id);
+      }
+      if (!found) {
+        found = FindLambda(stmt.for_stmt().inc(), source_id);
+      }
+      if (!found) {
+        found = FindLambdaInStmts(stmt.for_stmt().body(), source_id);
+      }
+      return found;
+    case Statement::TYPE_NOT_SET:
+      break;
+  }
+  return found;
+}
+
+}  // namespace
+
+void ResolveVariables(Program* pgm) {
+  FrameLayout* layout = pgm->mutable_layout();
+  layout->Clear();
+  Slots slots(layout);
+  for (const Statement& s : pgm->stmt()) {
+    CollectNames(s, &slots);
+  }
+  for (Statement& s : *pgm->mutable_stmt()) {
+    Resolve(&s, slots);
+  }
+}
+
+const LambdaExpression* FindLambda(const Program& pgm, int64_t source_id) {
+  return FindLambdaInStmts(pgm.stmt(), source_id);
+}
+
+const FrameLayout& FindLayout(const Program& pgm, int64_t lambda_id) {
+  const LambdaExpression* lambda_exp = FindLambda(pgm, lambda_id);
+  return lambda_exp ? lambda_exp->layout() : pgm.layout();
+}
+
+void FillEnv(const FrameLayout& layout, Closure* closure) {
+  for (int i = 0; i < closure->capture_size() && i < layout.name_size(); ++i) {
+    if (closure->capture(i) >= 0) {
+      (*closure->mutable_env())[layout.name(i)] = closure->capture(i);
+    }
+  }
+}
+
+}  // namespace steinlang
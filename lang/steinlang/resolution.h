@@ -0,0 +1,32 @@
+// Static resolution of variable names to frame slots.
+
+#ifndef LANG_STEINLANG_RESOLUTION_H_
+#define LANG_STEINLANG_RESOLUTION_H_
+
+#include <stdint.h>
+
+#include "lang/steinlang/steinlang_syntax.pb.h"
+
+namespace steinlang {
+
+// Fill in the FrameLayout of pgm and of every LambdaExpression in it, and the
+// slot of every Variable.
+// Evaluation must be able to find the lambda a closure was created from, so
+// pgm should also be annotated with AnnotateSource.
+void ResolveVariables(Program* pgm);
+
+// Find the LambdaExpression whose Expression has the given Origin.source_id.
+// Returns nullptr if there is none. This is a linear search, meant for
+// debugging and printing.
+const LambdaExpression* FindLambda(const Program& pgm, int64_t source_id);
+
+// The FrameLayout for a LocalContext or Closure with the given lambda_id.
+const FrameLayout& FindLayout(const Program& pgm, int64_t lambda_id);
+
+// Rebuild the name-based env of closure from its captured slots. Slots that
+// weren't bound when the closure was created are left out.
+void FillEnv(const FrameLayout& layout, Closure* closure);
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_RESOLUTION_H_
@@ -0,0 +1,24 @@
+#ifndef LANG_STEINLANG_RUN_STATUS_H_
+#define LANG_STEINLANG_RUN_STATUS_H_
+
+#include <stdint.h>
+
+namespace steinlang {
+
+// Why Evaluator::Run or VirtualMachine::Run returned.
+enum class StopReason {
+  // There are no computations left.
+  kFinished,
+  // The step budget ran out first. Run again to continue.
+  kBudgetExhausted,
+};
+
+struct RunStatus {
+  StopReason reason;
+  // The number of steps executed.
+  int64_t steps;
+};
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_RUN_STATUS_H_
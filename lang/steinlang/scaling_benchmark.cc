@@ -0,0 +1,95 @@
+// Measures how evaluating a program in many independent contexts at once
+// (EvaluateConcurrently) scales with the number of threads, from 1 up to
+// --max_threads, for the program read from stdin. Every run evaluates the
+// same --contexts contexts, so with perfect scaling the time is inversely
+// proportional to the number of threads.
+//
+// Example:
+// scaling_benchmark --contexts=32 < lang/steinlang/pgms/fibo_test.stein.txt
+
+#include <gflags/gflags.h>
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lang/steinlang/concurrent_evaluation.h"
+#include "lang/steinlang/fork_join.h"
+#include "lang/steinlang/language_evaluation.h"
+#include "lang/steinlang/steinlang_parser.h"
+#include "util/file_io.h"
+
+DEFINE_int32(contexts, 16, "Number of contexts to evaluate the program in.");
+DEFINE_int32(max_threads, 0,
+             "Evaluate the contexts on 1 to this many threads. 0 means the "
+             "number of hardware threads.");
+DEFINE_int32(repetitions, 3,
+             "Evaluate the contexts this many times per number of threads, "
+             "and report the fastest run.");
+DEFINE_int64(steps_per_run, 4096, "Budget for each call to Evaluator::Run.");
+
+namespace steinlang {
+namespace {
+
+// The fastest of --repetitions runs, in seconds. Checks that every context
+// printed the same output.
+double TimeRuns(std::shared_ptr<const Program> pgm, int num_threads,
+                size_t* peak_allocated_size, bool* consistent) {
+  ForkJoinPool pool(num_threads);
+  double best = 0;
+  for (int i = 0; i < FLAGS_repetitions; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<ContextResult> results = EvaluateConcurrently(
+        pgm, FLAGS_contexts, &pool, FLAGS_steps_per_run);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+    best = i == 0 ? seconds : std::min(best, seconds);
+    for (const ContextResult& result : results) {
+      *peak_allocated_size =
+          std::max(*peak_allocated_size, result.peak_allocated_size);
+      *consistent &= result.output == results[0].output;
+    }
+  }
+  return best;
+}
+
+}  // namespace
+}  // namespace steinlang
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  steinlang::Program pgm;
+  if (!steinlang::ParseProgram(util::ReadStdInToString(), &pgm)) {
+    printf("failed to parse input.\n");
+    return 1;
+  }
+  const std::shared_ptr<const steinlang::Program> prepared =
+      steinlang::PrepareProgram(pgm);
+
+  const int max_threads =
+      FLAGS_max_threads > 0
+          ? FLAGS_max_threads
+          : std::max<int>(std::thread::hardware_concurrency(), 1);
+  printf("%d contexts, %u hardware threads\n", FLAGS_contexts,
+         std::thread::hardware_concurrency());
+  double baseline = 0;
+  for (int threads = 1; threads <= max_threads; ++threads) {
+    size_t peak_allocated_size = 0;
+    bool consistent = true;
+    const double seconds = steinlang::TimeRuns(prepared, threads,
+                                               &peak_allocated_size,
+                                               &consistent);
+    if (threads == 1) {
+      baseline = seconds;
+    }
+    printf("%2d threads: %8.1f ms, speedup %5.2fx, efficiency %3.0f%%, "
+           "peak arena %zu bytes per context%s\n",
+           threads, seconds * 1e3, baseline / seconds,
+           100 * baseline / seconds / threads, peak_allocated_size,
+           consistent ? "" : ", OUTPUT DIFFERS");
+  }
+  return 0;
+}
@@ -0,0 +1,210 @@
+#include "lang/steinlang/scheduler.h"
+
+#include <gflags/gflags.h>
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+
+DEFINE_int64(scheduler_quantum_steps, 1024,
+             "Number of steps that the Scheduler runs a task for before "
+             "giving its thread to another task.");
+
+namespace steinlang {
+
+std::string SchedulerStats::DebugString() const {
+  std::ostringstream out;
+  out << "scheduler: " << quanta << " quanta, longest " << max_quantum_us
+      << " us";
+  return out.str();
+}
+
+Scheduler::Scheduler(int num_threads)
+    : quantum_steps_(std::max<int64_t>(FLAGS_scheduler_quantum_steps, 1)) {
+  for (int i = 0; i < std::max(num_threads, 1); ++i) {
+    workers_.emplace_back([this] { Work(); });
+  }
+}
+
+Scheduler::~Scheduler() {
+  {
+    std::lock_guard<std::mutex> lock(mu_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+Scheduler::TaskId Scheduler::Add(std::shared_ptr<const Program> pgm,
+                                 const TaskOptions& options) {
+  auto task = std::make_unique<Task>();
+  task->options = options;
+  task->options.weight = std::max(options.weight, 1);
+  task->allocator = std::make_unique<PoolingArenaAllocator>();
+  task->evaluator = std::make_unique<Evaluator>(
+      std::move(pgm), task->allocator->AllocateEvalContext(),
+      task->allocator.get());
+
+  std::lock_guard<std::mutex> lock(mu_);
+  const TaskId id = next_id_++;
+  Task* task_ptr = task.get();
+  tasks_.emplace(id, std::move(task));
+  Enqueue(id, task_ptr);
+  return id;
+}
+
+void Scheduler::Park(TaskId id) {
+  std::lock_guard<std::mutex> lock(mu_);
+  Task* task = tasks_.at(id).get();
+  if (task->state != TaskState::kRunnable) {
+    return;
+  }
+  if (task->running) {
+    task->park_requested = true;
+    return;
+  }
+  queue_.erase({task->vruntime, id});
+  task->state = TaskState::kParked;
+  if (queue_.empty() && running_ == 0) {
+    idle_cv_.notify_all();
+  }
+}
+
+void Scheduler::Unpark(TaskId id) {
+  std::lock_guard<std::mutex> lock(mu_);
+  Task* task = tasks_.at(id).get();
+  if (task->state == TaskState::kParked) {
+    task->state = TaskState::kRunnable;
+    Enqueue(id, task);
+  } else {
+    task->park_requested = false;
+  }
+}
+
+void Scheduler::Remove(TaskId id) {
+  std::lock_guard<std::mutex> lock(mu_);
+  auto it = tasks_.find(id);
+  if (it == tasks_.end()) {
+    return;
+  }
+  Task* task = it->second.get();
+  if (task->running) {
+    task->remove_requested = true;
+    return;
+  }
+  if (task->state == TaskState::kRunnable) {
+    queue_.erase({task->vruntime, id});
+  }
+  tasks_.erase(it);
+  if (queue_.empty() && running_ == 0) {
+    idle_cv_.notify_all();
+  }
+}
+
+TaskStatus Scheduler::status(TaskId id) const {
+  std::lock_guard<std::mutex> lock(mu_);
+  const Task& task = *tasks_.at(id);
+  return {task.state, task.steps,
+          task.allocator != nullptr
+              ? task.allocator->allocated_size() + task.forked_allocated_size
+              : 0};
+}
+
+std::vector<std::string> Scheduler::ConsumeOutput(TaskId id) {
+  std::lock_guard<std::mutex> lock(mu_);
+  std::vector<std::string> output;
+  output.swap(tasks_.at(id)->output);
+  return output;
+}
+
+void Scheduler::WaitIdle() {
+  std::unique_lock<std::mutex> lock(mu_);
+  idle_cv_.wait(lock, [this] { return queue_.empty() && running_ == 0; });
+}
+
+SchedulerStats Scheduler::stats() const {
+  std::lock_guard<std::mutex> lock(mu_);
+  return stats_;
+}
+
+void Scheduler::Enqueue(TaskId id, Task* task) {
+  task->vruntime = std::max(task->vruntime, min_vruntime_);
+  queue_.emplace(task->vruntime, id);
+  work_cv_.notify_one();
+}
+
+void Scheduler::FinishQuantum(TaskId id, Task* task, RunStatus status) {
+  task->steps += status.steps;
+  task->vruntime += static_cast<double>(status.steps) / task->options.weight;
+  task->forked_allocated_size = task->evaluator->forked_allocated_size();
+  if (task->remove_requested) {
+    tasks_.erase(id);
+    return;
+  }
+  const TaskOptions& options = task->options;
+  if (status.reason == StopReason::kFinished) {
+    task->state = TaskState::kFinished;
+  } else if (options.max_steps > 0 && task->steps >= options.max_steps) {
+    task->state = TaskState::kStepBudgetExceeded;
+  } else if (options.max_allocated_size > 0 &&
+             task->allocator->allocated_size() + task->forked_allocated_size >
+                 options.max_allocated_size) {
+    task->state = TaskState::kMemoryBudgetExceeded;
+  } else if (task->park_requested) {
+    task->state = TaskState::kParked;
+  } else {
+    Enqueue(id, task);
+  }
+  task->park_requested = false;
+  if (task->state != TaskState::kRunnable &&
+      task->state != TaskState::kParked) {
+    task->evaluator.reset();
+    task->allocator.reset();
+  }
+}
+
+void Scheduler::Work() {
+  std::unique_lock<std::mutex> lock(mu_);
+  while (true) {
+    work_cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+    if (stop_) {
+      return;
+    }
+    const TaskId id = queue_.begin()->second;
+    queue_.erase(queue_.begin());
+    Task* task = tasks_.at(id).get();
+    min_vruntime_ = std::max(min_vruntime_, task->vruntime);
+    task->running = true;
+    ++running_;
+    int64_t budget = quantum_steps_;
+    if (task->options.max_steps > 0) {
+      budget = std::min(budget, task->options.max_steps - task->steps);
+    }
+
+    // Nothing else touches the task's evaluator while it's running.
+    lock.unlock();
+    auto start = std::chrono::steady_clock::now();
+    const RunStatus status = task->evaluator->Run(budget);
+    std::vector<std::string> output = task->evaluator->consume_output();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    lock.lock();
+
+    task->running = false;
+    --running_;
+    ++stats_.quanta;
+    stats_.max_quantum_us = std::max<int64_t>(
+        stats_.max_quantum_us,
+        std::chrono::duration_cast<std::chrono::microseconds>(elapsed)
+            .count());
+    for (std::string& x : output) {
+      task->output.push_back(std::move(x));
+    }
+    FinishQuantum(id, task, status);
+    if (queue_.empty() && running_ == 0) {
+      idle_cv_.notify_all();
+    }
+  }
+}
+
+}  // namespace steinlang
@@ -0,0 +1,157 @@
+// A cooperative scheduler that interleaves the evaluation of many programs,
+// e.g. the scripts of many tenants, on a few threads. Evaluator::Run can be
+// resumed after any number of steps, so each task runs for a quantum of
+// --scheduler_quantum_steps steps at a time, which bounds how long a task
+// that's ready waits for a thread.
+//
+// Threads are shared fairly by weight: each task accumulates virtual time,
+// its steps divided by its weight, and the runnable task with the least
+// virtual time runs next. A task that becomes runnable starts no earlier than
+// the task that last started a quantum, so it can't monopolize the threads by
+// catching up on time it spent parked. Idle threads sleep until a task is
+// runnable.
+
+#ifndef LANG_STEINLANG_SCHEDULER_H_
+#define LANG_STEINLANG_SCHEDULER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "lang/steinlang/language_evaluation.h"
+#include "lang/steinlang/memory.h"
+#include "lang/steinlang/steinlang_syntax.pb.h"
+
+namespace steinlang {
+
+struct TaskOptions {
+  // The task's share of the threads, relative to other tasks.
+  int weight = 1;
+  // The task is stopped once it has run this many steps. 0 is no limit.
+  int64_t max_steps = 0;
+  // The task is stopped once its allocator, and those of the calls it has
+  // forked, have allocated more than this many bytes, as of the end of a
+  // quantum. 0 is no limit.
+  size_t max_allocated_size = 0;
+};
+
+enum class TaskState {
+  // Waiting for or running a quantum.
+  kRunnable,
+  // Not scheduled until it's unparked.
+  kParked,
+  // The task is done, and its evaluation state is freed, because there are no
+  // computations left, or because it was stopped by TaskOptions::max_steps or
+  // max_allocated_size.
+  kFinished,
+  kStepBudgetExceeded,
+  kMemoryBudgetExceeded,
+};
+
+struct TaskStatus {
+  TaskState state;
+  int64_t steps;
+  // What the task's allocator has allocated, and those of its forked calls as
+  // of the end of its last quantum.
+  size_t allocated_size;
+};
+
+struct SchedulerStats {
+  int64_t quanta = 0;
+  // The longest that a quantum took.
+  int64_t max_quantum_us = 0;
+
+  std::string DebugString() const;
+};
+
+class Scheduler {
+ public:
+  using TaskId = int64_t;
+
+  // Run tasks on num_threads threads.
+  explicit Scheduler(int num_threads);
+  // Waits for the quanta that are running to finish.
+  ~Scheduler();
+
+  Scheduler(const Scheduler&) = delete;
+  Scheduler& operator=(const Scheduler&) = delete;
+
+  // Evaluate pgm, as returned by PrepareProgram, from the beginning in a new
+  // task, which is runnable right away.
+  TaskId Add(std::shared_ptr<const Program> pgm, const TaskOptions& options);
+
+  // Stop scheduling a runnable task, e.g. while it waits for something else.
+  // If it's running, it's parked at the end of its quantum.
+  void Park(TaskId id);
+  // Schedule a parked task again.
+  void Unpark(TaskId id);
+
+  // Forget about a task, and free its evaluation state. If it's running, that
+  // happens at the end of its quantum.
+  void Remove(TaskId id);
+
+  TaskStatus status(TaskId id) const;
+
+  // The output that the task has printed since the last call.
+  std::vector<std::string> ConsumeOutput(TaskId id);
+
+  // Block until no task is runnable: all of them are parked or done.
+  void WaitIdle();
+
+  SchedulerStats stats() const;
+
+ private:
+  struct Task {
+    TaskOptions options;
+    // Destroyed after evaluator, which allocates on it.
+    std::unique_ptr<PoolingArenaAllocator> allocator;
+    std::unique_ptr<Evaluator> evaluator;
+    // The evaluator's forked_allocated_size at the end of its last quantum.
+    size_t forked_allocated_size = 0;
+    TaskState state = TaskState::kRunnable;
+    double vruntime = 0;
+    int64_t steps = 0;
+    std::vector<std::string> output;
+    bool running = false;
+    // Requests made while the task was running.
+    bool park_requested = false;
+    bool remove_requested = false;
+  };
+
+  // Queue a task that has become runnable. mu_ must be held.
+  void Enqueue(TaskId id, Task* task);
+
+  // Update a task after a quantum of steps. mu_ must be held.
+  void FinishQuantum(TaskId id, Task* task, RunStatus status);
+
+  void Work();
+
+  mutable std::mutex mu_;
+  std::unordered_map<TaskId, std::unique_ptr<Task>> tasks_;
+  // The runnable tasks that aren't running, by virtual time.
+  std::set<std::pair<double, TaskId>> queue_;
+  // The virtual time of the last task to start a quantum.
+  double min_vruntime_ = 0;
+  TaskId next_id_ = 0;
+  int running_ = 0;
+  bool stop_ = false;
+  SchedulerStats stats_;
+  const int64_t quantum_steps_;
+  // Signaled when a task is queued, for idle workers.
+  std::condition_variable work_cv_;
+  // Signaled when the last running quantum finishes with nothing queued.
+  std::condition_variable idle_cv_;
+  std::vector<std::thread> workers_;
+};
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_SCHEDULER_H_
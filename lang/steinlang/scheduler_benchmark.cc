@@ -0,0 +1,76 @@
+// Runs --tasks copies of the program read from stdin on a Scheduler with
+// --scheduler_threads threads for --duration_ms, then parks them all and
+// reports how the steps were shared between tasks of weight 1 and tasks of
+// weight --heavy_weight, and the longest quantum, which bounds how long a
+// runnable task waits for a thread. The program should run longer than
+// --duration_ms, or the tasks finish before they're compared.
+//
+// Example:
+// scheduler_benchmark --tasks=1000 < lang/steinlang/pgms/fibo_test.stein.txt
+
+#include <gflags/gflags.h>
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "lang/steinlang/language_evaluation.h"
+#include "lang/steinlang/scheduler.h"
+#include "lang/steinlang/steinlang_parser.h"
+#include "util/file_io.h"
+
+DEFINE_int32(tasks, 1000, "Number of tasks to evaluate the program in.");
+DEFINE_int32(scheduler_threads, 2, "Number of threads to run the tasks on.");
+DEFINE_int32(heavy_weight, 4, "The weight of every other task.");
+DEFINE_int32(duration_ms, 1000, "How long to run the tasks for.");
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  steinlang::Program pgm;
+  if (!steinlang::ParseProgram(util::ReadStdInToString(), &pgm)) {
+    printf("failed to parse input.\n");
+    return 1;
+  }
+  const std::shared_ptr<const steinlang::Program> prepared =
+      steinlang::PrepareProgram(pgm);
+
+  steinlang::Scheduler scheduler(FLAGS_scheduler_threads);
+  std::vector<steinlang::Scheduler::TaskId> ids;
+  for (int i = 0; i < FLAGS_tasks; ++i) {
+    steinlang::TaskOptions options;
+    options.weight = i % 2 == 0 ? 1 : FLAGS_heavy_weight;
+    ids.push_back(scheduler.Add(prepared, options));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(FLAGS_duration_ms));
+  for (steinlang::Scheduler::TaskId id : ids) {
+    scheduler.Park(id);
+  }
+  scheduler.WaitIdle();
+
+  // By weight: light, heavy.
+  int64_t steps[2] = {0, 0};
+  int tasks[2] = {0, 0};
+  int finished = 0;
+  size_t allocated_size = 0;
+  for (size_t i = 0; i < ids.size(); ++i) {
+    const steinlang::TaskStatus status = scheduler.status(ids[i]);
+    steps[i % 2] += status.steps;
+    ++tasks[i % 2];
+    finished += status.state == steinlang::TaskState::kFinished;
+    allocated_size += status.allocated_size;
+  }
+  const double light = tasks[0] > 0 ? static_cast<double>(steps[0]) / tasks[0]
+                                    : 0;
+  const double heavy = tasks[1] > 0 ? static_cast<double>(steps[1]) / tasks[1]
+                                    : 0;
+  printf("%lld steps in %d ms, %d of %d tasks finished\n",
+         static_cast<long long>(steps[0] + steps[1]), FLAGS_duration_ms,
+         finished, FLAGS_tasks);
+  printf("mean steps per task: %.0f at weight 1, %.0f at weight %d (%.2fx)\n",
+         light, heavy, FLAGS_heavy_weight, light > 0 ? heavy / light : 0);
+  printf("%zu bytes allocated, %zu per task\n", allocated_size,
+         FLAGS_tasks > 0 ? allocated_size / FLAGS_tasks : 0);
+  printf("%s\n", scheduler.stats().DebugString().c_str());
+  return 0;
+}
@@ -0,0 +1,250 @@
+#include "lang/steinlang/scheduler.h"
+
+#include <gflags/gflags.h>
+#include <stdio.h>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lang/steinlang/language_evaluation.h"
+#include "lang/steinlang/memory.h"
+#include "lang/steinlang/run_status.h"
+#include "lang/steinlang/steinlang_parser.h"
+
+DECLARE_int32(threads);
+DECLARE_int64(scheduler_quantum_steps);
+
+namespace steinlang {
+namespace {
+
+// Runs until it's stopped.
+constexpr char kLoop[] = "i = 0; while 0 < 1 { i = i + 1; }";
+// Leaves a string on the arena on every iteration.
+constexpr char kGrowingLoop[] =
+    "while 0 < 1 { s = \"garbage on the arena\"; s = 0; }";
+// Pure recursive calls, which fork with --threads > 1.
+constexpr char kFib[] =
+    "fib = lambda n: n if n <= 1 else fib(n - 1) + fib(n - 2);"
+    "print fib(15);";
+constexpr int64_t kQuantumSteps = 1000;
+
+std::shared_ptr<const Program> Prepare(const char* text) {
+  Program pgm;
+  if (!ParseProgram(text, &pgm)) {
+    fprintf(stderr, "failed to parse %s\n", text);
+    return nullptr;
+  }
+  return PrepareProgram(pgm);
+}
+
+// The steps and output of evaluating pgm on its own.
+int64_t Evaluate(std::shared_ptr<const Program> pgm,
+                 std::vector<std::string>* output) {
+  PoolingArenaAllocator allocator;
+  Evaluator evaluator(std::move(pgm), allocator.AllocateEvalContext(),
+                      &allocator);
+  int64_t steps = 0;
+  RunStatus status;
+  do {
+    status = evaluator.Run(kQuantumSteps);
+    steps += status.steps;
+    for (std::string& line : evaluator.consume_output()) {
+      output->push_back(std::move(line));
+    }
+  } while (status.reason != StopReason::kFinished);
+  return steps;
+}
+
+// Wait until a task has run at least steps steps. With one thread and one
+// task, the task is then always running unless it's stopped, since the
+// worker requeues and restarts it without letting go of the scheduler's lock.
+void WaitForSteps(const Scheduler& scheduler, Scheduler::TaskId id,
+                  int64_t steps) {
+  while (scheduler.status(id).steps < steps) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+}
+
+bool TestParksRunningTask() {
+  Scheduler scheduler(1);
+  const Scheduler::TaskId id = scheduler.Add(Prepare(kLoop), TaskOptions());
+  WaitForSteps(scheduler, id, 1);
+  scheduler.Park(id);
+  scheduler.WaitIdle();
+  const TaskStatus parked = scheduler.status(id);
+  // Parked at the end of a quantum.
+  if (parked.state != TaskState::kParked ||
+      parked.steps % kQuantumSteps != 0) {
+    fprintf(stderr, "parks running task: not parked after a quantum, "
+                    "%lld steps\n",
+            static_cast<long long>(parked.steps));
+    return false;
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  if (scheduler.status(id).steps != parked.steps) {
+    fprintf(stderr, "parks running task: ran while parked\n");
+    return false;
+  }
+  scheduler.Unpark(id);
+  WaitForSteps(scheduler, id, parked.steps + 1);
+  scheduler.Remove(id);
+  // Returns only once the removed task is no longer scheduled.
+  scheduler.WaitIdle();
+  const int64_t quanta = scheduler.stats().quanta;
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  if (scheduler.stats().quanta != quanta) {
+    fprintf(stderr, "parks running task: ran after it was removed\n");
+    return false;
+  }
+  return true;
+}
+
+bool TestStopsAtMaxSteps() {
+  std::vector<std::string> expected;
+  const std::shared_ptr<const Program> pgm = Prepare(kFib);
+  const int64_t total_steps = Evaluate(pgm, &expected);
+  Scheduler scheduler(1);
+  TaskOptions exact;
+  exact.max_steps = total_steps;
+  TaskOptions short_of_it;
+  // Not a multiple of the quantum.
+  short_of_it.max_steps = 2 * kQuantumSteps + 7;
+  const Scheduler::TaskId exact_id = scheduler.Add(pgm, exact);
+  const Scheduler::TaskId short_id = scheduler.Add(pgm, short_of_it);
+  scheduler.WaitIdle();
+
+  bool passed = true;
+  const TaskStatus exact_status = scheduler.status(exact_id);
+  if (exact_status.state != TaskState::kFinished ||
+      exact_status.steps != total_steps ||
+      scheduler.ConsumeOutput(exact_id) != expected) {
+    fprintf(stderr, "stops at max steps: a task with just enough steps "
+                    "didn't finish\n");
+    passed = false;
+  }
+  const TaskStatus short_status = scheduler.status(short_id);
+  if (short_status.state != TaskState::kStepBudgetExceeded ||
+      short_status.steps != short_of_it.max_steps ||
+      short_status.allocated_size != 0) {
+    fprintf(stderr, "stops at max steps: stopped at %lld steps rather than "
+                    "%lld\n",
+            static_cast<long long>(short_status.steps),
+            static_cast<long long>(short_of_it.max_steps));
+    passed = false;
+  }
+  return passed;
+}
+
+bool TestStopsAtMemoryBudget() {
+  Scheduler scheduler(1);
+  TaskOptions options;
+  options.max_allocated_size = 256 * 1024;
+  const Scheduler::TaskId growing =
+      scheduler.Add(Prepare(kGrowingLoop), options);
+  options.max_steps = 10 * kQuantumSteps;
+  const Scheduler::TaskId looping = scheduler.Add(Prepare(kLoop), options);
+  scheduler.WaitIdle();
+
+  bool passed = true;
+  if (scheduler.status(growing).state != TaskState::kMemoryBudgetExceeded) {
+    fprintf(stderr, "stops at memory budget: a growing task wasn't "
+                    "stopped\n");
+    passed = false;
+  }
+  if (scheduler.status(looping).state != TaskState::kStepBudgetExceeded) {
+    fprintf(stderr, "stops at memory budget: a task within it was "
+                    "stopped\n");
+    passed = false;
+  }
+  return passed;
+}
+
+bool TestSharesByWeight() {
+  Scheduler scheduler(1);
+  const std::shared_ptr<const Program> pgm = Prepare(kLoop);
+  TaskOptions light;
+  TaskOptions heavy;
+  heavy.weight = 3;
+  const Scheduler::TaskId light_id = scheduler.Add(pgm, light);
+  const Scheduler::TaskId heavy_id = scheduler.Add(pgm, heavy);
+  // The light task may run on its own for a while before the heavy one is
+  // added, so the shares are compared from when both have run.
+  WaitForSteps(scheduler, heavy_id, 1);
+  const int64_t light_start = scheduler.status(light_id).steps;
+  const int64_t heavy_start = scheduler.status(heavy_id).steps;
+  WaitForSteps(scheduler, light_id, light_start + 100 * kQuantumSteps);
+  scheduler.Park(light_id);
+  scheduler.Park(heavy_id);
+  scheduler.WaitIdle();
+
+  const double ratio =
+      static_cast<double>(scheduler.status(heavy_id).steps - heavy_start) /
+      (scheduler.status(light_id).steps - light_start);
+  if (ratio < 2.8 || ratio > 3.2) {
+    fprintf(stderr, "shares by weight: weight 3 ran %.2fx the steps of "
+                    "weight 1\n",
+            ratio);
+    return false;
+  }
+  return true;
+}
+
+// Tasks whose calls fork onto other threads count the forked steps towards
+// their quanta and budgets like any other steps.
+bool TestForkedTasks() {
+  std::vector<std::string> expected;
+  const std::shared_ptr<const Program> pgm = Prepare(kFib);
+  const int64_t total_steps = Evaluate(pgm, &expected);
+  Scheduler scheduler(2);
+  std::vector<Scheduler::TaskId> finishing;
+  for (int i = 0; i < 4; ++i) {
+    finishing.push_back(scheduler.Add(pgm, TaskOptions()));
+  }
+  TaskOptions limited;
+  limited.max_steps = 5 * kQuantumSteps + 3;
+  const Scheduler::TaskId limited_id = scheduler.Add(pgm, limited);
+  scheduler.WaitIdle();
+
+  bool passed = true;
+  for (Scheduler::TaskId id : finishing) {
+    const TaskStatus status = scheduler.status(id);
+    if (status.state != TaskState::kFinished || status.steps != total_steps ||
+        scheduler.ConsumeOutput(id) != expected) {
+      fprintf(stderr, "forked tasks: task %lld ran %lld steps rather than "
+                      "%lld\n",
+              static_cast<long long>(id),
+              static_cast<long long>(status.steps),
+              static_cast<long long>(total_steps));
+      passed = false;
+    }
+  }
+  const TaskStatus limited_status = scheduler.status(limited_id);
+  if (limited_status.state != TaskState::kStepBudgetExceeded ||
+      limited_status.steps != limited.max_steps) {
+    fprintf(stderr, "forked tasks: stopped at %lld steps rather than %lld\n",
+            static_cast<long long>(limited_status.steps),
+            static_cast<long long>(limited.max_steps));
+    passed = false;
+  }
+  return passed;
+}
+
+}  // namespace
+}  // namespace steinlang
+
+int main(int argc, char** argv) {
+  // The fork-join pool is made the first time an Evaluator is, so this holds
+  // for every test, and only kFib's calls fork.
+  FLAGS_threads = 2;
+  FLAGS_scheduler_quantum_steps = steinlang::kQuantumSteps;
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  bool passed = steinlang::TestParksRunningTask();
+  passed = steinlang::TestStopsAtMaxSteps() && passed;
+  passed = steinlang::TestStopsAtMemoryBudget() && passed;
+  passed = steinlang::TestSharesByWeight() && passed;
+  passed = steinlang::TestForkedTasks() && passed;
+  fprintf(stderr, passed ? "passed\n" : "failed\n");
+  return passed ? 0 : 1;
+}
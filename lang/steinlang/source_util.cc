@@ -35,6 +35,74 @@ void AnnotateRecursive(google::protobuf::Message* msg, int* counter) {
     }
   }
 }
+void IndexRecursive(const google::protobuf::Message& msg, SourceIndex* index) {
+  const google::protobuf::Descriptor* descriptor = msg.GetDescriptor();
+  if (descriptor->full_name() == "steinlang.Expression") {
+    const Expression& exp = (const Expression&)msg;
+    const int64_t id = exp.origin().source_id();
+    if (index->exp.size() <= static_cast<size_t>(id)) {
+      index->exp.resize(id + 1);
+    }
+    index->exp[id] = &exp;
+  } else if (descriptor->full_name() == "steinlang.Statement") {
+    const Statement& stmt = (const Statement&)msg;
+    const int64_t id = stmt.origin().source_id();
+    if (index->stmt.size() <= static_cast<size_t>(id)) {
+      index->stmt.resize(id + 1);
+    }
+    index->stmt[id] = &stmt;
+  }
+
+  const google::protobuf::Reflection* refl = msg.GetReflection();
+  for (int i = 0; i < descriptor->field_count(); ++i) {
+    const google::protobuf::FieldDescriptor* field = descriptor->field(i);
+    if (field->type() == google::protobuf::FieldDescriptor::TYPE_MESSAGE) {
+      if (field->is_repeated()) {
+        for (int j = 0; j < refl->FieldSize(msg, field); ++j) {
+          IndexRecursive(refl->GetRepeatedMessage(msg, field, j), index);
+        }
+      } else if (refl->HasField(msg, field)) {
+        IndexRecursive(refl->GetMessage(msg, field), index);
+      }
+    }
+  }
+}
+void ClearRecursive(google::protobuf::Message* msg) {
+  const google::protobuf::Descriptor* descriptor = msg->GetDescriptor();
+  if (descriptor->full_name() == "steinlang.Expression") {
+    Expression* exp = (Expression*)msg;
+    exp->mutable_origin()->clear_source_id();
+  } else if (descriptor->full_name() == "steinlang.Statement") {
+    Statement* stmt = (Statement*)msg;
+    stmt->mutable_origin()->clear_source_id();
+  } else if (descriptor->full_name() == "steinlang.Variable") {
+    Variable* var = (Variable*)msg;
+    var->clear_slot();
+  } else if (descriptor->full_name() == "steinlang.LambdaExpression") {
+    LambdaExpression* lambda = (LambdaExpression*)msg;
+    lambda->clear_layout();
+  } else if (descriptor->full_name() == "steinlang.BinArithExpression") {
+    BinArithExpression* bin = (BinArithExpression*)msg;
+    bin->clear_fused();
+  } else if (descriptor->full_name() == "steinlang.AssignStatement") {
+    AssignStatement* assign = (AssignStatement*)msg;
+    assign->clear_fused();
+  }
+
+  const google::protobuf::Reflection* refl = msg->GetReflection();
+  for (int i = 0; i < descriptor->field_count(); ++i) {
+    const google::protobuf::FieldDescriptor* field = descriptor->field(i);
+    if (field->type() == google::protobuf::FieldDescriptor::TYPE_MESSAGE) {
+      if (field->is_repeated()) {
+        for (int j = 0; j < refl->FieldSize(*msg, field); ++j) {
+          ClearRecursive(refl->MutableRepeatedMessage(msg, field, j));
+        }
+      } else if (refl->HasField(*msg, field)) {
+        ClearRecursive(refl->MutableMessage(msg, field));
+      }
+    }
+  }
+}
 }  // namespace
 
 void AnnotateSource(Program* pgm) {
@@ -42,4 +110,14 @@ void AnnotateSource(Program* pgm) {
   AnnotateRecursive(pgm, &counter);
 }
 
+void IndexSource(const Program& pgm, SourceIndex* index) {
+  index->exp.clear();
+  index->stmt.clear();
+  IndexRecursive(pgm, index);
+}
+
+void ClearAnnotations(google::protobuf::Message* msg) {
+  ClearRecursive(msg);
+}
+
 }  // steinlang
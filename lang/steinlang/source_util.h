@@ -1,12 +1,34 @@
 #ifndef LANG_STEINLANG_SOURCE_UTIL_H_
 #define LANG_STEINLANG_SOURCE_UTIL_H_
 
+#include <vector>
+
+#include <google/protobuf/message.h>
+
 #include "lang/steinlang/steinlang_syntax.pb.h"
 
 namespace steinlang {
 
 void AnnotateSource(Program* pgm);
 
+// The Expressions and Statements of a Program annotated with AnnotateSource,
+// indexed by Origin.source_id. Entries for other ids are nullptr.
+struct SourceIndex {
+  std::vector<const Expression*> exp;
+  std::vector<const Statement*> stmt;
+};
+
+// The index points into pgm, so it's invalidated if pgm is modified or
+// destroyed.
+void IndexSource(const Program& pgm, SourceIndex* index);
+
+// Clear what evaluation annotated msg and its submessages with, so that the
+// params and body of a printed closure look the same as the parsed source:
+// source ids from AnnotateSource, slots and layouts from ResolveVariables, and
+// fused flags from SelectSuperinstructions. Expressions and Statements keep an
+// empty Origin, which closures have always printed with.
+void ClearAnnotations(google::protobuf::Message* msg);
+
 }  // steinlang
 
 #endif  // LANG_STEINLANG_SOURCE_UTIL_H_
@@ -0,0 +1,60 @@
+// Translates a steinlang program, read from stdin, to a standalone C++
+// program that prints the same output, so it can be compiled ahead of time
+// rather than interpreted. The program goes through the same optimization
+// passes as in interpreter_main, and is compiled to bytecode; each bytecode
+// instruction becomes a call into aot_runtime.
+//
+// Example:
+// steinlang_aotc --output=fibo.cc < lang/steinlang/pgms/fibo_test.stein.txt
+
+#include <gflags/gflags.h>
+#include <stdio.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "lang/steinlang/aot_translation.h"
+#include "lang/steinlang/bytecode.h"
+#include "lang/steinlang/language_evaluation.h"
+#include "lang/steinlang/memory.h"
+#include "lang/steinlang/optimization.h"
+#include "lang/steinlang/steinlang_parser.h"
+#include "util/file_io.h"
+
+DEFINE_string(output, "", "Write the C++ program here rather than to stdout.");
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  steinlang::Program pgm;
+  if (!steinlang::ParseProgram(util::ReadStdInToString(), &pgm)) {
+    fprintf(stderr, "failed to parse input.\n");
+    return 1;
+  }
+  steinlang::OptimizationStats stats;
+  steinlang::Optimize(&pgm, &stats);
+
+  // Annotate the program like the interpreter does, so printed closures are
+  // the same.
+  steinlang::PoolingArenaAllocator allocator;
+  steinlang::EvalContext* ctx = allocator.AllocateEvalContext();
+  steinlang::InitEvalContext(pgm, ctx);
+  steinlang::Bytecode bytecode;
+  if (!steinlang::Compile(ctx->pgm(), &bytecode)) {
+    fprintf(stderr, "failed to compile program to bytecode.\n");
+    return 1;
+  }
+
+  const std::string cpp = steinlang::TranslateToCpp(ctx->pgm(), bytecode);
+  if (FLAGS_output.empty()) {
+    std::cout << cpp;
+  } else {
+    std::ofstream out(FLAGS_output);
+    out << cpp;
+    if (!out) {
+      fprintf(stderr, "failed to write %s.\n", FLAGS_output.c_str());
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -570,4 +570,14 @@ Program ToProgram(const Parser::ParseTreeNode& parse_tree) {
   return pgm;
 }
 
+bool ParseProgram(const std::string& text, Program* pgm) {
+  const std::vector<Tokenizer::Token> tokens = Tokenizer()(text);
+  auto parse_result = Parser().Parse(tokens.begin(), tokens.end());
+  if (!parse_result.success || parse_result.pos != tokens.end()) {
+    return false;
+  }
+  *pgm = ToProgram(parse_result.node);
+  return true;
+}
+
 }  // namespace steinlang
@@ -87,6 +87,9 @@ class Parser : public lang::RecursiveDescentParser<TokenTag, VariableTag> {
 
 Program ToProgram(const Parser::ParseTreeNode& parse_tree);
 
+// Tokenize and parse text as a whole Program. Returns false if it isn't one.
+bool ParseProgram(const std::string& text, Program* pgm);
+
 }  // namespace steinlang
 
 #endif  // LANG_STEINLANG_STEINLANG_PARSER_H_
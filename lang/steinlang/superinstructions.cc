@@ -0,0 +1,59 @@
+#include "lang/steinlang/superinstructions.h"
+
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+#include <google/protobuf/reflection.h>
+
+namespace steinlang {
+
+namespace {
+
+bool IsOperand(const Expression& exp) {
+  return exp.has_var_exp() || exp.has_lit_exp();
+}
+
+// Select superinstructions in msg and the messages nested in it, innermost
+// first, so that an assignment can tell whether its rhs was fused.
+void SelectRecursive(google::protobuf::Message* msg, int64_t* fused) {
+  const google::protobuf::Descriptor* descriptor = msg->GetDescriptor();
+  const google::protobuf::Reflection* refl = msg->GetReflection();
+  for (int i = 0; i < descriptor->field_count(); ++i) {
+    const google::protobuf::FieldDescriptor* field = descriptor->field(i);
+    if (field->type() == google::protobuf::FieldDescriptor::TYPE_MESSAGE) {
+      if (field->is_repeated()) {
+        for (int j = 0; j < refl->FieldSize(*msg, field); ++j) {
+          SelectRecursive(refl->MutableRepeatedMessage(msg, field, j), fused);
+        }
+      } else if (refl->HasField(*msg, field)) {
+        SelectRecursive(refl->MutableMessage(msg, field), fused);
+      }
+    }
+  }
+
+  if (descriptor->full_name() == "steinlang.BinArithExpression") {
+    BinArithExpression* bin_exp = static_cast<BinArithExpression*>(msg);
+    if (IsOperand(bin_exp->lhs()) && IsOperand(bin_exp->rhs())) {
+      bin_exp->set_fused(true);
+      ++*fused;
+    }
+  } else if (descriptor->full_name() == "steinlang.AssignStatement") {
+    AssignStatement* assign_stmt = static_cast<AssignStatement*>(msg);
+    const Expression& rhs = assign_stmt->rhs();
+    if (assign_stmt->lhs().has_var_exp() &&
+        (IsOperand(rhs) ||
+         (rhs.has_bin_arith_exp() && rhs.bin_arith_exp().fused()))) {
+      assign_stmt->set_fused(true);
+      ++*fused;
+    }
+  }
+}
+
+}  // namespace
+
+int64_t SelectSuperinstructions(Program* pgm) {
+  int64_t fused = 0;
+  SelectRecursive(pgm, &fused);
+  return fused;
+}
+
+}  // namespace steinlang
@@ -0,0 +1,22 @@
+// A peephole pass that selects fused evaluation of common expression and
+// statement shapes for the Evaluator.
+
+#ifndef LANG_STEINLANG_SUPERINSTRUCTIONS_H_
+#define LANG_STEINLANG_SUPERINSTRUCTIONS_H_
+
+#include <stdint.h>
+
+#include "lang/steinlang/steinlang_syntax.pb.h"
+
+namespace steinlang {
+
+// Set BinArithExpression.fused and AssignStatement.fused wherever their
+// operands allow it, e.g. for n <= 1, n - 1 and i = i + 1. Returns the number
+// of expressions and statements that were fused.
+// pgm should already be resolved with ResolveVariables, since fused evaluation
+// looks operands up by slot.
+int64_t SelectSuperinstructions(Program* pgm);
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_SUPERINSTRUCTIONS_H_
@@ -0,0 +1,244 @@
+#include "lang/steinlang/value.h"
+
+namespace steinlang {
+
+const size_t Value::kTypeOffset = offsetof(Value, type_);
+const size_t Value::kPayloadOffset = offsetof(Value, int_);
+
+Value Value::Str(std::string x) {
+  StrObject* obj = new StrObject;
+  obj->str = std::move(x);
+  Value v;
+  v.type_ = Type::kStr;
+  v.obj_ = obj;
+  return v;
+}
+
+Value Value::Tuple(std::vector<Value> elem) {
+  TupleObject* obj = new TupleObject;
+  obj->elem = std::move(elem);
+  Value v;
+  v.type_ = Type::kTuple;
+  v.obj_ = obj;
+  return v;
+}
+
+Value Value::Closure(int64_t lambda_id, std::vector<int64_t> capture) {
+  ClosureObject* obj = new ClosureObject;
+  obj->lambda_id = lambda_id;
+  obj->capture = std::move(capture);
+  Value v;
+  v.type_ = Type::kClosure;
+  v.obj_ = obj;
+  return v;
+}
+
+void Value::Destroy() {
+  switch (type_) {
+    case Type::kStr:
+      delete static_cast<StrObject*>(obj_);
+      break;
+    case Type::kClosure:
+      delete static_cast<ClosureObject*>(obj_);
+      break;
+    case Type::kTuple:
+      delete static_cast<TupleObject*>(obj_);
+      break;
+    default:
+      break;
+  }
+}
+
+const std::string& Value::str_val() const {
+  static const std::string* kEmptyStr = new std::string;
+  return type_ == Type::kStr ? static_cast<StrObject*>(obj_)->str : *kEmptyStr;
+}
+
+Value Value::FromLiteral(const Literal& lit) {
+  switch (lit.type_case()) {
+    case Literal::kNoneVal:
+      return None();
+    case Literal::kBoolVal:
+      return Bool(lit.bool_val());
+    case Literal::kIntVal:
+      return Int(lit.int_val());
+    case Literal::kFloatVal:
+      return Float(lit.float_val());
+    case Literal::kStrVal:
+      return Str(lit.str_val());
+    case Literal::kClosureVal:
+      return Closure(lit.closure_val().lambda_id(),
+                     {lit.closure_val().capture().begin(),
+                      lit.closure_val().capture().end()});
+    case Literal::kTupleVal: {
+      std::vector<Value> elem;
+      for (const Literal& e : lit.tuple_val().elem()) {
+        elem.push_back(FromLiteral(e));
+      }
+      return Tuple(std::move(elem));
+    }
+    case Literal::TYPE_NOT_SET:
+      break;
+  }
+  return Value();
+}
+
+void Value::ToLiteral(Literal* lit) const {
+  lit->Clear();
+  switch (type_) {
+    case Type::kEmpty:
+      break;
+    case Type::kNone:
+      lit->set_none_val(true);
+      break;
+    case Type::kBool:
+      lit->set_bool_val(bool_);
+      break;
+    case Type::kInt:
+      lit->set_int_val(int_);
+      break;
+    case Type::kFloat:
+      lit->set_float_val(float_);
+      break;
+    case Type::kStr:
+      lit->set_str_val(str_val());
+      break;
+    case Type::kClosure: {
+      steinlang::Closure* closure = lit->mutable_closure_val();
+      closure->set_lambda_id(closure_val()->lambda_id);
+      for (int64_t addr : closure_val()->capture) {
+        closure->add_capture(addr);
+      }
+      break;
+    }
+    case Type::kTuple:
+      lit->mutable_tuple_val();
+      for (const Value& elem : tuple_val()->elem) {
+        elem.ToLiteral(lit->mutable_tuple_val()->add_elem());
+      }
+      break;
+  }
+}
+
+void Neg(Value* x) {
+  switch (x->type()) {
+    case Value::Type::kBool:
+      x->set_bool(-x->bool_val());
+      break;
+    case Value::Type::kInt:
+      x->set_int(-x->int_val());
+      break;
+    case Value::Type::kFloat:
+      x->set_float(-x->float_val());
+      break;
+    default:
+      x->set_none();
+      break;
+  }
+}
+
+void BoolNot(Value* x) {
+  switch (x->type()) {
+    case Value::Type::kBool:
+      x->set_bool(!x->bool_val());
+      break;
+    default:
+      x->set_none();
+      break;
+  }
+}
+
+namespace {
+
+// True if one of x and y is an int and the other a float, in which case the
+// int is promoted to float, like in literal_ops.h.
+bool IsMixed(const Value& x, const Value& y) {
+  return (x.type() == Value::Type::kInt && y.type() == Value::Type::kFloat) ||
+         (x.type() == Value::Type::kFloat && y.type() == Value::Type::kInt);
+}
+
+float AsFloat(const Value& x) {
+  return x.type() == Value::Type::kInt ? x.int_val() : x.float_val();
+}
+
+}  // namespace
+
+#define NUM_BIN_OP(name, op)                               \
+  void name(Value* x, const Value& y) {                    \
+    if (IsMixed(*x, y)) {                                  \
+      x->set_float(AsFloat(*x) op AsFloat(y));             \
+      return;                                              \
+    }                                                      \
+    switch (x->type()) {                                   \
+      case Value::Type::kInt:                              \
+        x->set_int(x->int_val() op y.int_val());           \
+        break;                                             \
+      case Value::Type::kFloat:                            \
+        x->set_float(x->float_val() op y.float_val());     \
+        break;                                             \
+      default:                                             \
+        x->set_none();                                     \
+        break;                                             \
+    }                                                      \
+  }
+
+NUM_BIN_OP(Add, +)
+NUM_BIN_OP(Sub, -)
+NUM_BIN_OP(Mul, *)
+NUM_BIN_OP(Div, / )
+
+#define NUM_CMP_OP(name, op)                               \
+  void name(Value* x, const Value& y) {                    \
+    if (IsMixed(*x, y)) {                                  \
+      x->set_bool(AsFloat(*x) op AsFloat(y));              \
+      return;                                              \
+    }                                                      \
+    switch (x->type()) {                                   \
+      case Value::Type::kBool:                             \
+        x->set_bool(x->bool_val() op y.bool_val());        \
+        break;                                             \
+      case Value::Type::kInt:                              \
+        x->set_bool(x->int_val() op y.int_val());          \
+        break;                                             \
+      case Value::Type::kFloat:                            \
+        x->set_bool(x->float_val() op y.float_val());      \
+        break;                                             \
+      case Value::Type::kStr:                              \
+        x->set_bool(x->str_val() op y.str_val());          \
+        break;                                             \
+      default:                                             \
+        x->set_none();                                     \
+        break;                                             \
+    }                                                      \
+  }
+
+NUM_CMP_OP(CompareGt, > )
+NUM_CMP_OP(CompareGe, >= )
+NUM_CMP_OP(CompareLt, < )
+NUM_CMP_OP(CompareLe, <= )
+NUM_CMP_OP(CompareEq, == )
+NUM_CMP_OP(CompareNe, != )
+
+void BoolAnd(Value* x, const Value& y) {
+  switch (x->type()) {
+    case Value::Type::kBool:
+      x->set_bool(x->bool_val() && y.bool_val());
+      break;
+    default:
+      x->set_none();
+      break;
+  }
+}
+
+void BoolOr(Value* x, const Value& y) {
+  switch (x->type()) {
+    case Value::Type::kBool:
+      x->set_bool(x->bool_val() || y.bool_val());
+      break;
+    default:
+      x->set_none();
+      break;
+  }
+}
+
+}  // namespace steinlang
@@ -0,0 +1,229 @@
+// An unboxed, 16-byte tagged representation of steinlang values, used by the
+// VirtualMachine instead of Literal protobufs. Scalars are stored inline, so
+// arithmetic on them never allocates. Strings, tuples and closures are
+// immutable, reference counted heap objects, so copying a Value never copies
+// them.
+
+#ifndef LANG_STEINLANG_VALUE_H_
+#define LANG_STEINLANG_VALUE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "lang/steinlang/steinlang_syntax.pb.h"
+
+namespace steinlang {
+
+class Value;
+
+struct HeapObject {
+  int32_t refs = 1;
+};
+
+struct StrObject : HeapObject {
+  std::string str;
+};
+
+struct TupleObject : HeapObject {
+  std::vector<Value> elem;
+};
+
+struct ClosureObject : HeapObject {
+  // Like Closure.lambda_id and Closure.capture.
+  int64_t lambda_id = 0;
+  std::vector<int64_t> capture;
+};
+
+class Value {
+ public:
+  // Like Literal's oneof cases. kEmpty is an unset Literal, e.g. the value of a
+  // variable that was never assigned.
+  enum class Type : uint8_t {
+    kEmpty,
+    kNone,
+    kBool,
+    kInt,
+    kFloat,
+    kStr,
+    kClosure,
+    kTuple,
+  };
+
+  Value() : type_(Type::kEmpty), int_(0) {}
+
+  static Value None() {
+    Value v;
+    v.set_none();
+    return v;
+  }
+  static Value Bool(bool x) {
+    Value v;
+    v.set_bool(x);
+    return v;
+  }
+  static Value Int(int64_t x) {
+    Value v;
+    v.set_int(x);
+    return v;
+  }
+  static Value Float(float x) {
+    Value v;
+    v.set_float(x);
+    return v;
+  }
+  static Value Str(std::string x);
+  static Value Tuple(std::vector<Value> elem);
+  static Value Closure(int64_t lambda_id, std::vector<int64_t> capture);
+
+  static Value FromLiteral(const Literal& lit);
+  void ToLiteral(Literal* lit) const;
+
+  Value(const Value& other) : type_(other.type_), int_(other.int_) {
+    if (is_heap()) {
+      ++obj_->refs;
+    }
+  }
+  Value(Value&& other) : type_(other.type_), int_(other.int_) {
+    other.type_ = Type::kEmpty;
+  }
+  // Copy or move and swap, since other may be owned by this Value.
+  Value& operator=(const Value& other) {
+    Value copy(other);
+    swap(copy);
+    return *this;
+  }
+  Value& operator=(Value&& other) {
+    Value moved(std::move(other));
+    swap(moved);
+    return *this;
+  }
+  ~Value() { Release(); }
+
+  void swap(Value& other) {
+    std::swap(type_, other.type_);
+    std::swap(int_, other.int_);
+  }
+
+  Type type() const { return type_; }
+
+  // Where the type and the scalar value or HeapObject pointer are, for code
+  // that reads and writes Values directly, i.e. the JIT. Scalars are stored in
+  // all 8 bytes of the payload, with the unused bytes zero.
+  static const size_t kTypeOffset;
+  static const size_t kPayloadOffset;
+
+  // Like the Literal accessors, these return a default value if the Value has
+  // a different type.
+  bool bool_val() const { return type_ == Type::kBool && bool_; }
+  int64_t int_val() const { return type_ == Type::kInt ? int_ : 0; }
+  float float_val() const { return type_ == Type::kFloat ? float_ : 0; }
+  const std::string& str_val() const;
+  // nullptr if the Value isn't a closure or a tuple, respectively.
+  const ClosureObject* closure_val() const {
+    return type_ == Type::kClosure ? static_cast<ClosureObject*>(obj_)
+                                   : nullptr;
+  }
+  const TupleObject* tuple_val() const {
+    return type_ == Type::kTuple ? static_cast<TupleObject*>(obj_) : nullptr;
+  }
+
+  void set_none() { Set(Type::kNone); }
+  void set_bool(bool x) {
+    Set(Type::kBool);
+    bool_ = x;
+  }
+  void set_int(int64_t x) {
+    Set(Type::kInt);
+    int_ = x;
+  }
+  void set_float(float x) {
+    Set(Type::kFloat);
+    float_ = x;
+  }
+
+ private:
+  bool is_heap() const { return type_ >= Type::kStr; }
+
+  void Set(Type type) {
+    Release();
+    type_ = type;
+    int_ = 0;
+  }
+
+  void Release() {
+    if (is_heap() && --obj_->refs == 0) {
+      Destroy();
+    }
+    type_ = Type::kEmpty;
+  }
+
+  void Destroy();
+
+  Type type_;
+  union {
+    bool bool_;
+    int64_t int_;
+    float float_;
+    HeapObject* obj_;
+  };
+};
+
+static_assert(sizeof(Value) == 16, "Value should be 16 bytes");
+
+inline void swap(Value& a, Value& b) { a.swap(b); }
+
+// Call f(addr) for every store address captured by closures in v.
+template <typename F>
+void ForEachCapture(const Value& v, F f) {
+  if (const ClosureObject* closure = v.closure_val()) {
+    for (int64_t addr : closure->capture) {
+      f(addr);
+    }
+  } else if (const TupleObject* tuple = v.tuple_val()) {
+    for (const Value& elem : tuple->elem) {
+      ForEachCapture(elem, f);
+    }
+  }
+}
+
+// Replace every store address addr captured by closures in v with f(addr).
+// Heap objects may be shared, so they're copied rather than modified.
+template <typename F>
+void ForwardCaptures(Value* v, F f) {
+  if (const ClosureObject* closure = v->closure_val()) {
+    std::vector<int64_t> capture;
+    for (int64_t addr : closure->capture) {
+      capture.push_back(f(addr));
+    }
+    *v = Value::Closure(closure->lambda_id, std::move(capture));
+  } else if (const TupleObject* tuple = v->tuple_val()) {
+    std::vector<Value> elem = tuple->elem;
+    for (Value& e : elem) {
+      ForwardCaptures(&e, f);
+    }
+    *v = Value::Tuple(std::move(elem));
+  }
+}
+
+// Equivalent to the Literal operations in literal_ops.h.
+void Neg(Value* x);
+void BoolNot(Value* x);
+void Add(Value* x, const Value& y);
+void Sub(Value* x, const Value& y);
+void Mul(Value* x, const Value& y);
+void Div(Value* x, const Value& y);
+void CompareGt(Value* x, const Value& y);
+void CompareGe(Value* x, const Value& y);
+void CompareLt(Value* x, const Value& y);
+void CompareLe(Value* x, const Value& y);
+void CompareEq(Value* x, const Value& y);
+void CompareNe(Value* x, const Value& y);
+void BoolAnd(Value* x, const Value& y);
+void BoolOr(Value* x, const Value& y);
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_VALUE_H_
@@ -0,0 +1,502 @@
+#include "lang/steinlang/virtual_machine.h"
+
+#include <gflags/gflags.h>
+#include <stddef.h>
+#include <sstream>
+
+#include "lang/steinlang/resolution.h"
+#include "lang/steinlang/source_util.h"
+
+DEFINE_bool(jit, false,
+            "Compile closures that are called often to native code. Only "
+            "supported on x86-64 Linux; elsewhere this has no effect.");
+DEFINE_int64(jit_threshold, 100,
+             "With --jit, compile a closure once it has been called this many "
+             "times.");
+
+namespace steinlang {
+
+VirtualMachine::VirtualMachine(const Bytecode* bytecode) : bytecode_(bytecode) {
+  const Function& top_level = bytecode_->functions[0];
+  registers_.resize(top_level.num_registers);
+  env_.resize(top_level.layout->name_size(), -1);
+  frames_.push_back({&top_level, 0, 0, 0, 0});
+  if (FLAGS_jit && JitSupported()) {
+    jit_.resize(bytecode_->functions.size());
+  }
+  if (memo_.enabled()) {
+    for (const Function& fn : bytecode_->functions) {
+      if (fn.lambda != nullptr) {
+        pure_lambdas_.Add(fn.source_id, *fn.lambda);
+      }
+    }
+  }
+}
+
+int64_t VirtualMachine::Lookup(int slot) {
+  int64_t* addr = &env_[frames_.back().env_base + slot];
+  if (*addr < 0) {
+    *addr = store_.size();
+    store_.emplace_back();
+  }
+  return *addr;
+}
+
+void VirtualMachine::Assign(int slot, Value* value) {
+  int64_t* addr = &env_[frames_.back().env_base + slot];
+  if (*addr < 0) {
+    *addr = store_.size();
+    store_.emplace_back();
+  }
+  store_[*addr].swap(*value);
+}
+
+Value* VirtualMachine::CopyToRvalue(int dst, int src) {
+  Register& src_reg = reg(src);
+  Register& dst_reg = reg(dst);
+  if (src_reg.ref >= 0) {
+    dst_reg.value = store_[src_reg.ref];
+  } else if (dst != src) {
+    dst_reg.value = src_reg.value;
+  }
+  dst_reg.ref = -1;
+  return &dst_reg.value;
+}
+
+void VirtualMachine::BinOp(const Instruction& instr,
+                           void (*op)(Value*, const Value&)) {
+  if (instr.a == instr.c && instr.a != instr.b) {
+    Value rhs = *ValueOf(&reg(instr.c));
+    op(CopyToRvalue(instr.a, instr.b), rhs);
+  } else {
+    op(CopyToRvalue(instr.a, instr.b), *ValueOf(&reg(instr.c)));
+  }
+}
+
+void VirtualMachine::Call(const Instruction& instr) {
+  const Frame& caller = frames_.back();
+  const CallSite& site = caller.fn->call_sites[instr.c];
+  const int num_args = site.num_args;
+  const ClosureObject* closure = ValueOf(&reg(instr.b))->closure_val();
+  const Function* fn = nullptr;
+  if (closure != nullptr) {
+    if (const Function* const* cached =
+            call_cache_.Lookup(site.source_id, closure->lambda_id)) {
+      fn = *cached;
+    } else {
+      auto fn_it = bytecode_->function_by_source_id.find(closure->lambda_id);
+      if (fn_it != bytecode_->function_by_source_id.end()) {
+        fn = &bytecode_->functions[fn_it->second];
+        call_cache_.Insert(site.source_id, closure->lambda_id, fn);
+      }
+    }
+  }
+  if (fn == nullptr) {
+    Register& dst = reg(instr.a);
+    dst.ref = -1;
+    dst.value.set_none();
+    return;
+  }
+
+  if (args_.size() < static_cast<size_t>(num_args)) {
+    args_.resize(num_args);
+  }
+  for (int i = 0; i < num_args; ++i) {
+    args_[i] = *ValueOf(&reg(instr.b + 1 + i));
+  }
+
+  std::string memo_key;
+  const bool memoized =
+      memo_.enabled() && MemoKey(*closure, num_args, &memo_key);
+  if (memoized) {
+    if (const Value* cached = memo_.Lookup(closure->lambda_id, memo_key)) {
+      Register& dst = reg(instr.a);
+      dst.ref = -1;
+      dst.value = *cached;
+      return;
+    }
+  }
+
+  // In a tail call, the callee takes over the caller's frame, and returns
+  // straight to the caller's caller.
+  const bool tail_call = IsTailCall(instr);
+  const int base =
+      tail_call ? caller.base : caller.base + caller.fn->num_registers;
+  const int env_base =
+      tail_call ? caller.env_base
+                : caller.env_base + caller.fn->layout->name_size();
+  const int ret_dst = tail_call ? caller.ret_dst : instr.a;
+  const int env_size = fn->layout->name_size();
+
+  if (env_.size() < static_cast<size_t>(env_base + env_size)) {
+    env_.resize(env_base + env_size);
+  }
+  const std::vector<int64_t>& capture = closure->capture;
+  for (int i = 0; i < env_size; ++i) {
+    env_[env_base + i] =
+        static_cast<size_t>(i) < capture.size() ? capture[i] : -1;
+  }
+
+  if (registers_.size() < static_cast<size_t>(base + fn->num_registers)) {
+    registers_.resize(base + fn->num_registers);
+  }
+  if (tail_call) {
+    if (caller.memoized) {
+      memo_keys_.pop_back();
+    }
+    frames_.pop_back();
+  }
+  frames_.push_back({fn, 0, base, ret_dst, env_base, memoized});
+  if (memoized) {
+    memo_keys_.push_back(std::move(memo_key));
+  }
+  const int num_params = fn->params.size();
+  for (int i = 0; i < num_args && i < num_params; ++i) {
+    Assign(fn->params[i], &args_[i]);
+  }
+
+  if (!jit_.empty()) {
+    JitFunction& jit_fn = jit_[fn - bytecode_->functions.data()];
+    if (++jit_fn.calls == FLAGS_jit_threshold) {
+      jit_fn.code = NativeCode::Compile(
+          *fn, {sizeof(Register), offsetof(Register, ref),
+                offsetof(Register, value)});
+      if (jit_fn.code != nullptr) {
+        ++jit_stats_.compiled_functions;
+        jit_stats_.code_bytes += jit_fn.code->size();
+      }
+    }
+  }
+}
+
+bool VirtualMachine::MemoKey(const ClosureObject& closure, int num_args,
+                             std::string* key) const {
+  std::vector<int64_t> reads;
+  const auto closure_at = [this](int64_t addr, int64_t* lambda_id)
+      -> const std::vector<int64_t>* {
+    const ClosureObject* callee = store_[addr].closure_val();
+    if (callee == nullptr) {
+      return nullptr;
+    }
+    *lambda_id = callee->lambda_id;
+    return &callee->capture;
+  };
+  if (!pure_lambdas_.IsPure(closure.lambda_id, closure.capture, closure_at,
+                            &reads)) {
+    return false;
+  }
+  Literal key_lit;
+  Tuple* tuple = key_lit.mutable_tuple_val();
+  for (int i = 0; i < num_args; ++i) {
+    args_[i].ToLiteral(tuple->add_elem());
+  }
+  for (int64_t addr : reads) {
+    store_[addr].ToLiteral(tuple->add_elem());
+  }
+  return key_lit.SerializeToString(key);
+}
+
+bool VirtualMachine::IsTailCall(const Instruction& call) const {
+  // Returning from the top level stops evaluation, so it has no caller to
+  // return to.
+  if (frames_.size() < 2) {
+    return false;
+  }
+  const std::vector<Instruction>& code = frames_.back().fn->code;
+  const int code_size = code.size();
+  int pc = frames_.back().pc;
+  // Follow jumps, e.g. out of the branches of a conditional, but not around a
+  // loop forever.
+  for (int jumps = 0;
+       pc < code_size && code[pc].op == OpCode::kJump && jumps < code_size;
+       ++jumps) {
+    pc = code[pc].b;
+  }
+  return pc < code_size && code[pc].op == OpCode::kReturn &&
+         code[pc].a == call.a;
+}
+
+void VirtualMachine::Return(const Instruction& instr) {
+  Register& src = reg(instr.a);
+  Value ret_val;
+  if (src.ref >= 0) {
+    ret_val = store_[src.ref];
+  } else {
+    ret_val.swap(src.value);
+  }
+  if (frames_.back().memoized) {
+    // Store addresses in a cached closure would dangle once the store is
+    // garbage collected.
+    bool has_captures = false;
+    ForEachCapture(ret_val, [&](int64_t) { has_captures = true; });
+    if (!has_captures) {
+      memo_.Insert(frames_.back().fn->source_id, std::move(memo_keys_.back()),
+                   ret_val);
+    }
+    memo_keys_.pop_back();
+  }
+  const int ret_dst = frames_.back().ret_dst;
+  frames_.pop_back();
+  if (frames_.empty()) {
+    return;
+  }
+  Register& dst = reg(ret_dst);
+  dst.ref = -1;
+  dst.value.swap(ret_val);
+}
+
+int64_t VirtualMachine::CollectGarbage() {
+  StoreCollector<Value> gc(store_.size(),
+                           [this](int64_t addr) { return &store_[addr]; });
+
+  // The roots are the env slots and registers of every frame. Those past the
+  // innermost frame are stale, and are always overwritten before they're read.
+  const Frame& top = frames_.back();
+  const size_t num_env = top.env_base + top.fn->layout->name_size();
+  const size_t num_registers = top.base + top.fn->num_registers;
+  for (size_t i = 0; i < num_env; ++i) {
+    gc.MarkAddress(env_[i]);
+  }
+  for (size_t i = 0; i < num_registers; ++i) {
+    if (registers_[i].ref >= 0) {
+      gc.MarkAddress(registers_[i].ref);
+    } else {
+      gc.MarkValue(registers_[i].value);
+    }
+  }
+
+  const int64_t live = gc.Compact();
+  for (size_t i = 0; i < env_.size(); ++i) {
+    env_[i] = i < num_env ? gc.Forward(env_[i]) : -1;
+  }
+  for (size_t i = 0; i < registers_.size(); ++i) {
+    Register& r = registers_[i];
+    if (i >= num_registers) {
+      r.ref = -1;
+      r.value = Value();
+    } else if (r.ref >= 0) {
+      r.ref = gc.Forward(r.ref);
+    } else {
+      gc.Forward(&r.value);
+    }
+  }
+  args_.clear();
+  store_.resize(live);
+  return live;
+}
+
+void VirtualMachine::Step() {
+  MaybeCollectGarbage();
+  Execute();
+}
+
+RunStatus VirtualMachine::Run(int64_t max_steps) {
+  MaybeCollectGarbage();
+  int64_t steps = 0;
+  while (steps < max_steps && HasComputation()) {
+    if (!jit_.empty()) {
+      steps += ExecuteNative(max_steps - steps);
+      if (steps == max_steps) {
+        break;
+      }
+    }
+    Execute();
+    ++steps;
+  }
+  return {HasComputation() ? StopReason::kBudgetExhausted
+                           : StopReason::kFinished,
+          steps};
+}
+
+int64_t VirtualMachine::ExecuteNative(int64_t max_steps) {
+  Frame& frame = frames_.back();
+  const NativeCode* code =
+      jit_[frame.fn - bytecode_->functions.data()].code.get();
+  if (code == nullptr || !code->supported(frame.pc)) {
+    return 0;
+  }
+  // Native code neither calls nor binds variables, so these pointers stay
+  // valid while it runs.
+  JitFrame native_frame = {&registers_[frame.base], store_.data(),
+                           &env_[frame.env_base], max_steps};
+  frame.pc = code->Run(frame.pc, &native_frame);
+  const int64_t steps = max_steps - native_frame.steps_left;
+  jit_stats_.native_steps += steps;
+  return steps;
+}
+
+void VirtualMachine::Execute() {
+  Frame& frame = frames_.back();
+  const Function& fn = *frame.fn;
+  const Instruction& instr = fn.code[frame.pc++];
+  switch (instr.op) {
+    case OpCode::kLoadConst: {
+      Register& dst = reg(instr.a);
+      dst.ref = -1;
+      dst.value = fn.constants[instr.b];
+      break;
+    }
+    case OpCode::kLoadVar:
+      reg(instr.a).ref = Lookup(instr.b);
+      break;
+    case OpCode::kDeclareVar:
+      Lookup(instr.a);
+      break;
+    case OpCode::kStoreVar: {
+      const int64_t addr = Lookup(instr.a);
+      Register& src = reg(instr.b);
+      if (src.ref >= 0) {
+        store_[addr] = store_[src.ref];
+      } else {
+        store_[addr].swap(src.value);
+      }
+      break;
+    }
+    case OpCode::kNeg:
+      Neg(CopyToRvalue(instr.a, instr.b));
+      break;
+    case OpCode::kNot:
+      BoolNot(CopyToRvalue(instr.a, instr.b));
+      break;
+    case OpCode::kAdd:
+      BinOp(instr, &Add);
+      break;
+    case OpCode::kSub:
+      BinOp(instr, &Sub);
+      break;
+    case OpCode::kMul:
+      BinOp(instr, &Mul);
+      break;
+    case OpCode::kDiv:
+      BinOp(instr, &Div);
+      break;
+    case OpCode::kGt:
+      BinOp(instr, &CompareGt);
+      break;
+    case OpCode::kGe:
+      BinOp(instr, &CompareGe);
+      break;
+    case OpCode::kLt:
+      BinOp(instr, &CompareLt);
+      break;
+    case OpCode::kLe:
+      BinOp(instr, &CompareLe);
+      break;
+    case OpCode::kEq:
+      BinOp(instr, &CompareEq);
+      break;
+    case OpCode::kNe:
+      BinOp(instr, &CompareNe);
+      break;
+    case OpCode::kAnd:
+      BinOp(instr, &BoolAnd);
+      break;
+    case OpCode::kOr:
+      BinOp(instr, &BoolOr);
+      break;
+    case OpCode::kMakeTuple: {
+      std::vector<Value> elem;
+      elem.reserve(instr.c);
+      for (int i = 0; i < instr.c; ++i) {
+        elem.push_back(*ValueOf(&reg(instr.b + i)));
+      }
+      Register& dst = reg(instr.a);
+      dst.ref = -1;
+      dst.value = Value::Tuple(std::move(elem));
+      break;
+    }
+    case OpCode::kMakeClosure: {
+      const Function& lambda_fn = bytecode_->functions[instr.b];
+      std::vector<int64_t> capture;
+      capture.reserve(lambda_fn.layout->capture_size());
+      for (int enclosing_slot : lambda_fn.layout->capture()) {
+        capture.push_back(env_[frame.env_base + enclosing_slot]);
+      }
+      Register& dst = reg(instr.a);
+      dst.ref = -1;
+      dst.value = Value::Closure(lambda_fn.source_id, std::move(capture));
+      break;
+    }
+    case OpCode::kCall:
+      Call(instr);
+      break;
+    case OpCode::kReturn:
+      Return(instr);
+      break;
+    case OpCode::kJump:
+      frame.pc = instr.b;
+      break;
+    case OpCode::kJumpIfFalse:
+      if (!ValueOf(&reg(instr.a))->bool_val()) {
+        frame.pc = instr.b;
+      }
+      break;
+    case OpCode::kPrint: {
+      Literal lit;
+      ValueOf(&reg(instr.a))->ToLiteral(&lit);
+      MakePrintable(&lit);
+      output_.push_back(lit.ShortDebugString());
+      break;
+    }
+    case OpCode::kHalt:
+      frames_.pop_back();
+      break;
+  }
+}
+
+void VirtualMachine::MakePrintable(Literal* lit) const {
+  if (lit->has_closure_val()) {
+    Closure* closure = lit->mutable_closure_val();
+    auto fn_it = bytecode_->function_by_source_id.find(closure->lambda_id());
+    if (fn_it != bytecode_->function_by_source_id.end()) {
+      const LambdaExpression* lambda =
+          bytecode_->functions[fn_it->second].lambda;
+      *closure->mutable_param() = lambda->param();
+      *closure->mutable_body() = lambda->body();
+      ClearAnnotations(closure);
+      FillEnv(lambda->layout(), closure);
+    }
+    closure->clear_lambda_id();
+    closure->clear_capture();
+  } else if (lit->has_tuple_val()) {
+    for (Literal& elem : *lit->mutable_tuple_val()->mutable_elem()) {
+      MakePrintable(&elem);
+    }
+  }
+}
+
+std::string VirtualMachine::DebugString() const {
+  std::ostringstream out;
+  if (frames_.empty()) {
+    return out.str();
+  }
+  const Frame& frame = frames_.back();
+  out << "frame depth: " << frames_.size() << ", source_id "
+      << frame.fn->source_id << ", pc " << frame.pc << "\n";
+  out << "registers:\n";
+  for (int i = 0; i < frame.fn->num_registers; ++i) {
+    const Register& r = registers_[frame.base + i];
+    out << "  r[" << i << "] = ";
+    if (r.ref >= 0) {
+      out << "&" << r.ref;
+    } else {
+      Literal lit;
+      r.value.ToLiteral(&lit);
+      out << lit.ShortDebugString();
+    }
+    out << "\n";
+  }
+  out << "env:\n";
+  for (int i = 0; i < frame.fn->layout->name_size(); ++i) {
+    const int64_t addr = env_[frame.env_base + i];
+    if (addr >= 0) {
+      Literal lit;
+      store_[addr].ToLiteral(&lit);
+      out << "  env[" << frame.fn->layout->name(i)
+          << "] = " << lit.ShortDebugString() << "\n";
+    }
+  }
+  return out.str();
+}
+
+}  // namespace steinlang
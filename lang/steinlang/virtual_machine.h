@@ -0,0 +1,163 @@
+#ifndef LANG_STEINLANG_VIRTUAL_MACHINE_H_
+#define LANG_STEINLANG_VIRTUAL_MACHINE_H_
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "lang/steinlang/bytecode.h"
+#include "lang/steinlang/garbage_collection.h"
+#include "lang/steinlang/inline_cache.h"
+#include "lang/steinlang/jit.h"
+#include "lang/steinlang/memoization.h"
+#include "lang/steinlang/run_status.h"
+#include "lang/steinlang/steinlang_syntax.pb.h"
+#include "lang/steinlang/value.h"
+
+namespace steinlang {
+
+// VirtualMachine runs compiled Bytecode, one instruction per step. It has the
+// same observable behavior as Evaluator running the same Program, but keeps
+// its state in plain C++ structures rather than in an EvalContext, so it can't
+// be serialized mid-evaluation.
+// Example evaluation loop:
+//
+// Bytecode bytecode;
+// Compile(pgm, &bytecode);
+// VirtualMachine vm(&bytecode);
+// while (vm.Run(4096).reason != StopReason::kFinished) {
+//   vm.consume_output();
+// }
+class VirtualMachine {
+ public:
+  // bytecode must outlive the VirtualMachine.
+  explicit VirtualMachine(const Bytecode* bytecode);
+
+  VirtualMachine(const VirtualMachine&) = delete;
+  VirtualMachine& operator=(const VirtualMachine&) = delete;
+
+  bool HasComputation() const { return !frames_.empty(); }
+
+  void Step();
+
+  // Execute up to max_steps steps. The store is only considered for garbage
+  // collection once per call.
+  RunStatus Run(int64_t max_steps);
+
+  std::vector<std::string> consume_output() {
+    std::vector<std::string> output;
+    output.swap(output_);
+    return output;
+  }
+
+  const GcStats& gc_stats() const { return gc_.stats(); }
+
+  InlineCacheStats inline_cache_stats() const { return call_cache_.stats(); }
+
+  const JitStats& jit_stats() const { return jit_stats_; }
+
+  const MemoStats& memo_stats() const { return memo_.stats(); }
+
+  // Verbose evaluation state of the innermost frame.
+  std::string DebugString() const;
+
+ private:
+  // Like Result: either a reference to a store address, or an rvalue. Variable
+  // references are only dereferenced when the value is needed.
+  struct Register {
+    int64_t ref = -1;
+    Value value;
+  };
+
+  // Like LocalContext.
+  struct Frame {
+    const Function* fn;
+    int pc;
+    // Index of the frame's first register in registers_.
+    int base;
+    // Register in the caller's frame which receives the return value.
+    int ret_dst;
+    // Index of the frame's first env slot in env_.
+    int env_base;
+    // Whether the call is memoized, in which case its key is on memo_keys_.
+    bool memoized = false;
+  };
+
+  // Garbage collect the store if it's due.
+  void MaybeCollectGarbage() {
+    if (gc_.ShouldCollect(store_.size())) {
+      gc_.Collect(store_.size(), [this] { return CollectGarbage(); });
+    }
+  }
+
+  // Execute the next instruction of the innermost frame, which must exist.
+  void Execute();
+
+  // If the innermost frame's function has been compiled and its next
+  // instruction is supported, run native code from there, for up to
+  // max_steps steps. Returns the number of steps run.
+  int64_t ExecuteNative(int64_t max_steps);
+
+  Register& reg(int i) { return registers_[frames_.back().base + i]; }
+
+  // Equivalent to Evaluator::Lookup and Evaluator::Assign.
+  int64_t Lookup(int slot);
+  void Assign(int slot, Value* value);
+
+  Value* ValueOf(Register* r) {
+    return r->ref >= 0 ? &store_[r->ref] : &r->value;
+  }
+
+  // Make r[dst] an rvalue holding a copy of r[src]'s value, and return it.
+  Value* CopyToRvalue(int dst, int src);
+
+  void BinOp(const Instruction& instr, void (*op)(Value*, const Value&));
+  void Call(const Instruction& instr);
+  // If calling closure with the first num_args values in args_ can be
+  // memoized, set key to what its result is cached under and return true.
+  bool MemoKey(const ClosureObject& closure, int num_args,
+               std::string* key) const;
+  // True if call, the instruction just executed by the innermost frame, is
+  // followed by returning its result.
+  bool IsTailCall(const Instruction& call) const;
+  void Return(const Instruction& instr);
+
+  // Garbage collect the store. Returns the number of live values.
+  int64_t CollectGarbage();
+
+  // Fill in the params and body of closures for printing.
+  void MakePrintable(Literal* lit) const;
+
+  const Bytecode* bytecode_;
+  std::vector<Value> store_;
+  std::vector<Register> registers_;
+  // Store addresses bound to the env slots of all frames, or -1 if unbound.
+  std::vector<int64_t> env_;
+  std::vector<Frame> frames_;
+  std::vector<std::string> output_;
+  // Scratch space for call arguments, reused across calls.
+  std::vector<Value> args_;
+  GcSchedule gc_;
+  // The Function that closures called from each call site resolve to.
+  InlineCache<const Function*> call_cache_;
+
+  // Per lambda, i.e. per Origin.source_id of a LambdaExpression.
+  struct JitFunction {
+    int64_t calls = 0;
+    // Set once calls reaches --jit_threshold.
+    std::unique_ptr<NativeCode> code;
+  };
+  // Indexed like bytecode_->functions. Empty unless --jit is set.
+  std::vector<JitFunction> jit_;
+  JitStats jit_stats_;
+
+  PureLambdas pure_lambdas_;
+  Memoizer<Value> memo_;
+  // The keys of the memoized frames, innermost last.
+  std::vector<std::string> memo_keys_;
+};
+
+}  // namespace steinlang
+
+#endif  // LANG_STEINLANG_VIRTUAL_MACHINE_H_